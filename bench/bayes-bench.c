@@ -0,0 +1,572 @@
+/* bayes-bench.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Measures training throughput, guess latency, model load and save time
+ * and memory per token for every tokenizer and storage backend, on a
+ * synthetic corpus that only depends on the options given. The results
+ * are printed as JSON so that runs can be compared by scripts.
+ */
+
+#include "config.h"
+
+#include <bayes-glib.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct
+{
+  gchar     **names;
+  GPtrArray  *train_labels;
+  GPtrArray  *train_texts;
+  GPtrArray  *test_texts;
+} BenchCorpus;
+
+typedef struct
+{
+  const gchar    *name;
+  BayesTokenizer  tokenizer;
+} BenchTokenizer;
+
+typedef struct
+{
+  const gchar  *name;
+  BayesStorage *(*create)   (const gchar *path, GError **error);
+  gboolean      (*save)     (BayesStorage *storage, const gchar *path, GError **error);
+  BayesStorage *(*load)     (const gchar *path, GError **error);
+  guint64       (*get_size) (BayesStorage *storage, const gchar *path);
+} BenchStorage;
+
+static gint     seed = 1;
+static gint     n_classes = 8;
+static gint     n_documents = 2000;
+static gint     n_words = 100;
+static gint     n_vocabulary = 50000;
+static gint     n_guesses = 500;
+static gchar   *output;
+static gchar   *only_tokenizer;
+static gchar   *only_storage;
+
+static GOptionEntry entries[] = {
+  { "seed", 0, 0, G_OPTION_ARG_INT, &seed, "Seed of the corpus generator", "N" },
+  { "classes", 0, 0, G_OPTION_ARG_INT, &n_classes, "Number of classifications", "N" },
+  { "documents", 0, 0, G_OPTION_ARG_INT, &n_documents, "Number of training documents", "N" },
+  { "words", 0, 0, G_OPTION_ARG_INT, &n_words, "Words per document", "N" },
+  { "vocabulary", 0, 0, G_OPTION_ARG_INT, &n_vocabulary, "Number of distinct words", "N" },
+  { "guesses", 0, 0, G_OPTION_ARG_INT, &n_guesses, "Number of documents to guess", "N" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Write results to FILE", "FILE" },
+  { "tokenizer", 0, 0, G_OPTION_ARG_STRING, &only_tokenizer, "Only benchmark TOKENIZER", "TOKENIZER" },
+  { "storage", 0, 0, G_OPTION_ARG_STRING, &only_storage, "Only benchmark STORAGE", "STORAGE" },
+  { NULL }
+};
+
+static gint64
+bench_now (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (gint64)ts.tv_sec * G_GINT64_CONSTANT (1000000000) + ts.tv_nsec;
+#else
+  return g_get_monotonic_time () * 1000;
+#endif
+}
+
+static gint
+compare_gint64 (gconstpointer a,
+                gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a;
+  gint64 y = *(const gint64 *)b;
+
+  return (x > y) - (x < y);
+}
+
+/*
+ * Words are drawn from a Zipf distribution. Half of the words of a
+ * document come from the distribution shared by all classifications, the
+ * other half from a copy that is rotated differently for each
+ * classification, so that frequent words are common to all of them
+ * while each has its own topical words.
+ */
+static guint
+bench_zipf_sample (GRand         *rand,
+                   const gdouble *cdf,
+                   guint          n)
+{
+  gdouble u = g_rand_double (rand) * cdf [n - 1];
+  guint lo = 0;
+  guint hi = n - 1;
+
+  while (lo < hi)
+    {
+      guint mid = (lo + hi) / 2;
+
+      if (cdf [mid] < u)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+static gchar *
+bench_document (GRand         *rand,
+                const gdouble *cdf,
+                gchar        **vocabulary,
+                guint          offset)
+{
+  GString *str = g_string_new (NULL);
+  guint rank;
+  gint i;
+
+  for (i = 0; i < n_words; i++)
+    {
+      rank = bench_zipf_sample (rand, cdf, n_vocabulary);
+      if (g_rand_boolean (rand))
+        rank = (rank + offset) % n_vocabulary;
+
+      if (i > 0)
+        g_string_append_c (str, ' ');
+      g_string_append (str, vocabulary [rank]);
+    }
+
+  return g_string_free (str, FALSE);
+}
+
+static BenchCorpus *
+bench_corpus_new (void)
+{
+  BenchCorpus *corpus;
+  gchar **vocabulary;
+  guint *offsets;
+  gdouble *cdf;
+  GRand *rand;
+  guint class_id;
+  gint len;
+  gint i;
+  gint j;
+
+  rand = g_rand_new_with_seed (seed);
+  corpus = g_new0 (BenchCorpus, 1);
+
+  vocabulary = g_new0 (gchar *, n_vocabulary + 1);
+  for (i = 0; i < n_vocabulary; i++)
+    {
+      len = g_rand_int_range (rand, 2, 11);
+      vocabulary [i] = g_malloc (len + 1);
+      for (j = 0; j < len; j++)
+        vocabulary [i][j] = 'a' + g_rand_int_range (rand, 0, 26);
+      vocabulary [i][len] = '\0';
+    }
+
+  cdf = g_new (gdouble, n_vocabulary);
+  for (i = 0; i < n_vocabulary; i++)
+    cdf [i] = (i > 0 ? cdf [i - 1] : 0.0) + 1.0 / (i + 1);
+
+  corpus->names = g_new0 (gchar *, n_classes + 1);
+  offsets = g_new (guint, n_classes);
+  for (i = 0; i < n_classes; i++)
+    {
+      corpus->names [i] = g_strdup_printf ("class%d", i);
+      offsets [i] = g_rand_int_range (rand, 0, n_vocabulary);
+    }
+
+  corpus->train_labels = g_ptr_array_new ();
+  corpus->train_texts = g_ptr_array_new_with_free_func (g_free);
+  for (i = 0; i < n_documents; i++)
+    {
+      class_id = g_rand_int_range (rand, 0, n_classes);
+      g_ptr_array_add (corpus->train_labels, corpus->names [class_id]);
+      g_ptr_array_add (corpus->train_texts,
+                       bench_document (rand, cdf, vocabulary, offsets [class_id]));
+    }
+
+  corpus->test_texts = g_ptr_array_new_with_free_func (g_free);
+  for (i = 0; i < n_guesses; i++)
+    {
+      class_id = g_rand_int_range (rand, 0, n_classes);
+      g_ptr_array_add (corpus->test_texts,
+                       bench_document (rand, cdf, vocabulary, offsets [class_id]));
+    }
+
+  g_strfreev (vocabulary);
+  g_free (offsets);
+  g_free (cdf);
+  g_rand_free (rand);
+
+  return corpus;
+}
+
+static void
+bench_corpus_free (BenchCorpus *corpus)
+{
+  g_strfreev (corpus->names);
+  g_ptr_array_unref (corpus->train_labels);
+  g_ptr_array_unref (corpus->train_texts);
+  g_ptr_array_unref (corpus->test_texts);
+  g_free (corpus);
+}
+
+static BayesStorage *
+memory_create (const gchar  *path,
+               GError      **error)
+{
+  return BAYES_STORAGE (bayes_storage_memory_new ());
+}
+
+static gboolean
+memory_save (BayesStorage  *storage,
+             const gchar   *path,
+             GError       **error)
+{
+  return bayes_storage_memory_save_to_file (BAYES_STORAGE_MEMORY (storage), path, error);
+}
+
+static BayesStorage *
+memory_load (const gchar  *path,
+             GError      **error)
+{
+  return (BayesStorage *)bayes_storage_memory_new_from_file (path, error);
+}
+
+static guint64
+memory_get_size (BayesStorage *storage,
+                 const gchar  *path)
+{
+  return bayes_storage_memory_get_memory_used (BAYES_STORAGE_MEMORY (storage));
+}
+
+static BayesStorage *
+sketch_create (const gchar  *path,
+               GError      **error)
+{
+  return BAYES_STORAGE (bayes_storage_sketch_new (1 << 16, 4));
+}
+
+static guint64
+sketch_get_size (BayesStorage *storage,
+                 const gchar  *path)
+{
+  return (guint64)bayes_storage_sketch_get_memory_size (BAYES_STORAGE_SKETCH (storage)) *
+         (n_classes + 1);
+}
+
+static BayesStorage *
+mapped_create (const gchar  *path,
+               GError      **error)
+{
+  return (BayesStorage *)bayes_storage_mapped_new (path, error);
+}
+
+static gboolean
+mapped_save (BayesStorage  *storage,
+             const gchar   *path,
+             GError       **error)
+{
+  return bayes_storage_mapped_flush (BAYES_STORAGE_MAPPED (storage), error);
+}
+
+static BayesStorage *
+mapped_load (const gchar  *path,
+             GError      **error)
+{
+  return (BayesStorage *)bayes_storage_mapped_new (path, error);
+}
+
+static guint64
+mapped_get_size (BayesStorage *storage,
+                 const gchar  *path)
+{
+  GStatBuf st;
+
+  if (g_stat (path, &st) != 0)
+    return 0;
+
+  return st.st_size;
+}
+
+static const BenchTokenizer tokenizers[] = {
+  { "word", bayes_tokenizer_word },
+  { "code-tokens", bayes_tokenizer_code_tokens },
+  { "word-shingles", bayes_tokenizer_word_shingles },
+  { "char-ngrams", bayes_tokenizer_char_ngrams },
+};
+
+static const BenchStorage storages[] = {
+  { "memory", memory_create, memory_save, memory_load, memory_get_size },
+  { "sketch", sketch_create, NULL, NULL, sketch_get_size },
+  { "mapped", mapped_create, mapped_save, mapped_load, mapped_get_size },
+};
+
+static void
+bench_add_seconds (JsonBuilder *builder,
+                   const gchar *name,
+                   gint64       nsec)
+{
+  json_builder_set_member_name (builder, name);
+  if (nsec < 0)
+    json_builder_add_null_value (builder);
+  else
+    json_builder_add_double_value (builder, nsec / 1e9);
+}
+
+static gboolean
+bench_run (JsonBuilder          *builder,
+           BenchCorpus          *corpus,
+           const BenchTokenizer *tokenizer,
+           const BenchStorage   *storage,
+           const gchar          *tmpdir,
+           GError              **error)
+{
+  g_autoptr(BayesClassifier) classifier = NULL;
+  g_autoptr(BayesStorage) store = NULL;
+  g_autoptr(GHashTable) distinct = NULL;
+  g_autofree gchar *path = NULL;
+  g_autofree gint64 *latencies = NULL;
+  GList *guesses;
+  guint64 n_tokens = 0;
+  gint64 save_nsec = -1;
+  gint64 load_nsec = -1;
+  gint64 train_nsec;
+  gint64 total_nsec = 0;
+  gint64 begin;
+  gchar **tokens;
+  guint i;
+  guint j;
+
+  path = g_build_filename (tmpdir, storage->name, NULL);
+
+  /*
+   * Count the tokens up front so that tokenizing twice does not show up
+   * in the training time.
+   */
+  distinct = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  for (i = 0; i < corpus->train_texts->len; i++)
+    {
+      tokens = tokenizer->tokenizer (g_ptr_array_index (corpus->train_texts, i), NULL);
+      for (j = 0; tokens [j]; j++, n_tokens++)
+        g_hash_table_add (distinct, tokens [j]);
+      g_free (tokens);
+    }
+
+  if (!(store = storage->create (path, error)))
+    return FALSE;
+
+  classifier = bayes_classifier_new ();
+  bayes_classifier_set_storage (classifier, store);
+  bayes_classifier_set_tokenizer (classifier, tokenizer->tokenizer, NULL, NULL);
+
+  begin = bench_now ();
+  for (i = 0; i < corpus->train_texts->len; i++)
+    bayes_classifier_train (classifier,
+                            g_ptr_array_index (corpus->train_labels, i),
+                            g_ptr_array_index (corpus->train_texts, i));
+  train_nsec = bench_now () - begin;
+
+  if (storage->save != NULL)
+    {
+      begin = bench_now ();
+      if (!storage->save (store, path, error))
+        return FALSE;
+      save_nsec = bench_now () - begin;
+    }
+
+  latencies = g_new (gint64, corpus->test_texts->len);
+  for (i = 0; i < corpus->test_texts->len; i++)
+    {
+      begin = bench_now ();
+      guesses = bayes_classifier_guess (classifier, g_ptr_array_index (corpus->test_texts, i));
+      latencies [i] = bench_now () - begin;
+      total_nsec += latencies [i];
+      g_list_free_full (guesses, (GDestroyNotify)bayes_guess_unref);
+    }
+  qsort (latencies, corpus->test_texts->len, sizeof (gint64), compare_gint64);
+
+  if (storage->load != NULL)
+    {
+      g_autoptr(BayesStorage) loaded = NULL;
+
+      begin = bench_now ();
+      if (!(loaded = storage->load (path, error)))
+        return FALSE;
+      load_nsec = bench_now () - begin;
+    }
+
+  json_builder_begin_object (builder);
+
+  json_builder_set_member_name (builder, "tokenizer");
+  json_builder_add_string_value (builder, tokenizer->name);
+  json_builder_set_member_name (builder, "storage");
+  json_builder_add_string_value (builder, storage->name);
+
+  json_builder_set_member_name (builder, "train");
+  json_builder_begin_object (builder);
+  bench_add_seconds (builder, "seconds", train_nsec);
+  json_builder_set_member_name (builder, "documents_per_second");
+  json_builder_add_double_value (builder, corpus->train_texts->len / (MAX (train_nsec, 1) / 1e9));
+  json_builder_set_member_name (builder, "tokens_per_second");
+  json_builder_add_double_value (builder, n_tokens / (MAX (train_nsec, 1) / 1e9));
+  json_builder_end_object (builder);
+
+  json_builder_set_member_name (builder, "guess");
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "count");
+  json_builder_add_int_value (builder, corpus->test_texts->len);
+  if (corpus->test_texts->len > 0)
+    {
+      json_builder_set_member_name (builder, "mean_us");
+      json_builder_add_double_value (builder, total_nsec / 1e3 / corpus->test_texts->len);
+      json_builder_set_member_name (builder, "p50_us");
+      json_builder_add_double_value (builder, latencies [corpus->test_texts->len / 2] / 1e3);
+      json_builder_set_member_name (builder, "p99_us");
+      json_builder_add_double_value (builder, latencies [corpus->test_texts->len * 99 / 100] / 1e3);
+    }
+  json_builder_end_object (builder);
+
+  bench_add_seconds (builder, "save_seconds", save_nsec);
+  bench_add_seconds (builder, "load_seconds", load_nsec);
+
+  json_builder_set_member_name (builder, "tokens");
+  json_builder_add_int_value (builder, n_tokens);
+  json_builder_set_member_name (builder, "distinct_tokens");
+  json_builder_add_int_value (builder, g_hash_table_size (distinct));
+  json_builder_set_member_name (builder, "bytes_per_token");
+  json_builder_add_double_value (builder,
+                                 (gdouble)storage->get_size (store, path) /
+                                 MAX (g_hash_table_size (distinct), 1));
+
+  json_builder_end_object (builder);
+
+  g_unlink (path);
+
+  return TRUE;
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(JsonGenerator) generator = NULL;
+  g_autoptr(JsonBuilder) builder = NULL;
+  g_autoptr(JsonNode) root = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *tmpdir = NULL;
+  g_autofree gchar *json = NULL;
+  BenchCorpus *corpus;
+  guint i;
+  guint j;
+
+  context = g_option_context_new ("- benchmark bayes-glib");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  if (n_classes < 1 || n_documents < 1 || n_words < 1 || n_vocabulary < 1 || n_guesses < 0)
+    {
+      g_printerr ("Invalid corpus size\n");
+      return EXIT_FAILURE;
+    }
+
+  if (!(tmpdir = g_dir_make_tmp ("bayes-bench-XXXXXX", &error)))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  corpus = bench_corpus_new ();
+
+  builder = json_builder_new ();
+  json_builder_begin_object (builder);
+
+  json_builder_set_member_name (builder, "corpus");
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "seed");
+  json_builder_add_int_value (builder, seed);
+  json_builder_set_member_name (builder, "classes");
+  json_builder_add_int_value (builder, n_classes);
+  json_builder_set_member_name (builder, "documents");
+  json_builder_add_int_value (builder, n_documents);
+  json_builder_set_member_name (builder, "words");
+  json_builder_add_int_value (builder, n_words);
+  json_builder_set_member_name (builder, "vocabulary");
+  json_builder_add_int_value (builder, n_vocabulary);
+  json_builder_set_member_name (builder, "guesses");
+  json_builder_add_int_value (builder, n_guesses);
+  json_builder_end_object (builder);
+
+  json_builder_set_member_name (builder, "results");
+  json_builder_begin_array (builder);
+
+  for (i = 0; i < G_N_ELEMENTS (tokenizers); i++)
+    {
+      if (only_tokenizer && g_strcmp0 (only_tokenizer, tokenizers [i].name) != 0)
+        continue;
+
+      for (j = 0; j < G_N_ELEMENTS (storages); j++)
+        {
+          if (only_storage && g_strcmp0 (only_storage, storages [j].name) != 0)
+            continue;
+
+          if (!bench_run (builder, corpus, &tokenizers [i], &storages [j], tmpdir, &error))
+            {
+              g_printerr ("%s/%s: %s\n", tokenizers [i].name, storages [j].name, error->message);
+              g_rmdir (tmpdir);
+              bench_corpus_free (corpus);
+              return EXIT_FAILURE;
+            }
+        }
+    }
+
+  json_builder_end_array (builder);
+  json_builder_end_object (builder);
+
+  root = json_builder_get_root (builder);
+  generator = json_generator_new ();
+  json_generator_set_pretty (generator, TRUE);
+  json_generator_set_root (generator, root);
+
+  g_rmdir (tmpdir);
+  bench_corpus_free (corpus);
+
+  if (output != NULL)
+    {
+      if (!json_generator_to_file (generator, output, &error))
+        {
+          g_printerr ("%s\n", error->message);
+          return EXIT_FAILURE;
+        }
+    }
+  else
+    {
+      json = json_generator_to_data (generator, NULL);
+      g_print ("%s\n", json);
+    }
+
+  return EXIT_SUCCESS;
+}
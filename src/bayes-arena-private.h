@@ -0,0 +1,61 @@
+/* bayes-arena-private.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BAYES_ARENA_PRIVATE_H
+#define BAYES_ARENA_PRIVATE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * A bump allocator for token strings, addressed by 32-bit offsets so that
+ * the buffer may move when it grows. Strings are never freed individually,
+ * bayes_arena_release() only accounts for them so that the owner can
+ * decide when to rebuild the arena.
+ */
+typedef struct _BayesArena BayesArena;
+
+struct _BayesArena
+{
+  gchar *data;
+  gsize  size;
+  gsize  used;
+  gsize  dead;
+  guint  mapped : 1;
+};
+
+BayesArena *bayes_arena_new     (void);
+BayesArena *bayes_arena_copy    (const BayesArena *arena);
+void        bayes_arena_free    (BayesArena       *arena);
+guint32     bayes_arena_add     (BayesArena       *arena,
+                                 const gchar      *str,
+                                 gsize             len);
+void        bayes_arena_release (BayesArena       *arena,
+                                 guint32           offset);
+
+static inline const gchar *
+bayes_arena_get (const BayesArena *arena,
+                 guint32           offset)
+{
+  return arena->data + offset;
+}
+
+G_END_DECLS
+
+#endif /* BAYES_ARENA_PRIVATE_H */
@@ -0,0 +1,200 @@
+/* bayes-arena.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#include "bayes-arena-private.h"
+
+/*
+ * Arenas start small since most classifications only hold a few thousand
+ * tokens, and double as they grow. Once an arena reaches the size of a
+ * huge page it is mapped on a huge page boundary and advised to the
+ * kernel as a candidate for transparent huge pages, so that walking a
+ * large arena does not thrash the TLB.
+ */
+#define MIN_ARENA_SIZE  256
+#define HUGE_PAGE_SIZE  (2 * 1024 * 1024)
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+# define USE_HUGE_PAGES 1
+#endif
+
+static gchar *
+bayes_arena_alloc (gsize     size,
+                   gboolean *mapped)
+{
+#ifdef USE_HUGE_PAGES
+  if (size % HUGE_PAGE_SIZE == 0)
+    {
+      gchar *map;
+      gsize head;
+
+      /*
+       * Over-allocate by one huge page so the mapping can be trimmed to
+       * start on a huge page boundary.
+       */
+      map = mmap (NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+      if (map != MAP_FAILED)
+        {
+          head = (HUGE_PAGE_SIZE - ((guintptr)map % HUGE_PAGE_SIZE)) % HUGE_PAGE_SIZE;
+          if (head != 0)
+            munmap (map, head);
+          munmap (map + head + size, HUGE_PAGE_SIZE - head);
+          madvise (map + head, size, MADV_HUGEPAGE);
+
+          *mapped = TRUE;
+
+          return map + head;
+        }
+    }
+#endif
+
+  *mapped = FALSE;
+
+  return g_malloc (size);
+}
+
+static void
+bayes_arena_dealloc (gchar    *data,
+                     gsize     size,
+                     gboolean  mapped)
+{
+#ifdef USE_HUGE_PAGES
+  if (mapped)
+    {
+      munmap (data, size);
+      return;
+    }
+#endif
+
+  g_free (data);
+}
+
+BayesArena *
+bayes_arena_new (void)
+{
+  return g_slice_new0 (BayesArena);
+}
+
+/*
+ * Copies @arena, live and released strings alike, so that offsets into
+ * @arena are valid in the copy.
+ */
+BayesArena *
+bayes_arena_copy (const BayesArena *arena)
+{
+  BayesArena *copy;
+  gboolean mapped = FALSE;
+
+  g_assert (arena);
+
+  copy = bayes_arena_new ();
+
+  if (arena->used != 0)
+    {
+      copy->size = MAX (arena->used, MIN_ARENA_SIZE);
+      if (copy->size >= HUGE_PAGE_SIZE)
+        copy->size = (copy->size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+      copy->data = bayes_arena_alloc (copy->size, &mapped);
+      copy->mapped = mapped;
+      copy->used = arena->used;
+      copy->dead = arena->dead;
+      memcpy (copy->data, arena->data, arena->used);
+    }
+
+  return copy;
+}
+
+void
+bayes_arena_free (BayesArena *arena)
+{
+  if (arena == NULL)
+    return;
+
+  bayes_arena_dealloc (arena->data, arena->size, arena->mapped);
+  g_slice_free (BayesArena, arena);
+}
+
+guint32
+bayes_arena_add (BayesArena  *arena,
+                 const gchar *str,
+                 gsize        len)
+{
+  gboolean mapped;
+  gchar *data;
+  gsize size;
+  guint32 offset;
+
+  g_assert (arena);
+  g_assert (str);
+
+  if (G_UNLIKELY (arena->size - arena->used < len + 1))
+    {
+      if (arena->used + len + 1 > G_MAXUINT32)
+        g_error ("Token arena exhausted");
+
+      size = MAX (arena->size, MIN_ARENA_SIZE);
+      while (size < arena->used + len + 1)
+        size *= 2;
+
+      /*
+       * Plain heap memory is simply reallocated, anything that is or will
+       * be mapped needs to be copied.
+       */
+      if (!arena->mapped && size < HUGE_PAGE_SIZE)
+        {
+          arena->data = g_realloc (arena->data, size);
+        }
+      else
+        {
+          data = bayes_arena_alloc (size, &mapped);
+          if (arena->used != 0)
+            memcpy (data, arena->data, arena->used);
+          bayes_arena_dealloc (arena->data, arena->size, arena->mapped);
+          arena->data = data;
+          arena->mapped = mapped;
+        }
+
+      arena->size = size;
+    }
+
+  offset = arena->used;
+  memcpy (arena->data + offset, str, len);
+  arena->data [offset + len] = '\0';
+  arena->used += len + 1;
+
+  return offset;
+}
+
+void
+bayes_arena_release (BayesArena *arena,
+                     guint32     offset)
+{
+  g_assert (arena);
+  g_assert (offset < arena->used);
+
+  arena->dead += strlen (arena->data + offset) + 1;
+}
@@ -0,0 +1,100 @@
+/* bayes-bloom-private.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BAYES_BLOOM_PRIVATE_H
+#define BAYES_BLOOM_PRIVATE_H
+
+#include <glib.h>
+
+#include "bayes-hash-private.h"
+
+G_BEGIN_DECLS
+
+/*
+ * A blocked Bloom filter over 32-bit token hashes. A key sets one bit in
+ * each of the 8 words of a single 64-byte block, so a lookup touches one
+ * cache line. Sized at BAYES_BLOOM_BITS_PER_KEY bits per key, about 1% of
+ * the keys that were never added are reported as present.
+ *
+ * Keys cannot be removed. n_stale counts the keys that are no longer
+ * wanted so that the owner can decide when to rebuild the filter.
+ */
+#define BAYES_BLOOM_BITS_PER_KEY 12
+#define BAYES_BLOOM_BLOCK_WORDS  8
+
+typedef struct _BayesBloom BayesBloom;
+
+struct _BayesBloom
+{
+  guint64 *blocks;
+  guint32  n_blocks;
+  guint32  capacity;
+  guint32  n_keys;
+  guint32  n_stale;
+};
+
+BayesBloom *bayes_bloom_new             (guint32           capacity);
+void        bayes_bloom_free            (BayesBloom       *bloom);
+void        bayes_bloom_reset           (BayesBloom       *bloom,
+                                         guint32           capacity);
+gsize       bayes_bloom_get_memory_size (const BayesBloom *bloom);
+
+static const guint32 bayes_bloom_salts [BAYES_BLOOM_BLOCK_WORDS] = {
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+};
+
+static inline guint64 *
+bayes_bloom_block (const BayesBloom *bloom,
+                   guint64           h)
+{
+  return &bloom->blocks [((h >> 32) * bloom->n_blocks >> 32) * BAYES_BLOOM_BLOCK_WORDS];
+}
+
+static inline void
+bayes_bloom_add (BayesBloom *bloom,
+                 guint32     hash)
+{
+  guint64 h = bayes_hash_mix (hash);
+  guint64 *block = bayes_bloom_block (bloom, h);
+  guint i;
+
+  for (i = 0; i < BAYES_BLOOM_BLOCK_WORDS; i++)
+    block [i] |= G_GUINT64_CONSTANT (1) << (((guint32)h * bayes_bloom_salts [i]) >> 26);
+
+  bloom->n_keys++;
+}
+
+static inline gboolean
+bayes_bloom_contains (const BayesBloom *bloom,
+                      guint32           hash)
+{
+  guint64 h = bayes_hash_mix (hash);
+  const guint64 *block = bayes_bloom_block (bloom, h);
+  guint i;
+
+  for (i = 0; i < BAYES_BLOOM_BLOCK_WORDS; i++)
+    if (!(block [i] & (G_GUINT64_CONSTANT (1) << (((guint32)h * bayes_bloom_salts [i]) >> 26))))
+      return FALSE;
+
+  return TRUE;
+}
+
+G_END_DECLS
+
+#endif /* BAYES_BLOOM_PRIVATE_H */
@@ -0,0 +1,78 @@
+/* bayes-bloom.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "bayes-bloom-private.h"
+
+#define BLOCK_BITS (BAYES_BLOOM_BLOCK_WORDS * 64)
+
+BayesBloom *
+bayes_bloom_new (guint32 capacity)
+{
+  BayesBloom *bloom;
+
+  bloom = g_new0 (BayesBloom, 1);
+  bayes_bloom_reset (bloom, capacity);
+
+  return bloom;
+}
+
+void
+bayes_bloom_free (BayesBloom *bloom)
+{
+  if (bloom != NULL)
+    {
+      g_free (bloom->blocks);
+      g_free (bloom);
+    }
+}
+
+/*
+ * Removes every key from @bloom and sizes it for @capacity keys.
+ */
+void
+bayes_bloom_reset (BayesBloom *bloom,
+                   guint32     capacity)
+{
+  guint64 n_blocks;
+
+  capacity = MAX (capacity, 1);
+  n_blocks = ((guint64)capacity * BAYES_BLOOM_BITS_PER_KEY + BLOCK_BITS - 1) / BLOCK_BITS;
+
+  if (n_blocks != bloom->n_blocks)
+    {
+      g_free (bloom->blocks);
+      bloom->blocks = g_new0 (guint64, n_blocks * BAYES_BLOOM_BLOCK_WORDS);
+      bloom->n_blocks = n_blocks;
+    }
+  else
+    memset (bloom->blocks, 0, n_blocks * BAYES_BLOOM_BLOCK_WORDS * sizeof (guint64));
+
+  bloom->capacity = capacity;
+  bloom->n_keys = 0;
+  bloom->n_stale = 0;
+}
+
+gsize
+bayes_bloom_get_memory_size (const BayesBloom *bloom)
+{
+  return sizeof (BayesBloom) + (gsize)bloom->n_blocks * BAYES_BLOOM_BLOCK_WORDS * sizeof (guint64);
+}
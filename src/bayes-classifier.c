@@ -16,13 +16,21 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "config.h"
+
 #include <math.h>
+#include <string.h>
+#include <time.h>
 
 #include "bayes-classifier.h"
 #include "bayes-guess.h"
 #include "bayes-guess-private.h"
+#include "bayes-histogram-private.h"
 #include "bayes-storage-memory.h"
+#include "bayes-storage-memory-private.h"
+#include "bayes-storage-private.h"
 #include "bayes-tokenizer.h"
+#include "bayes-trace-private.h"
 
 /**
  * SECTION:bayes-classifier
@@ -37,6 +45,24 @@
  * needs. For example, it could be used to train SPAM vs HAM, or perhaps
  * even guess if your boyfriend or girlfriend will react negatively to your
  * instant message.
+ *
+ * When #BayesClassifier:collect-stats is enabled, the classifier records
+ * how long each phase of bayes_classifier_guess() and
+ * bayes_classifier_train() took. The results can be retrieved with
+ * bayes_classifier_get_stats().
+ *
+ * With many classifications where most tokens are only found in a few
+ * of them, enabling #BayesClassifier:sparse makes the cost of a guess
+ * grow with the classifications that contain the tokens rather than
+ * with all of them.
+ *
+ * Once training is done, bayes_classifier_freeze() precomputes a
+ * multinomial naive Bayes #BayesModel from the storage, after which
+ * guesses only add up the weights of the tokens.
+ *
+ * Guesses may run on several threads while the storage is replaced.
+ * Long running processes can use bayes_classifier_watch_file() to pick
+ * up retrained data as it is saved.
  */
 
 typedef gdouble (*BayesCombiner) (BayesClassifier  *classifier,
@@ -45,11 +71,44 @@ typedef gdouble (*BayesCombiner) (BayesClassifier  *classifier,
                                   const gchar      *name,
                                   gpointer          user_data);
 
+typedef struct
+{
+  guint64        guess_calls;
+  guint64        guess_tokens;
+  guint64        guess_unknown_tokens;
+  BayesHistogram guess_tokenize;
+  BayesHistogram guess_lookup;
+  BayesHistogram guess_combine;
+  BayesHistogram guess_sort;
+  BayesHistogram guess_total;
+  BayesHistogram guess_tokens_per_call;
+
+  guint64        train_calls;
+  guint64        train_tokens;
+  BayesHistogram train_tokenize;
+  BayesHistogram train_store;
+  BayesHistogram train_total;
+  BayesHistogram train_tokens_per_call;
+} BayesClassifierStats;
+
 struct _BayesClassifier
 {
   GObject         parent_instance;
+
+  /*
+   * @storage_mutex guards @storage, @memory and @model, which may be
+   * swapped while guesses run on other threads. Guesses and training
+   * take references under the lock and then run without it.
+   */
+  GMutex          storage_mutex;
   BayesStorage   *storage;
 
+  /*
+   * @storage when it is a #BayesStorageMemory, whose tables are then
+   * used directly.
+   */
+  BayesStorageMemory *memory;
+
   BayesTokenizer  token_func;
   gpointer        token_user_data;
   GDestroyNotify  token_notify;
@@ -57,12 +116,67 @@ struct _BayesClassifier
   BayesCombiner   combiner_func;
   gpointer        combiner_user_data;
   GDestroyNotify  combiner_notify;
+
+  /*
+   * Only allocated while stats are being collected. The mutex guards
+   * @stats so that guesses from multiple threads may record at once.
+   */
+  GMutex                 stats_mutex;
+  BayesClassifierStats  *stats;
+
+  guint                  sparse : 1;
+
+  BayesModel            *model;
+
+  /*
+   * The file reloaded by bayes_classifier_watch_file() and the reload in
+   * progress, if any.
+   */
+  GFile                 *watch_file;
+  GFileMonitor          *watch_monitor;
+  GCancellable          *reload_cancellable;
+};
+
+/*
+ * Time spent in each phase of a guess, only kept when @collect is set.
+ */
+typedef struct
+{
+  gboolean collect;
+  guint64  begin;
+  guint64  last;
+  guint64  tokenize;
+  guint64  lookup;
+  guint64  sort;
+  guint64  combine;
+} BayesGuessTimer;
+
+/*
+ * Scratch space of bayes_classifier_guess_with_context(). The arrays only
+ * ever grow. @names holds the classifications of the last guess by class
+ * id, %NULL-terminated, and keeps its copies while they match.
+ */
+struct _BayesGuessContext
+{
+  GArray    *lens;
+  GArray    *hashes;
+  GArray    *totals;
+  GArray    *values;
+  GArray    *scratch;
+  GArray    *scores;
+  GPtrArray *names;
 };
 
+static BayesGuessContext *bayes_guess_context_copy (BayesGuessContext *context);
+
 G_DEFINE_TYPE (BayesClassifier, bayes_classifier, G_TYPE_OBJECT)
+G_DEFINE_BOXED_TYPE (BayesGuessContext, bayes_guess_context,
+                     bayes_guess_context_copy, bayes_guess_context_free)
 
 enum {
   PROP_0,
+  PROP_COLLECT_STATS,
+  PROP_SPARSE,
   PROP_STORAGE,
   LAST_PROP
 };
@@ -104,14 +218,112 @@ bayes_classifier_robinson (BayesClassifier  *classifier,
   return (1 + S) / 2.0;
 }
 
+/*
+ * bayes_classifier_robinson() over plain probabilities.
+ */
+static gdouble
+bayes_classifier_robinson_values (const gdouble *values,
+                                  guint          len)
+{
+  gdouble nth;
+  gdouble P;
+  gdouble Q;
+  gdouble S;
+  gdouble v;
+  gdouble w;
+  guint i;
+
+  nth = 1.0 / (gdouble)len;
+
+  v = 1.0;
+  w = 1.0;
+
+  for (i = 0; i < len; i++)
+    {
+      v *= (1.0 - values [i]);
+      w *= values [i];
+    }
+
+  P = 1.0 - pow (v, nth);
+  Q = 1.0 - pow (w, nth);
+  S = (P - Q) / (P + Q);
+
+  return (1 + S) / 2.0;
+}
+
+/*
+ * Takes a reference on the storage a call runs against, and on the model
+ * if @model is not %NULL. @memory is set to the storage when it is a
+ * #BayesStorageMemory and is owned by the returned reference.
+ */
+static BayesStorage *
+bayes_classifier_acquire (BayesClassifier     *self,
+                          BayesStorageMemory **memory,
+                          BayesModel         **model)
+{
+  BayesStorage *storage;
+
+  g_mutex_lock (&self->storage_mutex);
+  storage = self->storage ? g_object_ref (self->storage) : NULL;
+  *memory = self->memory;
+  if (model != NULL)
+    *model = self->model ? bayes_model_ref (self->model) : NULL;
+  g_mutex_unlock (&self->storage_mutex);
+
+  return storage;
+}
+
+/*
+ * Returns a monotonic timestamp in nanoseconds.
+ */
+static inline guint64
+bayes_classifier_now (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (guint64)ts.tv_sec * G_GUINT64_CONSTANT (1000000000) + ts.tv_nsec;
+#else
+  return (guint64)g_get_monotonic_time () * 1000;
+#endif
+}
+
+/*
+ * Adds the time since the previous lap to @phase.
+ */
+static inline void
+bayes_guess_timer_lap (BayesGuessTimer *timer,
+                       guint64         *phase)
+{
+  guint64 now;
+
+  if (timer->collect)
+    {
+      now = bayes_classifier_now ();
+      *phase += now - timer->last;
+      timer->last = now;
+    }
+}
+
+/*
+ * Custom tokenizers may return %NULL for text without tokens, which is
+ * turned into an empty vector so that callers need not check.
+ */
 static gchar **
 bayes_classifier_tokenize (BayesClassifier *self,
                            const gchar     *text)
 {
+  gchar **tokens;
+
   g_return_val_if_fail (BAYES_IS_CLASSIFIER (self), NULL);
   g_return_val_if_fail (text, NULL);
 
-  return self->token_func (text, self->token_user_data);
+  if (!(tokens = self->token_func (text, self->token_user_data)))
+    tokens = g_new0 (gchar *, 1);
+
+  return tokens;
 }
 
 BayesClassifier *
@@ -125,19 +337,75 @@ bayes_classifier_train (BayesClassifier *self,
                         const gchar     *name,
                         const gchar     *text)
 {
+  BayesStorageMemory *memory;
+  BayesStorage *storage;
+  gboolean collect;
+  guint64 begin = 0;
+  guint64 tokenized = 0;
+  guint64 end;
   gchar **tokens;
-  guint i;
+  guint i = 0;
 
   g_return_if_fail (BAYES_IS_CLASSIFIER (self));
   g_return_if_fail (name);
   g_return_if_fail (text);
 
+  BAYES_TRACE2 (train__entry, name, strlen (text));
+
+  if ((collect = (self->stats != NULL)))
+    begin = bayes_classifier_now ();
+
+  storage = bayes_classifier_acquire (self, &memory, NULL);
+
   if (NULL != (tokens = bayes_classifier_tokenize (self, text)))
     {
-      for (i = 0; tokens[i]; i++)
-        bayes_storage_add_token (self->storage, name, tokens [i]);
+      if (collect)
+        tokenized = bayes_classifier_now ();
+      if (memory != NULL)
+        {
+          BayesTokens *table = bayes_storage_memory_ensure_class (memory, name);
+          gsize len;
+
+          for (i = 0; tokens[i]; i++)
+            {
+              len = strlen (tokens [i]);
+              bayes_storage_memory_add_hashed (memory, table, tokens [i], len,
+                                               bayes_tokens_hash (tokens [i], len), 1);
+            }
+        }
+      else
+        {
+          i = g_strv_length (tokens);
+          bayes_storage_add_token_counts (storage, name,
+                                          (const gchar * const *)tokens, NULL, i);
+        }
       g_strfreev (tokens);
     }
+
+  g_clear_object (&storage);
+
+  if (collect)
+    {
+      end = bayes_classifier_now ();
+      if (tokenized == 0)
+        tokenized = end;
+
+      g_mutex_lock (&self->stats_mutex);
+      if (self->stats != NULL)
+        {
+          BayesClassifierStats *stats = self->stats;
+
+          stats->train_calls++;
+          stats->train_tokens += i;
+          bayes_histogram_record (&stats->train_tokenize, tokenized - begin);
+          bayes_histogram_record (&stats->train_store, end - tokenized);
+          bayes_histogram_record (&stats->train_total, end - begin);
+          bayes_histogram_record (&stats->train_tokens_per_call, i);
+        }
+      g_mutex_unlock (&self->stats_mutex);
+    }
+
+  BAYES_TRACE2 (train__return, name, i);
 }
 
 static gint
@@ -174,24 +442,44 @@ bayes_classifier_combiner (BayesClassifier  *self,
   return self->combiner_func (self, guesses, len, name, self->combiner_user_data);
 }
 
-GList *
-bayes_classifier_guess (BayesClassifier *self,
-                        const gchar     *text)
+/*
+ * Sorts the guesses for a single classification and combines them.
+ */
+static BayesGuess *
+bayes_classifier_combine_guesses (BayesClassifier *self,
+                                  GPtrArray       *guesses,
+                                  const gchar     *name,
+                                  BayesGuessTimer *timer)
 {
   BayesGuess *guess;
+
+  g_ptr_array_sort (guesses, qsort_guesses);
+  bayes_guess_timer_lap (timer, &timer->sort);
+
+  guess = bayes_guess_new (name,
+                           bayes_classifier_combiner (self,
+                                                      (BayesGuess **)guesses->pdata,
+                                                      guesses->len, name));
+  bayes_guess_timer_lap (timer, &timer->combine);
+
+  return guess;
+}
+
+static GList *
+bayes_classifier_guess_dense (BayesClassifier  *self,
+                              BayesStorage     *storage,
+                              gchar           **tokens,
+                              gchar           **names,
+                              BayesGuessTimer  *timer)
+{
   GPtrArray *guesses;
   gdouble prob;
-  gchar **tokens;
-  gchar **names;
   GList *ret = NULL;
   guint i;
   guint j;
 
-  g_return_val_if_fail (BAYES_IS_CLASSIFIER (self), NULL);
-  g_return_val_if_fail (text, NULL);
-
-  tokens = bayes_classifier_tokenize (self, text);
-  names = bayes_storage_get_names (self->storage);
+  if (tokens[0] == NULL)
+    return NULL;
 
   for (i = 0; names[i]; i++)
     {
@@ -199,145 +487,1477 @@ bayes_classifier_guess (BayesClassifier *self,
 
       for (j = 0; tokens[j]; j++)
         {
-          prob = bayes_storage_get_token_probability (self->storage, names [i], tokens [j]);
-          guess = bayes_guess_new (tokens[j], prob);
-          g_ptr_array_add (guesses, guess);
+          prob = bayes_storage_get_token_probability (storage, names [i], tokens [j]);
+          g_ptr_array_add (guesses, bayes_guess_new (tokens[j], prob));
         }
 
-      g_ptr_array_sort (guesses, qsort_guesses);
+      bayes_guess_timer_lap (timer, &timer->lookup);
 
-      if (guesses->len != 0)
-        {
-          guess = bayes_guess_new (names[i],
-                                   bayes_classifier_combiner (self,
-                                                              (BayesGuess **)guesses->pdata,
-                                                              guesses->len, names[i]));
-          ret = g_list_prepend (ret, guess);
-        }
+      ret = g_list_prepend (ret, bayes_classifier_combine_guesses (self, guesses, names[i], timer));
 
       g_ptr_array_unref (guesses);
     }
 
-  g_strfreev (names);
-  g_strfreev (tokens);
-
-  ret = g_list_sort (ret, sort_guesses);
-
   return ret;
 }
 
-BayesStorage *
-bayes_classifier_get_storage (BayesClassifier *self)
+/*
+ * Hashes every token once and looks up its count across all
+ * classifications. Most tokens that were never trained on are rejected
+ * by the Bloom filter of the storage without probing the corpus.
+ */
+static void
+bayes_classifier_hash_tokens (BayesStorageMemory  *memory,
+                              gchar              **tokens,
+                              guint                n_tokens,
+                              gsize               *lens,
+                              guint32             *hashes,
+                              guint               *totals)
 {
-  g_return_val_if_fail (BAYES_IS_CLASSIFIER (self), NULL);
+  BayesTokenEntry *entry;
+  guint j;
 
-  return self->storage;
-}
+  for (j = 0; j < n_tokens; j++)
+    {
+      lens [j] = strlen (tokens [j]);
+      hashes [j] = bayes_tokens_hash (tokens [j], lens [j]);
 
-void
-bayes_classifier_set_storage (BayesClassifier *self,
-                              BayesStorage    *storage)
-{
-  g_return_if_fail (BAYES_IS_CLASSIFIER (self));
-  g_return_if_fail (!storage || BAYES_IS_STORAGE (storage));
+      if (!bayes_bloom_contains (memory->bloom, hashes [j]))
+        {
+          totals [j] = 0;
+          continue;
+        }
 
-  if (g_set_object (&self->storage, storage))
-    g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_STORAGE]);
+      entry = bayes_tokens_lookup_entry (memory->corpus, tokens [j], lens [j], hashes [j]);
+      totals [j] = entry ? entry->count : 0;
+    }
 }
 
-void
-bayes_classifier_set_tokenizer (BayesClassifier *self,
-                                BayesTokenizer   tokenizer,
-                                gpointer         user_data,
-                                GDestroyNotify   notify)
+static inline gdouble
+bayes_classifier_memory_probability (BayesStorageMemory *memory,
+                                     const BayesClass   *klass,
+                                     const gchar        *token,
+                                     gsize               len,
+                                     guint32             hash,
+                                     guint               total)
 {
-  g_return_if_fail (BAYES_IS_CLASSIFIER (self));
-  g_return_if_fail (tokenizer || (!user_data && !notify));
+  BayesTokenEntry *entry = NULL;
 
-  if (self->token_notify != NULL)
-    self->token_notify (self->token_user_data);
+  /* A token missing from the corpus is missing from every class. */
+  if (total != 0)
+    entry = bayes_tokens_lookup_entry (klass->tokens, token, len, hash);
 
-  self->token_func = tokenizer ? tokenizer : bayes_tokenizer_word;
-  self->token_user_data = tokenizer ? user_data : NULL;
-  self->token_notify = tokenizer ? notify : NULL;
+  return bayes_storage_compute_probability (klass->tokens->count,
+                                            memory->corpus->count,
+                                            entry ? entry->count : 0,
+                                            total);
 }
 
-static void
-bayes_classifier_set_combiner (BayesClassifier *self,
-                               BayesCombiner    combiner,
-                               gpointer         user_data,
-                               GDestroyNotify   notify)
+/*
+ * The same as bayes_classifier_guess_dense() against the tables of a
+ * #BayesStorageMemory. Each token is hashed and looked up in the corpus
+ * once rather than once per classification, and each classification
+ * table is only found once.
+ */
+static GList *
+bayes_classifier_guess_memory (BayesClassifier     *self,
+                               BayesStorageMemory  *memory,
+                               gchar              **tokens,
+                               BayesGuessTimer     *timer)
 {
-  g_return_if_fail (BAYES_IS_CLASSIFIER (self));
-  g_return_if_fail (combiner || (!user_data && !notify));
+  const BayesClass *klass;
+  GPtrArray *guesses;
+  guint32 *hashes;
+  gdouble prob;
+  gsize *lens;
+  guint *totals;
+  guint n_tokens;
+  GList *ret = NULL;
+  guint i;
+  guint j;
 
-  if (self->combiner_notify != NULL)
-    self->combiner_notify (self->combiner_user_data);
+  if (!(n_tokens = g_strv_length (tokens)))
+    return NULL;
 
-  self->combiner_func = combiner ? combiner : bayes_classifier_robinson;
-  self->combiner_user_data = combiner ? user_data : NULL;
-  self->combiner_notify = combiner ? notify : NULL;
-}
+  lens = g_new (gsize, n_tokens);
+  hashes = g_new (guint32, n_tokens);
+  totals = g_new (guint, n_tokens);
 
-static void
-bayes_classifier_finalize (GObject *object)
-{
-  BayesClassifier *self = (BayesClassifier *)object;
+  bayes_classifier_hash_tokens (memory, tokens, n_tokens, lens, hashes, totals);
 
-  bayes_classifier_set_tokenizer (self, NULL, NULL, NULL);
-  bayes_classifier_set_combiner (self, NULL, NULL, NULL);
-  g_clear_object (&self->storage);
+  for (i = 0; i < memory->classes->len; i++)
+    {
+      klass = &g_array_index (memory->classes, BayesClass, i);
+      guesses = g_ptr_array_new_with_free_func ((GDestroyNotify)bayes_guess_unref);
 
-  G_OBJECT_CLASS (bayes_classifier_parent_class)->finalize (object);
+      for (j = 0; j < n_tokens; j++)
+        {
+          prob = bayes_classifier_memory_probability (memory, klass, tokens [j],
+                                                      lens [j], hashes [j], totals [j]);
+          g_ptr_array_add (guesses, bayes_guess_new (tokens [j], prob));
+        }
+
+      bayes_guess_timer_lap (timer, &timer->lookup);
+
+      ret = g_list_prepend (ret, bayes_classifier_combine_guesses (self, guesses, klass->name, timer));
+
+      g_ptr_array_unref (guesses);
+    }
+
+  g_free (totals);
+  g_free (hashes);
+  g_free (lens);
+
+  return ret;
 }
 
-static void
-bayes_classifier_get_property (GObject    *object,
-                               guint       prop_id,
-                               GValue     *value,
-                               GParamSpec *pspec)
+/*
+ * Only the classifications found in the postings of the tokens get
+ * their own probabilities. A token that is absent from a classification
+ * has the same probability in all of them, so every other classification
+ * ends up with the same guess, which is only computed once. That guess
+ * differs for classifications without any tokens if some of the tokens
+ * are unknown, see bayes_storage_compute_probability().
+ *
+ * The probabilities are computed in the order of @tokens and classes are
+ * visited in the order of @names, as in bayes_classifier_guess_dense(),
+ * so that the results are identical. This relies on the combiner only
+ * depending on the probabilities and not on the classification, which
+ * only holds for bayes_classifier_robinson().
+ */
+static GList *
+bayes_classifier_guess_sparse (BayesClassifier  *self,
+                               BayesStorage     *storage,
+                               gchar           **tokens,
+                               gchar           **names,
+                               BayesGuessTimer  *timer)
 {
-  BayesClassifier *self = BAYES_CLASSIFIER (object);
+  const BayesPosting *posting;
+  GHashTable *distinct;
+  GPtrArray *guesses;
+  GArray *postings;
+  GArray *offsets;
+  GArray *matching;
+  GArray *totals;
+  gpointer value;
+  gboolean has_unknown = FALSE;
+  gboolean empty;
+  gboolean has_shared [2] = { FALSE, FALSE };
+  gdouble shared [2] = { 0.0, 0.0 };
+  gdouble prob;
+  guint *occurrences;
+  guint *counts;
+  guint *slots;
+  guint corpus_count;
+  guint pool_count;
+  guint n_distinct;
+  guint n_names;
+  guint n_tokens;
+  guint start;
+  guint count;
+  guint d;
+  guint i;
+  guint j;
+  guint k;
+  guint m;
+  GList *ret = NULL;
 
-  switch (prop_id)
+  n_tokens = g_strv_length (tokens);
+  n_names = g_strv_length (names);
+
+  if (n_tokens == 0)
+    return NULL;
+
+  corpus_count = bayes_storage_get_token_count (storage, NULL, NULL);
+
+  /*
+   * Look up every distinct token once. The postings of token d are
+   * postings [offsets [d]] to postings [offsets [d + 1]], and @slots maps
+   * a class id to its position in @matching plus one.
+   */
+  distinct = g_hash_table_new (g_str_hash, g_str_equal);
+  occurrences = g_new (guint, n_tokens);
+  postings = g_array_new (FALSE, FALSE, sizeof (BayesPosting));
+  offsets = g_array_new (FALSE, FALSE, sizeof (guint));
+  totals = g_array_new (FALSE, FALSE, sizeof (guint));
+  matching = g_array_new (FALSE, FALSE, sizeof (guint));
+  slots = g_new0 (guint, n_names);
+
+  for (j = 0; j < n_tokens; j++)
     {
-    case PROP_STORAGE:
-      g_value_set_object (value, bayes_classifier_get_storage (self));
-      break;
+      if (g_hash_table_lookup_extended (distinct, tokens [j], NULL, &value))
+        {
+          occurrences [j] = GPOINTER_TO_UINT (value);
+          continue;
+        }
 
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      d = offsets->len;
+      g_hash_table_insert (distinct, tokens [j], GUINT_TO_POINTER (d));
+      occurrences [j] = d;
+
+      start = postings->len;
+      g_array_append_val (offsets, start);
+      count = bayes_storage_get_token_count (storage, NULL, tokens [j]);
+      g_array_append_val (totals, count);
+      has_unknown |= (count == 0);
+
+      bayes_storage_get_postings (storage, tokens [j], postings);
+
+      for (k = start; k < postings->len; k++)
+        {
+          posting = &g_array_index (postings, BayesPosting, k);
+
+          if (posting->class_id < n_names && slots [posting->class_id] == 0)
+            {
+              g_array_append_val (matching, posting->class_id);
+              slots [posting->class_id] = matching->len;
+            }
+        }
     }
-}
 
-static void
-bayes_classifier_set_property (GObject      *object,
-                               guint         prop_id,
-                               const GValue *value,
-                               GParamSpec   *pspec)
-{
-  BayesClassifier *self = BAYES_CLASSIFIER (object);
+  n_distinct = offsets->len;
+  start = postings->len;
+  g_array_append_val (offsets, start);
 
-  switch (prop_id)
+  counts = g_new0 (guint, (gsize)matching->len * n_distinct);
+
+  for (d = 0; d < n_distinct; d++)
     {
-    case PROP_STORAGE:
-      bayes_classifier_set_storage (self, g_value_get_object (value));
-      break;
+      for (k = g_array_index (offsets, guint, d); k < g_array_index (offsets, guint, d + 1); k++)
+        {
+          posting = &g_array_index (postings, BayesPosting, k);
 
-    default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+          if (posting->class_id < n_names)
+            counts [(gsize)(slots [posting->class_id] - 1) * n_distinct + d] = posting->count;
+        }
     }
-}
 
-static void
-bayes_classifier_class_init (BayesClassifierClass *klass)
-{
-  GObjectClass *object_class;
+  bayes_guess_timer_lap (timer, &timer->lookup);
 
-  object_class = G_OBJECT_CLASS (klass);
-  object_class->finalize = bayes_classifier_finalize;
-  object_class->get_property = bayes_classifier_get_property;
-  object_class->set_property = bayes_classifier_set_property;
+  for (i = 0; i < n_names; i++)
+    {
+      if (slots [i] != 0)
+        {
+          m = slots [i] - 1;
+          pool_count = bayes_storage_get_token_count (storage, names [i], NULL);
+          guesses = g_ptr_array_new_with_free_func ((GDestroyNotify)bayes_guess_unref);
+
+          for (j = 0; j < n_tokens; j++)
+            {
+              d = occurrences [j];
+              prob = bayes_storage_compute_probability (pool_count,
+                                                        corpus_count,
+                                                        counts [(gsize)m * n_distinct + d],
+                                                        g_array_index (totals, guint, d));
+              g_ptr_array_add (guesses, bayes_guess_new (tokens [j], prob));
+            }
+
+          bayes_guess_timer_lap (timer, &timer->lookup);
+
+          ret = g_list_prepend (ret, bayes_classifier_combine_guesses (self, guesses, names [i], timer));
+
+          g_ptr_array_unref (guesses);
+          continue;
+        }
+
+      empty = has_unknown &&
+              bayes_storage_get_token_count (storage, names [i], NULL) == 0;
+
+      if (!has_shared [empty])
+        {
+          BayesGuess *guess;
+
+          guesses = g_ptr_array_new_with_free_func ((GDestroyNotify)bayes_guess_unref);
+
+          for (j = 0; j < n_tokens; j++)
+            {
+              prob = bayes_storage_compute_probability (empty ? 0 : 1,
+                                                        corpus_count,
+                                                        0,
+                                                        g_array_index (totals, guint, occurrences [j]));
+              g_ptr_array_add (guesses, bayes_guess_new (tokens [j], prob));
+            }
+
+          bayes_guess_timer_lap (timer, &timer->lookup);
+
+          guess = bayes_classifier_combine_guesses (self, guesses, names [i], timer);
+          shared [empty] = bayes_guess_get_probability (guess);
+          has_shared [empty] = TRUE;
+          bayes_guess_unref (guess);
+
+          g_ptr_array_unref (guesses);
+        }
+
+      ret = g_list_prepend (ret, bayes_guess_new (names [i], shared [empty]));
+    }
+
+  g_free (counts);
+  g_free (slots);
+  g_array_unref (matching);
+  g_array_unref (totals);
+  g_array_unref (offsets);
+  g_array_unref (postings);
+  g_free (occurrences);
+  g_hash_table_unref (distinct);
+
+  return ret;
+}
+
+static GList *
+bayes_classifier_guess_model (BayesClassifier  *self,
+                              BayesModel       *model,
+                              gchar           **tokens,
+                              BayesGuessTimer  *timer)
+{
+  GList *ret;
+
+  ret = bayes_model_guess (model, (const gchar * const *)tokens);
+  bayes_guess_timer_lap (timer, &timer->combine);
+
+  return ret;
+}
+
+/*
+ * Records the phases of a guess once it is complete. Anything done after
+ * the last lap counts as sorting.
+ */
+static void
+bayes_classifier_record_guess (BayesClassifier  *self,
+                               BayesStorage     *storage,
+                               gchar           **tokens,
+                               BayesGuessTimer  *timer)
+{
+  guint64 now;
+  guint n_tokens;
+  guint n_unknown = 0;
+  guint j;
+
+  now = bayes_classifier_now ();
+  timer->sort += now - timer->last;
+
+  /*
+   * Done after the clock is read so that it does not show up in the
+   * latencies. A probability of 0.0 is also returned for neutral
+   * tokens, so ask the storage for the count across all classes.
+   */
+  for (j = 0; tokens[j]; j++)
+    {
+      if (bayes_storage_get_token_count (storage, NULL, tokens [j]) == 0)
+        n_unknown++;
+    }
+  n_tokens = j;
+
+  g_mutex_lock (&self->stats_mutex);
+  if (self->stats != NULL)
+    {
+      BayesClassifierStats *stats = self->stats;
+
+      stats->guess_calls++;
+      stats->guess_tokens += n_tokens;
+      stats->guess_unknown_tokens += n_unknown;
+      bayes_histogram_record (&stats->guess_tokenize, timer->tokenize);
+      bayes_histogram_record (&stats->guess_lookup, timer->lookup);
+      bayes_histogram_record (&stats->guess_sort, timer->sort);
+      bayes_histogram_record (&stats->guess_combine, timer->combine);
+      bayes_histogram_record (&stats->guess_total, now - timer->begin);
+      bayes_histogram_record (&stats->guess_tokens_per_call, n_tokens);
+    }
+  g_mutex_unlock (&self->stats_mutex);
+}
+
+GList *
+bayes_classifier_guess (BayesClassifier *self,
+                        const gchar     *text)
+{
+  BayesGuessTimer timer = { 0 };
+  BayesStorageMemory *memory;
+  BayesStorage *storage;
+  BayesModel *model;
+  gboolean sparse;
+  gchar **tokens;
+  gchar **names;
+  GList *ret;
+
+  g_return_val_if_fail (BAYES_IS_CLASSIFIER (self), NULL);
+  g_return_val_if_fail (text, NULL);
+
+  BAYES_TRACE1 (guess__entry, strlen (text));
+
+  /* A custom combiner may tell classifications apart, see guess_sparse(). */
+  sparse = self->sparse && self->combiner_func == bayes_classifier_robinson;
+
+  if ((timer.collect = (self->stats != NULL)))
+    timer.begin = timer.last = bayes_classifier_now ();
+
+  tokens = bayes_classifier_tokenize (self, text);
+  storage = bayes_classifier_acquire (self, &memory, &model);
+
+  bayes_guess_timer_lap (&timer, &timer.tokenize);
+
+  if (model != NULL)
+    ret = bayes_classifier_guess_model (self, model, tokens, &timer);
+  else if (memory != NULL && !sparse)
+    ret = bayes_classifier_guess_memory (self, memory, tokens, &timer);
+  else
+    {
+      names = bayes_storage_get_names (storage);
+      if (sparse)
+        ret = bayes_classifier_guess_sparse (self, storage, tokens, names, &timer);
+      else
+        ret = bayes_classifier_guess_dense (self, storage, tokens, names, &timer);
+      g_strfreev (names);
+    }
+
+  ret = g_list_sort (ret, sort_guesses);
+
+  if (timer.collect)
+    bayes_classifier_record_guess (self, storage, tokens, &timer);
+
+  BAYES_TRACE2 (guess__return, g_strv_length (tokens), g_list_length (ret));
+
+  g_clear_pointer (&model, bayes_model_unref);
+  g_clear_object (&storage);
+  g_strfreev (tokens);
+
+  return ret;
+}
+
+BayesGuessContext *
+bayes_guess_context_new (void)
+{
+  BayesGuessContext *context;
+
+  context = g_slice_new0 (BayesGuessContext);
+  context->lens = g_array_new (FALSE, FALSE, sizeof (gsize));
+  context->hashes = g_array_new (FALSE, FALSE, sizeof (guint32));
+  context->totals = g_array_new (FALSE, FALSE, sizeof (guint));
+  context->values = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  context->scratch = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  context->scores = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  context->names = g_ptr_array_new_with_free_func (g_free);
+  g_ptr_array_add (context->names, NULL);
+
+  return context;
+}
+
+/*
+ * A context only holds scratch space, so a copy is a new context.
+ */
+static BayesGuessContext *
+bayes_guess_context_copy (BayesGuessContext *context)
+{
+  return bayes_guess_context_new ();
+}
+
+void
+bayes_guess_context_free (BayesGuessContext *context)
+{
+  if (context != NULL)
+    {
+      g_array_unref (context->lens);
+      g_array_unref (context->hashes);
+      g_array_unref (context->totals);
+      g_array_unref (context->values);
+      g_array_unref (context->scratch);
+      g_array_unref (context->scores);
+      g_ptr_array_unref (context->names);
+      g_slice_free (BayesGuessContext, context);
+    }
+}
+
+const gchar * const *
+bayes_guess_context_get_names (BayesGuessContext *context)
+{
+  g_return_val_if_fail (context != NULL, NULL);
+
+  return (const gchar * const *)context->names->pdata;
+}
+
+/*
+ * Records @name as the classification of class id @pos for the current
+ * guess. Ids are set in order, then bayes_guess_context_end_names() is
+ * called with their number.
+ */
+static void
+bayes_guess_context_set_name (BayesGuessContext *context,
+                              guint              pos,
+                              const gchar       *name)
+{
+  gchar **slot;
+
+  if (pos == context->names->len)
+    g_ptr_array_add (context->names, NULL);
+
+  slot = (gchar **)&g_ptr_array_index (context->names, pos);
+
+  if (g_strcmp0 (*slot, name) != 0)
+    {
+      g_free (*slot);
+      *slot = g_strdup (name);
+    }
+}
+
+static void
+bayes_guess_context_end_names (BayesGuessContext *context,
+                               guint              n_names)
+{
+  if (n_names < context->names->len)
+    g_ptr_array_set_size (context->names, n_names);
+  g_ptr_array_add (context->names, NULL);
+}
+
+/*
+ * The stable merge sort behind g_ptr_array_sort(), with the comparison of
+ * qsort_guesses(). That comparison truncates, so the split points have to
+ * match too for the probabilities to be combined in the same order as by
+ * bayes_classifier_guess().
+ */
+static void
+bayes_guess_context_msort (gdouble *values,
+                           gdouble *scratch,
+                           guint    len)
+{
+  gdouble *b1;
+  gdouble *b2;
+  gdouble *out;
+  guint n1;
+  guint n2;
+
+  if (len <= 1)
+    return;
+
+  n1 = len / 2;
+  n2 = len - n1;
+  b1 = values;
+  b2 = values + n1;
+
+  bayes_guess_context_msort (b1, scratch, n1);
+  bayes_guess_context_msort (b2, scratch, n2);
+
+  out = scratch;
+
+  while (n1 > 0 && n2 > 0)
+    {
+      if ((gint)((*b2 - *b1) * 100.0) <= 0)
+        {
+          *out++ = *b1++;
+          n1--;
+        }
+      else
+        {
+          *out++ = *b2++;
+          n2--;
+        }
+    }
+
+  if (n1 > 0)
+    memcpy (out, b1, n1 * sizeof (gdouble));
+  memcpy (values, scratch, (len - n2) * sizeof (gdouble));
+}
+
+/*
+ * Sorts the probabilities of the tokens for one classification and
+ * combines them. Only a custom combiner needs #BayesGuess instances,
+ * which are paired with their tokens before sorting.
+ */
+static gdouble
+bayes_guess_context_combine (BayesClassifier    *self,
+                             BayesGuessContext  *context,
+                             gchar             **tokens,
+                             guint               len,
+                             const gchar        *name,
+                             BayesGuessTimer    *timer)
+{
+  const gdouble *values;
+  GPtrArray *guesses;
+  gdouble ret;
+  guint j;
+
+  values = (const gdouble *)context->values->data;
+
+  if (self->combiner_func == bayes_classifier_robinson)
+    {
+      bayes_guess_context_msort ((gdouble *)context->values->data,
+                                 (gdouble *)context->scratch->data,
+                                 len);
+      bayes_guess_timer_lap (timer, &timer->sort);
+
+      ret = bayes_classifier_robinson_values (values, len);
+    }
+  else
+    {
+      guesses = g_ptr_array_new_with_free_func ((GDestroyNotify)bayes_guess_unref);
+      for (j = 0; j < len; j++)
+        g_ptr_array_add (guesses, bayes_guess_new (tokens [j], values [j]));
+      g_ptr_array_sort (guesses, qsort_guesses);
+      bayes_guess_timer_lap (timer, &timer->sort);
+
+      ret = bayes_classifier_combiner (self, (BayesGuess **)guesses->pdata, len, name);
+      g_ptr_array_unref (guesses);
+    }
+
+  bayes_guess_timer_lap (timer, &timer->combine);
+
+  return CLAMP (ret, 0.0, 1.0);
+}
+
+static inline gboolean
+bayes_guess_result_better (const BayesGuessResult *a,
+                           const BayesGuessResult *b)
+{
+  return a->probability > b->probability ||
+         (a->probability == b->probability && a->class_id < b->class_id);
+}
+
+static void
+bayes_guess_results_sift_down (BayesGuessResult *results,
+                               guint             n,
+                               guint             pos)
+{
+  BayesGuessResult tmp;
+  guint child;
+
+  for (; (child = 2 * pos + 1) < n; pos = child)
+    {
+      if (child + 1 < n && bayes_guess_result_better (&results [child], &results [child + 1]))
+        child++;
+
+      if (!bayes_guess_result_better (&results [pos], &results [child]))
+        break;
+
+      tmp = results [pos];
+      results [pos] = results [child];
+      results [child] = tmp;
+    }
+}
+
+/*
+ * Keeps the @max best results in a heap with the worst at the root.
+ */
+static void
+bayes_guess_results_push (BayesGuessResult *results,
+                          guint            *n,
+                          guint             max,
+                          guint             class_id,
+                          gdouble           probability)
+{
+  BayesGuessResult result = { class_id, probability };
+  BayesGuessResult tmp;
+  guint parent;
+  guint pos;
+
+  if (*n < max)
+    {
+      results [*n] = result;
+
+      for (pos = (*n)++; pos > 0; pos = parent)
+        {
+          parent = (pos - 1) / 2;
+
+          if (!bayes_guess_result_better (&results [parent], &results [pos]))
+            break;
+
+          tmp = results [pos];
+          results [pos] = results [parent];
+          results [parent] = tmp;
+        }
+    }
+  else if (max > 0 && bayes_guess_result_better (&result, &results [0]))
+    {
+      results [0] = result;
+      bayes_guess_results_sift_down (results, max, 0);
+    }
+}
+
+/*
+ * Turns the heap into an array ordered from best to worst.
+ */
+static void
+bayes_guess_results_sort (BayesGuessResult *results,
+                          guint             n)
+{
+  BayesGuessResult tmp;
+  guint end;
+
+  for (end = n; end > 1; end--)
+    {
+      tmp = results [0];
+      results [0] = results [end - 1];
+      results [end - 1] = tmp;
+      bayes_guess_results_sift_down (results, end - 1, 0);
+    }
+}
+
+guint
+bayes_classifier_guess_with_context (BayesClassifier   *self,
+                                     BayesGuessContext *context,
+                                     const gchar       *text,
+                                     BayesGuessResult  *results,
+                                     guint              n_results)
+{
+  BayesGuessTimer timer = { 0 };
+  BayesStorageMemory *memory;
+  BayesStorage *storage;
+  BayesModel *model;
+  const BayesClass *klass;
+  gdouble *values;
+  gdouble *scores;
+  gdouble max = -INFINITY;
+  gdouble sum = 0.0;
+  gdouble prob;
+  gchar **tokens;
+  gchar **names;
+  guint n_tokens;
+  guint n_classes;
+  guint n = 0;
+  guint i;
+  guint j;
+
+  g_return_val_if_fail (BAYES_IS_CLASSIFIER (self), 0);
+  g_return_val_if_fail (context != NULL, 0);
+  g_return_val_if_fail (text, 0);
+  g_return_val_if_fail (results != NULL || n_results == 0, 0);
+
+  BAYES_TRACE1 (guess__entry, strlen (text));
+
+  if ((timer.collect = (self->stats != NULL)))
+    timer.begin = timer.last = bayes_classifier_now ();
+
+  tokens = bayes_classifier_tokenize (self, text);
+  n_tokens = g_strv_length (tokens);
+  storage = bayes_classifier_acquire (self, &memory, &model);
+
+  bayes_guess_timer_lap (&timer, &timer.tokenize);
+
+  if (model != NULL)
+    {
+      n_classes = bayes_model_get_n_classes (model);
+      g_array_set_size (context->scores, n_classes);
+      scores = (gdouble *)context->scores->data;
+
+      bayes_model_score (model, (const gchar * const *)tokens, scores);
+
+      for (i = 0; i < n_classes; i++)
+        max = MAX (max, scores [i]);
+      for (i = 0; i < n_classes; i++)
+        {
+          scores [i] = exp (scores [i] - max);
+          sum += scores [i];
+        }
+
+      bayes_guess_timer_lap (&timer, &timer.combine);
+
+      for (i = 0; i < n_classes; i++)
+        {
+          bayes_guess_context_set_name (context, i, bayes_model_get_names (model) [i]);
+          bayes_guess_results_push (results, &n, n_results, i, scores [i] / sum);
+        }
+      bayes_guess_context_end_names (context, n_classes);
+    }
+  else if (n_tokens > 0)
+    {
+      g_array_set_size (context->values, n_tokens);
+      g_array_set_size (context->scratch, n_tokens);
+      values = (gdouble *)context->values->data;
+
+      if (memory != NULL)
+        {
+          g_array_set_size (context->lens, n_tokens);
+          g_array_set_size (context->hashes, n_tokens);
+          g_array_set_size (context->totals, n_tokens);
+
+          bayes_classifier_hash_tokens (memory, tokens, n_tokens,
+                                        (gsize *)context->lens->data,
+                                        (guint32 *)context->hashes->data,
+                                        (guint *)context->totals->data);
+
+          for (i = 0; i < memory->classes->len; i++)
+            {
+              klass = &g_array_index (memory->classes, BayesClass, i);
+
+              for (j = 0; j < n_tokens; j++)
+                {
+                  prob = bayes_classifier_memory_probability (memory, klass, tokens [j],
+                                                              g_array_index (context->lens, gsize, j),
+                                                              g_array_index (context->hashes, guint32, j),
+                                                              g_array_index (context->totals, guint, j));
+                  values [j] = CLAMP (prob, 0.0, 1.0);
+                }
+
+              bayes_guess_timer_lap (&timer, &timer.lookup);
+              prob = bayes_guess_context_combine (self, context, tokens, n_tokens, klass->name, &timer);
+              bayes_guess_context_set_name (context, i, klass->name);
+              bayes_guess_results_push (results, &n, n_results, i, prob);
+            }
+          bayes_guess_context_end_names (context, i);
+        }
+      else
+        {
+          names = bayes_storage_get_names (storage);
+
+          for (i = 0; names [i]; i++)
+            {
+              for (j = 0; j < n_tokens; j++)
+                {
+                  prob = bayes_storage_get_token_probability (storage, names [i], tokens [j]);
+                  values [j] = CLAMP (prob, 0.0, 1.0);
+                }
+
+              bayes_guess_timer_lap (&timer, &timer.lookup);
+              prob = bayes_guess_context_combine (self, context, tokens, n_tokens, names [i], &timer);
+              bayes_guess_context_set_name (context, i, names [i]);
+              bayes_guess_results_push (results, &n, n_results, i, prob);
+            }
+          bayes_guess_context_end_names (context, i);
+
+          g_strfreev (names);
+        }
+    }
+  else
+    {
+      bayes_guess_context_end_names (context, 0);
+    }
+
+  bayes_guess_results_sort (results, n);
+
+  if (timer.collect)
+    bayes_classifier_record_guess (self, storage, tokens, &timer);
+
+  BAYES_TRACE2 (guess__return, n_tokens, n);
+
+  g_clear_pointer (&model, bayes_model_unref);
+  g_clear_object (&storage);
+  g_strfreev (tokens);
+
+  return n;
+}
+
+BayesStorage *
+bayes_classifier_get_storage (BayesClassifier *self)
+{
+  g_return_val_if_fail (BAYES_IS_CLASSIFIER (self), NULL);
+
+  return self->storage;
+}
+
+BayesStorage *
+bayes_classifier_dup_storage (BayesClassifier *self)
+{
+  BayesStorage *storage;
+
+  g_return_val_if_fail (BAYES_IS_CLASSIFIER (self), NULL);
+
+  g_mutex_lock (&self->storage_mutex);
+  storage = self->storage ? g_object_ref (self->storage) : NULL;
+  g_mutex_unlock (&self->storage_mutex);
+
+  return storage;
+}
+
+/*
+ * Swaps in @storage if @set_storage and @model if @set_model, both at
+ * once. Guesses that already took references keep using the old ones,
+ * which are freed when the last of them is done.
+ */
+static void
+bayes_classifier_replace (BayesClassifier *self,
+                          gboolean         set_storage,
+                          BayesStorage    *storage,
+                          gboolean         set_model,
+                          BayesModel      *model)
+{
+  BayesStorage *old_storage = NULL;
+  BayesModel *old_model = NULL;
+  gboolean changed = FALSE;
+
+  g_mutex_lock (&self->storage_mutex);
+  if (set_storage && self->storage != storage)
+    {
+      old_storage = self->storage;
+      self->storage = storage ? g_object_ref (storage) : NULL;
+      self->memory = BAYES_IS_STORAGE_MEMORY (storage) ? (BayesStorageMemory *)storage : NULL;
+      changed = TRUE;
+    }
+  if (set_model && self->model != model)
+    {
+      old_model = self->model;
+      self->model = model ? bayes_model_ref (model) : NULL;
+    }
+  g_mutex_unlock (&self->storage_mutex);
+
+  g_clear_object (&old_storage);
+  g_clear_pointer (&old_model, bayes_model_unref);
+
+  if (changed)
+    g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_STORAGE]);
+}
+
+/*
+ * Creates the model used while frozen, quantized to @precision.
+ */
+static BayesModel *
+bayes_classifier_build_model (BayesStorage        *storage,
+                              BayesModelPrecision  precision)
+{
+  BayesModel *model;
+  BayesModel *quantized;
+
+  model = bayes_model_new (storage, 1.0);
+
+  if (precision == BAYES_MODEL_PRECISION_EXACT)
+    return model;
+
+  quantized = bayes_model_quantize (model, precision);
+  bayes_model_unref (model);
+
+  return quantized;
+}
+
+/*
+ * Swaps in @storage along with a model that matches it: if @self is
+ * frozen, @model when it was built from @storage at the current
+ * precision, or a new one otherwise, and no model if @self is thawed.
+ * A storage that a model cannot be built from thaws @self.
+ */
+static void
+bayes_classifier_swap_storage (BayesClassifier *self,
+                               BayesStorage    *storage,
+                               BayesModel      *model)
+{
+  BayesModelPrecision precision = BAYES_MODEL_PRECISION_EXACT;
+  BayesModel *built = NULL;
+  gboolean frozen;
+
+  g_mutex_lock (&self->storage_mutex);
+  frozen = self->model != NULL;
+  if (frozen)
+    precision = bayes_model_get_precision (self->model);
+  g_mutex_unlock (&self->storage_mutex);
+
+  if (frozen && storage != NULL && !bayes_storage_can_foreach (storage))
+    {
+      g_warning ("Thawing, %s does not support bayes_storage_foreach()",
+                 G_OBJECT_TYPE_NAME (storage));
+      frozen = FALSE;
+    }
+
+  if (!frozen || storage == NULL)
+    model = NULL;
+  else if (model == NULL || bayes_model_get_precision (model) != precision)
+    model = built = bayes_classifier_build_model (storage, precision);
+
+  bayes_classifier_replace (self, TRUE, storage, TRUE, model);
+
+  g_clear_pointer (&built, bayes_model_unref);
+}
+
+void
+bayes_classifier_set_storage (BayesClassifier *self,
+                              BayesStorage    *storage)
+{
+  g_return_if_fail (BAYES_IS_CLASSIFIER (self));
+  g_return_if_fail (!storage || BAYES_IS_STORAGE (storage));
+
+  if (storage != self->storage)
+    bayes_classifier_swap_storage (self, storage, NULL);
+}
+
+typedef struct
+{
+  GFile              *file;
+  gboolean            freeze;
+  BayesModelPrecision precision;
+  BayesStorage       *storage;
+  BayesModel         *model;
+} BayesReload;
+
+static void
+bayes_reload_free (gpointer data)
+{
+  BayesReload *reload = data;
+
+  g_clear_object (&reload->file);
+  g_clear_object (&reload->storage);
+  g_clear_pointer (&reload->model, bayes_model_unref);
+  g_slice_free (BayesReload, reload);
+}
+
+/*
+ * Loads the watched file, and freezes it like bayes_classifier_freeze()
+ * if the classifier was frozen, so that guesses never see a storage
+ * without its model.
+ */
+static void
+bayes_classifier_reload_worker (GTask        *task,
+                                gpointer      source_object,
+                                gpointer      task_data,
+                                GCancellable *cancellable)
+{
+  BayesReload *reload = task_data;
+  g_autoptr(GFileInputStream) stream = NULL;
+  BayesStorageMemory *memory;
+  GError *error = NULL;
+
+  if (!(stream = g_file_read (reload->file, cancellable, &error)) ||
+      !(memory = bayes_storage_memory_new_from_stream (G_INPUT_STREAM (stream), cancellable, &error)))
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  reload->storage = BAYES_STORAGE (memory);
+  if (reload->freeze)
+    reload->model = bayes_classifier_build_model (reload->storage, reload->precision);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+bayes_classifier_reload_cb (GObject      *object,
+                            GAsyncResult *result,
+                            gpointer      user_data)
+{
+  BayesClassifier *self = (BayesClassifier *)object;
+  BayesReload *reload;
+  g_autoptr(GError) error = NULL;
+
+  reload = g_task_get_task_data (G_TASK (result));
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error))
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_autofree gchar *uri = g_file_get_uri (reload->file);
+
+          g_warning ("Failed to reload %s: %s", uri, error->message);
+        }
+      return;
+    }
+
+  /* @self may have been frozen or thawed since the reload started. */
+  bayes_classifier_swap_storage (self, reload->storage, reload->model);
+}
+
+/*
+ * Starts loading the watched file in a thread. A reload that is still
+ * running is cancelled, its result would already be outdated.
+ */
+static void
+bayes_classifier_reload (BayesClassifier *self)
+{
+  BayesReload *reload;
+  GTask *task;
+
+  if (self->reload_cancellable != NULL)
+    {
+      g_cancellable_cancel (self->reload_cancellable);
+      g_clear_object (&self->reload_cancellable);
+    }
+
+  reload = g_slice_new0 (BayesReload);
+  reload->file = g_object_ref (self->watch_file);
+
+  g_mutex_lock (&self->storage_mutex);
+  reload->freeze = self->model != NULL;
+  if (reload->freeze)
+    reload->precision = bayes_model_get_precision (self->model);
+  g_mutex_unlock (&self->storage_mutex);
+
+  self->reload_cancellable = g_cancellable_new ();
+
+  task = g_task_new (self, self->reload_cancellable, bayes_classifier_reload_cb, NULL);
+  g_task_set_source_tag (task, bayes_classifier_reload);
+  g_task_set_task_data (task, reload, bayes_reload_free);
+  g_task_run_in_thread (task, bayes_classifier_reload_worker);
+  g_object_unref (task);
+}
+
+static void
+bayes_classifier_watch_changed (GFileMonitor      *monitor,
+                                GFile             *file,
+                                GFile             *other_file,
+                                GFileMonitorEvent  event,
+                                BayesClassifier   *self)
+{
+  /*
+   * Files are only loaded once they are completely written. Files that
+   * are moved into place also get this hint.
+   */
+  if (event == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT)
+    bayes_classifier_reload (self);
+}
+
+gboolean
+bayes_classifier_watch_file (BayesClassifier  *self,
+                             GFile            *file,
+                             GError          **error)
+{
+  GFileMonitor *monitor = NULL;
+
+  g_return_val_if_fail (BAYES_IS_CLASSIFIER (self), FALSE);
+  g_return_val_if_fail (!file || G_IS_FILE (file), FALSE);
+
+  if (file != NULL &&
+      !(monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, error)))
+    return FALSE;
+
+  if (self->reload_cancellable != NULL)
+    {
+      g_cancellable_cancel (self->reload_cancellable);
+      g_clear_object (&self->reload_cancellable);
+    }
+
+  if (self->watch_monitor != NULL)
+    {
+      g_signal_handlers_disconnect_by_func (self->watch_monitor,
+                                            G_CALLBACK (bayes_classifier_watch_changed),
+                                            self);
+      g_file_monitor_cancel (self->watch_monitor);
+      g_clear_object (&self->watch_monitor);
+    }
+
+  g_set_object (&self->watch_file, file);
+
+  if (monitor != NULL)
+    {
+      self->watch_monitor = monitor;
+      g_signal_connect (monitor, "changed",
+                        G_CALLBACK (bayes_classifier_watch_changed),
+                        self);
+    }
+
+  return TRUE;
+}
+
+gboolean
+bayes_classifier_get_collect_stats (BayesClassifier *self)
+{
+  g_return_val_if_fail (BAYES_IS_CLASSIFIER (self), FALSE);
+
+  return self->stats != NULL;
+}
+
+void
+bayes_classifier_set_collect_stats (BayesClassifier *self,
+                                    gboolean         collect_stats)
+{
+  BayesClassifierStats *stats = NULL;
+
+  g_return_if_fail (BAYES_IS_CLASSIFIER (self));
+
+  collect_stats = !!collect_stats;
+
+  if (collect_stats == (self->stats != NULL))
+    return;
+
+  g_mutex_lock (&self->stats_mutex);
+  if (collect_stats)
+    self->stats = g_new0 (BayesClassifierStats, 1);
+  else
+    stats = g_steal_pointer (&self->stats);
+  g_mutex_unlock (&self->stats_mutex);
+
+  g_free (stats);
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_COLLECT_STATS]);
+}
+
+void
+bayes_classifier_freeze (BayesClassifier *self)
+{
+  bayes_classifier_freeze_full (self, BAYES_MODEL_PRECISION_EXACT);
+}
+
+void
+bayes_classifier_freeze_full (BayesClassifier     *self,
+                              BayesModelPrecision  precision)
+{
+  BayesStorageMemory *memory;
+  BayesStorage *storage;
+  BayesModel *model;
+
+  g_return_if_fail (BAYES_IS_CLASSIFIER (self));
+  g_return_if_fail (self->storage != NULL);
+
+  storage = bayes_classifier_acquire (self, &memory, NULL);
+
+  if (!bayes_storage_can_foreach (storage))
+    {
+      g_warning ("Cannot freeze, %s does not support bayes_storage_foreach()",
+                 G_OBJECT_TYPE_NAME (storage));
+      g_object_unref (storage);
+      return;
+    }
+
+  model = bayes_classifier_build_model (storage, precision);
+  bayes_classifier_replace (self, FALSE, NULL, TRUE, model);
+  bayes_model_unref (model);
+  g_object_unref (storage);
+}
+
+void
+bayes_classifier_thaw (BayesClassifier *self)
+{
+  g_return_if_fail (BAYES_IS_CLASSIFIER (self));
+
+  bayes_classifier_replace (self, FALSE, NULL, TRUE, NULL);
+}
+
+BayesModel *
+bayes_classifier_get_model (BayesClassifier *self)
+{
+  g_return_val_if_fail (BAYES_IS_CLASSIFIER (self), NULL);
+
+  return self->model;
+}
+
+BayesModel *
+bayes_classifier_dup_model (BayesClassifier *self)
+{
+  BayesModel *model;
+
+  g_return_val_if_fail (BAYES_IS_CLASSIFIER (self), NULL);
+
+  g_mutex_lock (&self->storage_mutex);
+  model = self->model ? bayes_model_ref (self->model) : NULL;
+  g_mutex_unlock (&self->storage_mutex);
+
+  return model;
+}
+
+gboolean
+bayes_classifier_get_sparse (BayesClassifier *self)
+{
+  g_return_val_if_fail (BAYES_IS_CLASSIFIER (self), FALSE);
+
+  return self->sparse;
+}
+
+void
+bayes_classifier_set_sparse (BayesClassifier *self,
+                             gboolean         sparse)
+{
+  g_return_if_fail (BAYES_IS_CLASSIFIER (self));
+
+  sparse = !!sparse;
+
+  if (sparse != self->sparse)
+    {
+      self->sparse = sparse;
+      g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_SPARSE]);
+    }
+}
+
+void
+bayes_classifier_reset_stats (BayesClassifier *self)
+{
+  g_return_if_fail (BAYES_IS_CLASSIFIER (self));
+
+  g_mutex_lock (&self->stats_mutex);
+  if (self->stats != NULL)
+    memset (self->stats, 0, sizeof *self->stats);
+  g_mutex_unlock (&self->stats_mutex);
+}
+
+static void
+add_histogram (GVariantBuilder      *builder,
+               const gchar          *key,
+               const BayesHistogram *histogram)
+{
+  g_variant_builder_add (builder, "{sv}", key, bayes_histogram_to_variant (histogram));
+}
+
+GVariant *
+bayes_classifier_get_stats (BayesClassifier *self)
+{
+  BayesClassifierStats *stats;
+  GVariantBuilder guess;
+  GVariantBuilder train;
+  GVariantBuilder builder;
+
+  g_return_val_if_fail (BAYES_IS_CLASSIFIER (self), NULL);
+
+  g_variant_builder_init (&guess, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_init (&train, G_VARIANT_TYPE_VARDICT);
+
+  g_mutex_lock (&self->stats_mutex);
+
+  if (NULL != (stats = self->stats))
+    {
+      g_variant_builder_add (&guess, "{sv}", "calls", g_variant_new_uint64 (stats->guess_calls));
+      g_variant_builder_add (&guess, "{sv}", "tokens", g_variant_new_uint64 (stats->guess_tokens));
+      g_variant_builder_add (&guess, "{sv}", "unknown-tokens", g_variant_new_uint64 (stats->guess_unknown_tokens));
+      g_variant_builder_add (&guess, "{sv}", "unknown-rate",
+                             g_variant_new_double (stats->guess_tokens ?
+                                                   (gdouble)stats->guess_unknown_tokens / stats->guess_tokens :
+                                                   0.0));
+      add_histogram (&guess, "tokens-per-call", &stats->guess_tokens_per_call);
+      add_histogram (&guess, "tokenize", &stats->guess_tokenize);
+      add_histogram (&guess, "lookup", &stats->guess_lookup);
+      add_histogram (&guess, "sort", &stats->guess_sort);
+      add_histogram (&guess, "combine", &stats->guess_combine);
+      add_histogram (&guess, "total", &stats->guess_total);
+
+      g_variant_builder_add (&train, "{sv}", "calls", g_variant_new_uint64 (stats->train_calls));
+      g_variant_builder_add (&train, "{sv}", "tokens", g_variant_new_uint64 (stats->train_tokens));
+      add_histogram (&train, "tokens-per-call", &stats->train_tokens_per_call);
+      add_histogram (&train, "tokenize", &stats->train_tokenize);
+      add_histogram (&train, "store", &stats->train_store);
+      add_histogram (&train, "total", &stats->train_total);
+    }
+
+  g_mutex_unlock (&self->stats_mutex);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "guess", g_variant_builder_end (&guess));
+  g_variant_builder_add (&builder, "{sv}", "train", g_variant_builder_end (&train));
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+void
+bayes_classifier_set_tokenizer (BayesClassifier *self,
+                                BayesTokenizer   tokenizer,
+                                gpointer         user_data,
+                                GDestroyNotify   notify)
+{
+  g_return_if_fail (BAYES_IS_CLASSIFIER (self));
+  g_return_if_fail (tokenizer || (!user_data && !notify));
+
+  if (self->token_notify != NULL)
+    self->token_notify (self->token_user_data);
+
+  self->token_func = tokenizer ? tokenizer : bayes_tokenizer_word;
+  self->token_user_data = tokenizer ? user_data : NULL;
+  self->token_notify = tokenizer ? notify : NULL;
+}
+
+static void
+bayes_classifier_set_combiner (BayesClassifier *self,
+                               BayesCombiner    combiner,
+                               gpointer         user_data,
+                               GDestroyNotify   notify)
+{
+  g_return_if_fail (BAYES_IS_CLASSIFIER (self));
+  g_return_if_fail (combiner || (!user_data && !notify));
+
+  if (self->combiner_notify != NULL)
+    self->combiner_notify (self->combiner_user_data);
+
+  self->combiner_func = combiner ? combiner : bayes_classifier_robinson;
+  self->combiner_user_data = combiner ? user_data : NULL;
+  self->combiner_notify = combiner ? notify : NULL;
+}
+
+static void
+bayes_classifier_finalize (GObject *object)
+{
+  BayesClassifier *self = (BayesClassifier *)object;
+
+  bayes_classifier_watch_file (self, NULL, NULL);
+  bayes_classifier_set_tokenizer (self, NULL, NULL, NULL);
+  bayes_classifier_set_combiner (self, NULL, NULL, NULL);
+  g_clear_object (&self->storage);
+  g_clear_pointer (&self->model, bayes_model_unref);
+  g_mutex_clear (&self->storage_mutex);
+  g_clear_pointer (&self->stats, g_free);
+  g_mutex_clear (&self->stats_mutex);
+
+  G_OBJECT_CLASS (bayes_classifier_parent_class)->finalize (object);
+}
+
+static void
+bayes_classifier_get_property (GObject    *object,
+                               guint       prop_id,
+                               GValue     *value,
+                               GParamSpec *pspec)
+{
+  BayesClassifier *self = BAYES_CLASSIFIER (object);
+
+  switch (prop_id)
+    {
+    case PROP_COLLECT_STATS:
+      g_value_set_boolean (value, bayes_classifier_get_collect_stats (self));
+      break;
+
+    case PROP_SPARSE:
+      g_value_set_boolean (value, bayes_classifier_get_sparse (self));
+      break;
+
+    case PROP_STORAGE:
+      g_value_set_object (value, bayes_classifier_get_storage (self));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+bayes_classifier_set_property (GObject      *object,
+                               guint         prop_id,
+                               const GValue *value,
+                               GParamSpec   *pspec)
+{
+  BayesClassifier *self = BAYES_CLASSIFIER (object);
+
+  switch (prop_id)
+    {
+    case PROP_COLLECT_STATS:
+      bayes_classifier_set_collect_stats (self, g_value_get_boolean (value));
+      break;
+
+    case PROP_SPARSE:
+      bayes_classifier_set_sparse (self, g_value_get_boolean (value));
+      break;
+
+    case PROP_STORAGE:
+      bayes_classifier_set_storage (self, g_value_get_object (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+bayes_classifier_class_init (BayesClassifierClass *klass)
+{
+  GObjectClass *object_class;
+
+  object_class = G_OBJECT_CLASS (klass);
+  object_class->finalize = bayes_classifier_finalize;
+  object_class->get_property = bayes_classifier_get_property;
+  object_class->set_property = bayes_classifier_set_property;
+
+  /**
+   * BayesClassifier:collect-stats:
+   *
+   * The "collect-stats" property. When %TRUE, @classifier records
+   * counters and latency histograms for bayes_classifier_guess() and
+   * bayes_classifier_train(). See bayes_classifier_get_stats().
+   */
+  properties [PROP_COLLECT_STATS] =
+    g_param_spec_boolean ("collect-stats",
+                          "Collect Stats",
+                          "If runtime statistics should be collected.",
+                          FALSE,
+                          G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * BayesClassifier:sparse:
+   *
+   * The "sparse" property. When %TRUE, bayes_classifier_guess() uses
+   * bayes_storage_get_postings() to find the classifications that contain
+   * the tokens and computes a single shared guess for all others. The
+   * results are the same as without it.
+   */
+  properties [PROP_SPARSE] =
+    g_param_spec_boolean ("sparse",
+                          "Sparse",
+                          "If guesses should only visit classifications containing the tokens.",
+                          FALSE,
+                          G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY);
 
   /**
    * BayesClassifier:storage:
@@ -358,6 +1978,8 @@ bayes_classifier_class_init (BayesClassifierClass *klass)
 static void
 bayes_classifier_init (BayesClassifier *self)
 {
+  g_mutex_init (&self->storage_mutex);
+  g_mutex_init (&self->stats_mutex);
   bayes_classifier_set_tokenizer (self, NULL, NULL, NULL);
   bayes_classifier_set_combiner (self, NULL, NULL, NULL);
   bayes_classifier_set_storage (self, NULL);
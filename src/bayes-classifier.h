@@ -19,8 +19,9 @@
 #ifndef BAYES_CLASSIFIER_H
 #define BAYES_CLASSIFIER_H
 
-#include <glib-object.h>
+#include <gio/gio.h>
 
+#include "bayes-model.h"
 #include "bayes-storage.h"
 #include "bayes-tokenizer.h"
 
@@ -30,12 +31,191 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (BayesClassifier, bayes_classifier, BAYES, CLASSIFIER, GObject)
 
+#define BAYES_TYPE_GUESS_CONTEXT (bayes_guess_context_get_type())
+
+typedef struct _BayesGuessContext BayesGuessContext;
+
+/**
+ * BayesGuessResult:
+ * @class_id: The index of the classification in the array returned by
+ *   bayes_guess_context_get_names() for the context of the guess.
+ * @probability: The probability of the classification.
+ *
+ * A result of bayes_classifier_guess_with_context().
+ */
+typedef struct
+{
+  guint   class_id;
+  gdouble probability;
+} BayesGuessResult;
+
+GType              bayes_guess_context_get_type (void);
+
+/**
+ * bayes_guess_context_new:
+ *
+ * Creates the scratch space used by bayes_classifier_guess_with_context().
+ * A context may be used with any #BayesClassifier, but only by one thread
+ * at a time.
+ *
+ * Returns: (transfer full): A new #BayesGuessContext.
+ */
+BayesGuessContext *bayes_guess_context_new      (void);
+
+/**
+ * bayes_guess_context_free:
+ * @context: A #BayesGuessContext.
+ *
+ * Frees @context.
+ */
+void               bayes_guess_context_free     (BayesGuessContext *context);
+
+/**
+ * bayes_guess_context_get_names:
+ * @context: A #BayesGuessContext.
+ *
+ * Gets the classifications of the last guess made with @context, by
+ * class id. The ids of a guess depend on the storage of the classifier
+ * and on whether it is frozen, both of which may change between two
+ * guesses, so results are looked up here rather than in the storage.
+ *
+ * Returns: (array zero-terminated=1) (transfer none): The names, valid
+ *   until the next guess made with @context.
+ */
+const gchar * const *bayes_guess_context_get_names (BayesGuessContext *context);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (BayesGuessContext, bayes_guess_context_free)
+
+/**
+ * bayes_classifier_dup_model:
+ * @self: (in): A #BayesClassifier.
+ *
+ * Like bayes_classifier_get_model(), but safe to call from any thread
+ * while the model may be replaced on another one.
+ *
+ * Returns: (transfer full) (nullable): A #BayesModel, or %NULL if @self
+ *   is not frozen. Free with bayes_model_unref().
+ */
+BayesModel      *bayes_classifier_dup_model     (BayesClassifier *self);
+
+/**
+ * bayes_classifier_dup_storage:
+ * @self: (in): A #BayesClassifier.
+ *
+ * Like bayes_classifier_get_storage(), but safe to call from any thread
+ * while the storage may be replaced on another one.
+ *
+ * Returns: (transfer full) (nullable): A #BayesStorage.
+ */
+BayesStorage    *bayes_classifier_dup_storage   (BayesClassifier *self);
+
+/**
+ * bayes_classifier_freeze:
+ * @self: (in): A #BayesClassifier.
+ *
+ * Creates a #BayesModel with Laplace smoothing from the storage of @self,
+ * see bayes_model_new().
+ * Until bayes_classifier_thaw() is called, bayes_classifier_guess() scores
+ * documents with that model as a multinomial naive Bayes classifier
+ * instead of combining token probabilities.
+ *
+ * Training while frozen still updates the storage, but guesses only see
+ * the new data once @self is frozen again.
+ *
+ * The storage must support bayes_storage_foreach(). Otherwise a warning
+ * is logged and @self is left as it was.
+ */
+void             bayes_classifier_freeze        (BayesClassifier *self);
+
+/**
+ * bayes_classifier_freeze_full:
+ * @self: (in): A #BayesClassifier.
+ * @precision: How the weights of the model are stored.
+ *
+ * Like bayes_classifier_freeze(), but the model is quantized to
+ * @precision with bayes_model_quantize(). Models created when the file
+ * watched with bayes_classifier_watch_file() is reloaded keep the same
+ * precision.
+ */
+void             bayes_classifier_freeze_full   (BayesClassifier     *self,
+                                                 BayesModelPrecision  precision);
+
+/**
+ * bayes_classifier_get_collect_stats:
+ * @self: (in): A #BayesClassifier.
+ *
+ * Gets the #BayesClassifier:collect-stats property.
+ *
+ * Returns: %TRUE if runtime statistics are being collected.
+ */
+gboolean         bayes_classifier_get_collect_stats (BayesClassifier *self);
+
+/**
+ * bayes_classifier_get_model:
+ * @self: (in): A #BayesClassifier.
+ *
+ * Gets the model created by bayes_classifier_freeze().
+ *
+ * The model is replaced by bayes_classifier_freeze(),
+ * bayes_classifier_thaw(), bayes_classifier_set_storage() and the
+ * reloads of bayes_classifier_watch_file(), so only call this from the
+ * thread that does those. Use bayes_classifier_dup_model() from other
+ * threads.
+ *
+ * Returns: (transfer none) (nullable): A #BayesModel, or %NULL if @self
+ *   is not frozen.
+ */
+BayesModel      *bayes_classifier_get_model     (BayesClassifier *self);
+
+/**
+ * bayes_classifier_get_sparse:
+ * @self: (in): A #BayesClassifier.
+ *
+ * Gets the #BayesClassifier:sparse property.
+ *
+ * Returns: %TRUE if guesses only look at the classifications that
+ *   contain the tokens.
+ */
+gboolean         bayes_classifier_get_sparse    (BayesClassifier *self);
+
+/**
+ * bayes_classifier_get_stats:
+ * @self: (in): A #BayesClassifier.
+ *
+ * Retrieves the runtime statistics collected since
+ * #BayesClassifier:collect-stats was enabled or
+ * bayes_classifier_reset_stats() was last called.
+ *
+ * The result is a dictionary of type "a{sv}" with a "guess" and a "train"
+ * dictionary. Each contains the "calls" and "tokens" counters and a
+ * histogram for every phase. The phases of a guess are "tokenize",
+ * "lookup", "sort" and "combine", and those of training are "tokenize"
+ * and "store". "total" covers the whole call and "tokens-per-call" the
+ * number of tokens produced by the tokenizer. The guess dictionary also
+ * has "unknown-tokens" and "unknown-rate" for tokens not found in the
+ * storage.
+ *
+ * Each histogram is a dictionary with "count", "mean", "min", "p50", "p90",
+ * "p99", "p999" and "max". Latencies are in nanoseconds and percentiles are
+ * accurate to about 3%.
+ *
+ * Both dictionaries are empty if statistics are not being collected.
+ *
+ * Returns: (transfer full): A #GVariant.
+ */
+GVariant        *bayes_classifier_get_stats     (BayesClassifier *self);
+
 /**
  * bayes_classifier_get_storage:
  * @self: (in): A #BayesClassifier.
  *
  * Retrieves the #BayesStorage used for tokens by @classifier.
  *
+ * The storage is replaced by bayes_classifier_set_storage() and the
+ * reloads of bayes_classifier_watch_file(), so only call this from the
+ * thread that does those. Use bayes_classifier_dup_storage() from other
+ * threads.
+ *
  * Returns: (transfer none): A #BayesStorage.
  */
 BayesStorage    *bayes_classifier_get_storage   (BayesClassifier *self);
@@ -64,6 +244,33 @@ BayesStorage    *bayes_classifier_get_storage   (BayesClassifier *self);
 GList           *bayes_classifier_guess         (BayesClassifier *self,
                                                  const gchar     *text);
 
+/**
+ * bayes_classifier_guess_with_context:
+ * @self: (in): A #BayesClassifier.
+ * @context: A #BayesGuessContext.
+ * @text: (in): Text to tokenize and guess the classification.
+ * @results: (array length=n_results) (out caller-allocates): The results.
+ * @n_results: The number of elements of @results.
+ *
+ * Guesses the classification of @text like bayes_classifier_guess(), but
+ * writes the @n_results most likely classifications to @results, most
+ * likely first, instead of returning a list. Classifications that are
+ * equally likely are ordered by class id.
+ *
+ * All scratch space is kept in @context and reused by later calls. Once
+ * it has grown to fit the documents and classifications seen, a guess
+ * against a #BayesStorageMemory or a frozen classifier only allocates
+ * what the tokenizer returns.
+ *
+ * Returns: The number of results written to @results.
+ */
+guint            bayes_classifier_guess_with_context
+                                                (BayesClassifier   *self,
+                                                 BayesGuessContext *context,
+                                                 const gchar       *text,
+                                                 BayesGuessResult  *results,
+                                                 guint              n_results);
+
 /**
  * bayes_classifier_new:
  *
@@ -78,6 +285,35 @@ GList           *bayes_classifier_guess         (BayesClassifier *self,
  */
 BayesClassifier *bayes_classifier_new           (void);
 
+/**
+ * bayes_classifier_reset_stats:
+ * @self: (in): A #BayesClassifier.
+ *
+ * Clears the runtime statistics collected so far by @self.
+ */
+void             bayes_classifier_reset_stats   (BayesClassifier *self);
+
+/**
+ * bayes_classifier_set_collect_stats:
+ * @self: (in): A #BayesClassifier.
+ * @collect_stats: If statistics should be collected.
+ *
+ * Enables or disables the collection of runtime statistics by @self.
+ * Disabling collection drops the statistics collected so far.
+ */
+void             bayes_classifier_set_collect_stats (BayesClassifier *self,
+                                                     gboolean         collect_stats);
+
+/**
+ * bayes_classifier_set_sparse:
+ * @self: (in): A #BayesClassifier.
+ * @sparse: If guesses should use the postings of the tokens.
+ *
+ * Sets the #BayesClassifier:sparse property.
+ */
+void             bayes_classifier_set_sparse    (BayesClassifier *self,
+                                                 gboolean         sparse);
+
 /**
  * bayes_classifier_set_storage:
  * @self: (in): A #BayesClassifier.
@@ -85,6 +321,16 @@ BayesClassifier *bayes_classifier_new           (void);
  *
  * Sets the storage to use for tokens by the classifier.
  * If @storage is %NULL, then in memory storage will be used.
+ *
+ * If @self is frozen, the model is replaced with one created from
+ * @storage at the same precision, see bayes_classifier_freeze_full(),
+ * so that guesses never score against a model of another storage.
+ * Setting a %NULL storage, or one that does not support
+ * bayes_storage_foreach(), thaws @self.
+ *
+ * This may be called while other threads are guessing. Guesses that
+ * have already started finish with the previous storage, which is
+ * released once the last of them is done.
  */
 void             bayes_classifier_set_storage   (BayesClassifier *self,
                                                  BayesStorage    *storage);
@@ -105,6 +351,15 @@ void             bayes_classifier_set_tokenizer (BayesClassifier *self,
                                                  gpointer         user_data,
                                                  GDestroyNotify   notify);
 
+/**
+ * bayes_classifier_thaw:
+ * @self: (in): A #BayesClassifier.
+ *
+ * Drops the model created by bayes_classifier_freeze() so that guesses
+ * use the storage again.
+ */
+void             bayes_classifier_thaw          (BayesClassifier *self);
+
 /**
  * bayes_classifier_train:
  * @self: (in): A #BayesClassifier.
@@ -119,6 +374,30 @@ void             bayes_classifier_train         (BayesClassifier *self,
                                                  const gchar     *name,
                                                  const gchar     *text);
 
+/**
+ * bayes_classifier_watch_file:
+ * @self: (in): A #BayesClassifier.
+ * @file: (in) (nullable): A #GFile saved with
+ *   bayes_storage_memory_save_to_file(), or %NULL to stop watching.
+ * @error: (allow-none): Return location for an error, or %NULL.
+ *
+ * Watches @file and reloads the storage of @self whenever it has been
+ * rewritten, so that long running processes pick up retrained data
+ * without a restart. The file is not loaded right away.
+ *
+ * The file is loaded in a thread, and the new #BayesStorageMemory is
+ * swapped in as if by bayes_classifier_set_storage() from the
+ * thread-default main context of the caller. If @self is frozen at the
+ * time, the new storage is frozen too before it is swapped in. Files that
+ * fail to load are reported with g_warning() and the current storage is
+ * kept.
+ *
+ * Returns: %FALSE if @file could not be watched and @error is set.
+ */
+gboolean         bayes_classifier_watch_file    (BayesClassifier  *self,
+                                                 GFile            *file,
+                                                 GError          **error);
+
 G_END_DECLS
 
 #endif /* BAYES_CLASSIFIER_H */
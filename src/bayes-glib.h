@@ -22,8 +22,11 @@
 #define BAYES_GLIB_INSIDE 1
 #include "bayes-classifier.h"
 #include "bayes-guess.h"
+#include "bayes-model.h"
 #include "bayes-storage.h"
+#include "bayes-storage-mapped.h"
 #include "bayes-storage-memory.h"
+#include "bayes-storage-sketch.h"
 #include "bayes-tokenizer.h"
 #undef BAYES_GLIB_INSIDE
 
@@ -0,0 +1,77 @@
+/* bayes-hash-private.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BAYES_HASH_PRIVATE_H
+#define BAYES_HASH_PRIVATE_H
+
+#include <glib.h>
+#include <string.h>
+
+G_BEGIN_DECLS
+
+/*
+ * A 64-bit string hash used by the storage backends. The result does not
+ * depend on the host byte order so that it may be stored on disk.
+ */
+
+static inline guint64
+bayes_hash_mix (guint64 h)
+{
+  h ^= h >> 33;
+  h *= G_GUINT64_CONSTANT (0xff51afd7ed558ccd);
+  h ^= h >> 33;
+  h *= G_GUINT64_CONSTANT (0xc4ceb9fe1a85ec53);
+  h ^= h >> 33;
+
+  return h;
+}
+
+static inline guint64
+bayes_hash_bytes (const gchar *data,
+                  gsize        len)
+{
+  const guint64 m = G_GUINT64_CONSTANT (0x9e3779b97f4a7c15);
+  guint64 h = m ^ (len * G_GUINT64_CONSTANT (0xc6a4a7935bd1e995));
+  guint64 k;
+
+  for (; len >= 8; data += 8, len -= 8)
+    {
+      memcpy (&k, data, 8);
+      h = (h ^ bayes_hash_mix (GUINT64_FROM_LE (k))) * m;
+    }
+
+  if (len > 0)
+    {
+      k = 0;
+      while (len-- > 0)
+        k = (k << 8) | (guchar)data[len];
+      h = (h ^ bayes_hash_mix (k)) * m;
+    }
+
+  return bayes_hash_mix (h);
+}
+
+static inline guint64
+bayes_hash_str (const gchar *str)
+{
+  return bayes_hash_bytes (str, strlen (str));
+}
+
+G_END_DECLS
+
+#endif /* BAYES_HASH_PRIVATE_H */
@@ -0,0 +1,54 @@
+/* bayes-histogram-private.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BAYES_HISTOGRAM_PRIVATE_H
+#define BAYES_HISTOGRAM_PRIVATE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * A histogram with log-linear buckets in the style of HdrHistogram. Each
+ * power of two is split into 32 buckets, so recorded values are kept
+ * with a relative error of about 3%. Values up to 2^40 are tracked,
+ * larger ones are clamped.
+ */
+#define BAYES_HISTOGRAM_SUB_BITS  5
+#define BAYES_HISTOGRAM_MAX_BITS  40
+#define BAYES_HISTOGRAM_N_BUCKETS ((BAYES_HISTOGRAM_MAX_BITS - BAYES_HISTOGRAM_SUB_BITS + 1) << BAYES_HISTOGRAM_SUB_BITS)
+
+typedef struct
+{
+  guint64 count;
+  guint64 sum;
+  guint64 min;
+  guint64 max;
+  guint64 buckets [BAYES_HISTOGRAM_N_BUCKETS];
+} BayesHistogram;
+
+void      bayes_histogram_reset      (BayesHistogram       *histogram);
+void      bayes_histogram_record     (BayesHistogram       *histogram,
+                                      guint64               value);
+guint64   bayes_histogram_percentile (const BayesHistogram *histogram,
+                                      gdouble               percentile);
+GVariant *bayes_histogram_to_variant (const BayesHistogram *histogram);
+
+G_END_DECLS
+
+#endif /* BAYES_HISTOGRAM_PRIVATE_H */
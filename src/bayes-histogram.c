@@ -0,0 +1,127 @@
+/* bayes-histogram.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "bayes-histogram-private.h"
+
+#define SUB_COUNT (1 << BAYES_HISTOGRAM_SUB_BITS)
+#define MAX_VALUE ((G_GUINT64_CONSTANT (1) << BAYES_HISTOGRAM_MAX_BITS) - 1)
+
+/*
+ * Values below 2 * SUB_COUNT have a bucket each. Above, the bucket is
+ * given by the position of the highest bit and the SUB_BITS bits that
+ * follow it.
+ */
+static inline guint
+bayes_histogram_index (guint64 value)
+{
+  guint shift;
+
+  if (value < 2 * SUB_COUNT)
+    return value;
+
+  shift = g_bit_storage (value) - BAYES_HISTOGRAM_SUB_BITS - 1;
+
+  return (shift + 1) * SUB_COUNT + (guint)(value >> shift) - SUB_COUNT;
+}
+
+/*
+ * The largest value that falls into the bucket at @index.
+ */
+static inline guint64
+bayes_histogram_value (guint index)
+{
+  guint shift;
+
+  if (index < 2 * SUB_COUNT)
+    return index;
+
+  shift = index / SUB_COUNT - 1;
+
+  return ((guint64)(index % SUB_COUNT + SUB_COUNT + 1) << shift) - 1;
+}
+
+void
+bayes_histogram_reset (BayesHistogram *histogram)
+{
+  memset (histogram, 0, sizeof *histogram);
+}
+
+void
+bayes_histogram_record (BayesHistogram *histogram,
+                        guint64         value)
+{
+  value = MIN (value, MAX_VALUE);
+
+  if (histogram->count == 0 || value < histogram->min)
+    histogram->min = value;
+  if (value > histogram->max)
+    histogram->max = value;
+
+  histogram->count++;
+  histogram->sum += value;
+  histogram->buckets [bayes_histogram_index (value)]++;
+}
+
+/*
+ * Returns the value below which @percentile percent of the recorded
+ * values fall, rounded up to the bucket.
+ */
+guint64
+bayes_histogram_percentile (const BayesHistogram *histogram,
+                            gdouble               percentile)
+{
+  guint64 rank;
+  guint64 seen = 0;
+  guint i;
+
+  if (histogram->count == 0)
+    return 0;
+
+  rank = (guint64)(percentile / 100.0 * histogram->count + 0.5);
+  rank = CLAMP (rank, 1, histogram->count);
+
+  for (i = 0; i < BAYES_HISTOGRAM_N_BUCKETS; i++)
+    {
+      seen += histogram->buckets [i];
+      if (seen >= rank)
+        return MIN (bayes_histogram_value (i), histogram->max);
+    }
+
+  return histogram->max;
+}
+
+GVariant *
+bayes_histogram_to_variant (const BayesHistogram *histogram)
+{
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "count", g_variant_new_uint64 (histogram->count));
+  g_variant_builder_add (&builder, "{sv}", "mean",
+                         g_variant_new_double (histogram->count ? (gdouble)histogram->sum / histogram->count : 0.0));
+  g_variant_builder_add (&builder, "{sv}", "min", g_variant_new_uint64 (histogram->min));
+  g_variant_builder_add (&builder, "{sv}", "p50", g_variant_new_uint64 (bayes_histogram_percentile (histogram, 50.0)));
+  g_variant_builder_add (&builder, "{sv}", "p90", g_variant_new_uint64 (bayes_histogram_percentile (histogram, 90.0)));
+  g_variant_builder_add (&builder, "{sv}", "p99", g_variant_new_uint64 (bayes_histogram_percentile (histogram, 99.0)));
+  g_variant_builder_add (&builder, "{sv}", "p999", g_variant_new_uint64 (bayes_histogram_percentile (histogram, 99.9)));
+  g_variant_builder_add (&builder, "{sv}", "max", g_variant_new_uint64 (histogram->max));
+
+  return g_variant_builder_end (&builder);
+}
@@ -0,0 +1,76 @@
+/* bayes-model-private.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BAYES_MODEL_PRIVATE_H
+#define BAYES_MODEL_PRIVATE_H
+
+#include <glib.h>
+
+#include "bayes-model.h"
+#include "bayes-mphf-private.h"
+#include "bayes-storage-memory.h"
+
+G_BEGIN_DECLS
+
+/*
+ * The weights are stored by token, in compressed sparse rows: the
+ * postings of the token in row r are rows [r] to rows [r + 1] of
+ * class_ids and weights. The row of a token is its index in the minimal
+ * perfect hash index. The token strings are not kept, so unknown tokens
+ * are told apart by the fingerprints of the index only. If index could
+ * not be built, the vocabulary is kept instead and the row of a token is
+ * the value of its entry.
+ *
+ * The score of classification c is
+ *
+ *   prior [c] + n_known * unseen [c] + sum of weights [c] over the rows
+ *
+ * where n_known is the number of tokens found in the vocabulary. With
+ * additive smoothing, unseen [c] is the log-probability of a token that
+ * was never found in c and a weight is what finding it count times adds
+ * to that, log (1 + count / alpha).
+ *
+ * A quantized model has no class_ids and weights. Each posting is a code
+ * instead, the class id shifted left by the bits of the precision or'ed
+ * with the weight divided by scale, in codes16 if that fits 16 bits and
+ * in codes32 otherwise.
+ */
+struct _BayesModel
+{
+  /*< private >*/
+  volatile gint  ref_count;
+  gdouble        alpha;
+  guint          n_classes;
+  gchar        **names;
+  gdouble       *prior;
+  gdouble       *unseen;
+  BayesMphf     *index;
+  BayesTokens   *vocabulary;
+  guint          n_rows;
+  guint32       *rows;
+  guint32       *class_ids;
+  gdouble       *weights;
+  BayesModelPrecision precision;
+  gdouble        scale;
+  guint16       *codes16;
+  guint32       *codes32;
+};
+
+G_END_DECLS
+
+#endif /* BAYES_MODEL_PRIVATE_H */
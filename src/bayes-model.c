@@ -0,0 +1,672 @@
+/* bayes-model.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "bayes-guess.h"
+#include "bayes-guess-private.h"
+#include "bayes-model.h"
+#include "bayes-model-private.h"
+#include "bayes-storage-memory-private.h"
+
+/**
+ * SECTION:bayes-model
+ * @title: BayesModel
+ * @short_description: A frozen multinomial naive Bayes model.
+ *
+ * #BayesModel is a read-only snapshot of the training data in a
+ * #BayesStorage, scored as a multinomial naive Bayes classifier with
+ * additive smoothing. Everything that does not depend on the document is
+ * computed when the model is created, so scoring a document is a single
+ * pass that adds up the weights of its tokens for the classifications
+ * they were found in.
+ *
+ * See bayes_classifier_freeze() to have a #BayesClassifier guess with a
+ * #BayesModel.
+ *
+ * The vocabulary is indexed with a minimal perfect hash function and the
+ * tokens themselves are not kept. A token that was not trained on is
+ * mistaken for one that was with a probability of about 1 in 65536.
+ *
+ * For serving many models at once, bayes_model_quantize() stores the
+ * weights in 8 or 16 bits and bayes_model_calibrate() reports how much
+ * that changes the guesses.
+ *
+ * The #BayesModel structure is a reference counted #GBoxed type and may
+ * be used from multiple threads at once.
+ */
+
+G_DEFINE_BOXED_TYPE (BayesModel, bayes_model, bayes_model_ref, bayes_model_unref)
+
+typedef struct
+{
+  guint32 row;
+  guint32 class_id;
+  guint   count;
+} BayesModelPair;
+
+typedef struct
+{
+  BayesModel   *model;
+  BayesStorage *excluded;
+  GHashTable   *class_ids;
+  GArray       *pairs;
+  guint64      *pools;
+} BayesModelBuilder;
+
+static void
+bayes_model_add_pair (const gchar *name,
+                      const gchar *token,
+                      guint        count,
+                      gpointer     user_data)
+{
+  BayesModelBuilder *builder = user_data;
+  BayesModel *model = builder->model;
+  BayesModelPair pair;
+  gpointer value;
+  guint32 hash;
+  gsize len;
+
+  if (builder->excluded != NULL)
+    count -= MIN (count, bayes_storage_get_token_count (builder->excluded, name, token));
+
+  if (count == 0 ||
+      !g_hash_table_lookup_extended (builder->class_ids, name, NULL, &value))
+    return;
+
+  len = strlen (token);
+  hash = bayes_tokens_hash (token, len);
+
+  if (bayes_tokens_inc (model->vocabulary, token, len, hash, count, NULL))
+    *bayes_tokens_lookup_value (model->vocabulary, token, len, hash) = model->n_rows++;
+
+  pair.row = *bayes_tokens_lookup_value (model->vocabulary, token, len, hash);
+  pair.class_id = GPOINTER_TO_UINT (value);
+  pair.count = count;
+  g_array_append_val (builder->pairs, pair);
+
+  builder->pools [pair.class_id] += count;
+}
+
+/*
+ * Replaces the vocabulary with a minimal perfect hash index, renumbering
+ * the rows of @pairs to the indexes of their tokens.
+ */
+static void
+bayes_model_build_index (BayesModel *model,
+                         GArray     *pairs)
+{
+  BayesModelPair *pair;
+  const gchar *token;
+  guint64 *hashes;
+  guint32 *rows;
+  gsize len;
+  guint pos = 0;
+  guint i;
+
+  hashes = g_new (guint64, MAX (model->n_rows, 1));
+  while (bayes_tokens_iter_next (model->vocabulary, &pos, &token, NULL))
+    {
+      len = strlen (token);
+      hashes [*bayes_tokens_lookup_value (model->vocabulary, token, len,
+                                          bayes_tokens_hash (token, len))] =
+        bayes_hash_bytes (token, len);
+    }
+
+  if (!(model->index = bayes_mphf_new (hashes, model->n_rows)))
+    {
+      g_free (hashes);
+      return;
+    }
+
+  rows = g_new (guint32, MAX (model->n_rows, 1));
+  for (i = 0; i < model->n_rows; i++)
+    bayes_mphf_lookup (model->index, hashes [i], &rows [i]);
+
+  for (i = 0; i < pairs->len; i++)
+    {
+      pair = &g_array_index (pairs, BayesModelPair, i);
+      pair->row = rows [pair->row];
+    }
+
+  g_clear_pointer (&model->vocabulary, bayes_tokens_free);
+  g_free (rows);
+  g_free (hashes);
+}
+
+static BayesModel *
+bayes_model_build (BayesStorage *storage,
+                   BayesStorage *excluded,
+                   gdouble       alpha)
+{
+  BayesModelBuilder builder;
+  BayesModelPair *pair;
+  BayesModel *model;
+  guint32 *next;
+  guint64 corpus = 0;
+  guint i;
+
+  model = g_slice_new0 (BayesModel);
+  model->ref_count = 1;
+  model->alpha = alpha;
+  model->names = bayes_storage_get_names (storage);
+  model->n_classes = g_strv_length (model->names);
+  model->vocabulary = bayes_tokens_new ();
+  bayes_tokens_set_values (model->vocabulary, TRUE);
+
+  builder.model = model;
+  builder.excluded = excluded;
+  builder.class_ids = g_hash_table_new (g_str_hash, g_str_equal);
+  builder.pairs = g_array_new (FALSE, FALSE, sizeof (BayesModelPair));
+  builder.pools = g_new0 (guint64, model->n_classes);
+
+  for (i = 0; i < model->n_classes; i++)
+    g_hash_table_insert (builder.class_ids, model->names [i], GUINT_TO_POINTER (i));
+
+  bayes_storage_foreach (storage, bayes_model_add_pair, &builder);
+  bayes_model_build_index (model, builder.pairs);
+
+  /*
+   * Bucket the pairs by row.
+   */
+  model->rows = g_new0 (guint32, model->n_rows + 1);
+  model->class_ids = g_new (guint32, builder.pairs->len);
+  model->weights = g_new (gdouble, builder.pairs->len);
+
+  for (i = 0; i < builder.pairs->len; i++)
+    model->rows [g_array_index (builder.pairs, BayesModelPair, i).row + 1]++;
+  for (i = 0; i < model->n_rows; i++)
+    model->rows [i + 1] += model->rows [i];
+
+  next = g_memdup (model->rows, model->n_rows * sizeof (guint32));
+
+  for (i = 0; i < builder.pairs->len; i++)
+    {
+      pair = &g_array_index (builder.pairs, BayesModelPair, i);
+      model->class_ids [next [pair->row]] = pair->class_id;
+      model->weights [next [pair->row]] = log1p (pair->count / alpha);
+      next [pair->row]++;
+    }
+
+  model->prior = g_new (gdouble, model->n_classes);
+  model->unseen = g_new (gdouble, model->n_classes);
+
+  for (i = 0; i < model->n_classes; i++)
+    corpus += builder.pools [i];
+
+  for (i = 0; i < model->n_classes; i++)
+    {
+      model->prior [i] = log ((builder.pools [i] + alpha) /
+                              (corpus + alpha * model->n_classes));
+      model->unseen [i] = log (alpha / (builder.pools [i] + alpha * model->n_rows));
+    }
+
+  g_free (next);
+  g_free (builder.pools);
+  g_array_unref (builder.pairs);
+  g_hash_table_unref (builder.class_ids);
+
+  return model;
+}
+
+BayesModel *
+bayes_model_new (BayesStorage *storage,
+                 gdouble       alpha)
+{
+  g_return_val_if_fail (BAYES_IS_STORAGE (storage), NULL);
+  g_return_val_if_fail (alpha > 0.0, NULL);
+
+  return bayes_model_build (storage, NULL, alpha);
+}
+
+BayesModel *
+bayes_model_new_excluding (BayesStorage *storage,
+                           BayesStorage *excluded,
+                           gdouble       alpha)
+{
+  g_return_val_if_fail (BAYES_IS_STORAGE (storage), NULL);
+  g_return_val_if_fail (BAYES_IS_STORAGE (excluded), NULL);
+  g_return_val_if_fail (alpha > 0.0, NULL);
+
+  return bayes_model_build (storage, excluded, alpha);
+}
+
+BayesModel *
+bayes_model_quantize (BayesModel          *model,
+                      BayesModelPrecision  precision)
+{
+  BayesModel *ret;
+  gdouble max = 0.0;
+  guint32 n_postings;
+  guint32 code;
+  guint bits;
+  guint k;
+
+  g_return_val_if_fail (model != NULL, NULL);
+  g_return_val_if_fail (model->precision == BAYES_MODEL_PRECISION_EXACT, NULL);
+  g_return_val_if_fail (precision == BAYES_MODEL_PRECISION_EXACT ||
+                        precision == BAYES_MODEL_PRECISION_16_BIT ||
+                        precision == BAYES_MODEL_PRECISION_8_BIT, NULL);
+
+  bits = precision;
+  n_postings = model->rows [model->n_rows];
+
+  g_return_val_if_fail (bits == 0 || model->n_classes <= (1U << (32 - bits)), NULL);
+
+  ret = g_slice_new0 (BayesModel);
+  ret->ref_count = 1;
+  ret->alpha = model->alpha;
+  ret->n_classes = model->n_classes;
+  ret->names = g_strdupv (model->names);
+  ret->prior = g_memdup (model->prior, model->n_classes * sizeof (gdouble));
+  ret->unseen = g_memdup (model->unseen, model->n_classes * sizeof (gdouble));
+  ret->index = model->index ? bayes_mphf_copy (model->index) : NULL;
+  ret->vocabulary = bayes_tokens_copy (model->vocabulary);
+  ret->n_rows = model->n_rows;
+  ret->rows = g_memdup (model->rows, (model->n_rows + 1) * sizeof (guint32));
+  ret->precision = precision;
+
+  if (precision == BAYES_MODEL_PRECISION_EXACT)
+    {
+      ret->class_ids = g_memdup (model->class_ids, n_postings * sizeof (guint32));
+      ret->weights = g_memdup (model->weights, n_postings * sizeof (gdouble));
+      return ret;
+    }
+
+  /*
+   * Weights are never negative, so the codes span 0 to the largest
+   * weight.
+   */
+  for (k = 0; k < n_postings; k++)
+    max = MAX (max, model->weights [k]);
+
+  ret->scale = max > 0.0 ? max / ((1U << bits) - 1) : 1.0;
+
+  if (bits + g_bit_storage (MAX (model->n_classes, 1) - 1) <= 16)
+    ret->codes16 = g_new (guint16, n_postings);
+  else
+    ret->codes32 = g_new (guint32, n_postings);
+
+  for (k = 0; k < n_postings; k++)
+    {
+      code = model->class_ids [k] << bits |
+             (guint32)lround (model->weights [k] / ret->scale);
+
+      if (ret->codes16 != NULL)
+        ret->codes16 [k] = code;
+      else
+        ret->codes32 [k] = code;
+    }
+
+  return ret;
+}
+
+/**
+ * bayes_model_ref:
+ * @model: A #BayesModel.
+ *
+ * Increments the reference count of @model by one.
+ *
+ * Returns: (transfer full): @model.
+ */
+BayesModel *
+bayes_model_ref (BayesModel *model)
+{
+  g_return_val_if_fail (model != NULL, NULL);
+  g_return_val_if_fail (model->ref_count > 0, NULL);
+
+  g_atomic_int_inc (&model->ref_count);
+
+  return model;
+}
+
+/**
+ * bayes_model_unref:
+ * @model: A #BayesModel.
+ *
+ * Decrements the reference count of @model by one, freeing it once the
+ * count reaches zero.
+ */
+void
+bayes_model_unref (BayesModel *model)
+{
+  g_return_if_fail (model != NULL);
+  g_return_if_fail (model->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&model->ref_count))
+    {
+      g_strfreev (model->names);
+      g_free (model->prior);
+      g_free (model->unseen);
+      bayes_mphf_free (model->index);
+      bayes_tokens_free (model->vocabulary);
+      g_free (model->rows);
+      g_free (model->class_ids);
+      g_free (model->weights);
+      g_free (model->codes16);
+      g_free (model->codes32);
+      g_slice_free (BayesModel, model);
+    }
+}
+
+const gchar * const *
+bayes_model_get_names (BayesModel *model)
+{
+  g_return_val_if_fail (model != NULL, NULL);
+
+  return (const gchar * const *)model->names;
+}
+
+guint
+bayes_model_get_n_classes (BayesModel *model)
+{
+  g_return_val_if_fail (model != NULL, 0);
+
+  return model->n_classes;
+}
+
+guint
+bayes_model_get_n_tokens (BayesModel *model)
+{
+  g_return_val_if_fail (model != NULL, 0);
+
+  return model->n_rows;
+}
+
+BayesModelPrecision
+bayes_model_get_precision (BayesModel *model)
+{
+  g_return_val_if_fail (model != NULL, BAYES_MODEL_PRECISION_EXACT);
+
+  return model->precision;
+}
+
+gsize
+bayes_model_get_memory_size (BayesModel *model)
+{
+  gsize n_postings;
+  gsize size;
+  guint i;
+
+  g_return_val_if_fail (model != NULL, 0);
+
+  n_postings = model->rows [model->n_rows];
+
+  size = sizeof (BayesModel);
+  for (i = 0; i < model->n_classes; i++)
+    size += sizeof (gchar *) + strlen (model->names [i]) + 1 + 2 * sizeof (gdouble);
+
+  if (model->index != NULL)
+    size += bayes_mphf_get_memory_size (model->index);
+  else
+    size += (model->vocabulary->mask + 1) * (sizeof (BayesTokenEntry) + sizeof (guint32)) +
+            model->vocabulary->arena->used;
+  size += (model->n_rows + 1) * sizeof (guint32);
+
+  if (model->codes16 != NULL)
+    size += n_postings * sizeof (guint16);
+  else if (model->codes32 != NULL)
+    size += n_postings * sizeof (guint32);
+  else
+    size += n_postings * (sizeof (guint32) + sizeof (gdouble));
+
+  return size;
+}
+
+guint
+bayes_model_score (BayesModel          *model,
+                   const gchar * const *tokens,
+                   gdouble             *scores)
+{
+  const guint32 *value;
+  guint n_known = 0;
+  guint32 mask;
+  guint32 row;
+  guint32 end;
+  guint32 k;
+  guint bits;
+  gsize len;
+  guint i;
+
+  g_return_val_if_fail (model != NULL, 0);
+  g_return_val_if_fail (tokens != NULL, 0);
+  g_return_val_if_fail (scores != NULL || model->n_classes == 0, 0);
+
+  memcpy (scores, model->prior, model->n_classes * sizeof (gdouble));
+
+  for (i = 0; tokens [i]; i++)
+    {
+      len = strlen (tokens [i]);
+
+      if (model->index != NULL)
+        {
+          if (!bayes_mphf_lookup (model->index, bayes_hash_bytes (tokens [i], len), &row))
+            continue;
+        }
+      else
+        {
+          value = bayes_tokens_lookup_value (model->vocabulary, tokens [i], len,
+                                             bayes_tokens_hash (tokens [i], len));
+          if (value == NULL)
+            continue;
+          row = *value;
+        }
+
+      n_known++;
+
+      k = model->rows [row];
+      end = model->rows [row + 1];
+
+      if (model->weights != NULL)
+        {
+          for (; k < end; k++)
+            scores [model->class_ids [k]] += model->weights [k];
+          continue;
+        }
+
+      bits = model->precision;
+      mask = (1U << bits) - 1;
+
+      if (model->codes16 != NULL)
+        for (; k < end; k++)
+          scores [model->codes16 [k] >> bits] += (model->codes16 [k] & mask) * model->scale;
+      else
+        for (; k < end; k++)
+          scores [model->codes32 [k] >> bits] += (model->codes32 [k] & mask) * model->scale;
+    }
+
+  for (i = 0; i < model->n_classes; i++)
+    scores [i] += n_known * model->unseen [i];
+
+  return n_known;
+}
+
+static gint
+bayes_model_compare_guesses (gconstpointer a,
+                             gconstpointer b)
+{
+  const BayesGuess *ag = a;
+  const BayesGuess *bg = b;
+
+  return (bg->probability > ag->probability) - (bg->probability < ag->probability);
+}
+
+/*
+ * Turns the @n_classes scores in @probabilities into posterior
+ * probabilities and returns the index of the most likely one.
+ */
+static guint
+bayes_model_normalize (gdouble *probabilities,
+                       guint    n_classes)
+{
+  gdouble max = -INFINITY;
+  gdouble sum = 0.0;
+  guint best = 0;
+  guint i;
+
+  /*
+   * Normalize in the log domain, the likelihoods of long documents are
+   * far too small for a gdouble.
+   */
+  for (i = 0; i < n_classes; i++)
+    {
+      if (probabilities [i] > max)
+        {
+          max = probabilities [i];
+          best = i;
+        }
+    }
+
+  for (i = 0; i < n_classes; i++)
+    {
+      probabilities [i] = exp (probabilities [i] - max);
+      sum += probabilities [i];
+    }
+
+  for (i = 0; i < n_classes; i++)
+    probabilities [i] /= sum;
+
+  return best;
+}
+
+GList *
+bayes_model_guess (BayesModel          *model,
+                   const gchar * const *tokens)
+{
+  gdouble *scores;
+  GList *ret = NULL;
+  guint i;
+
+  g_return_val_if_fail (model != NULL, NULL);
+  g_return_val_if_fail (tokens != NULL, NULL);
+
+  if (model->n_classes == 0)
+    return NULL;
+
+  scores = g_new (gdouble, model->n_classes);
+  bayes_model_score (model, tokens, scores);
+  bayes_model_normalize (scores, model->n_classes);
+
+  for (i = model->n_classes; i > 0; i--)
+    ret = g_list_prepend (ret, bayes_guess_new (model->names [i - 1], scores [i - 1]));
+
+  g_free (scores);
+
+  return g_list_sort (ret, bayes_model_compare_guesses);
+}
+
+GVariant *
+bayes_model_calibrate (BayesModel          *model,
+                       BayesModel          *reference,
+                       GPtrArray           *documents,
+                       const gchar * const *labels)
+{
+  GVariantBuilder builder;
+  const gchar * const *tokens;
+  gdouble *scores;
+  gdouble *reference_scores;
+  gdouble max_score_error = 0.0;
+  gdouble max_error = 0.0;
+  gdouble sum_error = 0.0;
+  gdouble error;
+  guint n_agree = 0;
+  guint n_correct = 0;
+  guint n_reference_correct = 0;
+  guint best;
+  guint reference_best;
+  guint n;
+  guint i;
+  guint c;
+
+  g_return_val_if_fail (model != NULL, NULL);
+  g_return_val_if_fail (reference != NULL, NULL);
+  g_return_val_if_fail (model->n_classes == reference->n_classes, NULL);
+  g_return_val_if_fail (documents != NULL, NULL);
+  g_return_val_if_fail (labels == NULL || g_strv_length ((gchar **)labels) == documents->len, NULL);
+
+  n = documents->len;
+  scores = g_new (gdouble, model->n_classes);
+  reference_scores = g_new (gdouble, model->n_classes);
+
+  for (i = 0; i < n && model->n_classes > 0; i++)
+    {
+      tokens = g_ptr_array_index (documents, i);
+
+      bayes_model_score (model, tokens, scores);
+      bayes_model_score (reference, tokens, reference_scores);
+
+      for (c = 0; c < model->n_classes; c++)
+        max_score_error = MAX (max_score_error, fabs (scores [c] - reference_scores [c]));
+
+      best = bayes_model_normalize (scores, model->n_classes);
+      reference_best = bayes_model_normalize (reference_scores, model->n_classes);
+
+      error = 0.0;
+      for (c = 0; c < model->n_classes; c++)
+        error = MAX (error, fabs (scores [c] - reference_scores [c]));
+      sum_error += error;
+      max_error = MAX (max_error, error);
+
+      if (best == reference_best)
+        n_agree++;
+
+      if (labels != NULL)
+        {
+          if (g_strcmp0 (labels [i], model->names [best]) == 0)
+            n_correct++;
+          if (g_strcmp0 (labels [i], reference->names [reference_best]) == 0)
+            n_reference_correct++;
+        }
+    }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "documents", g_variant_new_uint32 (n));
+  g_variant_builder_add (&builder, "{sv}", "agreement",
+                         g_variant_new_double (n ? (gdouble)n_agree / n : 1.0));
+  g_variant_builder_add (&builder, "{sv}", "mean-probability-error",
+                         g_variant_new_double (n ? sum_error / n : 0.0));
+  g_variant_builder_add (&builder, "{sv}", "max-probability-error",
+                         g_variant_new_double (max_error));
+  g_variant_builder_add (&builder, "{sv}", "max-score-error",
+                         g_variant_new_double (max_score_error));
+  g_variant_builder_add (&builder, "{sv}", "memory-size",
+                         g_variant_new_uint64 (bayes_model_get_memory_size (model)));
+  g_variant_builder_add (&builder, "{sv}", "reference-memory-size",
+                         g_variant_new_uint64 (bayes_model_get_memory_size (reference)));
+
+  if (labels != NULL)
+    {
+      gdouble accuracy = n ? (gdouble)n_correct / n : 0.0;
+      gdouble reference_accuracy = n ? (gdouble)n_reference_correct / n : 0.0;
+
+      g_variant_builder_add (&builder, "{sv}", "accuracy",
+                             g_variant_new_double (accuracy));
+      g_variant_builder_add (&builder, "{sv}", "reference-accuracy",
+                             g_variant_new_double (reference_accuracy));
+      g_variant_builder_add (&builder, "{sv}", "accuracy-delta",
+                             g_variant_new_double (accuracy - reference_accuracy));
+    }
+
+  g_free (scores);
+  g_free (reference_scores);
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
@@ -0,0 +1,228 @@
+/* bayes-model.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BAYES_MODEL_H
+#define BAYES_MODEL_H
+
+#include <glib-object.h>
+
+#include "bayes-storage.h"
+
+G_BEGIN_DECLS
+
+#define BAYES_TYPE_MODEL (bayes_model_get_type())
+
+typedef struct _BayesModel BayesModel;
+
+/**
+ * BayesModelPrecision:
+ * @BAYES_MODEL_PRECISION_EXACT: Weights are stored as #gdouble.
+ * @BAYES_MODEL_PRECISION_16_BIT: Weights are quantized to 16 bits.
+ * @BAYES_MODEL_PRECISION_8_BIT: Weights are quantized to 8 bits.
+ *
+ * How the weights of a #BayesModel are stored, see bayes_model_quantize().
+ */
+typedef enum
+{
+  BAYES_MODEL_PRECISION_EXACT  = 0,
+  BAYES_MODEL_PRECISION_16_BIT = 16,
+  BAYES_MODEL_PRECISION_8_BIT  = 8,
+} BayesModelPrecision;
+
+GType               bayes_model_get_type        (void);
+
+/**
+ * bayes_model_new:
+ * @storage: A #BayesStorage.
+ * @alpha: The additive smoothing of the token counts, greater than 0.
+ *
+ * Creates a multinomial naive Bayes model from the training data in
+ * @storage. The log-probability of every token in every classification
+ * and the prior of every classification are computed once here, so that
+ * scoring a document only sums precomputed weights.
+ *
+ * The model is a snapshot, later changes to @storage do not affect it.
+ * @storage must support bayes_storage_foreach().
+ *
+ * Returns: (transfer full): A new #BayesModel.
+ */
+BayesModel         *bayes_model_new             (BayesStorage       *storage,
+                                                 gdouble             alpha);
+
+/**
+ * bayes_model_new_excluding:
+ * @storage: A #BayesStorage.
+ * @excluded: A #BayesStorage with part of the training data of @storage.
+ * @alpha: The additive smoothing of the token counts, greater than 0.
+ *
+ * Creates a model like bayes_model_new() from the token counts of
+ * @storage minus those of @excluded, as if the documents trained into
+ * @excluded had never been trained into @storage. The classifications
+ * are those of @storage, even if nothing is left of some of them.
+ *
+ * This is meant for cross-validation: train every document into
+ * @storage and into the storage of its fold once, and create the model
+ * of each fold with the storage of that fold as @excluded instead of
+ * training it again. Both storages are only read, so the models of
+ * several folds may be created from multiple threads at once.
+ *
+ * Returns: (transfer full): A new #BayesModel.
+ */
+BayesModel         *bayes_model_new_excluding   (BayesStorage       *storage,
+                                                 BayesStorage       *excluded,
+                                                 gdouble             alpha);
+
+/**
+ * bayes_model_quantize:
+ * @model: A #BayesModel with %BAYES_MODEL_PRECISION_EXACT.
+ * @precision: The precision of the new model.
+ *
+ * Creates a copy of @model that stores its weights with @precision. The
+ * weight of a token is the logarithm of its count, so quantizing it
+ * uniformly keeps the relative error of large counts small. Each weight
+ * is stored along with its classification in 2 bytes for
+ * %BAYES_MODEL_PRECISION_8_BIT with at most 256 classifications, and in
+ * 4 bytes otherwise, instead of 12 bytes.
+ *
+ * Use bayes_model_calibrate() to check the effect on the guesses.
+ *
+ * Returns: (transfer full): A new #BayesModel.
+ */
+BayesModel         *bayes_model_quantize        (BayesModel         *model,
+                                                 BayesModelPrecision precision);
+BayesModel         *bayes_model_ref             (BayesModel         *model);
+void                bayes_model_unref           (BayesModel         *model);
+
+/**
+ * bayes_model_get_names:
+ * @model: A #BayesModel.
+ *
+ * Gets the classifications of @model. The index of a classification in
+ * this array is the index of its score in bayes_model_score().
+ *
+ * Returns: (array zero-terminated=1) (transfer none): The names.
+ */
+const gchar * const *bayes_model_get_names      (BayesModel         *model);
+
+/**
+ * bayes_model_get_n_classes:
+ * @model: A #BayesModel.
+ *
+ * Returns: The number of classifications in @model.
+ */
+guint               bayes_model_get_n_classes   (BayesModel         *model);
+
+/**
+ * bayes_model_get_n_tokens:
+ * @model: A #BayesModel.
+ *
+ * Returns: The number of distinct tokens in @model.
+ */
+guint               bayes_model_get_n_tokens    (BayesModel         *model);
+
+/**
+ * bayes_model_get_precision:
+ * @model: A #BayesModel.
+ *
+ * Returns: How the weights of @model are stored.
+ */
+BayesModelPrecision bayes_model_get_precision   (BayesModel         *model);
+
+/**
+ * bayes_model_get_memory_size:
+ * @model: A #BayesModel.
+ *
+ * Gets the approximate number of bytes used by @model.
+ *
+ * Returns: The size of @model in bytes.
+ */
+gsize               bayes_model_get_memory_size (BayesModel         *model);
+
+/**
+ * bayes_model_calibrate:
+ * @model: A #BayesModel.
+ * @reference: The #BayesModel to compare with, usually the exact model
+ *   that @model was quantized from.
+ * @documents: (element-type GStrv): The tokens of the documents to guess.
+ * @labels: (array zero-terminated=1) (nullable): The classification of
+ *   each of @documents.
+ *
+ * Guesses @documents with both models and reports how far the guesses of
+ * @model are from those of @reference. Both models must have the same
+ * classifications.
+ *
+ * The report is a vardict with the following keys:
+ *
+ * - "documents" (u): the number of documents guessed.
+ * - "agreement" (d): the fraction of documents for which both models
+ *   guess the same classification first.
+ * - "mean-probability-error" (d): the largest difference of the
+ *   probability of a classification, averaged over the documents.
+ * - "max-probability-error" (d): the largest difference of the
+ *   probability of a classification over all documents.
+ * - "max-score-error" (d): the largest difference of a score, see
+ *   bayes_model_score().
+ * - "memory-size" (t) and "reference-memory-size" (t): see
+ *   bayes_model_get_memory_size().
+ *
+ * If @labels is given, the report also contains "accuracy" (d),
+ * "reference-accuracy" (d) and their difference "accuracy-delta" (d).
+ *
+ * Returns: (transfer full): A #GVariant of type a{sv}.
+ */
+GVariant           *bayes_model_calibrate       (BayesModel         *model,
+                                                 BayesModel         *reference,
+                                                 GPtrArray          *documents,
+                                                 const gchar * const *labels);
+
+/**
+ * bayes_model_score:
+ * @model: A #BayesModel.
+ * @tokens: (array zero-terminated=1): The tokens of a document.
+ * @scores: (array) (out caller-allocates): An array of
+ *   bayes_model_get_n_classes() scores.
+ *
+ * Computes the log-likelihood of the document made of @tokens for every
+ * classification, including its prior. Tokens that are not in @model are
+ * ignored.
+ *
+ * Returns: The number of tokens that were found in @model.
+ */
+guint               bayes_model_score           (BayesModel         *model,
+                                                 const gchar * const *tokens,
+                                                 gdouble            *scores);
+
+/**
+ * bayes_model_guess:
+ * @model: A #BayesModel.
+ * @tokens: (array zero-terminated=1): The tokens of a document.
+ *
+ * Computes the posterior probability of every classification for the
+ * document made of @tokens. The probabilities add up to 1.
+ *
+ * Returns: (element-type BayesGuess) (transfer full): The guesses, most
+ *   likely first.
+ */
+GList              *bayes_model_guess           (BayesModel         *model,
+                                                 const gchar * const *tokens);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (BayesModel, bayes_model_unref)
+
+G_END_DECLS
+
+#endif /* BAYES_MODEL_H */
@@ -0,0 +1,117 @@
+/* bayes-mphf-private.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BAYES_MPHF_PRIVATE_H
+#define BAYES_MPHF_PRIVATE_H
+
+#include <glib.h>
+
+#include "bayes-hash-private.h"
+
+G_BEGIN_DECLS
+
+/*
+ * A minimal perfect hash function over a fixed set of 64-bit key hashes,
+ * built with hash and displace in the style of CHD and PTHash. The keys
+ * are split into buckets of about BAYES_MPHF_BUCKET_SIZE keys, and each
+ * bucket has a 16-bit pilot chosen so that its keys land on free slots
+ * of a table slightly larger than the set. Slots past the number of keys
+ * are remapped to the free slots below it, so every key gets a distinct
+ * index in [0, n_keys).
+ *
+ * The keys themselves are not kept. A 16-bit fingerprint per index
+ * rejects all but about 1 in 65536 of the hashes that are not in the set.
+ */
+#define BAYES_MPHF_BUCKET_SIZE 5
+
+typedef struct
+{
+  guint64  seed;
+  guint32  n_keys;
+  guint32  n_slots;
+  guint32  n_buckets;
+  guint16 *pilots;
+  guint32 *remap;
+  guint16 *fingerprints;
+} BayesMphf;
+
+BayesMphf *bayes_mphf_new             (const guint64   *hashes,
+                                       guint32          n_keys);
+BayesMphf *bayes_mphf_copy            (const BayesMphf *mphf);
+void       bayes_mphf_free            (BayesMphf       *mphf);
+gsize      bayes_mphf_get_memory_size (const BayesMphf *mphf);
+
+static inline guint32
+bayes_mphf_position (const BayesMphf *mphf,
+                     guint64          hash,
+                     guint16          pilot)
+{
+  guint64 h = bayes_hash_mix (hash ^ (pilot * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15)));
+
+  return (guint32)(((h & G_MAXUINT32) * mphf->n_slots) >> 32);
+}
+
+/*
+ * As in PTHash, 60% of the keys go to the first 30% of the buckets. The
+ * dense buckets are placed first while the table is still mostly free,
+ * which leaves only small buckets for the crowded end.
+ */
+static inline guint32
+bayes_mphf_bucket (const BayesMphf *mphf,
+                   guint64          hash)
+{
+  guint64 dense = mphf->n_buckets * 3 / 10;
+  guint64 x = hash >> 32;
+  const guint64 split = G_GUINT64_CONSTANT (0x99999999);
+
+  if (x < split)
+    return (guint32)(x * dense / split);
+  else
+    return (guint32)(dense + (x - split) * (mphf->n_buckets - dense) / (G_GUINT64_CONSTANT (0x100000000) - split));
+}
+
+/*
+ * Looks up the index of the key with @hash, returning %FALSE if @hash is
+ * known not to be in the set.
+ */
+static inline gboolean
+bayes_mphf_lookup (const BayesMphf *mphf,
+                   guint64          hash,
+                   guint32         *index)
+{
+  guint32 pos;
+
+  if (mphf->n_keys == 0)
+    return FALSE;
+
+  hash = bayes_hash_mix (hash ^ mphf->seed);
+  pos = bayes_mphf_position (mphf, hash, mphf->pilots [bayes_mphf_bucket (mphf, hash)]);
+  if (pos >= mphf->n_keys)
+    pos = mphf->remap [pos - mphf->n_keys];
+
+  if (mphf->fingerprints [pos] != (guint16)hash)
+    return FALSE;
+
+  *index = pos;
+
+  return TRUE;
+}
+
+G_END_DECLS
+
+#endif /* BAYES_MPHF_PRIVATE_H */
@@ -0,0 +1,261 @@
+/* bayes-mphf.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bayes-mphf-private.h"
+
+/*
+ * Seeds tried before giving up. With a table 3% larger than the set, the
+ * last buckets still find a pilot within a few hundred tries, so a seed
+ * practically never fails.
+ */
+#define MAX_SEEDS 8
+#define N_PILOTS  (G_MAXUINT16 + 1)
+
+enum {
+  SLOT_FREE,
+  SLOT_TRYING,
+  SLOT_TAKEN,
+};
+
+static gint
+compare_guint64 (gconstpointer a,
+                 gconstpointer b)
+{
+  guint64 ai = *(const guint64 *)a;
+  guint64 bi = *(const guint64 *)b;
+
+  return (ai > bi) - (ai < bi);
+}
+
+/*
+ * Finds a pilot for every bucket, largest buckets first while the table
+ * is still mostly free. @hashes are the seeded hashes of the keys.
+ */
+static gboolean
+bayes_mphf_place (BayesMphf     *mphf,
+                  const guint64 *hashes,
+                  guint8        *slots)
+{
+  guint32 *starts;
+  guint32 *keys;
+  guint32 *order;
+  guint32 *next;
+  guint32 *by_size;
+  guint32 max_size = 0;
+  guint32 pilot;
+  guint32 size;
+  guint32 b;
+  guint32 i;
+  guint32 j;
+  guint32 pos;
+  gboolean ret = TRUE;
+
+  /* Sort the keys by bucket. */
+  starts = g_new0 (guint32, mphf->n_buckets + 1);
+  for (i = 0; i < mphf->n_keys; i++)
+    starts [bayes_mphf_bucket (mphf, hashes [i]) + 1]++;
+  for (b = 0; b < mphf->n_buckets; b++)
+    {
+      max_size = MAX (max_size, starts [b + 1]);
+      starts [b + 1] += starts [b];
+    }
+
+  keys = g_new (guint32, mphf->n_keys);
+  next = g_memdup (starts, mphf->n_buckets * sizeof (guint32));
+  for (i = 0; i < mphf->n_keys; i++)
+    keys [next [bayes_mphf_bucket (mphf, hashes [i])]++] = i;
+
+  /* Sort the buckets by decreasing size. */
+  by_size = g_new0 (guint32, max_size + 2);
+  for (b = 0; b < mphf->n_buckets; b++)
+    by_size [max_size - (starts [b + 1] - starts [b]) + 1]++;
+  for (size = 0; size <= max_size; size++)
+    by_size [size + 1] += by_size [size];
+
+  order = g_new (guint32, mphf->n_buckets);
+  for (b = 0; b < mphf->n_buckets; b++)
+    order [by_size [max_size - (starts [b + 1] - starts [b])]++] = b;
+
+  for (i = 0; ret && i < mphf->n_buckets; i++)
+    {
+      b = order [i];
+
+      if (starts [b] == starts [b + 1])
+        break;
+
+      for (pilot = 0; pilot < N_PILOTS; pilot++)
+        {
+          for (j = starts [b]; j < starts [b + 1]; j++)
+            {
+              pos = bayes_mphf_position (mphf, hashes [keys [j]], pilot);
+              if (slots [pos] != SLOT_FREE)
+                break;
+              slots [pos] = SLOT_TRYING;
+            }
+
+          size = j - starts [b];
+          for (j = starts [b]; j < starts [b] + size; j++)
+            slots [bayes_mphf_position (mphf, hashes [keys [j]], pilot)] =
+              size == starts [b + 1] - starts [b] ? SLOT_TAKEN : SLOT_FREE;
+
+          if (size == starts [b + 1] - starts [b])
+            break;
+        }
+
+      if (pilot == N_PILOTS)
+        ret = FALSE;
+      else
+        mphf->pilots [b] = pilot;
+    }
+
+  g_free (order);
+  g_free (by_size);
+  g_free (next);
+  g_free (keys);
+  g_free (starts);
+
+  return ret;
+}
+
+/*
+ * Creates a minimal perfect hash function over @hashes. Returns %NULL if
+ * @hashes are not distinct.
+ */
+BayesMphf *
+bayes_mphf_new (const guint64 *hashes,
+                guint32        n_keys)
+{
+  BayesMphf *mphf;
+  guint64 *seeded;
+  guint8 *slots;
+  guint32 free_pos;
+  guint32 pos;
+  guint32 i;
+  guint seed;
+
+  g_return_val_if_fail (hashes != NULL || n_keys == 0, NULL);
+  g_return_val_if_fail (n_keys < G_MAXUINT32 - G_MAXUINT32 / 32, NULL);
+
+  seeded = g_new (guint64, MAX (n_keys, 1));
+
+  /* Keys with the same hash could never be told apart. */
+  memcpy (seeded, hashes, n_keys * sizeof (guint64));
+  qsort (seeded, n_keys, sizeof (guint64), compare_guint64);
+  for (i = 1; i < n_keys; i++)
+    {
+      if (seeded [i] == seeded [i - 1])
+        {
+          g_free (seeded);
+          return NULL;
+        }
+    }
+
+  mphf = g_new0 (BayesMphf, 1);
+  mphf->n_keys = n_keys;
+  mphf->n_slots = n_keys + n_keys / 32 + 1;
+  mphf->n_buckets = (n_keys + BAYES_MPHF_BUCKET_SIZE - 1) / BAYES_MPHF_BUCKET_SIZE;
+  mphf->pilots = g_new0 (guint16, MAX (mphf->n_buckets, 1));
+  mphf->remap = g_new0 (guint32, mphf->n_slots - n_keys);
+  mphf->fingerprints = g_new0 (guint16, MAX (n_keys, 1));
+  slots = g_new (guint8, mphf->n_slots);
+
+  for (seed = 0; seed < MAX_SEEDS; seed++)
+    {
+      mphf->seed = bayes_hash_mix (seed + 1);
+      for (i = 0; i < n_keys; i++)
+        seeded [i] = bayes_hash_mix (hashes [i] ^ mphf->seed);
+
+      memset (slots, SLOT_FREE, mphf->n_slots);
+      memset (mphf->pilots, 0, MAX (mphf->n_buckets, 1) * sizeof (guint16));
+
+      if (bayes_mphf_place (mphf, seeded, slots))
+        break;
+    }
+
+  if (seed == MAX_SEEDS)
+    {
+      g_free (slots);
+      g_free (seeded);
+      bayes_mphf_free (mphf);
+      return NULL;
+    }
+
+  /* Move the keys placed past the end to the holes below it. */
+  free_pos = 0;
+  for (pos = n_keys; pos < mphf->n_slots; pos++)
+    {
+      if (slots [pos] != SLOT_TAKEN)
+        continue;
+      while (slots [free_pos] == SLOT_TAKEN)
+        free_pos++;
+      mphf->remap [pos - n_keys] = free_pos++;
+    }
+
+  for (i = 0; i < n_keys; i++)
+    {
+      pos = bayes_mphf_position (mphf, seeded [i],
+                                 mphf->pilots [bayes_mphf_bucket (mphf, seeded [i])]);
+      if (pos >= n_keys)
+        pos = mphf->remap [pos - n_keys];
+      mphf->fingerprints [pos] = (guint16)seeded [i];
+    }
+
+  g_free (slots);
+  g_free (seeded);
+
+  return mphf;
+}
+
+BayesMphf *
+bayes_mphf_copy (const BayesMphf *mphf)
+{
+  BayesMphf *copy;
+
+  copy = g_memdup (mphf, sizeof (BayesMphf));
+  copy->pilots = g_memdup (mphf->pilots, MAX (mphf->n_buckets, 1) * sizeof (guint16));
+  copy->remap = g_memdup (mphf->remap, (mphf->n_slots - mphf->n_keys) * sizeof (guint32));
+  copy->fingerprints = g_memdup (mphf->fingerprints, MAX (mphf->n_keys, 1) * sizeof (guint16));
+
+  return copy;
+}
+
+void
+bayes_mphf_free (BayesMphf *mphf)
+{
+  if (mphf != NULL)
+    {
+      g_free (mphf->pilots);
+      g_free (mphf->remap);
+      g_free (mphf->fingerprints);
+      g_free (mphf);
+    }
+}
+
+gsize
+bayes_mphf_get_memory_size (const BayesMphf *mphf)
+{
+  return sizeof (BayesMphf) +
+         mphf->n_buckets * sizeof (guint16) +
+         (mphf->n_slots - mphf->n_keys) * sizeof (guint32) +
+         mphf->n_keys * sizeof (guint16);
+}
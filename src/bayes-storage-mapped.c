@@ -0,0 +1,1389 @@
+/* bayes-storage-mapped.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#include "bayes-hash-private.h"
+#include "bayes-storage-mapped.h"
+#include "bayes-storage-memory-private.h"
+#include "bayes-storage-private.h"
+
+/**
+ * SECTION:bayes-storage-mapped
+ * @title: BayesStorageMapped
+ * @short_description: Storage of training data in a memory-mapped file.
+ *
+ * #BayesStorageMapped is an implementation of #BayesStorage for models
+ * that do not fit in memory. The tokens and their counts live in an
+ * index file that is mapped into memory, so only the pages touched by
+ * lookups are loaded and the kernel may evict them again under memory
+ * pressure.
+ *
+ * Tokens that are added are kept in a small in-memory overlay on top of
+ * the index. bayes_storage_mapped_flush() merges the overlay into a new
+ * index file, which also happens automatically once the overlay exceeds
+ * #BayesStorageMapped:overlay-limit.
+ *
+ * Index files use the byte order of the host that wrote them.
+ */
+
+/*
+ * The index file starts with a header, followed by the table of
+ * classifications and their names, a hash table of buckets and finally
+ * the records of the tokens. The hash table uses linear probing and is
+ * at most half full. Each record holds the count of the token in the
+ * corpus and its postings, the classifications it was seen in along
+ * with the count in each.
+ */
+#define INDEX_MAGIC      "BAYESIDX"
+#define INDEX_BYTE_ORDER 0x01020304
+#define INDEX_VERSION    1
+
+#define ALIGN(n,a) (((n) + (a) - 1) & ~(guint64)((a) - 1))
+
+typedef struct
+{
+  gchar   magic [8];
+  guint32 byte_order;
+  guint32 version;
+  guint32 n_classes;
+  guint32 reserved;
+  guint64 n_tokens;
+  guint64 n_buckets;
+  guint64 corpus_count;
+  guint64 classes_offset;
+  guint64 buckets_offset;
+  guint64 records_offset;
+  guint64 records_end;
+} BayesIndexHeader;
+
+typedef struct
+{
+  guint64 count;
+  guint64 name_offset;
+} BayesIndexClass;
+
+typedef struct
+{
+  guint64 hash;
+  guint64 offset;
+} BayesIndexBucket;
+
+typedef struct
+{
+  guint32 class_id;
+  guint32 count;
+} BayesIndexPosting;
+
+typedef struct
+{
+  guint32 corpus_count;
+  guint32 n_postings;
+  guint32 len;
+  /*
+   * Followed by n_postings postings and the token with its trailing
+   * nul byte, padded to 4 bytes.
+   */
+} BayesIndexRecord;
+
+struct _BayesStorageMapped
+{
+  GObject                 parent_instance;
+
+  gchar                  *filename;
+  guint64                 overlay_limit;
+
+  /*
+   * The mapped index, data is %NULL until an index has been written.
+   */
+  gchar                  *data;
+  gsize                   size;
+  const BayesIndexHeader *header;
+  const BayesIndexClass  *classes;
+  const BayesIndexBucket *buckets;
+  GHashTable             *class_ids;
+
+  /*
+   * Tokens added since the index was written.
+   */
+  GHashTable             *overlay;
+  BayesTokens            *overlay_corpus;
+  guint64                 overlay_size;
+};
+
+typedef struct
+{
+  guint32      class_id;
+  BayesTokens *tokens;
+} BayesOverlayClass;
+
+static void bayes_storage_init (BayesStorageInterface *iface);
+
+G_DEFINE_TYPE_EXTENDED (BayesStorageMapped,
+                        bayes_storage_mapped,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (BAYES_TYPE_STORAGE, bayes_storage_init))
+
+enum {
+  PROP_0,
+  PROP_FILENAME,
+  PROP_OVERLAY_LIMIT,
+  LAST_PROP
+};
+
+static GParamSpec *properties [LAST_PROP];
+
+static inline gsize
+bayes_index_record_size (guint32 n_postings,
+                         guint32 len)
+{
+  return ALIGN (sizeof (BayesIndexRecord) +
+                (gsize)n_postings * sizeof (BayesIndexPosting) +
+                len + 1, 4);
+}
+
+/*
+ * Counts saturate rather than wrap around, as in BayesTokens.
+ */
+static inline guint32
+bayes_index_count_add (guint64 a,
+                       guint64 b)
+{
+  return MIN (a + b, G_MAXUINT32);
+}
+
+static inline BayesIndexPosting *
+bayes_index_record_postings (const BayesIndexRecord *record)
+{
+  return (BayesIndexPosting *)(record + 1);
+}
+
+static inline const gchar *
+bayes_index_record_token (const BayesIndexRecord *record)
+{
+  return (const gchar *)(bayes_index_record_postings (record) + record->n_postings);
+}
+
+static const BayesIndexRecord *
+bayes_storage_mapped_get_record (BayesStorageMapped *self,
+                                 guint64             offset)
+{
+  const BayesIndexRecord *record;
+
+  if (offset < self->header->records_offset ||
+      offset > self->header->records_end ||
+      offset % 4 != 0 ||
+      self->header->records_end - offset < sizeof (BayesIndexRecord))
+    return NULL;
+
+  record = (const BayesIndexRecord *)(self->data + offset);
+
+  if (self->header->records_end - offset < bayes_index_record_size (record->n_postings, record->len))
+    return NULL;
+
+  /* Tokens are handed out as C strings. */
+  if (bayes_index_record_token (record) [record->len] != '\0')
+    return NULL;
+
+  return record;
+}
+
+static const BayesIndexRecord *
+bayes_storage_mapped_lookup (BayesStorageMapped *self,
+                             const gchar        *token,
+                             gsize               len,
+                             guint64             hash)
+{
+  const BayesIndexBucket *bucket;
+  const BayesIndexRecord *record;
+  guint64 mask;
+  guint64 pos;
+  guint64 i;
+
+  if (self->data == NULL)
+    return NULL;
+
+  mask = self->header->n_buckets - 1;
+
+  for (i = 0, pos = hash & mask; i <= mask; i++, pos = (pos + 1) & mask)
+    {
+      bucket = &self->buckets [pos];
+
+      if (bucket->offset == 0)
+        break;
+
+      if (bucket->hash == hash &&
+          (record = bayes_storage_mapped_get_record (self, bucket->offset)) &&
+          record->len == len &&
+          memcmp (bayes_index_record_token (record), token, len) == 0)
+        return record;
+    }
+
+  return NULL;
+}
+
+static guint
+bayes_index_record_get_count (const BayesIndexRecord *record,
+                              guint32                 class_id)
+{
+  const BayesIndexPosting *postings = bayes_index_record_postings (record);
+  guint i;
+
+  for (i = 0; i < record->n_postings; i++)
+    if (postings [i].class_id == class_id)
+      return postings [i].count;
+
+  return 0;
+}
+
+static gboolean
+bayes_storage_mapped_get_class_id (BayesStorageMapped *self,
+                                   const gchar        *name,
+                                   guint32            *class_id)
+{
+  gpointer value;
+
+  if (!g_hash_table_lookup_extended (self->class_ids, name, NULL, &value))
+    return FALSE;
+
+  *class_id = GPOINTER_TO_UINT (value);
+
+  return TRUE;
+}
+
+static void
+bayes_storage_mapped_unmap (BayesStorageMapped *self)
+{
+  g_hash_table_remove_all (self->class_ids);
+
+#ifdef HAVE_SYS_MMAN_H
+  if (self->data != NULL)
+    munmap (self->data, self->size);
+#endif
+
+  self->data = NULL;
+  self->size = 0;
+  self->header = NULL;
+  self->classes = NULL;
+  self->buckets = NULL;
+}
+
+static gboolean
+bayes_storage_mapped_invalid (const gchar  *filename,
+                              GError      **error)
+{
+  g_set_error (error,
+               G_IO_ERROR,
+               G_IO_ERROR_INVALID_DATA,
+               "\"%s\" is not a valid token index",
+               filename);
+
+  return FALSE;
+}
+
+static gboolean
+bayes_storage_mapped_validate (BayesStorageMapped  *self,
+                               GError             **error)
+{
+  const BayesIndexHeader *header = (const BayesIndexHeader *)self->data;
+  const gchar *name;
+  guint32 i;
+
+  if (self->size < sizeof *header || memcmp (header->magic, INDEX_MAGIC, 8) != 0)
+    return bayes_storage_mapped_invalid (self->filename, error);
+
+  if (header->byte_order != INDEX_BYTE_ORDER)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_SUPPORTED,
+                   "\"%s\" was written on a host of a different byte order",
+                   self->filename);
+      return FALSE;
+    }
+
+  if (header->version != INDEX_VERSION)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_SUPPORTED,
+                   "\"%s\" has unsupported version %u",
+                   self->filename, header->version);
+      return FALSE;
+    }
+
+  if (header->n_buckets == 0 ||
+      (header->n_buckets & (header->n_buckets - 1)) != 0 ||
+      header->n_tokens > header->n_buckets / 2 ||
+      header->classes_offset % 8 != 0 ||
+      header->classes_offset > self->size ||
+      header->n_classes > (self->size - header->classes_offset) / sizeof (BayesIndexClass) ||
+      header->buckets_offset % 8 != 0 ||
+      header->buckets_offset > self->size ||
+      header->n_buckets > (self->size - header->buckets_offset) / sizeof (BayesIndexBucket) ||
+      header->records_offset > header->records_end ||
+      header->records_end > self->size)
+    return bayes_storage_mapped_invalid (self->filename, error);
+
+  self->header = header;
+  self->classes = (const BayesIndexClass *)(self->data + header->classes_offset);
+  self->buckets = (const BayesIndexBucket *)(self->data + header->buckets_offset);
+
+  for (i = 0; i < header->n_classes; i++)
+    {
+      if (self->classes [i].name_offset >= self->size)
+        return bayes_storage_mapped_invalid (self->filename, error);
+
+      name = self->data + self->classes [i].name_offset;
+
+      if (memchr (name, '\0', self->size - self->classes [i].name_offset) == NULL)
+        return bayes_storage_mapped_invalid (self->filename, error);
+
+      g_hash_table_insert (self->class_ids, (gchar *)name, GUINT_TO_POINTER (i));
+    }
+
+  return TRUE;
+}
+
+static gboolean
+bayes_storage_mapped_load (BayesStorageMapped  *self,
+                           GError             **error)
+{
+#ifdef HAVE_SYS_MMAN_H
+  struct stat st;
+  gpointer data;
+  int errsv;
+  int fd;
+
+  bayes_storage_mapped_unmap (self);
+
+  if (-1 == (fd = g_open (self->filename, O_RDONLY, 0)))
+    {
+      errsv = errno;
+
+      if (errsv == ENOENT)
+        return TRUE;
+
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errsv),
+                   "Failed to open \"%s\": %s",
+                   self->filename, g_strerror (errsv));
+      return FALSE;
+    }
+
+  if (fstat (fd, &st) == 0 && st.st_size == 0)
+    {
+      close (fd);
+      return bayes_storage_mapped_invalid (self->filename, error);
+    }
+
+  if (fstat (fd, &st) == -1 ||
+      MAP_FAILED == (data = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)))
+    {
+      errsv = errno;
+      close (fd);
+
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errsv),
+                   "Failed to map \"%s\": %s",
+                   self->filename, g_strerror (errsv));
+      return FALSE;
+    }
+
+  close (fd);
+
+  self->data = data;
+  self->size = st.st_size;
+
+#ifdef HAVE_MADVISE
+  /*
+   * Lookups hit random pages, reading ahead would only push other pages
+   * of the index out of the page cache.
+   */
+  madvise (self->data, self->size, MADV_RANDOM);
+#endif
+
+  if (!bayes_storage_mapped_validate (self, error))
+    {
+      bayes_storage_mapped_unmap (self);
+      return FALSE;
+    }
+
+  return TRUE;
+#else
+  g_set_error (error,
+               G_IO_ERROR,
+               G_IO_ERROR_NOT_SUPPORTED,
+               "Memory-mapped storage is not supported on this platform");
+
+  return FALSE;
+#endif
+}
+
+BayesStorageMapped *
+bayes_storage_mapped_new (const gchar  *filename,
+                          GError      **error)
+{
+  BayesStorageMapped *self;
+
+  g_return_val_if_fail (filename != NULL, NULL);
+
+  self = g_object_new (BAYES_TYPE_STORAGE_MAPPED,
+                       "filename", filename,
+                       NULL);
+
+  if (!bayes_storage_mapped_load (self, error))
+    g_clear_object (&self);
+
+  return self;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+/*
+ * Writes the record of @token, merging the postings of @old_record if any
+ * with the counts of the classifications in the overlay.
+ */
+static gsize
+bayes_index_write_record (gchar                  *dst,
+                          const BayesIndexRecord *old_record,
+                          const gchar            *token,
+                          gsize                   len,
+                          guint32                 hash,
+                          guint                   corpus_count,
+                          const GArray           *overlay_classes)
+{
+  BayesIndexRecord *record = (BayesIndexRecord *)dst;
+  BayesIndexPosting *postings = bayes_index_record_postings (record);
+  const BayesOverlayClass *overlay_class;
+  BayesTokenEntry *entry;
+  guint n_postings = 0;
+  guint i;
+  guint j;
+
+  if (old_record != NULL)
+    {
+      n_postings = old_record->n_postings;
+      memcpy (postings,
+              bayes_index_record_postings (old_record),
+              n_postings * sizeof (BayesIndexPosting));
+      corpus_count = bayes_index_count_add (corpus_count, old_record->corpus_count);
+    }
+
+  for (i = 0; i < overlay_classes->len; i++)
+    {
+      overlay_class = &g_array_index (overlay_classes, BayesOverlayClass, i);
+      entry = bayes_tokens_lookup_entry (overlay_class->tokens, token, len, hash);
+
+      if (entry == NULL)
+        continue;
+
+      for (j = 0; j < n_postings; j++)
+        if (postings [j].class_id == overlay_class->class_id)
+          break;
+
+      if (j == n_postings)
+        {
+          postings [j].class_id = overlay_class->class_id;
+          postings [j].count = 0;
+          n_postings++;
+        }
+
+      postings [j].count = bayes_index_count_add (postings [j].count, entry->count);
+    }
+
+  record->corpus_count = corpus_count;
+  record->n_postings = n_postings;
+  record->len = len;
+
+  /*
+   * The padding was zeroed when the file was extended.
+   */
+  memcpy ((gchar *)bayes_index_record_token (record), token, len);
+
+  return bayes_index_record_size (n_postings, len);
+}
+
+static void
+bayes_index_insert_bucket (BayesIndexBucket *buckets,
+                           guint64           n_buckets,
+                           guint64           hash,
+                           guint64           offset)
+{
+  guint64 pos;
+
+  for (pos = hash & (n_buckets - 1);
+       buckets [pos].offset != 0;
+       pos = (pos + 1) & (n_buckets - 1))
+    ;
+
+  buckets [pos].hash = hash;
+  buckets [pos].offset = offset;
+}
+
+/*
+ * Writes the merge of the mapped index and the overlay to @fd. The
+ * records of the current index are streamed through in file order, so
+ * the index never needs to fit in memory.
+ */
+static gboolean
+bayes_storage_mapped_write (BayesStorageMapped  *self,
+                            int                  fd,
+                            GError             **error)
+{
+  g_autoptr(GPtrArray) names = NULL;
+  g_autoptr(GArray) overlay_classes = NULL;
+  const BayesIndexRecord *old_record;
+  BayesOverlayClass overlay_class;
+  BayesIndexHeader header = { { 0 } };
+  BayesIndexBucket *buckets;
+  BayesIndexClass *classes;
+  GHashTableIter iter;
+  BayesTokens *tokens;
+  const gchar *token;
+  const gchar *name;
+  guint64 names_offset;
+  guint64 n_tokens;
+  guint64 offset;
+  guint64 hash;
+  guint32 class_id;
+  gchar *data;
+  gsize size;
+  gsize len;
+  guint count;
+  guint pos;
+  guint i;
+  int errsv;
+
+  names = g_ptr_array_new ();
+  overlay_classes = g_array_new (FALSE, FALSE, sizeof (BayesOverlayClass));
+
+  /*
+   * Classifications keep their id, new ones are appended.
+   */
+  if (self->data != NULL)
+    for (i = 0; i < self->header->n_classes; i++)
+      g_ptr_array_add (names, self->data + self->classes [i].name_offset);
+
+  g_hash_table_iter_init (&iter, self->overlay);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&name, (gpointer *)&tokens))
+    {
+      if (!bayes_storage_mapped_get_class_id (self, name, &class_id))
+        {
+          class_id = names->len;
+          g_ptr_array_add (names, (gchar *)name);
+        }
+
+      overlay_class.class_id = class_id;
+      overlay_class.tokens = tokens;
+      g_array_append_val (overlay_classes, overlay_class);
+    }
+
+  /*
+   * Compute the layout for the worst case of every token in the overlay
+   * being new. The file is truncated to the real size once written.
+   */
+  n_tokens = self->overlay_corpus->n_entries;
+  size = 0;
+
+  if (self->data != NULL)
+    {
+      n_tokens += self->header->n_tokens;
+      size += self->header->records_end - self->header->records_offset;
+    }
+
+  for (i = 0; i < overlay_classes->len; i++)
+    size += g_array_index (overlay_classes, BayesOverlayClass, i).tokens->n_entries *
+            sizeof (BayesIndexPosting);
+
+  pos = 0;
+  while (bayes_tokens_iter_next (self->overlay_corpus, &pos, &token, NULL))
+    size += bayes_index_record_size (0, strlen (token));
+
+  memcpy (header.magic, INDEX_MAGIC, 8);
+  header.byte_order = INDEX_BYTE_ORDER;
+  header.version = INDEX_VERSION;
+  header.n_classes = names->len;
+  header.corpus_count = self->overlay_corpus->count;
+  if (self->data != NULL)
+    header.corpus_count += self->header->corpus_count;
+
+  for (header.n_buckets = 16; header.n_buckets / 2 < n_tokens; header.n_buckets *= 2)
+    ;
+
+  header.classes_offset = ALIGN (sizeof header, 8);
+  names_offset = header.classes_offset + names->len * sizeof (BayesIndexClass);
+  header.buckets_offset = names_offset;
+  for (i = 0; i < names->len; i++)
+    header.buckets_offset += strlen (g_ptr_array_index (names, i)) + 1;
+  header.buckets_offset = ALIGN (header.buckets_offset, 8);
+  header.records_offset = header.buckets_offset + header.n_buckets * sizeof (BayesIndexBucket);
+  size += header.records_offset;
+
+  if (fchmod (fd, 0644) == -1 ||
+      ftruncate (fd, size) == -1 ||
+      MAP_FAILED == (data = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)))
+    {
+      errsv = errno;
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errsv),
+                   "Failed to write token index: %s",
+                   g_strerror (errsv));
+      return FALSE;
+    }
+
+  classes = (BayesIndexClass *)(data + header.classes_offset);
+  buckets = (BayesIndexBucket *)(data + header.buckets_offset);
+
+  for (i = 0, offset = names_offset; i < names->len; i++)
+    {
+      name = g_ptr_array_index (names, i);
+      len = strlen (name);
+
+      classes [i].name_offset = offset;
+      classes [i].count = 0;
+      if (self->data != NULL && i < self->header->n_classes)
+        classes [i].count = self->classes [i].count;
+
+      memcpy (data + offset, name, len + 1);
+      offset += len + 1;
+    }
+
+  for (i = 0; i < overlay_classes->len; i++)
+    {
+      overlay_class = g_array_index (overlay_classes, BayesOverlayClass, i);
+      classes [overlay_class.class_id].count += overlay_class.tokens->count;
+    }
+
+  offset = header.records_offset;
+  header.n_tokens = 0;
+
+  /*
+   * Tokens of the current index, merged with the overlay. Most tokens are
+   * not in the overlay and are copied as they are.
+   */
+  if (self->data != NULL)
+    {
+      guint64 old_offset = self->header->records_offset;
+      BayesTokenEntry *entry;
+
+      while (old_offset < self->header->records_end)
+        {
+          if (!(old_record = bayes_storage_mapped_get_record (self, old_offset)))
+            {
+              munmap (data, size);
+              return bayes_storage_mapped_invalid (self->filename, error);
+            }
+
+          old_offset += bayes_index_record_size (old_record->n_postings, old_record->len);
+
+          token = bayes_index_record_token (old_record);
+          hash = bayes_hash_bytes (token, old_record->len);
+          entry = bayes_tokens_lookup_entry (self->overlay_corpus, token, old_record->len,
+                                             (guint32)hash);
+
+          if (entry == NULL)
+            {
+              len = bayes_index_record_size (old_record->n_postings, old_record->len);
+              memcpy (data + offset, old_record, len);
+            }
+          else
+            {
+              len = bayes_index_write_record (data + offset, old_record,
+                                              token, old_record->len, (guint32)hash,
+                                              entry->count, overlay_classes);
+            }
+
+          bayes_index_insert_bucket (buckets, header.n_buckets, hash, offset);
+          header.n_tokens++;
+          offset += len;
+        }
+    }
+
+  /*
+   * Tokens that are new to the index.
+   */
+  pos = 0;
+  while (bayes_tokens_iter_next (self->overlay_corpus, &pos, &token, &count))
+    {
+      len = strlen (token);
+      hash = bayes_hash_bytes (token, len);
+
+      if (bayes_storage_mapped_lookup (self, token, len, hash))
+        continue;
+
+      bayes_index_insert_bucket (buckets, header.n_buckets, hash, offset);
+      offset += bayes_index_write_record (data + offset, NULL, token, len, (guint32)hash,
+                                          count, overlay_classes);
+      header.n_tokens++;
+    }
+
+  header.records_end = offset;
+  memcpy (data, &header, sizeof header);
+
+  munmap (data, size);
+
+  if (ftruncate (fd, offset) == -1 || fsync (fd) == -1)
+    {
+      errsv = errno;
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errsv),
+                   "Failed to write token index: %s",
+                   g_strerror (errsv));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+#endif
+
+gboolean
+bayes_storage_mapped_flush (BayesStorageMapped  *self,
+                            GError             **error)
+{
+#ifdef HAVE_SYS_MMAN_H
+  g_autofree gchar *tmpname = NULL;
+  gboolean ret;
+  int errsv;
+  int fd;
+
+  g_return_val_if_fail (BAYES_IS_STORAGE_MAPPED (self), FALSE);
+
+  if (g_hash_table_size (self->overlay) == 0)
+    return TRUE;
+
+  tmpname = g_strdup_printf ("%s.XXXXXX", self->filename);
+
+  if (-1 == (fd = g_mkstemp (tmpname)))
+    {
+      errsv = errno;
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errsv),
+                   "Failed to create \"%s\": %s",
+                   tmpname, g_strerror (errsv));
+      return FALSE;
+    }
+
+  ret = bayes_storage_mapped_write (self, fd, error);
+  close (fd);
+
+  if (ret && g_rename (tmpname, self->filename) == -1)
+    {
+      errsv = errno;
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errsv),
+                   "Failed to rename \"%s\": %s",
+                   tmpname, g_strerror (errsv));
+      ret = FALSE;
+    }
+
+  if (!ret)
+    {
+      g_unlink (tmpname);
+      return FALSE;
+    }
+
+  g_hash_table_remove_all (self->overlay);
+  g_clear_pointer (&self->overlay_corpus, bayes_tokens_free);
+  self->overlay_corpus = bayes_tokens_new ();
+  self->overlay_size = 0;
+
+  return bayes_storage_mapped_load (self, error);
+#else
+  g_set_error (error,
+               G_IO_ERROR,
+               G_IO_ERROR_NOT_SUPPORTED,
+               "Memory-mapped storage is not supported on this platform");
+
+  return FALSE;
+#endif
+}
+
+guint64
+bayes_storage_mapped_get_overlay_size (BayesStorageMapped *self)
+{
+  g_return_val_if_fail (BAYES_IS_STORAGE_MAPPED (self), 0);
+
+  return self->overlay_size;
+}
+
+static BayesTokens *
+bayes_storage_mapped_ensure_overlay (BayesStorageMapped *self,
+                                     const gchar        *name)
+{
+  BayesTokens *tokens;
+
+  if (!(tokens = g_hash_table_lookup (self->overlay, name)))
+    {
+      tokens = bayes_tokens_new ();
+      g_hash_table_insert (self->overlay, g_strdup (name), tokens);
+    }
+
+  return tokens;
+}
+
+static void
+bayes_storage_mapped_add_overlay (BayesStorageMapped *self,
+                                  BayesTokens        *tokens,
+                                  const gchar        *token,
+                                  guint               count)
+{
+  guint32 hash;
+  gsize len;
+
+  len = strlen (token);
+  hash = bayes_tokens_hash (token, len);
+
+  if (bayes_tokens_inc (tokens, token, len, hash, count, NULL))
+    self->overlay_size += len + 1 + BAYES_TOKEN_OVERHEAD;
+
+  if (bayes_tokens_inc (self->overlay_corpus, token, len, hash, count, NULL))
+    self->overlay_size += len + 1 + BAYES_TOKEN_OVERHEAD;
+}
+
+static void
+bayes_storage_mapped_check_overlay (BayesStorageMapped *self)
+{
+  g_autoptr(GError) error = NULL;
+
+  if (self->overlay_limit != 0 && self->overlay_size > self->overlay_limit)
+    {
+      if (!bayes_storage_mapped_flush (self, &error))
+        g_warning ("Failed to flush token index: %s", error->message);
+    }
+}
+
+static void
+bayes_storage_mapped_add_token_count (BayesStorage *storage,
+                                      const gchar  *name,
+                                      const gchar  *token,
+                                      guint         count)
+{
+  BayesStorageMapped *self = (BayesStorageMapped *)storage;
+
+  g_assert (BAYES_IS_STORAGE_MAPPED (self));
+  g_assert (name);
+  g_assert (token);
+
+  bayes_storage_mapped_add_overlay (self,
+                                    bayes_storage_mapped_ensure_overlay (self, name),
+                                    token, count);
+  bayes_storage_mapped_check_overlay (self);
+}
+
+/*
+ * The overlay is only flushed once the whole batch has been added, so a
+ * document is never split across two files.
+ */
+static void
+bayes_storage_mapped_add_token_counts (BayesStorage        *storage,
+                                       const gchar         *name,
+                                       const gchar * const *tokens,
+                                       const guint         *counts,
+                                       guint                n_tokens)
+{
+  BayesStorageMapped *self = (BayesStorageMapped *)storage;
+  BayesTokens *table;
+  guint i;
+
+  g_assert (BAYES_IS_STORAGE_MAPPED (self));
+  g_assert (name);
+  g_assert (tokens);
+
+  table = bayes_storage_mapped_ensure_overlay (self, name);
+
+  for (i = 0; i < n_tokens; i++)
+    {
+      if (!counts || counts [i])
+        bayes_storage_mapped_add_overlay (self, table, tokens [i], counts ? counts [i] : 1);
+    }
+
+  bayes_storage_mapped_check_overlay (self);
+}
+
+void
+bayes_storage_mapped_add_memory (BayesStorageMapped *self,
+                                 BayesStorageMemory *memory)
+{
+  GHashTableIter iter;
+  BayesTokens *tokens;
+  const gchar *token;
+  const gchar *name;
+  guint count;
+  guint pos;
+
+  g_return_if_fail (BAYES_IS_STORAGE_MAPPED (self));
+  g_return_if_fail (BAYES_IS_STORAGE_MEMORY (memory));
+
+  g_hash_table_iter_init (&iter, memory->names);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&name, (gpointer *)&tokens))
+    {
+      pos = 0;
+      while (bayes_tokens_iter_next (tokens, &pos, &token, &count))
+        bayes_storage_mapped_add_token_count (BAYES_STORAGE (self), name, token, count);
+    }
+}
+
+static gchar **
+bayes_storage_mapped_get_names (BayesStorage *storage)
+{
+  BayesStorageMapped *self = (BayesStorageMapped *)storage;
+  GHashTableIter iter;
+  const gchar *name;
+  GPtrArray *ret;
+  guint32 class_id;
+  guint i;
+
+  g_assert (BAYES_IS_STORAGE_MAPPED (self));
+
+  ret = g_ptr_array_new ();
+
+  if (self->data != NULL)
+    for (i = 0; i < self->header->n_classes; i++)
+      g_ptr_array_add (ret, g_strdup (self->data + self->classes [i].name_offset));
+
+  g_hash_table_iter_init (&iter, self->overlay);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&name, NULL))
+    if (!bayes_storage_mapped_get_class_id (self, name, &class_id))
+      g_ptr_array_add (ret, g_strdup (name));
+
+  g_ptr_array_add (ret, NULL);
+
+  return (gchar **)g_ptr_array_free (ret, FALSE);
+}
+
+/*
+ * Gets the count of @token in the classification @name, or the count of
+ * all tokens if @token is %NULL. @name may be %NULL for the corpus.
+ * Returns %FALSE if @name is not known.
+ */
+static gboolean
+bayes_storage_mapped_get_count (BayesStorageMapped *self,
+                                const gchar        *name,
+                                const gchar        *token,
+                                gsize               len,
+                                guint64             hash,
+                                guint              *count)
+{
+  const BayesIndexRecord *record;
+  BayesTokenEntry *entry;
+  BayesTokens *tokens;
+  guint32 class_id = 0;
+  gboolean has_class;
+
+  *count = 0;
+
+  if (name != NULL)
+    {
+      tokens = g_hash_table_lookup (self->overlay, name);
+      has_class = bayes_storage_mapped_get_class_id (self, name, &class_id);
+
+      if (tokens == NULL && !has_class)
+        return FALSE;
+    }
+  else
+    {
+      tokens = self->overlay_corpus;
+      has_class = self->data != NULL;
+    }
+
+  if (token == NULL)
+    {
+      if (tokens != NULL)
+        *count = tokens->count;
+
+      if (has_class)
+        *count = bayes_index_count_add (*count, (name != NULL) ? self->classes [class_id].count
+                                                               : self->header->corpus_count);
+
+      return TRUE;
+    }
+
+  if (tokens != NULL && (entry = bayes_tokens_lookup_entry (tokens, token, len, (guint32)hash)))
+    *count = entry->count;
+
+  if (has_class && (record = bayes_storage_mapped_lookup (self, token, len, hash)))
+    *count = bayes_index_count_add (*count, (name != NULL) ? bayes_index_record_get_count (record, class_id)
+                                                           : record->corpus_count);
+
+  return TRUE;
+}
+
+static guint
+bayes_storage_mapped_get_token_count (BayesStorage *storage,
+                                      const gchar  *name,
+                                      const gchar  *token)
+{
+  BayesStorageMapped *self = (BayesStorageMapped *)storage;
+  guint64 hash = 0;
+  gsize len = 0;
+  guint count;
+
+  g_assert (BAYES_IS_STORAGE_MAPPED (self));
+
+  if (token != NULL)
+    {
+      len = strlen (token);
+      hash = bayes_hash_bytes (token, len);
+    }
+
+  bayes_storage_mapped_get_count (self, name, token, len, hash, &count);
+
+  return count;
+}
+
+static gdouble
+bayes_storage_mapped_get_token_probability (BayesStorage *storage,
+                                            const gchar  *name,
+                                            const gchar  *token)
+{
+  BayesStorageMapped *self = (BayesStorageMapped *)storage;
+  guint pool_count;
+  guint corpus_count;
+  guint this_count;
+  guint tot_count;
+  guint64 hash;
+  gsize len;
+
+  g_assert (BAYES_IS_STORAGE_MAPPED (self));
+  g_assert (name);
+  g_assert (token);
+
+  if (!bayes_storage_mapped_get_count (self, name, NULL, 0, 0, &pool_count))
+    return 0.0;
+
+  len = strlen (token);
+  hash = bayes_hash_bytes (token, len);
+
+  bayes_storage_mapped_get_count (self, NULL, NULL, 0, 0, &corpus_count);
+  bayes_storage_mapped_get_count (self, name, token, len, hash, &this_count);
+  bayes_storage_mapped_get_count (self, NULL, token, len, hash, &tot_count);
+
+  return bayes_storage_compute_probability (pool_count, corpus_count, this_count, tot_count);
+}
+
+/*
+ * The postings of the index are used as they are and merged with the
+ * counts of the overlay. Classifications only found in the overlay are
+ * numbered after those of the index in the order get_names() lists them.
+ */
+static guint
+bayes_storage_mapped_get_postings (BayesStorage *storage,
+                                   const gchar  *token,
+                                   GArray       *postings)
+{
+  BayesStorageMapped *self = (BayesStorageMapped *)storage;
+  const BayesIndexPosting *record_postings;
+  const BayesIndexRecord *record;
+  BayesTokenEntry *entry;
+  GHashTableIter iter;
+  BayesPosting posting;
+  BayesTokens *tokens;
+  const gchar *name;
+  guint32 class_id;
+  guint32 next_id;
+  guint64 hash;
+  guint first;
+  gsize len;
+  guint i;
+
+  g_assert (BAYES_IS_STORAGE_MAPPED (self));
+  g_assert (token);
+  g_assert (postings);
+
+  len = strlen (token);
+  hash = bayes_hash_bytes (token, len);
+  first = postings->len;
+
+  if ((record = bayes_storage_mapped_lookup (self, token, len, hash)))
+    {
+      record_postings = bayes_index_record_postings (record);
+
+      for (i = 0; i < record->n_postings; i++)
+        {
+          if (record_postings [i].class_id >= self->header->n_classes)
+            continue;
+
+          posting.class_id = record_postings [i].class_id;
+          posting.count = record_postings [i].count;
+          g_array_append_val (postings, posting);
+        }
+    }
+
+  if (bayes_tokens_lookup_entry (self->overlay_corpus, token, len, (guint32)hash) == NULL)
+    return postings->len - first;
+
+  next_id = self->data ? self->header->n_classes : 0;
+
+  g_hash_table_iter_init (&iter, self->overlay);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&name, (gpointer *)&tokens))
+    {
+      if (!bayes_storage_mapped_get_class_id (self, name, &class_id))
+        class_id = next_id++;
+
+      if (!(entry = bayes_tokens_lookup_entry (tokens, token, len, (guint32)hash)))
+        continue;
+
+      for (i = first; i < postings->len; i++)
+        {
+          if (g_array_index (postings, BayesPosting, i).class_id == class_id)
+            {
+              g_array_index (postings, BayesPosting, i).count =
+                bayes_index_count_add (g_array_index (postings, BayesPosting, i).count, entry->count);
+              break;
+            }
+        }
+
+      if (i == postings->len)
+        {
+          posting.class_id = class_id;
+          posting.count = entry->count;
+          g_array_append_val (postings, posting);
+        }
+    }
+
+  return postings->len - first;
+}
+
+/*
+ * Walks the records of the index, adding the counts of the overlay to
+ * them, and then the tokens that are only in the overlay.
+ */
+static void
+bayes_storage_mapped_foreach (BayesStorage            *storage,
+                              BayesStorageForeachFunc  func,
+                              gpointer                 user_data)
+{
+  BayesStorageMapped *self = (BayesStorageMapped *)storage;
+  const BayesIndexPosting *postings;
+  const BayesIndexRecord *record;
+  BayesTokenEntry *entry;
+  GHashTableIter iter;
+  BayesTokens *tokens;
+  const gchar *token;
+  const gchar *name;
+  guint64 offset;
+  guint32 class_id;
+  guint32 hash;
+  gsize len;
+  guint count;
+  guint pos;
+  guint i;
+
+  g_assert (BAYES_IS_STORAGE_MAPPED (self));
+  g_assert (func);
+
+  if (self->data != NULL)
+    {
+      for (offset = self->header->records_offset;
+           offset < self->header->records_end;
+           offset += bayes_index_record_size (record->n_postings, record->len))
+        {
+          if (!(record = bayes_storage_mapped_get_record (self, offset)))
+            break;
+
+          token = bayes_index_record_token (record);
+          hash = (guint32)bayes_hash_bytes (token, record->len);
+          postings = bayes_index_record_postings (record);
+
+          for (i = 0; i < record->n_postings; i++)
+            {
+              if (postings [i].class_id >= self->header->n_classes)
+                continue;
+
+              name = self->data + self->classes [postings [i].class_id].name_offset;
+              count = postings [i].count;
+
+              if ((tokens = g_hash_table_lookup (self->overlay, name)) &&
+                  (entry = bayes_tokens_lookup_entry (tokens, token, record->len, hash)))
+                count = bayes_index_count_add (count, entry->count);
+
+              func (name, token, count, user_data);
+            }
+
+          if (!bayes_tokens_lookup_entry (self->overlay_corpus, token, record->len, hash))
+            continue;
+
+          /*
+           * Classifications that only found the token since the index was
+           * written.
+           */
+          g_hash_table_iter_init (&iter, self->overlay);
+          while (g_hash_table_iter_next (&iter, (gpointer *)&name, (gpointer *)&tokens))
+            {
+              if (bayes_storage_mapped_get_class_id (self, name, &class_id) &&
+                  bayes_index_record_get_count (record, class_id) != 0)
+                continue;
+
+              if ((entry = bayes_tokens_lookup_entry (tokens, token, record->len, hash)))
+                func (name, token, entry->count, user_data);
+            }
+        }
+    }
+
+  g_hash_table_iter_init (&iter, self->overlay);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&name, (gpointer *)&tokens))
+    {
+      pos = 0;
+      while (bayes_tokens_iter_next (tokens, &pos, &token, &count))
+        {
+          len = strlen (token);
+
+          if (!bayes_storage_mapped_lookup (self, token, len, bayes_hash_bytes (token, len)))
+            func (name, token, count, user_data);
+        }
+    }
+}
+
+static void
+bayes_storage_mapped_finalize (GObject *object)
+{
+  BayesStorageMapped *self = (BayesStorageMapped *)object;
+
+  bayes_storage_mapped_unmap (self);
+
+  g_clear_pointer (&self->class_ids, g_hash_table_unref);
+  g_clear_pointer (&self->overlay, g_hash_table_unref);
+  g_clear_pointer (&self->overlay_corpus, bayes_tokens_free);
+  g_clear_pointer (&self->filename, g_free);
+
+  G_OBJECT_CLASS (bayes_storage_mapped_parent_class)->finalize (object);
+}
+
+static void
+bayes_storage_mapped_get_property (GObject    *object,
+                                   guint       prop_id,
+                                   GValue     *value,
+                                   GParamSpec *pspec)
+{
+  BayesStorageMapped *self = BAYES_STORAGE_MAPPED (object);
+
+  switch (prop_id)
+    {
+    case PROP_FILENAME:
+      g_value_set_string (value, self->filename);
+      break;
+
+    case PROP_OVERLAY_LIMIT:
+      g_value_set_uint64 (value, self->overlay_limit);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+bayes_storage_mapped_set_property (GObject      *object,
+                                   guint         prop_id,
+                                   const GValue *value,
+                                   GParamSpec   *pspec)
+{
+  BayesStorageMapped *self = BAYES_STORAGE_MAPPED (object);
+
+  switch (prop_id)
+    {
+    case PROP_FILENAME:
+      self->filename = g_value_dup_string (value);
+      break;
+
+    case PROP_OVERLAY_LIMIT:
+      self->overlay_limit = g_value_get_uint64 (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+bayes_storage_mapped_class_init (BayesStorageMappedClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = bayes_storage_mapped_finalize;
+  object_class->get_property = bayes_storage_mapped_get_property;
+  object_class->set_property = bayes_storage_mapped_set_property;
+
+  /**
+   * BayesStorageMapped:filename:
+   *
+   * The path of the index file.
+   */
+  properties [PROP_FILENAME] =
+    g_param_spec_string ("filename",
+                         "Filename",
+                         "The path of the index file.",
+                         NULL,
+                         (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * BayesStorageMapped:overlay-limit:
+   *
+   * The approximate number of bytes the tokens added since the last
+   * flush may use before they are flushed to the index file, or 0 to
+   * only flush when bayes_storage_mapped_flush() is called.
+   */
+  properties [PROP_OVERLAY_LIMIT] =
+    g_param_spec_uint64 ("overlay-limit",
+                         "Overlay Limit",
+                         "The size of the overlay at which it is flushed.",
+                         0, G_MAXUINT64, 64 * 1024 * 1024,
+                         (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_properties (object_class, LAST_PROP, properties);
+}
+
+static void
+bayes_storage_mapped_init (BayesStorageMapped *self)
+{
+  self->overlay_limit = 64 * 1024 * 1024;
+  self->class_ids = g_hash_table_new (g_str_hash, g_str_equal);
+  self->overlay = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, bayes_tokens_free);
+  self->overlay_corpus = bayes_tokens_new ();
+}
+
+static void
+bayes_storage_init (BayesStorageInterface *iface)
+{
+  iface->add_token_count = bayes_storage_mapped_add_token_count;
+  iface->get_names = bayes_storage_mapped_get_names;
+  iface->get_token_count = bayes_storage_mapped_get_token_count;
+  iface->get_token_probability = bayes_storage_mapped_get_token_probability;
+  iface->get_postings = bayes_storage_mapped_get_postings;
+  iface->foreach = bayes_storage_mapped_foreach;
+  iface->add_token_counts = bayes_storage_mapped_add_token_counts;
+}
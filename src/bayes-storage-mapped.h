@@ -0,0 +1,87 @@
+/* bayes-storage-mapped.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BAYES_STORAGE_MAPPED_H
+#define BAYES_STORAGE_MAPPED_H
+
+#include "bayes-storage.h"
+#include "bayes-storage-memory.h"
+
+G_BEGIN_DECLS
+
+#define BAYES_TYPE_STORAGE_MAPPED (bayes_storage_mapped_get_type())
+
+G_DECLARE_FINAL_TYPE (BayesStorageMapped, bayes_storage_mapped, BAYES, STORAGE_MAPPED, GObject)
+
+/**
+ * bayes_storage_mapped_new:
+ * @filename: the path of the index file
+ * @error: a location for a #GError or %NULL
+ *
+ * Creates a new #BayesStorageMapped backed by the index file at
+ * @filename. The file is mapped into memory rather than read, so only
+ * the pages touched by lookups are loaded. If @filename does not exist
+ * yet, the storage starts out empty and the file is created by the
+ * first call to bayes_storage_mapped_flush().
+ *
+ * Returns: (transfer full): A new #BayesStorageMapped or %NULL and
+ *   @error is set.
+ */
+BayesStorageMapped *bayes_storage_mapped_new              (const gchar         *filename,
+                                                           GError             **error);
+
+/**
+ * bayes_storage_mapped_flush:
+ * @self: a #BayesStorageMapped
+ * @error: a location for a #GError or %NULL
+ *
+ * Merges the tokens added since the last flush into the index file and
+ * maps the result. The new file is written next to the old one and
+ * renamed over it, so the index is never left partially written.
+ *
+ * Returns: %TRUE if successful, otherwise %FALSE and @error is set.
+ */
+gboolean            bayes_storage_mapped_flush            (BayesStorageMapped  *self,
+                                                           GError             **error);
+
+/**
+ * bayes_storage_mapped_add_memory:
+ * @self: a #BayesStorageMapped
+ * @memory: a #BayesStorageMemory
+ *
+ * Adds all of the training data of @memory to @self. Call
+ * bayes_storage_mapped_flush() afterwards to write it to the index
+ * file, for example to convert a model saved as JSON.
+ */
+void                bayes_storage_mapped_add_memory       (BayesStorageMapped  *self,
+                                                           BayesStorageMemory  *memory);
+
+/**
+ * bayes_storage_mapped_get_overlay_size:
+ * @self: a #BayesStorageMapped
+ *
+ * Gets the approximate number of bytes used by the tokens added since
+ * the last flush.
+ *
+ * Returns: the size of the overlay in bytes.
+ */
+guint64             bayes_storage_mapped_get_overlay_size (BayesStorageMapped  *self);
+
+G_END_DECLS
+
+#endif /* BAYES_STORAGE_MAPPED_H */
@@ -20,15 +20,239 @@
 
 #include <glib.h>
 
+#include <string.h>
+
+#include "bayes-arena-private.h"
+#include "bayes-bloom-private.h"
+#include "bayes-hash-private.h"
+#include "bayes-storage-memory.h"
+
 G_BEGIN_DECLS
 
+/*
+ * The token table is an open-addressing hash table with linear probing
+ * and Robin Hood displacement: an entry never sits further from its home
+ * slot than the entries it passed, so a lookup stops as soon as it meets
+ * an entry that is closer to home than the probe is. Entries are 12 bytes
+ * holding the hash, the count and the offset of the token in the arena
+ * of the table, so probing a miss never leaves the entry array unless the
+ * hashes match. Empty slots have a count of 0.
+ */
+typedef struct
+{
+  guint32 hash;
+  guint32 count;
+  guint32 key;
+} BayesTokenEntry;
+
+/*
+ * Approximate cost of a token entry beyond the bytes of the token itself,
+ * which live in the arena of the table: the table slot, accounting for
+ * tables being between 7/16 and 7/8 full.
+ */
+#define BAYES_TOKEN_OVERHEAD (2 * sizeof (BayesTokenEntry))
+
+/*
+ * @values is an optional array parallel to @entries holding a value for
+ * each token that moves along with its entry. New tokens get a value of
+ * 0. It is only allocated for tables that use it.
+ */
 struct _BayesTokens
 {
   /*< private >*/
-  GHashTable *tokens;
-  guint       count;
+  BayesTokenEntry *entries;
+  guint32         *values;
+  guint            mask;
+  guint            n_entries;
+  guint            count;
+  BayesArena      *arena;
 };
 
+/*
+ * An entry of BayesStorageMemory.classes, the index in that array is the
+ * class id.
+ */
+typedef struct
+{
+  const gchar *name;
+  BayesTokens *tokens;
+} BayesClass;
+
+struct _BayesStorageMemory
+{
+  GObject     parent_instance;
+
+  /*< private >*/
+
+  /* somehow this is needed to get proper GI types for properties */
+  /**
+   * BayesStorageMemory:names: (type GLib.HashTable(utf8,Bayes.Tokens))
+   */
+  GHashTable  *names;
+
+  /**
+   * BayesStorageMemory:corpus: (type Bayes.Tokens)
+   */
+  BayesTokens *corpus;
+
+  /*
+   * Pruning state. Tokens that are first seen while a memory budget is
+   * set are queued in order of arrival so they can be evicted a few at
+   * a time once the budget is exceeded.
+   */
+  guint64      memory_budget;
+  guint64      memory_used;
+  guint64      generation;
+  guint        prune_count;
+  guint        prune_age;
+  GArray      *young;
+  guint        young_head;
+
+  /*
+   * Classifications in the order of their class ids, and the inverted
+   * index of tokens to the classifications they were found in. The
+   * index is a list of postings threaded through a node pool, with the
+   * head of each list stored alongside the token in the corpus. It is
+   * only built once postings are first asked for, under postings_mutex.
+   */
+  GArray      *classes;
+  GHashTable  *class_ids;
+  GArray      *postings;
+  guint32      postings_free;
+  GMutex       postings_mutex;
+
+  /*
+   * Decay state. Once every half-life of token occurrences a sweep is
+   * owed that halves every count, it visits a few slots of the
+   * classification tables per call to add_token_count().
+   */
+  guint64      half_life;
+  guint64      decay_next;
+  guint64      decay_slots;
+  guint        decay_owed;
+  guint        decay_epoch;
+  guint        decay_class;
+  guint        decay_pos;
+
+  /*
+   * Tokens changed since the storage was last saved, as a set of token
+   * strings for each classification table. Each classification table
+   * then also flags its tokens that are in the set. %NULL unless
+   * changes are tracked. dirty_used is the part of memory_used taken by
+   * the sets.
+   */
+  GHashTable  *dirty;
+  guint64      dirty_used;
+
+  /*
+   * A Bloom filter of the hashes of the tokens in the corpus, so that
+   * guesses can skip the tokens that were never trained on without
+   * probing the tables. Tokens are added as they are first seen, and the
+   * filter is rebuilt from the corpus when it fills up or once many of
+   * its tokens were removed.
+   */
+  BayesBloom  *bloom;
+};
+
+#ifndef __GI_SCANNER__
+
+BayesTokens *bayes_tokens_new        (void);
+void         bayes_tokens_free       (gpointer           data);
+gpointer     bayes_tokens_copy       (gpointer           data);
+gboolean     bayes_tokens_inc        (BayesTokens       *tokens,
+                                      const gchar       *token,
+                                      gsize              len,
+                                      guint32            hash,
+                                      guint              count,
+                                      guint32           *key);
+void         bayes_tokens_reserve    (BayesTokens       *tokens,
+                                      guint              n_new);
+guint        bayes_tokens_remove     (BayesTokens       *tokens,
+                                      const gchar       *token,
+                                      gsize              len,
+                                      guint32            hash);
+void         bayes_tokens_dec        (BayesTokens       *tokens,
+                                      const gchar       *token,
+                                      gsize              len,
+                                      guint32            hash,
+                                      guint              count);
+BayesArena  *bayes_tokens_compact    (BayesTokens       *tokens);
+gboolean     bayes_tokens_iter_next  (const BayesTokens *tokens,
+                                      guint             *pos,
+                                      const gchar      **token,
+                                      guint             *count);
+void         bayes_tokens_set_values (BayesTokens       *tokens,
+                                      gboolean           enabled);
+guint32     *bayes_tokens_lookup_value
+                                     (BayesTokens       *tokens,
+                                      const gchar       *token,
+                                      gsize              len,
+                                      guint32            hash);
+
+/*
+ * Used by BayesClassifier to train without going through the
+ * BayesStorage interface.
+ */
+BayesTokens *bayes_storage_memory_ensure_class
+                                     (BayesStorageMemory *self,
+                                      const gchar        *name);
+void         bayes_storage_memory_add_hashed
+                                     (BayesStorageMemory *self,
+                                      BayesTokens        *tokens,
+                                      const gchar        *token,
+                                      gsize               len,
+                                      guint32             hash,
+                                      guint               count);
+
+static inline guint32
+bayes_tokens_hash (const gchar *token,
+                   gsize        len)
+{
+  return (guint32)bayes_hash_bytes (token, len);
+}
+
+static inline BayesTokenEntry *
+bayes_tokens_lookup_entry (const BayesTokens *tokens,
+                           const gchar       *token,
+                           gsize              len,
+                           guint32            hash)
+{
+  BayesTokenEntry *entry;
+  const gchar *key;
+  guint mask = tokens->mask;
+  guint pos = hash & mask;
+  guint dist;
+
+  for (dist = 0; ; dist++, pos = (pos + 1) & mask)
+    {
+      entry = &tokens->entries [pos];
+
+      if (entry->count == 0 || ((pos - entry->hash) & mask) < dist)
+        return NULL;
+
+      if (entry->hash == hash)
+        {
+          key = bayes_arena_get (tokens->arena, entry->key);
+          if (strncmp (key, token, len) == 0 && key [len] == '\0')
+            return entry;
+        }
+    }
+}
+
+static inline guint
+bayes_tokens_lookup (const BayesTokens *tokens,
+                     const gchar       *token)
+{
+  BayesTokenEntry *entry;
+  gsize len = strlen (token);
+
+  entry = bayes_tokens_lookup_entry (tokens, token, len, bayes_tokens_hash (token, len));
+
+  return entry ? entry->count : 0;
+}
+
+#endif /* __GI_SCANNER__ */
+
 G_END_DECLS
 
 #endif /* BAYES_STORAGE_MEMORY_PRIVATE_H */
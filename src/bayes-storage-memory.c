@@ -16,8 +16,14 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "config.h"
+
+#include <string.h>
+
 #include "bayes-storage-memory.h"
 #include "bayes-storage-memory-private.h"
+#include "bayes-storage-private.h"
+#include "bayes-trace-private.h"
 #include <json-glib/json-glib.h>
 #include <json-glib/json-gobject.h>
 
@@ -28,17 +34,78 @@
  *
  * #BayesStorageMemory is an implementation of #BayesStorage that
  * stores the tokens and their associated counts in memory using
- * #GHashTable. It is mean for smaller data sets. It can be serialized
+ * compact hash tables. It is mean for smaller data sets. It can be serialized
  * and deserialized from JSON format.
+ *
+ * For long running processes that keep training, a memory budget may be
+ * set with bayes_storage_memory_set_memory_budget(). Rarely seen tokens
+ * are then evicted incrementally while training once the budget has been
+ * exceeded. Old training data can also be made to fade away with
+ * bayes_storage_memory_set_half_life().
+ *
+ * Checkpoints can be saved as small deltas with
+ * bayes_storage_memory_save_delta() once change tracking has been enabled
+ * with bayes_storage_memory_set_track_changes(), right after loading the
+ * storage or before saving it in full. A delta then holds the tokens
+ * changed since the last full save or delta, and is only valid applied
+ * to the storage loaded from that chain of files.
+ */
+
+/*
+ * Arenas of tables that lost tokens to pruning are rebuilt once this
+ * many bytes, and more than half of the arena, are unused.
+ */
+#define COMPACT_THRESHOLD 4096
+
+/*
+ * Number of queued tokens examined per call to add_token_count() once
+ * the memory budget has been exceeded. Keeping this small bounds the
+ * latency of a single training call.
+ */
+#define PRUNE_STEPS 4
+
+/*
+ * Minimum number of table slots visited per call to add_token_count()
+ * while a decay sweep is owed.
+ */
+#define DECAY_STEPS 8
+
+/*
+ * Smallest number of tokens the Bloom filter of the corpus is sized for.
+ * It is rebuilt with room for twice the tokens of the corpus once full.
+ */
+#define BLOOM_MIN_CAPACITY 1024
+
+typedef struct
+{
+  BayesTokens *tokens;
+  guint32      key;
+  guint64      born;
+} BayesYoungToken;
+
+/*
+ * A node of the inverted index. Node 0 is never used so that 0 can end
+ * a list.
  */
+typedef struct
+{
+  guint32 class_id;
+  guint32 next;
+} BayesPostingNode;
 
 static void bayes_storage_init (BayesStorageInterface *iface);
+static void bayes_storage_memory_start_tracking (BayesStorageMemory *self);
 
 enum {
 	PROP_0,
 
 	PROP_NAMES,
 	PROP_CORPUS,
+	PROP_MEMORY_BUDGET,
+	PROP_PRUNE_COUNT,
+	PROP_PRUNE_AGE,
+	PROP_HALF_LIFE,
+	PROP_TRACK_CHANGES,
 
 	N_PROPERTIES
 };
@@ -56,231 +123,1417 @@ G_DEFINE_TYPE_EXTENDED (BayesStorageMemory,
                         G_IMPLEMENT_INTERFACE (BAYES_TYPE_STORAGE, bayes_storage_init);
 			G_IMPLEMENT_INTERFACE (JSON_TYPE_SERIALIZABLE, json_serializable_iface_init))
 
-static void
-bayes_tokens_free (gpointer data)
+/*
+ * The dirty flag of a token of a classification table while changes are
+ * tracked, with the same fill as BAYES_TOKEN_OVERHEAD.
+ */
+#define BAYES_FLAG_OVERHEAD (2 * sizeof (guint32))
+
+/*
+ * The cost of a token in a set of dirty tokens beyond its bytes: its
+ * slot in the set and the header of its allocation.
+ */
+#define BAYES_DIRTY_OVERHEAD (4 * sizeof (gpointer))
+
+static inline gsize
+bayes_tokens_entry_size (gsize len)
+{
+  return len + 1 + BAYES_TOKEN_OVERHEAD;
+}
+
+static gboolean
+bayes_tokens_needs_compact (BayesTokens *tokens)
+{
+  return tokens->arena->dead >= COMPACT_THRESHOLD &&
+         tokens->arena->dead * 2 > tokens->arena->used;
+}
+
+static gsize
+bayes_tokens_get_memory_size (BayesTokens *tokens)
+{
+  return tokens->arena->used - tokens->arena->dead +
+         tokens->n_entries * BAYES_TOKEN_OVERHEAD;
+}
+
+/*
+ * converts BayesTokens to { "tokens": {}, "count": (int) }
+ */
+static JsonNode *
+bayes_tokens_serialize (gconstpointer boxed) {
+	const BayesTokens *tokens = boxed;
+	JsonObject *object;
+	JsonNode *node;
+
+	if (boxed == NULL)
+		return json_node_new (JSON_NODE_NULL);
+
+	object = json_object_new ();
+	node = json_node_new (JSON_NODE_OBJECT);
+
+	/*
+	 * serialize HashTable<string,uint> member
+	 */
+	const gchar *token;
+	guint count;
+	guint pos = 0;
+	JsonObject *table_object;
+
+	table_object = json_object_new ();
+	while (bayes_tokens_iter_next (tokens, &pos, &token, &count))
+		json_object_set_int_member (table_object, token, count);
+
+	json_object_set_object_member (object, "tokens", table_object);
+
+	/*
+	 * serialize token count
+	 */
+	json_object_set_int_member (object, "count", tokens->count);
+
+	json_node_take_object (node, object);
+
+	return node;
+}
+
+static void
+bayes_tokens_hashtable_foreach (JsonObject *table_object,
+				const gchar *name,
+				JsonNode *node,
+				gpointer _tokens)
+{
+	BayesTokens *tokens = _tokens;
+	gsize len = strlen (name);
+
+	bayes_tokens_inc (tokens, name, len, bayes_tokens_hash (name, len),
+			  (guint) json_node_get_int (node), NULL);
+}
+
+/*
+ * { "tokens": {}, "count": (uint) }
+ */
+static gpointer
+bayes_tokens_deserialize (JsonNode *node) {
+	JsonObject *object;
+	BayesTokens *tokens;
+
+	if (json_node_get_node_type (node) != JSON_NODE_OBJECT)
+		return NULL;
+
+	object = json_node_get_object (node);
+
+	tokens = bayes_tokens_new ();
+
+	/*
+	 * deserialize HashTable<string,uint> member
+	 */
+	JsonObject *table_object;
+
+	table_object = json_object_get_object_member (object, "tokens");
+	json_object_foreach_member (table_object, bayes_tokens_hashtable_foreach, tokens);
+
+	/*
+	 * unnecessary to deserialize token count
+	 */
+
+	return tokens;
+}
+
+GType
+bayes_tokens_get_type (void)
+{
+	static GType type = 0;
+
+	if (G_UNLIKELY (type == 0)) {
+		type = g_boxed_type_register_static ("BayesTokens", bayes_tokens_copy, bayes_tokens_free);
+
+		/*
+		 * register transform functions
+		 */
+		json_boxed_register_serialize_func (type, JSON_NODE_OBJECT, bayes_tokens_serialize);
+		json_boxed_register_deserialize_func (type, JSON_NODE_OBJECT, bayes_tokens_deserialize);
+	}
+
+	return type;
+}
+
+
+#ifdef ENABLE_TRACING
+static guint
+bayes_storage_memory_get_n_classes (BayesStorageMemory *self)
+{
+  return self->names ? g_hash_table_size (self->names) : 0;
+}
+
+static guint
+bayes_storage_memory_get_n_tokens (BayesStorageMemory *self)
+{
+  return self->corpus ? self->corpus->n_entries : 0;
+}
+#endif
+
+BayesStorageMemory *
+bayes_storage_memory_new (void)
+{
+  return g_object_new (BAYES_TYPE_STORAGE_MEMORY, NULL);
+}
+
+/*
+ * Creates the storage from the document loaded by @parser, which may be
+ * anything that parses as JSON.
+ */
+static BayesStorageMemory *
+bayes_storage_memory_new_from_parser (JsonParser  *parser,
+                                      GError     **error)
+{
+  JsonNode *node;
+  GObject *obj = NULL;
+
+  node = json_parser_get_root (parser);
+
+  if (node != NULL && JSON_NODE_HOLDS_OBJECT (node))
+    obj = json_gobject_deserialize (BAYES_TYPE_STORAGE_MEMORY, node);
+
+  if (obj == NULL || !BAYES_IS_STORAGE_MEMORY (obj))
+    {
+      g_clear_object (&obj);
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_DATA,
+                   "The training data is not a serialized BayesStorageMemory");
+      return NULL;
+    }
+
+  return BAYES_STORAGE_MEMORY (obj);
+}
+
+BayesStorageMemory *
+bayes_storage_memory_new_from_file (const gchar  *filename,
+                                    GError      **error)
+{
+	JsonParser *parser = json_parser_new ();
+	BayesStorageMemory *self = NULL;
+
+	BAYES_TRACE1 (load__entry, filename);
+
+	if (json_parser_load_from_file (parser, filename, error))
+		self = bayes_storage_memory_new_from_parser (parser, error);
+
+	g_object_unref (parser);
+
+	BAYES_TRACE3 (load__return, filename,
+	              self ? bayes_storage_memory_get_n_classes (self) : 0,
+	              self ? bayes_storage_memory_get_n_tokens (self) : 0);
+
+	return self;
+}
+
+BayesStorageMemory *
+bayes_storage_memory_new_from_stream (GInputStream  *stream,
+                                      GCancellable  *cancellable,
+                                      GError       **error)
+{
+  JsonParser *parser = json_parser_new ();
+  BayesStorageMemory *self = NULL;
+
+  if (json_parser_load_from_stream (parser, stream, cancellable, error))
+    self = bayes_storage_memory_new_from_parser (parser, error);
+
+  g_object_unref (parser);
+
+  return self;
+}
+
+gboolean
+bayes_storage_memory_save_to_file (BayesStorageMemory *self,
+				   const gchar *filename,
+				   GError **error)
+{
+	JsonGenerator *json_gen;
+	JsonNode *root;
+	gboolean ret;
+
+	BAYES_TRACE3 (save__entry, filename,
+	              bayes_storage_memory_get_n_classes (self),
+	              bayes_storage_memory_get_n_tokens (self));
+
+	json_gen = json_generator_new ();
+	root = json_gobject_serialize (G_OBJECT (self));
+	json_generator_set_root (json_gen, root);
+
+	json_node_free (root);
+
+	ret = json_generator_to_file (json_gen, filename, error);
+
+	g_object_unref (json_gen);
+
+	if (ret && self->dirty != NULL)
+		bayes_storage_memory_start_tracking (self);
+
+	BAYES_TRACE2 (save__return, filename, ret);
+
+	return ret;
+}
+
+
+static void
+bayes_storage_memory_update_memory_used (BayesStorageMemory *self)
+{
+  GHashTableIter iter;
+  BayesTokens *tokens;
+
+  self->memory_used = 0;
+
+  if (self->names != NULL)
+    {
+      g_hash_table_iter_init (&iter, self->names);
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&tokens))
+        {
+          self->memory_used += bayes_tokens_get_memory_size (tokens);
+          if (tokens->values != NULL)
+            self->memory_used += tokens->n_entries * BAYES_FLAG_OVERHEAD;
+        }
+    }
+
+  if (self->corpus != NULL)
+    self->memory_used += bayes_tokens_get_memory_size (self->corpus);
+
+  if (self->young != NULL)
+    self->memory_used += (self->young->len - self->young_head) * sizeof (BayesYoungToken);
+
+  self->memory_used += self->dirty_used;
+}
+
+static void
+bayes_storage_memory_clear_young (BayesStorageMemory *self)
+{
+  self->memory_used -= MIN (self->memory_used,
+                            (self->young->len - self->young_head) * sizeof (BayesYoungToken));
+  g_array_set_size (self->young, 0);
+  self->young_head = 0;
+}
+
+/*
+ * Queues the token @key of @tokens, which was just added, for pruning
+ * while a memory budget is set.
+ */
+static void
+bayes_storage_memory_enqueue_young (BayesStorageMemory *self,
+                                    BayesTokens        *tokens,
+                                    guint32             key)
+{
+  BayesYoungToken young;
+
+  if (self->memory_budget == 0)
+    return;
+
+  young.tokens = tokens;
+  young.key = key;
+  young.born = self->generation;
+  g_array_append_val (self->young, young);
+  self->memory_used += sizeof (BayesYoungToken);
+}
+
+static void
+bayes_storage_memory_clear_postings (BayesStorageMemory *self)
+{
+  g_clear_pointer (&self->postings, g_array_unref);
+  self->postings_free = 0;
+
+  if (self->corpus != NULL)
+    bayes_tokens_set_values (self->corpus, FALSE);
+}
+
+static void
+bayes_storage_memory_rebuild_bloom (BayesStorageMemory *self)
+{
+  guint n_tokens = self->corpus ? self->corpus->n_entries : 0;
+  guint pos;
+
+  bayes_bloom_reset (self->bloom, MAX (BLOOM_MIN_CAPACITY, n_tokens * 2));
+
+  if (self->corpus != NULL)
+    {
+      for (pos = 0; pos <= self->corpus->mask; pos++)
+        if (self->corpus->entries [pos].count != 0)
+          bayes_bloom_add (self->bloom, self->corpus->entries [pos].hash);
+    }
+}
+
+static void
+bayes_storage_memory_reset_decay (BayesStorageMemory *self)
+{
+  self->decay_next = self->generation + self->half_life;
+  self->decay_owed = 0;
+  self->decay_class = 0;
+  self->decay_pos = 0;
+}
+
+/*
+ * Starts tracking changes from the current state, forgetting anything
+ * changed before. Every classification table gets a flag per token
+ * telling whether it is already in the set of dirty tokens.
+ */
+static void
+bayes_storage_memory_start_tracking (BayesStorageMemory *self)
+{
+  GHashTableIter iter;
+  BayesTokens *tokens;
+
+  if (self->dirty == NULL)
+    self->dirty = g_hash_table_new_full (NULL, NULL, NULL,
+                                         (GDestroyNotify)g_hash_table_unref);
+  else
+    g_hash_table_remove_all (self->dirty);
+
+  self->dirty_used = 0;
+
+  g_hash_table_iter_init (&iter, self->names);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&tokens))
+    {
+      bayes_tokens_set_values (tokens, FALSE);
+      bayes_tokens_set_values (tokens, TRUE);
+    }
+
+  bayes_storage_memory_update_memory_used (self);
+}
+
+static void
+bayes_storage_memory_stop_tracking (BayesStorageMemory *self)
+{
+  GHashTableIter iter;
+  BayesTokens *tokens;
+
+  g_clear_pointer (&self->dirty, g_hash_table_unref);
+  self->dirty_used = 0;
+
+  g_hash_table_iter_init (&iter, self->names);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&tokens))
+    bayes_tokens_set_values (tokens, FALSE);
+
+  bayes_storage_memory_update_memory_used (self);
+}
+
+static GHashTable *
+bayes_storage_memory_ensure_dirty (BayesStorageMemory *self,
+                                   BayesTokens        *tokens)
+{
+  GHashTable *set;
+
+  if (!(set = g_hash_table_lookup (self->dirty, tokens)))
+    {
+      set = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+      g_hash_table_insert (self->dirty, tokens, set);
+    }
+
+  return set;
+}
+
+/*
+ * Remembers that the count of @token in the classification @tokens is
+ * about to change. The flag of the token avoids copying it again for
+ * every occurrence trained.
+ */
+static inline void
+bayes_storage_memory_mark_dirty (BayesStorageMemory *self,
+                                 BayesTokens        *tokens,
+                                 const gchar        *token,
+                                 gsize               len,
+                                 guint32             hash)
+{
+  guint32 *flag;
+  gsize size;
+
+  if (self->dirty == NULL)
+    return;
+
+  flag = bayes_tokens_lookup_value (tokens, token, len, hash);
+  if (flag != NULL && *flag != 0)
+    return;
+
+  g_hash_table_add (bayes_storage_memory_ensure_dirty (self, tokens),
+                    g_strndup (token, len));
+
+  size = len + 1 + BAYES_DIRTY_OVERHEAD;
+  self->dirty_used += size;
+  self->memory_used += size;
+
+  if (flag != NULL)
+    *flag = 1;
+}
+
+static guint
+bayes_storage_memory_add_class (BayesStorageMemory *self,
+                                const gchar        *name,
+                                BayesTokens        *tokens)
+{
+  BayesClass klass = { name, tokens };
+
+  g_array_append_val (self->classes, klass);
+  g_hash_table_insert (self->class_ids, tokens, GUINT_TO_POINTER (self->classes->len));
+
+  return self->classes->len - 1;
+}
+
+static inline guint
+bayes_storage_memory_get_class_id (BayesStorageMemory *self,
+                                   BayesTokens        *tokens)
+{
+  return GPOINTER_TO_UINT (g_hash_table_lookup (self->class_ids, tokens)) - 1;
+}
+
+/*
+ * Assigns class ids to the classifications after the table of names has
+ * been replaced. The index refers to the old ids and is dropped.
+ */
+static void
+bayes_storage_memory_index_classes (BayesStorageMemory *self)
+{
+  GHashTableIter iter;
+  const gchar *name;
+  BayesTokens *tokens;
+
+  g_array_set_size (self->classes, 0);
+  g_hash_table_remove_all (self->class_ids);
+  bayes_storage_memory_clear_postings (self);
+  bayes_storage_memory_reset_decay (self);
+
+  if (self->names != NULL)
+    {
+      g_hash_table_iter_init (&iter, self->names);
+      while (g_hash_table_iter_next (&iter, (gpointer *)&name, (gpointer *)&tokens))
+        bayes_storage_memory_add_class (self, name, tokens);
+    }
+}
+
+static void
+bayes_storage_memory_link_posting (BayesStorageMemory *self,
+                                   guint32            *head,
+                                   guint               class_id)
+{
+  BayesPostingNode *node;
+  guint32 node_id;
+
+  if (self->postings_free != 0)
+    {
+      node_id = self->postings_free;
+      self->postings_free = g_array_index (self->postings, BayesPostingNode, node_id).next;
+    }
+  else
+    {
+      node_id = self->postings->len;
+      g_array_set_size (self->postings, node_id + 1);
+    }
+
+  node = &g_array_index (self->postings, BayesPostingNode, node_id);
+  node->class_id = class_id;
+  node->next = *head;
+  *head = node_id;
+}
+
+static void
+bayes_storage_memory_unlink_posting (BayesStorageMemory *self,
+                                     guint32            *head,
+                                     guint               class_id)
+{
+  BayesPostingNode *node;
+  guint32 *link;
+  guint32 node_id;
+
+  for (link = head; *link != 0; link = &node->next)
+    {
+      node_id = *link;
+      node = &g_array_index (self->postings, BayesPostingNode, node_id);
+
+      if (node->class_id == class_id)
+        {
+          *link = node->next;
+          node->next = self->postings_free;
+          self->postings_free = node_id;
+          return;
+        }
+    }
+}
+
+/*
+ * Builds the inverted index from the classification tables. Classes are
+ * visited last to first so that every list ends up ordered by class id.
+ *
+ * The index is built on the first call to get_postings(), which may come
+ * from several guesses at once, so it is built under postings_mutex and
+ * only published once complete.
+ */
+static void
+bayes_storage_memory_ensure_postings (BayesStorageMemory *self)
+{
+  BayesPostingNode node;
+  GArray *nodes;
+  const gchar *token;
+  guint32 *head;
+  gsize len;
+  guint pos;
+  guint i;
+
+  if (g_atomic_pointer_get (&self->postings) != NULL)
+    return;
+
+  g_mutex_lock (&self->postings_mutex);
+
+  if (self->postings != NULL)
+    {
+      g_mutex_unlock (&self->postings_mutex);
+      return;
+    }
+
+  bayes_tokens_set_values (self->corpus, TRUE);
+  nodes = g_array_new (FALSE, FALSE, sizeof (BayesPostingNode));
+  g_array_set_size (nodes, 1);
+
+  for (i = self->classes->len; i > 0; i--)
+    {
+      BayesClass *klass = &g_array_index (self->classes, BayesClass, i - 1);
+
+      pos = 0;
+      while (bayes_tokens_iter_next (klass->tokens, &pos, &token, NULL))
+        {
+          len = strlen (token);
+          head = bayes_tokens_lookup_value (self->corpus, token, len,
+                                            bayes_tokens_hash (token, len));
+          if (head != NULL)
+            {
+              node.class_id = i - 1;
+              node.next = *head;
+              *head = nodes->len;
+              g_array_append_val (nodes, node);
+            }
+        }
+    }
+
+  self->postings_free = 0;
+  g_atomic_pointer_set (&self->postings, nodes);
+
+  g_mutex_unlock (&self->postings_mutex);
+}
+
+/*
+ * Rebuilds the arena of the classification @tokens. The pruning queue
+ * refers to the keys of the table so its entries are moved over to the
+ * new keys.
+ */
+static void
+bayes_storage_memory_compact (BayesStorageMemory *self,
+                              BayesTokens        *tokens)
+{
+  BayesTokenEntry *entry;
+  BayesYoungToken *young;
+  BayesArena *old_arena;
+  const gchar *token;
+  gsize len;
+  guint i;
+
+  old_arena = bayes_tokens_compact (tokens);
+
+  for (i = self->young_head; i < self->young->len; i++)
+    {
+      young = &g_array_index (self->young, BayesYoungToken, i);
+
+      if (young->tokens == tokens)
+        {
+          token = bayes_arena_get (old_arena, young->key);
+          len = strlen (token);
+          entry = bayes_tokens_lookup_entry (tokens, token, len,
+                                             bayes_tokens_hash (token, len));
+
+          /* Tokens removed by decay are dropped from the queue. */
+          if (entry != NULL)
+            young->key = entry->key;
+          else
+            young->tokens = NULL;
+        }
+    }
+
+  bayes_arena_free (old_arena);
+}
+
+static void
+bayes_storage_memory_evict (BayesStorageMemory *self,
+                            BayesTokens        *tokens,
+                            const gchar        *token,
+                            guint               count)
+{
+  BayesTokenEntry *entry;
+  gsize entry_size;
+  guint32 *head;
+  guint32 hash;
+  gsize len;
+
+  len = strlen (token);
+  hash = bayes_tokens_hash (token, len);
+  entry_size = bayes_tokens_entry_size (len);
+
+  bayes_storage_memory_mark_dirty (self, tokens, token, len, hash);
+
+  if (self->postings != NULL &&
+      (head = bayes_tokens_lookup_value (self->corpus, token, len, hash)))
+    bayes_storage_memory_unlink_posting (self, head,
+                                         bayes_storage_memory_get_class_id (self, tokens));
+
+  /*
+   * Remove the occurrences from the corpus first, @token lives in the
+   * arena of the classification table and is only valid until it is
+   * compacted.
+   */
+  entry = bayes_tokens_lookup_entry (self->corpus, token, len, hash);
+  if (entry != NULL && entry->count <= count)
+    {
+      self->memory_used -= MIN (self->memory_used, entry_size);
+      self->bloom->n_stale++;
+    }
+  bayes_tokens_dec (self->corpus, token, len, hash, count);
+
+  if (self->bloom->n_stale * 2 > self->bloom->n_keys)
+    bayes_storage_memory_rebuild_bloom (self);
+
+  if (tokens->values != NULL)
+    entry_size += BAYES_FLAG_OVERHEAD;
+  bayes_tokens_remove (tokens, token, len, hash);
+  self->memory_used -= MIN (self->memory_used, entry_size);
+
+  if (bayes_tokens_needs_compact (self->corpus))
+    bayes_arena_free (bayes_tokens_compact (self->corpus));
+
+  if (bayes_tokens_needs_compact (tokens))
+    bayes_storage_memory_compact (self, tokens);
+}
+
+/*
+ * Examines at most @max_steps of the oldest queued tokens, evicting those
+ * that are still rare. Tokens that have become common are dropped from
+ * the queue and will not be considered again.
+ */
+static void
+bayes_storage_memory_prune (BayesStorageMemory *self,
+                            guint               max_steps)
+{
+  BayesYoungToken *young;
+  const gchar *token;
+  guint token_count;
+  guint i;
+
+  for (i = 0; i < max_steps && self->memory_used > self->memory_budget; i++)
+    {
+      if (self->young_head >= self->young->len)
+        break;
+
+      young = &g_array_index (self->young, BayesYoungToken, self->young_head);
+
+      /*
+       * The queue is ordered by age, nothing behind the head can be old
+       * enough either.
+       */
+      if (self->generation - young->born < self->prune_age)
+        break;
+
+      self->young_head++;
+      self->memory_used -= MIN (self->memory_used, sizeof (BayesYoungToken));
+
+      if (young->tokens == NULL)
+        continue;
+
+      token = bayes_arena_get (young->tokens->arena, young->key);
+      token_count = bayes_tokens_lookup (young->tokens, token);
+
+      if (token_count != 0 && token_count <= self->prune_count)
+        bayes_storage_memory_evict (self, young->tokens, token, token_count);
+    }
+
+  /*
+   * Drop the consumed head of the queue once it makes up most of the
+   * array so that the cost is amortized over the evictions.
+   */
+  if (self->young_head > 1024 && self->young_head * 2 > self->young->len)
+    {
+      g_array_remove_range (self->young, 0, self->young_head);
+      self->young_head = 0;
+    }
+}
+
+/*
+ * Halves the count of the token in slot @pos of the classification
+ * @tokens, taking the same occurrences out of the corpus. Returns %FALSE
+ * if the token was removed, in which case the slot may now hold a token
+ * that has not been visited yet.
+ */
+static gboolean
+bayes_storage_memory_decay_entry (BayesStorageMemory *self,
+                                  BayesTokens        *tokens,
+                                  guint               pos)
+{
+  BayesTokenEntry *entry = &tokens->entries [pos];
+  const gchar *token;
+  guint count = entry->count;
+  guint kept;
+
+  kept = (count + (self->decay_epoch & 1)) / 2;
+  token = bayes_arena_get (tokens->arena, entry->key);
+
+  if (kept == 0)
+    {
+      bayes_storage_memory_evict (self, tokens, token, count);
+      return FALSE;
+    }
+
+  bayes_storage_memory_mark_dirty (self, tokens, token, strlen (token), entry->hash);
+
+  entry->count = kept;
+  tokens->count -= MIN (tokens->count, count - kept);
+  bayes_tokens_dec (self->corpus, token, strlen (token), entry->hash, count - kept);
+
+  return TRUE;
+}
+
+static guint64
+bayes_storage_memory_count_slots (BayesStorageMemory *self)
+{
+  guint64 n_slots = 0;
+  guint i;
+
+  for (i = 0; i < self->classes->len; i++)
+    n_slots += g_array_index (self->classes, BayesClass, i).tokens->mask + 1;
+
+  return n_slots;
+}
+
+/*
+ * Advances the decay sweep after @count occurrences were added. The
+ * number of slots visited is scaled so that a sweep over the slots
+ * present when it started finishes within one half-life, and grows
+ * further if sweeps fall behind.
+ */
+static void
+bayes_storage_memory_decay (BayesStorageMemory *self,
+                            guint               count)
+{
+  BayesTokens *tokens;
+  guint64 periods;
+  guint64 steps;
+
+  if (self->generation >= self->decay_next)
+    {
+      periods = (self->generation - self->decay_next) / self->half_life + 1;
+      self->decay_next += periods * self->half_life;
+      if (self->decay_owed == 0)
+        self->decay_slots = bayes_storage_memory_count_slots (self);
+      self->decay_owed = MIN ((guint64)self->decay_owed + periods, G_MAXUINT);
+    }
+
+  if (self->decay_owed == 0)
+    return;
+
+  steps = DECAY_STEPS + (guint64)count * self->decay_slots * self->decay_owed / self->half_life;
+
+  while (steps > 0 && self->decay_owed > 0)
+    {
+      if (self->decay_class >= self->classes->len)
+        {
+          self->decay_epoch++;
+          self->decay_class = 0;
+          self->decay_pos = 0;
+          if (--self->decay_owed > 0)
+            self->decay_slots = bayes_storage_memory_count_slots (self);
+          continue;
+        }
+
+      tokens = g_array_index (self->classes, BayesClass, self->decay_class).tokens;
+
+      if (self->decay_pos > tokens->mask)
+        {
+          self->decay_class++;
+          self->decay_pos = 0;
+          continue;
+        }
+
+      steps--;
+
+      if (tokens->entries [self->decay_pos].count == 0 ||
+          bayes_storage_memory_decay_entry (self, tokens, self->decay_pos))
+        self->decay_pos++;
+    }
+}
+
+guint64
+bayes_storage_memory_get_memory_budget (BayesStorageMemory *self)
+{
+  g_return_val_if_fail (BAYES_IS_STORAGE_MEMORY (self), 0);
+
+  return self->memory_budget;
+}
+
+void
+bayes_storage_memory_set_memory_budget (BayesStorageMemory *self,
+                                        guint64             memory_budget)
+{
+  g_return_if_fail (BAYES_IS_STORAGE_MEMORY (self));
+
+  if (self->memory_budget != memory_budget)
+    {
+      self->memory_budget = memory_budget;
+      if (memory_budget == 0)
+        bayes_storage_memory_clear_young (self);
+      g_object_notify_by_pspec (G_OBJECT (self), obj_properties [PROP_MEMORY_BUDGET]);
+    }
+}
+
+guint64
+bayes_storage_memory_get_half_life (BayesStorageMemory *self)
+{
+  g_return_val_if_fail (BAYES_IS_STORAGE_MEMORY (self), 0);
+
+  return self->half_life;
+}
+
+void
+bayes_storage_memory_set_half_life (BayesStorageMemory *self,
+                                    guint64             half_life)
+{
+  g_return_if_fail (BAYES_IS_STORAGE_MEMORY (self));
+
+  if (self->half_life != half_life)
+    {
+      self->half_life = half_life;
+      bayes_storage_memory_reset_decay (self);
+      g_object_notify_by_pspec (G_OBJECT (self), obj_properties [PROP_HALF_LIFE]);
+    }
+}
+
+gboolean
+bayes_storage_memory_get_track_changes (BayesStorageMemory *self)
+{
+  g_return_val_if_fail (BAYES_IS_STORAGE_MEMORY (self), FALSE);
+
+  return self->dirty != NULL;
+}
+
+void
+bayes_storage_memory_set_track_changes (BayesStorageMemory *self,
+                                        gboolean            track_changes)
+{
+  g_return_if_fail (BAYES_IS_STORAGE_MEMORY (self));
+
+  track_changes = !!track_changes;
+
+  if ((self->dirty != NULL) != track_changes)
+    {
+      if (track_changes)
+        bayes_storage_memory_start_tracking (self);
+      else
+        bayes_storage_memory_stop_tracking (self);
+      g_object_notify_by_pspec (G_OBJECT (self), obj_properties [PROP_TRACK_CHANGES]);
+    }
+}
+
+guint64
+bayes_storage_memory_get_memory_used (BayesStorageMemory *self)
+{
+  g_return_val_if_fail (BAYES_IS_STORAGE_MEMORY (self), 0);
+
+  return self->memory_used;
+}
+
+typedef struct
+{
+  guint64 n_tokens;
+  guint64 n_buckets;
+  guint64 key_bytes;
+  guint64 arena_bytes;
+  guint64 serialized_size;
+} BayesTokensStats;
+
+static guint
+count_digits (guint64 value)
+{
+  guint n = 1;
+
+  while (value >= 10)
+    {
+      value /= 10;
+      n++;
+    }
+
+  return n;
+}
+
+/*
+ * Everything here is kept up to date by the table itself, so no tokens
+ * are visited. The serialized size assumes every count has as many
+ * digits as the mean count and that no token needs escaping.
+ */
+static GVariant *
+bayes_tokens_get_stats (const BayesTokens *tokens,
+                        BayesTokensStats  *total)
 {
-  BayesTokens *tokens = data;
-
-  if (tokens != NULL)
+  GVariantBuilder builder;
+  guint64 n_buckets = tokens->entries ? (guint64)tokens->mask + 1 : 0;
+  guint64 key_bytes = tokens->arena->used - tokens->arena->dead;
+  guint64 serialized_size;
+
+  /* {"tokens":{},"count":N} */
+  serialized_size = 22 + count_digits (tokens->count);
+  if (tokens->n_entries > 0)
     {
-      g_hash_table_unref (tokens->tokens);
-      g_free (tokens);
+      /* "token":N, with the NUL already counted in key_bytes */
+      serialized_size += key_bytes + tokens->n_entries * 3 +
+                         tokens->n_entries * count_digits (tokens->count / tokens->n_entries);
     }
+
+  total->n_tokens += tokens->n_entries;
+  total->n_buckets += n_buckets;
+  total->key_bytes += key_bytes;
+  total->arena_bytes += tokens->arena->size;
+  total->serialized_size += serialized_size;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "tokens", g_variant_new_uint64 (tokens->n_entries));
+  g_variant_builder_add (&builder, "{sv}", "occurrences", g_variant_new_uint64 (tokens->count));
+  g_variant_builder_add (&builder, "{sv}", "key-bytes", g_variant_new_uint64 (key_bytes));
+  g_variant_builder_add (&builder, "{sv}", "arena-bytes", g_variant_new_uint64 (tokens->arena->size));
+  g_variant_builder_add (&builder, "{sv}", "bucket-bytes",
+                         g_variant_new_uint64 (n_buckets * sizeof (BayesTokenEntry)));
+  g_variant_builder_add (&builder, "{sv}", "load-factor",
+                         g_variant_new_double (n_buckets ? (gdouble)tokens->n_entries / n_buckets : 0.0));
+  g_variant_builder_add (&builder, "{sv}", "serialized-size", g_variant_new_uint64 (serialized_size));
+
+  return g_variant_builder_end (&builder);
 }
 
-static gpointer
-bayes_tokens_copy (gpointer data)
+GVariant *
+bayes_storage_memory_get_memory_stats (BayesStorageMemory *self)
 {
-	BayesTokens *old_tokens = data;
-	BayesTokens *tokens;
-
-	if (old_tokens == NULL)
-		return NULL;
+  BayesTokensStats total = { 0 };
+  GVariantBuilder classes;
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  const gchar *name;
+  BayesTokens *tokens;
+  GVariant *corpus = NULL;
+  guint64 postings_bytes = 0;
+  guint n_classes = 0;
 
-	tokens = g_new0 (BayesTokens, 1);
-	tokens->tokens = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  g_return_val_if_fail (BAYES_IS_STORAGE_MEMORY (self), NULL);
 
-	GHashTableIter iter;
-	gchar *key;
-	guint *val;
+  g_variant_builder_init (&classes, G_VARIANT_TYPE_VARDICT);
 
-	g_hash_table_iter_init (&iter, old_tokens->tokens);
-	while (g_hash_table_iter_next (&iter, (gpointer *)&key, (gpointer *)&val))
-		g_hash_table_insert (tokens->tokens, g_strdup (key), g_memdup (val, sizeof (*val)));
+  if (self->names != NULL)
+    {
+      n_classes = g_hash_table_size (self->names);
+
+      g_hash_table_iter_init (&iter, self->names);
+      while (g_hash_table_iter_next (&iter, (gpointer *)&name, (gpointer *)&tokens))
+        {
+          /* {"name":,} around each class */
+          total.serialized_size += strlen (name) + 4;
+          g_variant_builder_add (&classes, "{sv}", name, bayes_tokens_get_stats (tokens, &total));
+        }
+    }
 
-	tokens->count = old_tokens->count;
-	
-	return tokens;
+  if (self->corpus != NULL)
+    corpus = bayes_tokens_get_stats (self->corpus, &total);
+
+  /* The index may be built by a guess in another thread meanwhile. */
+  g_mutex_lock (&self->postings_mutex);
+  if (self->postings != NULL)
+    postings_bytes = self->postings->len * sizeof (BayesPostingNode) +
+                     ((guint64)self->corpus->mask + 1) * sizeof (guint32);
+  g_mutex_unlock (&self->postings_mutex);
+
+  /* {"names":{},"corpus":} and the remaining properties */
+  total.serialized_size += 96;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "classes", g_variant_new_uint32 (n_classes));
+  g_variant_builder_add (&builder, "{sv}", "distinct-tokens",
+                         g_variant_new_uint64 (self->corpus ? self->corpus->n_entries : 0));
+  g_variant_builder_add (&builder, "{sv}", "token-occurrences",
+                         g_variant_new_uint64 (self->corpus ? self->corpus->count : 0));
+  g_variant_builder_add (&builder, "{sv}", "key-bytes", g_variant_new_uint64 (total.key_bytes));
+  g_variant_builder_add (&builder, "{sv}", "arena-bytes", g_variant_new_uint64 (total.arena_bytes));
+  g_variant_builder_add (&builder, "{sv}", "bucket-bytes",
+                         g_variant_new_uint64 (total.n_buckets * sizeof (BayesTokenEntry)));
+  g_variant_builder_add (&builder, "{sv}", "load-factor",
+                         g_variant_new_double (total.n_buckets ? (gdouble)total.n_tokens / total.n_buckets : 0.0));
+  g_variant_builder_add (&builder, "{sv}", "bloom-bytes",
+                         g_variant_new_uint64 (bayes_bloom_get_memory_size (self->bloom)));
+  g_variant_builder_add (&builder, "{sv}", "postings-bytes", g_variant_new_uint64 (postings_bytes));
+  g_variant_builder_add (&builder, "{sv}", "memory-used", g_variant_new_uint64 (self->memory_used));
+  g_variant_builder_add (&builder, "{sv}", "serialized-size", g_variant_new_uint64 (total.serialized_size));
+  if (corpus != NULL)
+    g_variant_builder_add (&builder, "{sv}", "corpus", corpus);
+  g_variant_builder_add (&builder, "{sv}", "by-class", g_variant_builder_end (&classes));
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
 }
 
-static void
-bayes_tokens_inc (BayesTokens *tokens,
-        	  const gchar *token,
-		  guint        count)
+/*
+ * Gets the classification hashtable or creates it if necessary.
+ */
+BayesTokens *
+bayes_storage_memory_ensure_class (BayesStorageMemory *self,
+                                   const gchar        *name)
 {
-  guint *token_count;
+  BayesTokens *tokens;
+  gchar *new_name;
 
-  /*
-   * Get the container for the token count or create it if necessary.
-   */
-  if (!(token_count = g_hash_table_lookup (tokens->tokens, token)))
+  if (!(tokens = g_hash_table_lookup (self->names, name)))
     {
-      token_count = g_new0 (guint, 1);
-      g_hash_table_insert (tokens->tokens, g_strdup (token), token_count);
+      tokens = bayes_tokens_new ();
+      new_name = g_strdup (name);
+      g_hash_table_insert (self->names, new_name, tokens);
+      bayes_storage_memory_add_class (self, new_name, tokens);
+
+      /* A new classification is saved in the next delta even if empty. */
+      if (self->dirty != NULL)
+        {
+          bayes_tokens_set_values (tokens, TRUE);
+          bayes_storage_memory_ensure_dirty (self, tokens);
+        }
     }
 
-  /*
-   * Increment the count of the token.
-   */
-  *token_count += count;
-  tokens->count += count;
+  return tokens;
 }
 
 /*
- * converts BayesTokens to { "tokens": {}, "count": (int) }
+ * Adds @count occurrences of @token to the classification @tokens and to
+ * the corpus. Returns %TRUE if @token is new to the classification, in
+ * which case @key is set to its key.
  */
-static JsonNode *
-bayes_tokens_serialize (gconstpointer boxed) {
-	const BayesTokens *tokens = boxed;
-	JsonObject *object;
-	JsonNode *node;
+static gboolean
+bayes_storage_memory_inc (BayesStorageMemory *self,
+                          BayesTokens        *tokens,
+                          const gchar        *token,
+                          gsize               len,
+                          guint32             hash,
+                          guint               count,
+                          guint32            *key)
+{
+  gboolean is_new;
+  guint32 *head;
 
-	if (boxed == NULL)
-		return json_node_new (JSON_NODE_NULL);
+  if ((is_new = bayes_tokens_inc (tokens, token, len, hash, count, key)))
+    self->memory_used += bayes_tokens_entry_size (len) +
+                         (tokens->values != NULL ? BAYES_FLAG_OVERHEAD : 0);
 
-	object = json_object_new ();
-	node = json_node_new (JSON_NODE_OBJECT);
+  bayes_storage_memory_mark_dirty (self, tokens, token, len, hash);
 
-	/*
-	 * serialize HashTable<string,uint> member
-	 */
-	GHashTableIter iter;
-	gchar *token; /* key */
-	guint *count; /* value */
-	JsonObject *table_object;
+  if (bayes_tokens_inc (self->corpus, token, len, hash, count, NULL))
+    {
+      self->memory_used += bayes_tokens_entry_size (len);
 
-	table_object = json_object_new ();
-	g_hash_table_iter_init (&iter, tokens->tokens);
-	while (g_hash_table_iter_next (&iter, (gpointer *) &token, (gpointer *)&count))
-		json_object_set_int_member (table_object, token, *count);
+      if (self->bloom->n_keys >= self->bloom->capacity)
+        bayes_storage_memory_rebuild_bloom (self);
+      else
+        bayes_bloom_add (self->bloom, hash);
+    }
 
-	json_object_set_object_member (object, "tokens", table_object);
+  if (is_new && self->postings != NULL &&
+      (head = bayes_tokens_lookup_value (self->corpus, token, len, hash)))
+    bayes_storage_memory_link_posting (self, head,
+                                       bayes_storage_memory_get_class_id (self, tokens));
 
-	/*
-	 * serialize token count
-	 */
-	json_object_set_int_member (object, "count", tokens->count);
+  return is_new;
+}
 
-	json_node_take_object (node, object);
+/*
+ * Adds @count occurrences of @token to the classification @tokens. The
+ * hash is shared by the classification table and the corpus.
+ */
+void
+bayes_storage_memory_add_hashed (BayesStorageMemory *self,
+                                 BayesTokens        *tokens,
+                                 const gchar        *token,
+                                 gsize               len,
+                                 guint32             hash,
+                                 guint               count)
+{
+  guint32 key;
 
-	return node;
+  self->generation += count;
+
+  if (bayes_storage_memory_inc (self, tokens, token, len, hash, count, &key))
+    bayes_storage_memory_enqueue_young (self, tokens, key);
+
+  if (self->memory_budget != 0 && self->memory_used > self->memory_budget)
+    bayes_storage_memory_prune (self, PRUNE_STEPS);
+
+  if (self->half_life != 0)
+    bayes_storage_memory_decay (self, count);
 }
 
+/*
+ * Sets the count of @token in the classification @tokens, adjusting the
+ * corpus by the difference.
+ */
 static void
-bayes_tokens_hashtable_foreach (JsonObject *table_object,
-				const gchar *name,
-				JsonNode *node,
-				gpointer _tokens)
+bayes_storage_memory_set_count (BayesStorageMemory *self,
+                                BayesTokens        *tokens,
+                                const gchar        *token,
+                                guint               count)
 {
-	BayesTokens *tokens = _tokens;
+  BayesTokenEntry *entry;
+  guint32 hash;
+  guint32 key;
+  gsize len;
+  guint diff;
 
-	bayes_tokens_inc (tokens, name, (guint) json_node_get_int (node));
+  len = strlen (token);
+  hash = bayes_tokens_hash (token, len);
+  entry = bayes_tokens_lookup_entry (tokens, token, len, hash);
+
+  if (entry == NULL)
+    {
+      if (bayes_storage_memory_inc (self, tokens, token, len, hash, count, &key))
+        bayes_storage_memory_enqueue_young (self, tokens, key);
+    }
+  else if (count > entry->count)
+    bayes_storage_memory_inc (self, tokens, token, len, hash, count - entry->count, NULL);
+  else if (count == 0)
+    bayes_storage_memory_evict (self, tokens, token, entry->count);
+  else if (count < entry->count)
+    {
+      diff = entry->count - count;
+      bayes_storage_memory_mark_dirty (self, tokens, token, len, hash);
+      entry->count = count;
+      tokens->count -= MIN (tokens->count, diff);
+      bayes_tokens_dec (self->corpus, token, len, hash, diff);
+    }
 }
 
-/*
- * { "tokens": {}, "count": (uint) }
- */
-static gpointer
-bayes_tokens_deserialize (JsonNode *node) {
-	JsonObject *object;
-	BayesTokens *tokens;
+gboolean
+bayes_storage_memory_save_delta (BayesStorageMemory  *self,
+                                 const gchar         *filename,
+                                 GError             **error)
+{
+  JsonGenerator *json_gen;
+  JsonObject *delta_obj;
+  JsonObject *table_obj;
+  JsonObject *root_obj;
+  JsonNode *root;
+  GHashTableIter iter;
+  GHashTableIter set_iter;
+  BayesTokens *tokens;
+  GHashTable *set;
+  const gchar *token;
+  guint32 *flag;
+  gsize len;
+  gboolean ret;
 
-	if (json_node_get_node_type (node) != JSON_NODE_OBJECT)
-		return NULL;
+  g_return_val_if_fail (BAYES_IS_STORAGE_MEMORY (self), FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
 
-	object = json_node_get_object (node);
+  if (self->dirty == NULL)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_INITIALIZED,
+                   "A delta requires changes to be tracked");
+      return FALSE;
+    }
 
-	tokens = g_new0(BayesTokens, 1);
-	tokens->tokens = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  /* { "delta": { "class": { "token": count } } }, removed tokens are 0 */
+  delta_obj = json_object_new ();
 
-	/*
-	 * deserialize HashTable<string,uint> member
-	 */
-	JsonObject *table_object;
+  g_hash_table_iter_init (&iter, self->dirty);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&tokens, (gpointer *)&set))
+    {
+      table_obj = json_object_new ();
 
-	table_object = json_object_get_object_member (object, "tokens");
-	json_object_foreach_member (table_object, bayes_tokens_hashtable_foreach, tokens);
+      g_hash_table_iter_init (&set_iter, set);
+      while (g_hash_table_iter_next (&set_iter, (gpointer *)&token, NULL))
+        json_object_set_int_member (table_obj, token, bayes_tokens_lookup (tokens, token));
 
-	/*
-	 * unnecessary to deserialize token count
-	 */
+      json_object_set_object_member (delta_obj,
+                                     g_array_index (self->classes, BayesClass,
+                                                    bayes_storage_memory_get_class_id (self, tokens)).name,
+                                     table_obj);
+    }
 
-	return tokens;
-}
+  root_obj = json_object_new ();
+  json_object_set_object_member (root_obj, "delta", delta_obj);
+  root = json_node_new (JSON_NODE_OBJECT);
+  json_node_take_object (root, root_obj);
 
-GType
-bayes_tokens_get_type (void)
-{
-	static GType type = 0;
+  json_gen = json_generator_new ();
+  json_generator_set_root (json_gen, root);
+  json_node_free (root);
 
-	if (G_UNLIKELY (type == 0)) {
-		type = g_boxed_type_register_static ("BayesTokens", bayes_tokens_copy, bayes_tokens_free);
+  ret = json_generator_to_file (json_gen, filename, error);
 
-		/*
-		 * register transform functions
-		 */
-		json_boxed_register_serialize_func (type, JSON_NODE_OBJECT, bayes_tokens_serialize);
-		json_boxed_register_deserialize_func (type, JSON_NODE_OBJECT, bayes_tokens_deserialize);
-	}
+  g_object_unref (json_gen);
 
-	return type;
-}
+  if (!ret)
+    return FALSE;
 
+  /* Only the flags of the tokens saved need to be cleared. */
+  g_hash_table_iter_init (&iter, self->dirty);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&tokens, (gpointer *)&set))
+    {
+      g_hash_table_iter_init (&set_iter, set);
+      while (g_hash_table_iter_next (&set_iter, (gpointer *)&token, NULL))
+        {
+          len = strlen (token);
+          flag = bayes_tokens_lookup_value (tokens, token, len, bayes_tokens_hash (token, len));
+          if (flag != NULL)
+            *flag = 0;
+        }
+    }
+  g_hash_table_remove_all (self->dirty);
 
-BayesStorageMemory *
-bayes_storage_memory_new (void)
-{
-  return g_object_new (BAYES_TYPE_STORAGE_MEMORY, NULL);
+  self->memory_used -= MIN (self->memory_used, self->dirty_used);
+  self->dirty_used = 0;
+
+  return TRUE;
 }
 
-BayesStorageMemory *
-bayes_storage_memory_new_from_file (const gchar  *filename,
+static gboolean
+bayes_storage_memory_invalid_delta (const gchar  *filename,
                                     GError      **error)
 {
-	JsonParser *parser = json_parser_new ();
-	JsonNode *node;
-	GObject *obj;
-	
-	if (!json_parser_load_from_file (parser, filename, error))
-		return NULL;
+  g_set_error (error,
+               G_IO_ERROR,
+               G_IO_ERROR_INVALID_DATA,
+               "\"%s\" is not a valid delta",
+               filename);
 
-	node = json_parser_get_root (parser);
-	obj = json_gobject_deserialize (BAYES_TYPE_STORAGE_MEMORY, node);
-
-	return BAYES_STORAGE_MEMORY (obj);
+  return FALSE;
 }
 
-BayesStorageMemory *
-bayes_storage_memory_new_from_stream (GInputStream  *stream,
-                                      GCancellable  *cancellable,
-                                      GError       **error)
+gboolean
+bayes_storage_memory_load_delta (BayesStorageMemory  *self,
+                                 const gchar         *filename,
+                                 GError             **error)
 {
-  JsonParser *parser = json_parser_new ();
-  JsonNode *node;
-  GObject *obj;
+  g_autoptr(JsonParser) parser = NULL;
+  GHashTableIter iter;
+  JsonObject *delta_obj;
+  JsonObject *table_obj;
+  JsonNode *class_node;
+  JsonNode *token_node;
+  JsonNode *root;
+  GHashTable *dirty;
+  BayesTokens *tokens;
+  GList *classes;
+  GList *members;
+  GList *c;
+  GList *t;
+  gint64 count;
+  gboolean valid = TRUE;
+
+  g_return_val_if_fail (BAYES_IS_STORAGE_MEMORY (self), FALSE);
+  g_return_val_if_fail (filename != NULL, FALSE);
+
+  parser = json_parser_new ();
+  if (!json_parser_load_from_file (parser, filename, error))
+    return FALSE;
+
+  /* Check the whole delta first so that a bad file changes nothing. */
+  root = json_parser_get_root (parser);
+  if (root == NULL || !JSON_NODE_HOLDS_OBJECT (root) ||
+      !json_object_has_member (json_node_get_object (root), "delta") ||
+      !JSON_NODE_HOLDS_OBJECT (json_object_get_member (json_node_get_object (root), "delta")))
+    return bayes_storage_memory_invalid_delta (filename, error);
+
+  delta_obj = json_object_get_object_member (json_node_get_object (root), "delta");
+  classes = json_object_get_members (delta_obj);
+
+  for (c = classes; valid && c != NULL; c = c->next)
+    {
+      class_node = json_object_get_member (delta_obj, c->data);
+      if (!JSON_NODE_HOLDS_OBJECT (class_node))
+        {
+          valid = FALSE;
+          break;
+        }
+
+      table_obj = json_node_get_object (class_node);
+      members = json_object_get_members (table_obj);
+
+      for (t = members; t != NULL; t = t->next)
+        {
+          token_node = json_object_get_member (table_obj, t->data);
+          if (!JSON_NODE_HOLDS_VALUE (token_node) ||
+              json_node_get_value_type (token_node) != G_TYPE_INT64 ||
+              (count = json_node_get_int (token_node)) < 0 ||
+              count > G_MAXUINT)
+            {
+              valid = FALSE;
+              break;
+            }
+        }
+
+      g_list_free (members);
+    }
 
-  if (!json_parser_load_from_stream (parser, stream, NULL, error))
-    return NULL;
+  if (!valid)
+    {
+      g_list_free (classes);
+      return bayes_storage_memory_invalid_delta (filename, error);
+    }
 
-  node = json_parser_get_root (parser);
-  obj = json_gobject_deserialize (BAYES_TYPE_STORAGE_MEMORY, node);
+  /*
+   * The delta brings @self up to date with a saved state, which is not a
+   * change to be saved again.
+   */
+  dirty = g_steal_pointer (&self->dirty);
 
-  return BAYES_STORAGE_MEMORY (obj);
+  for (c = classes; c != NULL; c = c->next)
+    {
+      tokens = bayes_storage_memory_ensure_class (self, c->data);
+      table_obj = json_object_get_object_member (delta_obj, c->data);
+      members = json_object_get_members (table_obj);
+
+      for (t = members; t != NULL; t = t->next)
+        bayes_storage_memory_set_count (self, tokens, t->data,
+                                        json_object_get_int_member (table_obj, t->data));
+
+      g_list_free (members);
+    }
+
+  g_list_free (classes);
+  self->dirty = dirty;
+
+  if (self->dirty != NULL)
+    {
+      g_hash_table_iter_init (&iter, self->names);
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&tokens))
+        bayes_tokens_set_values (tokens, TRUE);
+      bayes_storage_memory_update_memory_used (self);
+    }
+
+  return TRUE;
 }
 
-gboolean
-bayes_storage_memory_save_to_file (BayesStorageMemory *self,
-				   const gchar *filename,
-				   GError **error)
+BayesStorageMemory *
+bayes_storage_memory_new_from_files (const gchar         *filename,
+                                     const gchar * const *deltas,
+                                     GError             **error)
 {
-	JsonGenerator *json_gen;
-	JsonNode *root;
-	gboolean ret;
-
-	json_gen = json_generator_new ();
-	root = json_gobject_serialize (G_OBJECT (self));
-	json_generator_set_root (json_gen, root);
+  BayesStorageMemory *self;
+  guint i;
 
-	json_node_free (root);
+  g_return_val_if_fail (filename != NULL, NULL);
 
-	ret = json_generator_to_file (json_gen, filename, error);
+  if (!(self = bayes_storage_memory_new_from_file (filename, error)))
+    return NULL;
 
-	g_object_unref (json_gen);
+  for (i = 0; deltas != NULL && deltas [i] != NULL; i++)
+    {
+      if (!bayes_storage_memory_load_delta (self, deltas [i], error))
+        {
+          g_object_unref (self);
+          return NULL;
+        }
+    }
 
-	return ret;
+  return self;
 }
 
-
 static void
 bayes_storage_memory_add_token_count (BayesStorage *storage,
                                       const gchar  *name,
@@ -288,24 +1541,57 @@ bayes_storage_memory_add_token_count (BayesStorage *storage,
                                       guint         count)
 {
   BayesStorageMemory *self = (BayesStorageMemory *)storage;
-  BayesTokens *tokens;
+  gsize len;
 
   g_assert (BAYES_IS_STORAGE_MEMORY (self));
   g_assert (name);
   g_assert (token);
 
-  /*
-   * Get the classification hashtable or create it if necessary.
-   */
-  if (!(tokens = g_hash_table_lookup (self->names, name)))
+  len = strlen (token);
+  bayes_storage_memory_add_hashed (self,
+                                   bayes_storage_memory_ensure_class (self, name),
+                                   token, len, bayes_tokens_hash (token, len), count);
+}
+
+/*
+ * Resolves the classification once for the whole batch. Counted tokens
+ * are mostly distinct, so both tables are grown up front instead of
+ * doubling repeatedly while the batch is added.
+ */
+static void
+bayes_storage_memory_add_token_counts (BayesStorage        *storage,
+                                       const gchar         *name,
+                                       const gchar * const *tokens,
+                                       const guint         *counts,
+                                       guint                n_tokens)
+{
+  BayesStorageMemory *self = (BayesStorageMemory *)storage;
+  BayesTokens *table;
+  gsize len;
+  guint i;
+
+  g_assert (BAYES_IS_STORAGE_MEMORY (self));
+  g_assert (name);
+  g_assert (tokens);
+
+  table = bayes_storage_memory_ensure_class (self, name);
+
+  if (counts != NULL)
     {
-      tokens = g_new0 (BayesTokens, 1);
-      tokens->tokens = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
-      g_hash_table_insert (self->names, g_strdup (name), tokens);
+      bayes_tokens_reserve (table, n_tokens);
+      bayes_tokens_reserve (self->corpus, n_tokens);
     }
 
-  bayes_tokens_inc (tokens, token, count);
-  bayes_tokens_inc (self->corpus, token, count);
+  for (i = 0; i < n_tokens; i++)
+    {
+      if (counts && !counts [i])
+        continue;
+
+      len = strlen (tokens [i]);
+      bayes_storage_memory_add_hashed (self, table, tokens [i], len,
+                                       bayes_tokens_hash (tokens [i], len),
+                                       counts ? counts [i] : 1);
+    }
 }
 
 static guint
@@ -315,7 +1601,6 @@ bayes_storage_memory_get_token_count (BayesStorage *storage,
 {
   BayesStorageMemory *self = (BayesStorageMemory *)storage;
   BayesTokens *tokens;
-  guint *token_count;
 
   g_assert (BAYES_IS_STORAGE_MEMORY (self));
 
@@ -325,8 +1610,8 @@ bayes_storage_memory_get_token_count (BayesStorage *storage,
     {
       if (!token)
         return tokens->count;
-      else if ((token_count = g_hash_table_lookup(tokens->tokens, token)))
-        return *token_count;
+      else
+        return bayes_tokens_lookup (tokens, token);
     }
 
   return 0;
@@ -338,15 +1623,11 @@ bayes_storage_memory_get_token_probability (BayesStorage *storage,
                                             const gchar  *token)
 {
   BayesStorageMemory *self = (BayesStorageMemory *)storage;
-  gdouble pool_count;
-  gdouble them_count;
-  gdouble tot_count;
-  gdouble this_count;
-  gdouble other_count;
-  gdouble good_metric;
-  gdouble bad_metric;
-  gdouble f;
+  BayesTokenEntry *this_entry;
+  BayesTokenEntry *tot_entry;
   BayesTokens *tokens;
+  guint32 hash;
+  gsize len;
 
   g_assert (BAYES_IS_STORAGE_MEMORY (self));
   g_assert (name);
@@ -355,40 +1636,112 @@ bayes_storage_memory_get_token_probability (BayesStorage *storage,
   if (!(tokens = g_hash_table_lookup(self->names, name)))
     return 0.0;
 
-  pool_count = tokens->count;
-  them_count = MAX (self->corpus->count - pool_count, 1);
-  this_count = bayes_storage_memory_get_token_count (storage, name, token);
-  tot_count = bayes_storage_memory_get_token_count (storage, NULL, token);
-  other_count = tot_count - this_count;
-  good_metric = (!pool_count) ? 1.0 : MIN (1.0, other_count / pool_count);
-  bad_metric = MIN (1.0, this_count / them_count);
-  f = bad_metric / (good_metric + bad_metric);
+  len = strlen (token);
+  hash = bayes_tokens_hash (token, len);
 
-  if (ABS (f - 0.5) >= 0.1)
-     return MAX (0.0001, MIN (0.9999, f));
+  /* Tokens that were never trained on are in none of the tables. */
+  if (!bayes_bloom_contains (self->bloom, hash))
+    return bayes_storage_compute_probability (tokens->count, self->corpus->count, 0, 0);
 
-  return 0.0;
+  this_entry = bayes_tokens_lookup_entry (tokens, token, len, hash);
+  tot_entry = bayes_tokens_lookup_entry (self->corpus, token, len, hash);
+
+  return bayes_storage_compute_probability (tokens->count,
+                                            self->corpus->count,
+                                            this_entry ? this_entry->count : 0,
+                                            tot_entry ? tot_entry->count : 0);
 }
 
 static gchar **
 bayes_storage_memory_get_names (BayesStorage *storage)
 {
   BayesStorageMemory *self = (BayesStorageMemory *)storage;
-  GHashTableIter iter;
   GPtrArray *ret;
-  gchar *key;
+  guint i;
 
   g_assert (BAYES_IS_STORAGE_MEMORY (self));
 
-  ret = g_ptr_array_new ();
-  g_hash_table_iter_init (&iter, self->names);
-  while (g_hash_table_iter_next (&iter, (gpointer *)&key, NULL))
-    g_ptr_array_add (ret, g_strdup (key));
+  /*
+   * In the order of the class ids used by get_postings().
+   */
+  ret = g_ptr_array_sized_new (self->classes->len + 1);
+  for (i = 0; i < self->classes->len; i++)
+    g_ptr_array_add (ret, g_strdup (g_array_index (self->classes, BayesClass, i).name));
   g_ptr_array_add (ret, NULL);
 
   return (gchar **)g_ptr_array_free(ret, FALSE);
 }
 
+static guint
+bayes_storage_memory_get_postings (BayesStorage *storage,
+                                   const gchar  *token,
+                                   GArray       *postings)
+{
+  BayesStorageMemory *self = (BayesStorageMemory *)storage;
+  const BayesPostingNode *node;
+  BayesTokenEntry *entry;
+  BayesPosting posting;
+  BayesClass *klass;
+  guint32 *head;
+  guint32 node_id;
+  guint32 hash;
+  gsize len;
+  guint n = 0;
+
+  g_assert (BAYES_IS_STORAGE_MEMORY (self));
+  g_assert (token);
+  g_assert (postings);
+
+  bayes_storage_memory_ensure_postings (self);
+
+  len = strlen (token);
+  hash = bayes_tokens_hash (token, len);
+
+  if (!(head = bayes_tokens_lookup_value (self->corpus, token, len, hash)))
+    return 0;
+
+  for (node_id = *head; node_id != 0; node_id = node->next)
+    {
+      node = &g_array_index (self->postings, BayesPostingNode, node_id);
+      klass = &g_array_index (self->classes, BayesClass, node->class_id);
+
+      if ((entry = bayes_tokens_lookup_entry (klass->tokens, token, len, hash)))
+        {
+          posting.class_id = node->class_id;
+          posting.count = entry->count;
+          g_array_append_val (postings, posting);
+          n++;
+        }
+    }
+
+  return n;
+}
+
+static void
+bayes_storage_memory_foreach (BayesStorage            *storage,
+                              BayesStorageForeachFunc  func,
+                              gpointer                 user_data)
+{
+  BayesStorageMemory *self = (BayesStorageMemory *)storage;
+  const gchar *token;
+  BayesClass *klass;
+  guint count;
+  guint pos;
+  guint i;
+
+  g_assert (BAYES_IS_STORAGE_MEMORY (self));
+  g_assert (func);
+
+  for (i = 0; i < self->classes->len; i++)
+    {
+      klass = &g_array_index (self->classes, BayesClass, i);
+
+      pos = 0;
+      while (bayes_tokens_iter_next (klass->tokens, &pos, &token, &count))
+        func (klass->name, token, count, user_data);
+    }
+}
+
 static void
 bayes_storage_hashtable_deserialize_foreach (JsonObject *table_object,
 					     const gchar *member_name,
@@ -479,6 +1832,16 @@ bayes_storage_memory_serialize_property (JsonSerializable *serializable,
 
 		boxed = g_value_get_boxed (value);
 		node = json_boxed_serialize (BAYES_TYPE_TOKENS, boxed);
+	} else if (pspec == obj_properties [PROP_MEMORY_BUDGET] ||
+		   pspec == obj_properties [PROP_PRUNE_COUNT] ||
+		   pspec == obj_properties [PROP_PRUNE_AGE] ||
+		   pspec == obj_properties [PROP_HALF_LIFE] ||
+		   pspec == obj_properties [PROP_TRACK_CHANGES]) {
+		/*
+		 * pruning, decay and tracking settings belong to the process,
+		 * not the training data
+		 */
+		node = NULL;
 	} else
 		node = serializable_iface->serialize_property (serializable, prop_name, value, pspec);
 
@@ -500,6 +1863,21 @@ bayes_storage_memory_get_property (GObject    *object,
 	case PROP_CORPUS:
 		g_value_set_boxed (value, self->corpus);
 		break;
+	case PROP_MEMORY_BUDGET:
+		g_value_set_uint64 (value, self->memory_budget);
+		break;
+	case PROP_PRUNE_COUNT:
+		g_value_set_uint (value, self->prune_count);
+		break;
+	case PROP_PRUNE_AGE:
+		g_value_set_uint (value, self->prune_age);
+		break;
+	case PROP_HALF_LIFE:
+		g_value_set_uint64 (value, self->half_life);
+		break;
+	case PROP_TRACK_CHANGES:
+		g_value_set_boolean (value, self->dirty != NULL);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 	}
@@ -515,13 +1893,42 @@ bayes_storage_memory_set_property (GObject     *object,
 
 	switch (prop_id) {
 	case PROP_NAMES:
+		bayes_storage_memory_clear_young (self);
+		g_clear_pointer (&self->names, g_hash_table_unref);
 		self->names = g_value_dup_boxed (value);
+		bayes_storage_memory_index_classes (self);
+		/* the new tables are the new state to track changes from */
+		if (self->dirty != NULL)
+			bayes_storage_memory_start_tracking (self);
+		else
+			bayes_storage_memory_update_memory_used (self);
 		g_object_notify_by_pspec (object, obj_properties [PROP_NAMES]);
 		break;
 	case PROP_CORPUS:
+		bayes_storage_memory_clear_postings (self);
+		g_clear_pointer (&self->corpus, bayes_tokens_free);
 		self->corpus = g_value_dup_boxed (value);
+		if (self->corpus != NULL)
+			bayes_tokens_set_values (self->corpus, FALSE);
+		bayes_storage_memory_rebuild_bloom (self);
+		bayes_storage_memory_update_memory_used (self);
 		g_object_notify_by_pspec (object, obj_properties [PROP_CORPUS]);
 		break;
+	case PROP_MEMORY_BUDGET:
+		bayes_storage_memory_set_memory_budget (self, g_value_get_uint64 (value));
+		break;
+	case PROP_PRUNE_COUNT:
+		self->prune_count = g_value_get_uint (value);
+		break;
+	case PROP_PRUNE_AGE:
+		self->prune_age = g_value_get_uint (value);
+		break;
+	case PROP_HALF_LIFE:
+		bayes_storage_memory_set_half_life (self, g_value_get_uint64 (value));
+		break;
+	case PROP_TRACK_CHANGES:
+		bayes_storage_memory_set_track_changes (self, g_value_get_boolean (value));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 	}
@@ -534,6 +1941,13 @@ bayes_storage_memory_finalize (GObject *object)
 
   g_hash_table_unref (self->names);
   bayes_tokens_free (self->corpus);
+  g_array_unref (self->young);
+  g_array_unref (self->classes);
+  g_hash_table_unref (self->class_ids);
+  g_clear_pointer (&self->postings, g_array_unref);
+  g_mutex_clear (&self->postings_mutex);
+  g_clear_pointer (&self->dirty, g_hash_table_unref);
+  bayes_bloom_free (self->bloom);
 
   G_OBJECT_CLASS (bayes_storage_memory_parent_class)->finalize (object);
 }
@@ -570,6 +1984,65 @@ bayes_storage_memory_class_init (BayesStorageMemoryClass *klass)
 			      BAYES_TYPE_TOKENS,
 			      G_PARAM_READWRITE | G_PARAM_PRIVATE |
 			      G_PARAM_STATIC_STRINGS);
+  /**
+   * BayesStorageMemory:memory-budget:
+   *
+   * Approximate number of bytes the token tables may use before rare
+   * tokens are evicted, or 0 for no limit.
+   */
+  obj_properties[PROP_MEMORY_BUDGET] =
+	  g_param_spec_uint64 ("memory-budget", "Memory Budget",
+			       "Approximate memory budget in bytes",
+			       0, G_MAXUINT64, 0,
+			       G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY |
+			       G_PARAM_STATIC_STRINGS);
+  /**
+   * BayesStorageMemory:prune-count:
+   *
+   * Tokens seen at most this many times within a classification may be
+   * evicted when the memory budget is exceeded.
+   */
+  obj_properties[PROP_PRUNE_COUNT] =
+	  g_param_spec_uint ("prune-count", "Prune Count",
+			     "Largest count of a token that may be evicted",
+			     1, G_MAXUINT, 1,
+			     G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  /**
+   * BayesStorageMemory:prune-age:
+   *
+   * The number of token occurrences that must be added after a token was
+   * first seen before it may be evicted.
+   */
+  obj_properties[PROP_PRUNE_AGE] =
+	  g_param_spec_uint ("prune-age", "Prune Age",
+			     "Token occurrences before a token may be evicted",
+			     0, G_MAXUINT, 10000,
+			     G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  /**
+   * BayesStorageMemory:half-life:
+   *
+   * The number of token occurrences after which counts are halved, or 0
+   * if counts do not decay. See bayes_storage_memory_set_half_life().
+   */
+  obj_properties[PROP_HALF_LIFE] =
+	  g_param_spec_uint64 ("half-life", "Half-life",
+			       "Token occurrences after which counts are halved",
+			       0, G_MAXUINT64, 0,
+			       G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY |
+			       G_PARAM_STATIC_STRINGS);
+  /**
+   * BayesStorageMemory:track-changes:
+   *
+   * Whether the tokens whose counts change are tracked for
+   * bayes_storage_memory_save_delta(). See
+   * bayes_storage_memory_set_track_changes().
+   */
+  obj_properties[PROP_TRACK_CHANGES] =
+	  g_param_spec_boolean ("track-changes", "Track Changes",
+				"Whether changes are tracked for delta saves",
+				FALSE,
+				G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY |
+				G_PARAM_STATIC_STRINGS);
   g_object_class_install_properties (object_class,
 		  		     N_PROPERTIES, obj_properties);
 }
@@ -591,12 +2064,16 @@ bayes_storage_memory_find_property (JsonSerializable *serializable,
 static void
 bayes_storage_memory_init (BayesStorageMemory *self)
 {
-  BayesTokens *tokens;
-
   self->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, bayes_tokens_free);
-  tokens = g_new0(BayesTokens, 1);
-  tokens->tokens = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
-  self->corpus = tokens;
+  self->corpus = bayes_tokens_new ();
+  self->bloom = bayes_bloom_new (BLOOM_MIN_CAPACITY);
+
+  self->prune_count = 1;
+  self->prune_age = 10000;
+  self->young = g_array_new (FALSE, FALSE, sizeof (BayesYoungToken));
+  self->classes = g_array_new (FALSE, FALSE, sizeof (BayesClass));
+  self->class_ids = g_hash_table_new (NULL, NULL);
+  g_mutex_init (&self->postings_mutex);
 }
 
 static void
@@ -606,6 +2083,9 @@ bayes_storage_init (BayesStorageInterface *iface)
   iface->get_names = bayes_storage_memory_get_names;
   iface->get_token_count = bayes_storage_memory_get_token_count;
   iface->get_token_probability = bayes_storage_memory_get_token_probability;
+  iface->get_postings = bayes_storage_memory_get_postings;
+  iface->foreach = bayes_storage_memory_foreach;
+  iface->add_token_counts = bayes_storage_memory_add_token_counts;
 }
 
 static void json_serializable_iface_init (JsonSerializableIface *iface) {
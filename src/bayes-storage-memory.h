@@ -32,24 +32,6 @@ typedef struct _BayesTokens BayesTokens;
 
 G_DECLARE_FINAL_TYPE (BayesStorageMemory, bayes_storage_memory, BAYES, STORAGE_MEMORY, GObject)
 
-struct _BayesStorageMemory
-{
-  GObject     parent_instance;
-
-  /*< private >*/
-
-  /* somehow this is needed to get proper GI types for properties */
-  /**
-   * BayesStorageMemory:names: (type GLib.HashTable(utf8,Bayes.Tokens))
-   */
-  GHashTable  *names;
-
-  /**
-   * BayesStorageMemory:corpus: (type Bayes.Tokens)
-   */
-  BayesTokens *corpus;
-};
-
 /**
  * bayes_storage_memory_new:
  *
@@ -104,6 +86,194 @@ gboolean bayes_storage_memory_save_to_file (BayesStorageMemory *self,
 					    const gchar *filename,
 					    GError **error);
 
+/**
+ * bayes_storage_memory_new_from_files:
+ * @filename: Name of the file saved with bayes_storage_memory_save_to_file()
+ * @deltas: (array zero-terminated=1) (nullable): Names of the files saved
+ *   with bayes_storage_memory_save_delta() since, in the order they were
+ *   saved
+ * @error: (allow-none): Return location for an error, or %NULL
+ *
+ * Loads a storage from a full save and the chain of deltas saved after
+ * it, see bayes_storage_memory_load_delta().
+ *
+ * Returns: (transfer full): a new #BayesStorageMemory or %NULL if any of
+ * the files could not be loaded.
+ */
+BayesStorageMemory *bayes_storage_memory_new_from_files (const gchar         *filename,
+                                                         const gchar * const *deltas,
+                                                         GError             **error);
+
+/**
+ * bayes_storage_memory_save_delta:
+ * @self: a #BayesStorageMemory
+ * @filename: name of file to save
+ * @error: (allow-none): Return location for an error, or %NULL
+ *
+ * Saves only the tokens whose counts changed since @self was last saved,
+ * so that frequent checkpoints of a large storage cost as much as the
+ * training done in between. Tokens that were removed, by pruning or
+ * decay, are saved with a count of 0.
+ *
+ * This fails with %G_IO_ERROR_NOT_INITIALIZED unless changes are tracked,
+ * see bayes_storage_memory_set_track_changes().
+ *
+ * Returns: %FALSE if @error is set
+ */
+gboolean bayes_storage_memory_save_delta (BayesStorageMemory  *self,
+                                          const gchar         *filename,
+                                          GError             **error);
+
+/**
+ * bayes_storage_memory_load_delta:
+ * @self: a #BayesStorageMemory
+ * @filename: name of a file saved with bayes_storage_memory_save_delta()
+ * @error: (allow-none): Return location for an error, or %NULL
+ *
+ * Applies a delta to @self. Deltas must be applied in the order they
+ * were saved, to the storage loaded from the full save they follow.
+ *
+ * Returns: %FALSE if @error is set
+ */
+gboolean bayes_storage_memory_load_delta (BayesStorageMemory  *self,
+                                          const gchar         *filename,
+                                          GError             **error);
+
+/**
+ * bayes_storage_memory_get_memory_budget:
+ * @self: a #BayesStorageMemory
+ *
+ * Gets the memory budget set with bayes_storage_memory_set_memory_budget().
+ *
+ * Returns: the budget in bytes, or 0 if unlimited.
+ */
+guint64 bayes_storage_memory_get_memory_budget (BayesStorageMemory *self);
+
+/**
+ * bayes_storage_memory_set_memory_budget:
+ * @self: a #BayesStorageMemory
+ * @memory_budget: the budget in bytes, or 0 for unlimited
+ *
+ * Sets an approximate upper bound on the memory used by token tables.
+ *
+ * Once the budget is exceeded, rarely seen tokens are evicted a few at a
+ * time as new tokens are added. A token is a candidate for eviction when
+ * its count within a classification is at most
+ * #BayesStorageMemory:prune-count and at least
+ * #BayesStorageMemory:prune-age token occurrences have been added since
+ * it was first seen. The oldest candidates are evicted first.
+ *
+ * Only tokens first seen after a budget has been set are tracked, whether
+ * they are added or come from bayes_storage_memory_load_delta(), so
+ * training data loaded from a file before is never pruned. The queue of
+ * tokens not yet old enough to be pruned counts toward the budget.
+ */
+void bayes_storage_memory_set_memory_budget (BayesStorageMemory *self,
+                                             guint64             memory_budget);
+
+/**
+ * bayes_storage_memory_get_memory_used:
+ * @self: a #BayesStorageMemory
+ *
+ * Gets the estimated number of bytes used by the token tables of @self.
+ * This is the value compared against the memory budget.
+ *
+ * Returns: the estimated memory use in bytes.
+ */
+guint64 bayes_storage_memory_get_memory_used (BayesStorageMemory *self);
+
+/**
+ * bayes_storage_memory_get_half_life:
+ * @self: a #BayesStorageMemory
+ *
+ * Gets the half-life set with bayes_storage_memory_set_half_life().
+ *
+ * Returns: the half-life in token occurrences, or 0 if counts do not decay.
+ */
+guint64 bayes_storage_memory_get_half_life (BayesStorageMemory *self);
+
+/**
+ * bayes_storage_memory_set_half_life:
+ * @self: a #BayesStorageMemory
+ * @half_life: the half-life in token occurrences, or 0 to disable decay
+ *
+ * Makes old training data fade for filters that are trained continuously.
+ *
+ * Every time @half_life token occurrences have been added, the count of
+ * every token in every classification is halved, and tokens whose count
+ * drops to 0 are removed. The halving is spread over the token
+ * occurrences added during the following half-life rather than done at
+ * once, so training never pauses for a pass over the whole vocabulary.
+ * The counts of all classifications together are therefore bounded by
+ * about twice @half_life.
+ *
+ * Counts are rounded down and up on alternate halvings so that tokens
+ * seen once are not favoured or forgotten more than others.
+ */
+void bayes_storage_memory_set_half_life (BayesStorageMemory *self,
+                                         guint64             half_life);
+
+/**
+ * bayes_storage_memory_get_track_changes:
+ * @self: a #BayesStorageMemory
+ *
+ * Gets whether changes are tracked for bayes_storage_memory_save_delta().
+ *
+ * Returns: %TRUE if changes are tracked.
+ */
+gboolean bayes_storage_memory_get_track_changes (BayesStorageMemory *self);
+
+/**
+ * bayes_storage_memory_set_track_changes:
+ * @self: a #BayesStorageMemory
+ * @track_changes: whether to track changes
+ *
+ * Starts or stops tracking the tokens whose counts change, so that they
+ * can be saved with bayes_storage_memory_save_delta().
+ *
+ * Tracking starts from the current state of @self, which should be the
+ * state of a file, so enable it right after loading @self or before
+ * saving it with bayes_storage_memory_save_to_file(). Every full save
+ * starts tracking again from the state saved.
+ *
+ * Tracking costs a flag per token and a copy of every token changed
+ * until the next save. Both are counted in
+ * bayes_storage_memory_get_memory_used().
+ */
+void bayes_storage_memory_set_track_changes (BayesStorageMemory *self,
+                                             gboolean            track_changes);
+
+/**
+ * bayes_storage_memory_get_memory_stats:
+ * @self: a #BayesStorageMemory
+ *
+ * Gets a breakdown of what the token tables of @self cost. The cost of
+ * this call grows with the number of classifications, not with the
+ * number of tokens.
+ *
+ * The result is a dictionary of type "a{sv}" with the following keys:
+ *
+ * - "classes": the number of classifications.
+ * - "distinct-tokens" and "token-occurrences": the number of distinct
+ *   tokens and the sum of their counts across all classifications.
+ * - "key-bytes": the bytes holding token strings that are still in use.
+ *   "arena-bytes" is what was allocated for them.
+ * - "bucket-bytes" and "load-factor": the size and fill ratio of the
+ *   hash table buckets.
+ * - "bloom-bytes": the size of the filter of the tokens of the corpus.
+ * - "postings-bytes": the size of the inverted index used by
+ *   bayes_storage_get_postings(), or 0 if it has not been built.
+ * - "memory-used": see bayes_storage_memory_get_memory_used().
+ * - "serialized-size": an estimate of the size written by
+ *   bayes_storage_memory_save_to_file().
+ *
+ * "corpus" and each entry of "by-class" hold the same figures for a
+ * single table, with "tokens" and "occurrences" for its counts.
+ *
+ * Returns: (transfer full): A #GVariant.
+ */
+GVariant *bayes_storage_memory_get_memory_stats (BayesStorageMemory *self);
+
 G_END_DECLS
 
 #endif /* BAYES_STORAGE_MEMORY_H */
@@ -0,0 +1,64 @@
+/* bayes-storage-private.h
+ *
+ * Copyright (C) 2012 Christian Hergert <chris@dronelabs.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BAYES_STORAGE_PRIVATE_H
+#define BAYES_STORAGE_PRIVATE_H
+
+#include <glib.h>
+
+#include "bayes-storage.h"
+
+G_BEGIN_DECLS
+
+gboolean bayes_storage_can_foreach (BayesStorage *self);
+
+/*
+ * The token probability shared by the storage implementations.
+ *
+ * @pool_count is the number of tokens in the classification, @corpus_count
+ * the number of tokens in all classifications, @this_count the number of
+ * times the token was found in the classification and @tot_count the
+ * number of times it was found in all classifications.
+ */
+static inline gdouble
+bayes_storage_compute_probability (gdouble pool_count,
+                                   gdouble corpus_count,
+                                   gdouble this_count,
+                                   gdouble tot_count)
+{
+  gdouble them_count;
+  gdouble other_count;
+  gdouble good_metric;
+  gdouble bad_metric;
+  gdouble f;
+
+  them_count = MAX (corpus_count - pool_count, 1);
+  other_count = tot_count - this_count;
+  good_metric = (!pool_count) ? 1.0 : MIN (1.0, other_count / pool_count);
+  bad_metric = MIN (1.0, this_count / them_count);
+  f = bad_metric / (good_metric + bad_metric);
+
+  if (ABS (f - 0.5) >= 0.1)
+     return MAX (0.0001, MIN (0.9999, f));
+
+  return 0.0;
+}
+
+G_END_DECLS
+
+#endif /* BAYES_STORAGE_PRIVATE_H */
@@ -0,0 +1,605 @@
+/* bayes-storage-sketch.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bayes-hash-private.h"
+#include "bayes-storage-private.h"
+#include "bayes-storage-sketch.h"
+
+/**
+ * SECTION:bayes-storage-sketch
+ * @title: BayesStorageSketch
+ * @short_description: Approximate storage of training data in fixed memory.
+ *
+ * #BayesStorageSketch is an implementation of #BayesStorage that counts
+ * tokens in a count-min sketch per classification. The memory used and
+ * the cost of a lookup do not depend on the number of distinct tokens,
+ * at the price of counts that may be overestimated. This suits very
+ * large vocabularies such as URLs or message headers.
+ *
+ * Optionally, the most frequent tokens of each classification can be
+ * counted exactly in a small table of heavy hitters.
+ *
+ * bayes_storage_get_names() is supported but the tokens themselves are
+ * not kept, so the training data cannot be enumerated or serialized.
+ */
+
+/*
+ * A token counted exactly. @base is its estimate when it was promoted and
+ * @pos its index in the heap of its sketch.
+ */
+typedef struct
+{
+  gchar *token;
+  guint  count;
+  guint  base;
+  guint  pos;
+} BayesHeavyHitter;
+
+/*
+ * The heavy hitters are found by token in @heavy, and kept in @heap, a
+ * binary min-heap by count, so that the one to replace is always at the
+ * root.
+ */
+typedef struct
+{
+  guint32    *counters;
+  guint       count;
+  GHashTable *heavy;
+  GPtrArray  *heap;
+} BayesSketch;
+
+struct _BayesStorageSketch
+{
+  GObject      parent_instance;
+
+  guint        width;
+  guint        depth;
+  guint        n_heavy_hitters;
+
+  GHashTable  *names;
+  BayesSketch *corpus;
+};
+
+static void bayes_storage_init (BayesStorageInterface *iface);
+
+G_DEFINE_TYPE_EXTENDED (BayesStorageSketch,
+                        bayes_storage_sketch,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (BAYES_TYPE_STORAGE, bayes_storage_init))
+
+enum {
+  PROP_0,
+  PROP_WIDTH,
+  PROP_DEPTH,
+  PROP_N_HEAVY_HITTERS,
+  LAST_PROP
+};
+
+static GParamSpec *properties [LAST_PROP];
+
+static void
+bayes_heavy_hitter_free (gpointer data)
+{
+  BayesHeavyHitter *hitter = data;
+
+  g_free (hitter->token);
+  g_slice_free (BayesHeavyHitter, hitter);
+}
+
+static BayesSketch *
+bayes_sketch_new (BayesStorageSketch *self)
+{
+  BayesSketch *sketch;
+
+  sketch = g_slice_new0 (BayesSketch);
+  sketch->counters = g_new0 (guint32, (gsize)self->width * self->depth);
+
+  if (self->n_heavy_hitters != 0)
+    {
+      sketch->heavy = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                             bayes_heavy_hitter_free);
+      sketch->heap = g_ptr_array_sized_new (self->n_heavy_hitters);
+    }
+
+  return sketch;
+}
+
+static void
+bayes_sketch_free (gpointer data)
+{
+  BayesSketch *sketch = data;
+
+  if (sketch != NULL)
+    {
+      g_clear_pointer (&sketch->heap, g_ptr_array_unref);
+      g_clear_pointer (&sketch->heavy, g_hash_table_unref);
+      g_free (sketch->counters);
+      g_slice_free (BayesSketch, sketch);
+    }
+}
+
+/*
+ * The rows are indexed by double hashing, the upper and lower halves of
+ * the 64-bit hash serving as the two hash functions.
+ */
+static inline guint
+bayes_sketch_index (BayesStorageSketch *self,
+                    guint64             hash,
+                    guint               row)
+{
+  guint32 h1 = (guint32)hash;
+  guint32 h2 = (guint32)(hash >> 32) | 1;
+
+  return row * self->width + ((h1 + row * h2) & (self->width - 1));
+}
+
+static guint
+bayes_sketch_estimate (BayesStorageSketch *self,
+                       BayesSketch        *sketch,
+                       guint64             hash)
+{
+  guint32 min = G_MAXUINT32;
+  guint i;
+
+  for (i = 0; i < self->depth; i++)
+    min = MIN (min, sketch->counters [bayes_sketch_index (self, hash, i)]);
+
+  return min;
+}
+
+/*
+ * Conservative update: only the counters that are below the new estimate
+ * are raised, which keeps the overestimation of other tokens down.
+ * Returns the new estimate for @hash.
+ */
+static guint
+bayes_sketch_update (BayesStorageSketch *self,
+                     BayesSketch        *sketch,
+                     guint64             hash,
+                     guint               count)
+{
+  guint32 *counter;
+  guint32 estimate;
+  guint i;
+
+  estimate = bayes_sketch_estimate (self, sketch, hash);
+  estimate = (count > G_MAXUINT32 - estimate) ? G_MAXUINT32 : estimate + count;
+
+  for (i = 0; i < self->depth; i++)
+    {
+      counter = &sketch->counters [bayes_sketch_index (self, hash, i)];
+      if (*counter < estimate)
+        *counter = estimate;
+    }
+
+  return estimate;
+}
+
+static inline void
+bayes_sketch_heap_set (BayesSketch      *sketch,
+                       guint             pos,
+                       BayesHeavyHitter *hitter)
+{
+  g_ptr_array_index (sketch->heap, pos) = hitter;
+  hitter->pos = pos;
+}
+
+/*
+ * Moves @hitter down the heap after its count grew.
+ */
+static void
+bayes_sketch_heap_down (BayesSketch      *sketch,
+                        BayesHeavyHitter *hitter)
+{
+  BayesHeavyHitter *child;
+  guint pos = hitter->pos;
+  guint n = sketch->heap->len;
+  guint c;
+
+  while ((c = 2 * pos + 1) < n)
+    {
+      child = g_ptr_array_index (sketch->heap, c);
+      if (c + 1 < n &&
+          ((BayesHeavyHitter *)g_ptr_array_index (sketch->heap, c + 1))->count < child->count)
+        child = g_ptr_array_index (sketch->heap, ++c);
+
+      if (hitter->count <= child->count)
+        break;
+
+      bayes_sketch_heap_set (sketch, pos, child);
+      pos = c;
+    }
+
+  bayes_sketch_heap_set (sketch, pos, hitter);
+}
+
+/*
+ * Inserts @hitter at the end of the heap and moves it up.
+ */
+static void
+bayes_sketch_heap_push (BayesSketch      *sketch,
+                        BayesHeavyHitter *hitter)
+{
+  BayesHeavyHitter *parent;
+  guint pos;
+
+  pos = sketch->heap->len;
+  g_ptr_array_add (sketch->heap, hitter);
+
+  while (pos > 0)
+    {
+      parent = g_ptr_array_index (sketch->heap, (pos - 1) / 2);
+      if (parent->count <= hitter->count)
+        break;
+
+      bayes_sketch_heap_set (sketch, pos, parent);
+      pos = (pos - 1) / 2;
+    }
+
+  bayes_sketch_heap_set (sketch, pos, hitter);
+}
+
+static void
+bayes_sketch_promote (BayesStorageSketch *self,
+                      BayesSketch        *sketch,
+                      const gchar        *token,
+                      guint               estimate)
+{
+  BayesHeavyHitter *hitter;
+  BayesHeavyHitter *min_hitter;
+
+  hitter = g_slice_new (BayesHeavyHitter);
+  hitter->token = g_strdup (token);
+  hitter->count = estimate;
+  hitter->base = estimate;
+
+  if (sketch->heap->len < self->n_heavy_hitters)
+    {
+      g_hash_table_insert (sketch->heavy, hitter->token, hitter);
+      bayes_sketch_heap_push (sketch, hitter);
+      return;
+    }
+
+  /*
+   * Give the occurrences counted exactly since the promotion of the
+   * least frequent heavy hitter back to the sketch, and replace it.
+   */
+  min_hitter = g_ptr_array_index (sketch->heap, 0);
+
+  if (min_hitter->count > min_hitter->base)
+    bayes_sketch_update (self, sketch, bayes_hash_str (min_hitter->token),
+                         min_hitter->count - min_hitter->base);
+  g_hash_table_remove (sketch->heavy, min_hitter->token);
+
+  g_hash_table_insert (sketch->heavy, hitter->token, hitter);
+  bayes_sketch_heap_set (sketch, 0, hitter);
+  bayes_sketch_heap_down (sketch, hitter);
+}
+
+static void
+bayes_sketch_add (BayesStorageSketch *self,
+                  BayesSketch        *sketch,
+                  const gchar        *token,
+                  guint64             hash,
+                  guint               count)
+{
+  BayesHeavyHitter *hitter;
+  guint estimate;
+
+  sketch->count += count;
+
+  if (sketch->heavy != NULL && (hitter = g_hash_table_lookup (sketch->heavy, token)))
+    {
+      hitter->count = (count > G_MAXUINT - hitter->count) ? G_MAXUINT : hitter->count + count;
+      bayes_sketch_heap_down (sketch, hitter);
+      return;
+    }
+
+  estimate = bayes_sketch_update (self, sketch, hash, count);
+
+  if (sketch->heavy != NULL &&
+      (sketch->heap->len < self->n_heavy_hitters ||
+       estimate > ((BayesHeavyHitter *)g_ptr_array_index (sketch->heap, 0))->count))
+    bayes_sketch_promote (self, sketch, token, estimate);
+}
+
+static guint
+bayes_sketch_get (BayesStorageSketch *self,
+                  BayesSketch        *sketch,
+                  const gchar        *token,
+                  guint64             hash)
+{
+  BayesHeavyHitter *hitter;
+
+  if (sketch->heavy != NULL && (hitter = g_hash_table_lookup (sketch->heavy, token)))
+    return hitter->count;
+
+  return bayes_sketch_estimate (self, sketch, hash);
+}
+
+BayesStorageSketch *
+bayes_storage_sketch_new (guint width,
+                          guint depth)
+{
+  return bayes_storage_sketch_new_full (width, depth, 0);
+}
+
+BayesStorageSketch *
+bayes_storage_sketch_new_full (guint width,
+                               guint depth,
+                               guint n_heavy_hitters)
+{
+  g_return_val_if_fail (width > 0, NULL);
+  g_return_val_if_fail (depth > 0, NULL);
+
+  return g_object_new (BAYES_TYPE_STORAGE_SKETCH,
+                       "width", width,
+                       "depth", depth,
+                       "n-heavy-hitters", n_heavy_hitters,
+                       NULL);
+}
+
+gsize
+bayes_storage_sketch_get_memory_size (BayesStorageSketch *self)
+{
+  g_return_val_if_fail (BAYES_IS_STORAGE_SKETCH (self), 0);
+
+  return (gsize)self->width * self->depth * sizeof (guint32);
+}
+
+static void
+bayes_storage_sketch_add_token_count (BayesStorage *storage,
+                                      const gchar  *name,
+                                      const gchar  *token,
+                                      guint         count)
+{
+  BayesStorageSketch *self = (BayesStorageSketch *)storage;
+  BayesSketch *sketch;
+  guint64 hash;
+
+  g_assert (BAYES_IS_STORAGE_SKETCH (self));
+  g_assert (name);
+  g_assert (token);
+
+  if (!(sketch = g_hash_table_lookup (self->names, name)))
+    {
+      sketch = bayes_sketch_new (self);
+      g_hash_table_insert (self->names, g_strdup (name), sketch);
+    }
+
+  hash = bayes_hash_str (token);
+
+  bayes_sketch_add (self, sketch, token, hash, count);
+  bayes_sketch_add (self, self->corpus, token, hash, count);
+}
+
+static gchar **
+bayes_storage_sketch_get_names (BayesStorage *storage)
+{
+  BayesStorageSketch *self = (BayesStorageSketch *)storage;
+  GHashTableIter iter;
+  GPtrArray *ret;
+  gchar *key;
+
+  g_assert (BAYES_IS_STORAGE_SKETCH (self));
+
+  ret = g_ptr_array_new ();
+  g_hash_table_iter_init (&iter, self->names);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&key, NULL))
+    g_ptr_array_add (ret, g_strdup (key));
+  g_ptr_array_add (ret, NULL);
+
+  return (gchar **)g_ptr_array_free (ret, FALSE);
+}
+
+static guint
+bayes_storage_sketch_get_token_count (BayesStorage *storage,
+                                      const gchar  *name,
+                                      const gchar  *token)
+{
+  BayesStorageSketch *self = (BayesStorageSketch *)storage;
+  BayesSketch *sketch;
+
+  g_assert (BAYES_IS_STORAGE_SKETCH (self));
+
+  sketch = name ? g_hash_table_lookup (self->names, name) : self->corpus;
+
+  if (sketch == NULL)
+    return 0;
+  else if (token == NULL)
+    return sketch->count;
+  else
+    return bayes_sketch_get (self, sketch, token, bayes_hash_str (token));
+}
+
+static gdouble
+bayes_storage_sketch_get_token_probability (BayesStorage *storage,
+                                            const gchar  *name,
+                                            const gchar  *token)
+{
+  BayesStorageSketch *self = (BayesStorageSketch *)storage;
+  BayesSketch *sketch;
+  guint this_count;
+  guint tot_count;
+  guint64 hash;
+
+  g_assert (BAYES_IS_STORAGE_SKETCH (self));
+  g_assert (name);
+  g_assert (token);
+
+  if (!(sketch = g_hash_table_lookup (self->names, name)))
+    return 0.0;
+
+  hash = bayes_hash_str (token);
+  this_count = bayes_sketch_get (self, sketch, token, hash);
+  tot_count = bayes_sketch_get (self, self->corpus, token, hash);
+
+  /*
+   * Both counts are overestimates with independent errors, keep them
+   * consistent with each other.
+   */
+  tot_count = MAX (tot_count, this_count);
+
+  return bayes_storage_compute_probability (sketch->count,
+                                            self->corpus->count,
+                                            this_count,
+                                            tot_count);
+}
+
+static void
+bayes_storage_sketch_constructed (GObject *object)
+{
+  BayesStorageSketch *self = (BayesStorageSketch *)object;
+
+  G_OBJECT_CLASS (bayes_storage_sketch_parent_class)->constructed (object);
+
+  self->corpus = bayes_sketch_new (self);
+}
+
+static void
+bayes_storage_sketch_finalize (GObject *object)
+{
+  BayesStorageSketch *self = (BayesStorageSketch *)object;
+
+  g_clear_pointer (&self->names, g_hash_table_unref);
+  g_clear_pointer (&self->corpus, bayes_sketch_free);
+
+  G_OBJECT_CLASS (bayes_storage_sketch_parent_class)->finalize (object);
+}
+
+static void
+bayes_storage_sketch_get_property (GObject    *object,
+                                   guint       prop_id,
+                                   GValue     *value,
+                                   GParamSpec *pspec)
+{
+  BayesStorageSketch *self = BAYES_STORAGE_SKETCH (object);
+
+  switch (prop_id)
+    {
+    case PROP_WIDTH:
+      g_value_set_uint (value, self->width);
+      break;
+
+    case PROP_DEPTH:
+      g_value_set_uint (value, self->depth);
+      break;
+
+    case PROP_N_HEAVY_HITTERS:
+      g_value_set_uint (value, self->n_heavy_hitters);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+bayes_storage_sketch_set_property (GObject      *object,
+                                   guint         prop_id,
+                                   const GValue *value,
+                                   GParamSpec   *pspec)
+{
+  BayesStorageSketch *self = BAYES_STORAGE_SKETCH (object);
+  guint width;
+
+  switch (prop_id)
+    {
+    case PROP_WIDTH:
+      width = g_value_get_uint (value);
+      self->width = (width > 1) ? 1U << g_bit_storage (width - 1) : 1;
+      break;
+
+    case PROP_DEPTH:
+      self->depth = g_value_get_uint (value);
+      break;
+
+    case PROP_N_HEAVY_HITTERS:
+      self->n_heavy_hitters = g_value_get_uint (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+bayes_storage_sketch_class_init (BayesStorageSketchClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->constructed = bayes_storage_sketch_constructed;
+  object_class->finalize = bayes_storage_sketch_finalize;
+  object_class->get_property = bayes_storage_sketch_get_property;
+  object_class->set_property = bayes_storage_sketch_set_property;
+
+  /**
+   * BayesStorageSketch:width:
+   *
+   * The number of counters in each row of a sketch, a power of two.
+   */
+  properties [PROP_WIDTH] =
+    g_param_spec_uint ("width",
+                       "Width",
+                       "The number of counters in each row of a sketch.",
+                       1, 1U << 31, 1U << 16,
+                       (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * BayesStorageSketch:depth:
+   *
+   * The number of rows of a sketch.
+   */
+  properties [PROP_DEPTH] =
+    g_param_spec_uint ("depth",
+                       "Depth",
+                       "The number of rows of a sketch.",
+                       1, 32, 4,
+                       (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * BayesStorageSketch:n-heavy-hitters:
+   *
+   * The number of the most frequent tokens of each classification that
+   * are counted exactly, or 0 to count all tokens in the sketch.
+   */
+  properties [PROP_N_HEAVY_HITTERS] =
+    g_param_spec_uint ("n-heavy-hitters",
+                       "Heavy Hitters",
+                       "The number of tokens counted exactly per classification.",
+                       0, G_MAXUINT, 0,
+                       (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_properties (object_class, LAST_PROP, properties);
+}
+
+static void
+bayes_storage_sketch_init (BayesStorageSketch *self)
+{
+  self->names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, bayes_sketch_free);
+}
+
+static void
+bayes_storage_init (BayesStorageInterface *iface)
+{
+  iface->add_token_count = bayes_storage_sketch_add_token_count;
+  iface->get_names = bayes_storage_sketch_get_names;
+  iface->get_token_count = bayes_storage_sketch_get_token_count;
+  iface->get_token_probability = bayes_storage_sketch_get_token_probability;
+}
@@ -0,0 +1,82 @@
+/* bayes-storage-sketch.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BAYES_STORAGE_SKETCH_H
+#define BAYES_STORAGE_SKETCH_H
+
+#include "bayes-storage.h"
+
+G_BEGIN_DECLS
+
+#define BAYES_TYPE_STORAGE_SKETCH (bayes_storage_sketch_get_type())
+
+G_DECLARE_FINAL_TYPE (BayesStorageSketch, bayes_storage_sketch, BAYES, STORAGE_SKETCH, GObject)
+
+/**
+ * bayes_storage_sketch_new:
+ * @width: the number of counters in each row of a sketch
+ * @depth: the number of rows of a sketch
+ *
+ * Creates a new #BayesStorageSketch that counts tokens approximately
+ * using a count-min sketch of @depth rows of @width counters for each
+ * classification and one for the corpus. @width is rounded up to the
+ * next power of two.
+ *
+ * A count retrieved from the storage is never lower than the exact
+ * count. With a total of N occurrences added to a sketch, it exceeds
+ * the exact count by more than e × N / @width with a probability of at
+ * most e^-@depth.
+ *
+ * Returns: (transfer full): A new #BayesStorageSketch
+ */
+BayesStorageSketch *bayes_storage_sketch_new              (guint               width,
+                                                           guint               depth);
+
+/**
+ * bayes_storage_sketch_new_full:
+ * @width: the number of counters in each row of a sketch
+ * @depth: the number of rows of a sketch
+ * @n_heavy_hitters: the number of tokens counted exactly per classification
+ *
+ * Like bayes_storage_sketch_new() but additionally keeps exact counts of
+ * up to @n_heavy_hitters of the most frequent tokens of each
+ * classification. Frequent tokens contribute the most to the error of
+ * the sketch, keeping them out of it tightens the bound for all other
+ * tokens.
+ *
+ * Returns: (transfer full): A new #BayesStorageSketch
+ */
+BayesStorageSketch *bayes_storage_sketch_new_full         (guint               width,
+                                                           guint               depth,
+                                                           guint               n_heavy_hitters);
+
+/**
+ * bayes_storage_sketch_get_memory_size:
+ * @self: a #BayesStorageSketch
+ *
+ * Gets the number of bytes used by the counters of a single sketch,
+ * excluding the table of heavy hitters. Every classification and the
+ * corpus use one sketch each.
+ *
+ * Returns: the size of a sketch in bytes.
+ */
+gsize               bayes_storage_sketch_get_memory_size  (BayesStorageSketch *self);
+
+G_END_DECLS
+
+#endif /* BAYES_STORAGE_SKETCH_H */
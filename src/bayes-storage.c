@@ -17,6 +17,7 @@
  */
 
 #include "bayes-storage.h"
+#include "bayes-storage-private.h"
 
 /**
  * SECTION:bayes-storage
@@ -39,6 +40,23 @@ bayes_storage_real_add_token_count (BayesStorage *self,
 {
 }
 
+static void
+bayes_storage_real_add_token_counts (BayesStorage        *self,
+                                     const gchar         *name,
+                                     const gchar * const *tokens,
+                                     const guint         *counts,
+                                     guint                n_tokens)
+{
+  BayesStorageInterface *iface = BAYES_STORAGE_GET_IFACE (self);
+  guint i;
+
+  for (i = 0; i < n_tokens; i++)
+    {
+      if (!counts || counts [i])
+        iface->add_token_count (self, name, tokens [i], counts ? counts [i] : 1);
+    }
+}
+
 static gchar **
 bayes_storage_real_get_names (BayesStorage *self)
 {
@@ -61,6 +79,44 @@ bayes_storage_real_get_token_probability (BayesStorage *self,
   return 0.0;
 }
 
+/*
+ * Asks every classification for its count of @token.
+ */
+static guint
+bayes_storage_real_get_postings (BayesStorage *self,
+                                 const gchar  *token,
+                                 GArray       *postings)
+{
+  BayesPosting posting;
+  gchar **names;
+  guint n = 0;
+  guint i;
+
+  if (!(names = bayes_storage_get_names (self)))
+    return 0;
+
+  for (i = 0; names [i]; i++)
+    {
+      if ((posting.count = bayes_storage_get_token_count (self, names [i], token)))
+        {
+          posting.class_id = i;
+          g_array_append_val (postings, posting);
+          n++;
+        }
+    }
+
+  g_strfreev (names);
+
+  return n;
+}
+
+static void
+bayes_storage_real_foreach (BayesStorage            *self,
+                            BayesStorageForeachFunc  func,
+                            gpointer                 user_data)
+{
+}
+
 static void
 bayes_storage_default_init (BayesStorageInterface *iface)
 {
@@ -68,6 +124,9 @@ bayes_storage_default_init (BayesStorageInterface *iface)
   iface->get_names = bayes_storage_real_get_names;
   iface->get_token_count = bayes_storage_real_get_token_count;
   iface->get_token_probability = bayes_storage_real_get_token_probability;
+  iface->get_postings = bayes_storage_real_get_postings;
+  iface->foreach = bayes_storage_real_foreach;
+  iface->add_token_counts = bayes_storage_real_add_token_counts;
 }
 
 void
@@ -96,6 +155,21 @@ bayes_storage_add_token (BayesStorage *self,
   BAYES_STORAGE_GET_IFACE (self)->add_token_count (self, name, token, 1);
 }
 
+void
+bayes_storage_add_token_counts (BayesStorage        *self,
+                                const gchar         *name,
+                                const gchar * const *tokens,
+                                const guint         *counts,
+                                guint                n_tokens)
+{
+  g_return_if_fail (BAYES_IS_STORAGE (self));
+  g_return_if_fail (name);
+  g_return_if_fail (tokens || !n_tokens);
+
+  if (n_tokens > 0)
+    BAYES_STORAGE_GET_IFACE (self)->add_token_counts (self, name, tokens, counts, n_tokens);
+}
+
 gchar **
 bayes_storage_get_names (BayesStorage *self)
 {
@@ -126,3 +200,38 @@ bayes_storage_get_token_probability (BayesStorage *self,
 
   return BAYES_STORAGE_GET_IFACE (self)->get_token_probability (self, name, token);
 }
+
+guint
+bayes_storage_get_postings (BayesStorage *self,
+                            const gchar  *token,
+                            GArray       *postings)
+{
+  g_return_val_if_fail (BAYES_IS_STORAGE (self), 0);
+  g_return_val_if_fail (token, 0);
+  g_return_val_if_fail (postings, 0);
+
+  return BAYES_STORAGE_GET_IFACE (self)->get_postings (self, token, postings);
+}
+
+void
+bayes_storage_foreach (BayesStorage            *self,
+                       BayesStorageForeachFunc  func,
+                       gpointer                 user_data)
+{
+  g_return_if_fail (BAYES_IS_STORAGE (self));
+  g_return_if_fail (func);
+
+  BAYES_STORAGE_GET_IFACE (self)->foreach (self, func, user_data);
+}
+
+/*
+ * Whether @self implements foreach, which the default does not, so that
+ * a model is never built from a storage that looks empty.
+ */
+gboolean
+bayes_storage_can_foreach (BayesStorage *self)
+{
+  g_return_val_if_fail (BAYES_IS_STORAGE (self), FALSE);
+
+  return BAYES_STORAGE_GET_IFACE (self)->foreach != bayes_storage_real_foreach;
+}
@@ -27,6 +27,34 @@ G_BEGIN_DECLS
 
 G_DECLARE_INTERFACE (BayesStorage, bayes_storage, BAYES, STORAGE, GObject)
 
+/**
+ * BayesPosting:
+ * @class_id: The index of the classification in the array returned by
+ *   bayes_storage_get_names().
+ * @count: The number of times the token was found in the classification.
+ *
+ * An entry of the postings of a token, see bayes_storage_get_postings().
+ */
+typedef struct
+{
+  guint class_id;
+  guint count;
+} BayesPosting;
+
+/**
+ * BayesStorageForeachFunc:
+ * @name: The classification.
+ * @token: The token.
+ * @count: The number of times @token was found in @name.
+ * @user_data: The data passed to bayes_storage_foreach().
+ *
+ * The callback for bayes_storage_foreach().
+ */
+typedef void (*BayesStorageForeachFunc) (const gchar *name,
+                                         const gchar *token,
+                                         guint        count,
+                                         gpointer     user_data);
+
 struct _BayesStorageInterface
 {
    GTypeInterface parent;
@@ -42,6 +70,17 @@ struct _BayesStorageInterface
    gdouble   (*get_token_probability) (BayesStorage *self,
                                        const gchar  *name,
                                        const gchar  *token);
+   guint     (*get_postings)          (BayesStorage *self,
+                                       const gchar  *token,
+                                       GArray       *postings);
+   void      (*foreach)               (BayesStorage            *self,
+                                       BayesStorageForeachFunc  func,
+                                       gpointer                 user_data);
+   void      (*add_token_counts)      (BayesStorage         *self,
+                                       const gchar          *name,
+                                       const gchar * const  *tokens,
+                                       const guint          *counts,
+                                       guint                 n_tokens);
 };
 
 /**
@@ -72,6 +111,30 @@ void      bayes_storage_add_token_count       (BayesStorage *self,
                                                const gchar  *token,
                                                guint         count);
 
+/**
+ * bayes_storage_add_token_counts:
+ * @self: A #BayesStorage.
+ * @name: The classification to store the tokens in.
+ * @tokens: (array length=n_tokens): The tokens to add.
+ * @counts: (array length=n_tokens) (nullable): The count of each token,
+ *   or %NULL to add each token once.
+ * @n_tokens: The number of elements of @tokens.
+ *
+ * Adds a batch of tokens to the classification @name, as if
+ * bayes_storage_add_token_count() was called for each of them. Tokens
+ * with a count of zero are skipped.
+ *
+ * Storages may resolve @name once and apply the whole batch at once,
+ * so this is preferred when adding all the tokens of a document. A token
+ * may be repeated, but when @counts is given the storage may expect
+ * @tokens to be mostly distinct and reserve room for all of them.
+ */
+void      bayes_storage_add_token_counts      (BayesStorage        *self,
+                                               const gchar         *name,
+                                               const gchar * const *tokens,
+                                               const guint         *counts,
+                                               guint                n_tokens);
+
 /**
  * bayes_storage_get_names:
  * @self: A #BayesStorage.
@@ -115,6 +178,44 @@ gdouble   bayes_storage_get_token_probability (BayesStorage *self,
                                                const gchar  *name,
                                                const gchar  *token);
 
+/**
+ * bayes_storage_get_postings:
+ * @self: A #BayesStorage.
+ * @token: The token to look up.
+ * @postings: (element-type BayesPosting): A #GArray of #BayesPosting.
+ *
+ * Appends a #BayesPosting to @postings for every classification that
+ * @token was found in. The class ids are indexes into the array returned
+ * by bayes_storage_get_names() and stay valid until tokens are added
+ * to @self.
+ *
+ * Storages that keep an inverted index answer this with work
+ * proportional to the number of postings. Other storages have to check
+ * every classification.
+ *
+ * Returns: The number of postings appended.
+ */
+guint     bayes_storage_get_postings          (BayesStorage *self,
+                                               const gchar  *token,
+                                               GArray       *postings);
+
+/**
+ * bayes_storage_foreach:
+ * @self: A #BayesStorage.
+ * @func: (scope call): The function to call.
+ * @user_data: User data for @func.
+ *
+ * Calls @func once for every token of every classification in @self,
+ * with the count of the token in that classification. @self must not be
+ * modified from @func.
+ *
+ * Storages that cannot list their tokens, such as #BayesStorageSketch,
+ * do not call @func at all.
+ */
+void      bayes_storage_foreach               (BayesStorage            *self,
+                                               BayesStorageForeachFunc  func,
+                                               gpointer                 user_data);
+
 G_END_DECLS
 
 #endif /* BAYES_STORAGE_H */
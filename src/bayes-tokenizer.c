@@ -16,7 +16,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
+#include "bayes-hash-private.h"
 #include "bayes-tokenizer.h"
+#include "bayes-trace-private.h"
 
 static GRegex *word_regex;
 
@@ -40,6 +44,8 @@ bayes_tokenizer_word (const gchar *text,
   gchar **strv;
   guint i;
 
+  BAYES_TRACE2 (tokenize__entry, "word", strlen (text));
+
   if (g_once_init_enter (&initialized))
     {
       word_regex = g_regex_new ("\\w+", G_REGEX_OPTIMIZE, 0, NULL);
@@ -68,6 +74,8 @@ bayes_tokenizer_word (const gchar *text,
 
   g_match_info_free (match_info);
 
+  BAYES_TRACE2 (tokenize__return, "word", ret->len);
+
   g_ptr_array_add (ret, NULL);
 
   return (gchar **)g_ptr_array_free (ret, FALSE);
@@ -133,6 +141,8 @@ bayes_tokenizer_code_tokens (const gchar *text,
 
   struct Expr *expr;
 
+  BAYES_TRACE2 (tokenize__entry, "code-tokens", strlen (text));
+
   ret = g_ptr_array_new ();
 
   for (expr = &expressions[0]; expr->expr; ++expr)
@@ -172,6 +182,349 @@ bayes_tokenizer_code_tokens (const gchar *text,
       g_match_info_free (match_info);
     }
 
+  BAYES_TRACE2 (tokenize__return, "code-tokens", ret->len);
+
+  g_ptr_array_add (ret, NULL);
+
+  return (gchar **)g_ptr_array_free (ret, FALSE);
+}
+
+
+/*
+ * The n-gram tokenizers hash each window with a polynomial rolling hash,
+ * H = v[0] * B^(n-1) + ... + v[n-1], so sliding the window by one only
+ * removes the oldest value and adds the newest. Each feature is emitted
+ * as the hash of its window, so the text of a window is never copied.
+ */
+#define ROLLING_BASE G_GUINT64_CONSTANT (0x100000001b3)
+
+typedef struct
+{
+  guint64 window [BAYES_TOKENIZER_MAX_N];
+  guint64 hash;
+  guint64 base_pow;
+  guint   n;
+  guint   pos;
+  guint   filled;
+} BayesRollingHash;
+
+static void
+bayes_rolling_hash_init (BayesRollingHash *rolling,
+                         guint             n)
+{
+  guint i;
+
+  rolling->hash = 0;
+  rolling->base_pow = 1;
+  rolling->n = n;
+  rolling->pos = 0;
+  rolling->filled = 0;
+
+  for (i = 1; i < n; i++)
+    rolling->base_pow *= ROLLING_BASE;
+}
+
+/*
+ * Adds @value to the window and returns %TRUE once the window is full.
+ */
+static inline gboolean
+bayes_rolling_hash_push (BayesRollingHash *rolling,
+                         guint64           value)
+{
+  if (rolling->filled == rolling->n)
+    rolling->hash -= rolling->window [rolling->pos] * rolling->base_pow;
+  else
+    rolling->filled++;
+
+  rolling->hash = rolling->hash * ROLLING_BASE + value;
+  rolling->window [rolling->pos] = value;
+  rolling->pos = (rolling->pos + 1) % rolling->n;
+
+  return rolling->filled == rolling->n;
+}
+
+static guint
+bayes_tokenizer_get_n (gpointer user_data,
+                       guint    default_n)
+{
+  guint n = GPOINTER_TO_UINT (user_data);
+
+  if (n == 0)
+    return default_n;
+
+  return MIN (n, BAYES_TOKENIZER_MAX_N);
+}
+
+/*
+ * Formats a feature as "<kind><n>:<16 hex digits>" in a single
+ * allocation.
+ */
+static gchar *
+bayes_tokenizer_feature (gchar   kind,
+                         guint   n,
+                         guint64 hash)
+{
+  static const gchar hex[] = "0123456789abcdef";
+  gchar *feature = g_malloc (21);
+  gchar *p = feature;
+  gint i;
+
+  *p++ = kind;
+  if (n >= 10)
+    *p++ = '0' + n / 10;
+  *p++ = '0' + n % 10;
+  *p++ = ':';
+
+  hash = bayes_hash_mix (hash);
+  for (i = 60; i >= 0; i -= 4)
+    *p++ = hex [(hash >> i) & 0xf];
+  *p = '\0';
+
+  return feature;
+}
+
+static inline gboolean
+is_word_char (gunichar c)
+{
+  return g_unichar_isalnum (c) || g_unichar_ismark (c) || c == '_';
+}
+
+/*
+ * Decodes the character at @p, which is not ASCII, and sets @next to the
+ * character after it. Bytes that do not start a valid character, such
+ * as a sequence truncated by the end of the text, are skipped one at a
+ * time and decoded as U+FFFD, so that the terminating nul is never
+ * stepped over.
+ */
+static inline gunichar
+bayes_tokenizer_get_char (const gchar  *p,
+                          const gchar **next)
+{
+  gunichar c;
+
+  c = g_utf8_get_char_validated (p, -1);
+
+  if (c == (gunichar)-1 || c == (gunichar)-2)
+    {
+      *next = p + 1;
+      return 0xFFFD;
+    }
+
+  *next = g_utf8_next_char (p);
+
+  return c;
+}
+
+/*
+ * Finds the next run of word characters, as matched by "\w+", starting
+ * at *iter. ASCII bytes are classified without decoding them, and
+ * invalid UTF-8 separates words.
+ *
+ * Returns the start of the word, or %NULL at the end of the text. *iter
+ * is moved to the end of the word and @ascii set if it is all ASCII.
+ */
+static inline const gchar *
+bayes_tokenizer_next_word (const gchar **iter,
+                           gboolean     *ascii)
+{
+  const gchar *p = *iter;
+  const gchar *next;
+  const gchar *begin;
+  guchar b;
+
+  for (;; p = next)
+    {
+      b = *p;
+      if (b == '\0')
+        return NULL;
+      if (b < 0x80)
+        {
+          next = p + 1;
+          if (g_ascii_isalnum (b) || b == '_')
+            break;
+        }
+      else if (is_word_char (bayes_tokenizer_get_char (p, &next)))
+        break;
+    }
+
+  begin = p;
+  *ascii = TRUE;
+
+  for (;;)
+    {
+      b = *p;
+      if (b < 0x80)
+        {
+          if (!g_ascii_isalnum (b) && b != '_')
+            break;
+          p++;
+        }
+      else
+        {
+          if (!is_word_char (bayes_tokenizer_get_char (p, &next)))
+            break;
+          *ascii = FALSE;
+          p = next;
+        }
+    }
+
+  *iter = p;
+
+  return begin;
+}
+
+gchar **
+bayes_tokenizer_word_shingles (const gchar *text,
+                               gpointer     user_data)
+{
+  BayesRollingHash rolling;
+  const gchar *iter;
+  const gchar *begin;
+  gboolean ascii;
+  GPtrArray *ret;
+  guint n;
+
+  g_return_val_if_fail (text, NULL);
+
+  BAYES_TRACE2 (tokenize__entry, "word-shingles", strlen (text));
+
+  n = bayes_tokenizer_get_n (user_data, 2);
+  bayes_rolling_hash_init (&rolling, n);
+  ret = g_ptr_array_new ();
+
+  for (iter = text; (begin = bayes_tokenizer_next_word (&iter, &ascii)); )
+    {
+      if (bayes_rolling_hash_push (&rolling, bayes_hash_bytes (begin, iter - begin)))
+        g_ptr_array_add (ret, bayes_tokenizer_feature ('w', n, rolling.hash));
+    }
+
+  BAYES_TRACE2 (tokenize__return, "word-shingles", ret->len);
+
+  g_ptr_array_add (ret, NULL);
+
+  return (gchar **)g_ptr_array_free (ret, FALSE);
+}
+
+gchar **
+bayes_tokenizer_char_ngrams (const gchar *text,
+                             gpointer     user_data)
+{
+  BayesRollingHash rolling;
+  const gchar *iter;
+  const gchar *next;
+  GPtrArray *ret;
+  gunichar c;
+  guint n;
+
+  g_return_val_if_fail (text, NULL);
+
+  BAYES_TRACE2 (tokenize__entry, "char-ngrams", strlen (text));
+
+  n = bayes_tokenizer_get_n (user_data, 3);
+  bayes_rolling_hash_init (&rolling, n);
+  ret = g_ptr_array_new ();
+
+  for (iter = text; *iter; iter = next)
+    {
+      if ((guchar)*iter < 0x80)
+        {
+          c = *iter;
+          next = iter + 1;
+        }
+      else
+        c = bayes_tokenizer_get_char (iter, &next);
+
+      if (bayes_rolling_hash_push (&rolling, c + 1))
+        g_ptr_array_add (ret, bayes_tokenizer_feature ('c', n, rolling.hash));
+    }
+
+  BAYES_TRACE2 (tokenize__return, "char-ngrams", ret->len);
+
+  g_ptr_array_add (ret, NULL);
+
+  return (gchar **)g_ptr_array_free (ret, FALSE);
+}
+
+/*
+ * Slow path for words with non-ASCII characters that need Unicode
+ * normalization or case folding.
+ */
+static gchar *
+bayes_tokenizer_normalize_word (const gchar         *word,
+                                gsize                len,
+                                BayesTokenizerFlags  flags)
+{
+  gchar *normalized = NULL;
+  gchar *ret;
+  gchar *p;
+
+  if ((flags & BAYES_TOKENIZER_NFKC) != 0)
+    normalized = g_utf8_normalize (word, len, G_NORMALIZE_NFKC);
+
+  if ((flags & BAYES_TOKENIZER_CASEFOLD) != 0)
+    {
+      ret = normalized ? g_utf8_casefold (normalized, -1) : g_utf8_casefold (word, len);
+      g_free (normalized);
+      return ret;
+    }
+
+  ret = normalized ? normalized : g_strndup (word, len);
+
+  if ((flags & BAYES_TOKENIZER_ASCII_LOWER) != 0)
+    {
+      for (p = ret; *p; p++)
+        *p = g_ascii_tolower (*p);
+    }
+
+  return ret;
+}
+
+gchar **
+bayes_tokenizer_word_normalized (const gchar *text,
+                                 gpointer     user_data)
+{
+  BayesTokenizerFlags flags = GPOINTER_TO_UINT (user_data);
+  const gchar *iter;
+  const gchar *begin;
+  gboolean ascii;
+  gboolean lower;
+  GPtrArray *ret;
+  gchar *token;
+  gsize len;
+  gsize i;
+
+  g_return_val_if_fail (text, NULL);
+
+  BAYES_TRACE2 (tokenize__entry, "word-normalized", strlen (text));
+
+  /* ASCII is unchanged by NFKC and case folding only lowers it. */
+  lower = (flags & (BAYES_TOKENIZER_ASCII_LOWER | BAYES_TOKENIZER_CASEFOLD)) != 0;
+  ret = g_ptr_array_new ();
+
+  for (iter = text; (begin = bayes_tokenizer_next_word (&iter, &ascii)); )
+    {
+      len = iter - begin;
+
+      if (ascii || (flags & (BAYES_TOKENIZER_CASEFOLD | BAYES_TOKENIZER_NFKC)) == 0)
+        {
+          token = g_malloc (len + 1);
+          if (lower)
+            {
+              for (i = 0; i < len; i++)
+                token [i] = g_ascii_tolower (begin [i]);
+            }
+          else
+            memcpy (token, begin, len);
+          token [len] = '\0';
+        }
+      else
+        token = bayes_tokenizer_normalize_word (begin, len, flags);
+
+      g_ptr_array_add (ret, token);
+    }
+
+  BAYES_TRACE2 (tokenize__return, "word-normalized", ret->len);
+
   g_ptr_array_add (ret, NULL);
 
   return (gchar **)g_ptr_array_free (ret, FALSE);
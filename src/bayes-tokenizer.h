@@ -23,6 +23,34 @@
 
 G_BEGIN_DECLS
 
+/**
+ * BAYES_TOKENIZER_MAX_N:
+ *
+ * The largest window size supported by bayes_tokenizer_word_shingles()
+ * and bayes_tokenizer_char_ngrams().
+ */
+#define BAYES_TOKENIZER_MAX_N 16
+
+/**
+ * BayesTokenizerFlags:
+ * @BAYES_TOKENIZER_FLAGS_NONE: Tokens are left as they appear in the text.
+ * @BAYES_TOKENIZER_ASCII_LOWER: ASCII letters are lowered, other
+ *   characters are left alone.
+ * @BAYES_TOKENIZER_CASEFOLD: Tokens are case folded with
+ *   g_utf8_casefold().
+ * @BAYES_TOKENIZER_NFKC: Tokens are normalized to NFKC with
+ *   g_utf8_normalize().
+ *
+ * Normalization applied by bayes_tokenizer_word_normalized().
+ */
+typedef enum
+{
+  BAYES_TOKENIZER_FLAGS_NONE  = 0,
+  BAYES_TOKENIZER_ASCII_LOWER = 1 << 0,
+  BAYES_TOKENIZER_CASEFOLD    = 1 << 1,
+  BAYES_TOKENIZER_NFKC        = 1 << 2,
+} BayesTokenizerFlags;
+
 /**
  * BayesTokenizer:
  * @text: (in): The text to tokenize.
@@ -70,6 +98,76 @@ gchar **bayes_tokenizer_word (const gchar *text,
 gchar **bayes_tokenizer_code_tokens (const gchar *text,
                                      gpointer     user_data);
 
+/**
+ * bayes_tokenizer_word_normalized:
+ * @text: (in): A string of text to tokenize.
+ * @user_data: (skip): #BayesTokenizerFlags passed with GUINT_TO_POINTER().
+ *
+ * Splits @text into words like bayes_tokenizer_word() and normalizes each
+ * word according to the #BayesTokenizerFlags in @user_data while it is
+ * copied out of @text. Words made only of ASCII characters never go
+ * through the Unicode tables.
+ *
+ * |[<!-- language="C" -->
+ * bayes_classifier_set_tokenizer (classifier,
+ *                                 bayes_tokenizer_word_normalized,
+ *                                 GUINT_TO_POINTER (BAYES_TOKENIZER_CASEFOLD |
+ *                                                   BAYES_TOKENIZER_NFKC),
+ *                                 NULL);
+ * ]|
+ *
+ * Returns: (array zero-terminated=1) (transfer full):
+ *      A newly allocated, null-terminated array of strings.
+ */
+gchar **bayes_tokenizer_word_normalized (const gchar *text,
+                                         gpointer     user_data);
+
+/**
+ * bayes_tokenizer_word_shingles:
+ * @text: (in): A string of text to tokenize.
+ * @user_data: (skip): The number of words per shingle, or %NULL.
+ *
+ * Tokenizer producing one feature for every run of n consecutive words,
+ * with words split as in bayes_tokenizer_word(). n is passed with
+ * GUINT_TO_POINTER() as @user_data. It defaults to 2 and is limited to
+ * %BAYES_TOKENIZER_MAX_N. Text with fewer than n words yields no
+ * features.
+ *
+ * Features are computed with a rolling hash and are emitted as an opaque
+ * string such as "w2:9f86d081884c7d65" instead of the words themselves.
+ *
+ * |[<!-- language="C" -->
+ * bayes_classifier_set_tokenizer (classifier,
+ *                                 bayes_tokenizer_word_shingles,
+ *                                 GUINT_TO_POINTER (3),
+ *                                 NULL);
+ * ]|
+ *
+ * Returns: (array zero-terminated=1) (transfer full):
+ *      A newly allocated, null-terminated array of strings.
+ */
+gchar **bayes_tokenizer_word_shingles (const gchar *text,
+                                       gpointer     user_data);
+
+/**
+ * bayes_tokenizer_char_ngrams:
+ * @text: (in): A string of text to tokenize.
+ * @user_data: (skip): The number of characters per n-gram, or %NULL.
+ *
+ * Tokenizer producing one feature for every run of n consecutive
+ * characters of @text, which is useful for identifying the language of
+ * short texts. n is passed with GUINT_TO_POINTER() as @user_data. It
+ * defaults to 3 and is limited to %BAYES_TOKENIZER_MAX_N.
+ *
+ * Like bayes_tokenizer_word_shingles(), features are emitted as the
+ * rolling hash of the n-gram, such as "c3:2c26b46b68ffc68f".
+ *
+ * Returns: (array zero-terminated=1) (transfer full):
+ *      A newly allocated, null-terminated array of strings.
+ */
+gchar **bayes_tokenizer_char_ngrams (const gchar *text,
+                                     gpointer     user_data);
+
 G_END_DECLS
 
 #endif /* BAYES_TOKENIZER_H */
@@ -0,0 +1,380 @@
+/* bayes-tokens.c
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "bayes-storage-memory.h"
+#include "bayes-storage-memory-private.h"
+
+/*
+ * Robin Hood tables stay short-probed at high load, the table is grown
+ * once it is 7/8 full.
+ */
+#define MIN_TABLE_SIZE 8
+
+static inline guint
+bayes_tokens_distance (const BayesTokens *tokens,
+                       guint              pos)
+{
+  return (pos - tokens->entries [pos].hash) & tokens->mask;
+}
+
+/*
+ * Inserts @entry, which must not be in the table yet, displacing entries
+ * that are closer to their home slot than @entry is to its own.
+ */
+static void
+bayes_tokens_insert_entry (BayesTokens     *tokens,
+                           BayesTokenEntry  entry,
+                           guint32          value)
+{
+  BayesTokenEntry tmp;
+  guint32 tmp_value;
+  guint mask = tokens->mask;
+  guint pos = entry.hash & mask;
+  guint dist = 0;
+  guint entry_dist;
+
+  for (;; pos = (pos + 1) & mask, dist++)
+    {
+      if (tokens->entries [pos].count == 0)
+        {
+          tokens->entries [pos] = entry;
+          if (tokens->values != NULL)
+            tokens->values [pos] = value;
+          return;
+        }
+
+      entry_dist = bayes_tokens_distance (tokens, pos);
+
+      if (entry_dist < dist)
+        {
+          tmp = tokens->entries [pos];
+          tokens->entries [pos] = entry;
+          entry = tmp;
+          if (tokens->values != NULL)
+            {
+              tmp_value = tokens->values [pos];
+              tokens->values [pos] = value;
+              value = tmp_value;
+            }
+          dist = entry_dist;
+        }
+    }
+}
+
+static void
+bayes_tokens_resize (BayesTokens *tokens,
+                     guint        size)
+{
+  BayesTokenEntry *old_entries = tokens->entries;
+  guint32 *old_values = tokens->values;
+  guint old_size = tokens->entries ? tokens->mask + 1 : 0;
+  guint i;
+
+  tokens->entries = g_new0 (BayesTokenEntry, size);
+  tokens->values = old_values ? g_new0 (guint32, size) : NULL;
+  tokens->mask = size - 1;
+
+  for (i = 0; i < old_size; i++)
+    if (old_entries [i].count != 0)
+      bayes_tokens_insert_entry (tokens, old_entries [i], old_values ? old_values [i] : 0);
+
+  g_free (old_entries);
+  g_free (old_values);
+}
+
+BayesTokens *
+bayes_tokens_new (void)
+{
+  BayesTokens *tokens;
+
+  tokens = g_new0 (BayesTokens, 1);
+  tokens->entries = g_new0 (BayesTokenEntry, MIN_TABLE_SIZE);
+  tokens->mask = MIN_TABLE_SIZE - 1;
+  tokens->arena = bayes_arena_new ();
+
+  return tokens;
+}
+
+void
+bayes_tokens_free (gpointer data)
+{
+  BayesTokens *tokens = data;
+
+  if (tokens != NULL)
+    {
+      g_free (tokens->entries);
+      g_free (tokens->values);
+      bayes_arena_free (tokens->arena);
+      g_free (tokens);
+    }
+}
+
+gpointer
+bayes_tokens_copy (gpointer data)
+{
+  BayesTokens *old_tokens = data;
+  BayesTokens *tokens;
+
+  if (old_tokens == NULL)
+    return NULL;
+
+  /*
+   * Keys are offsets, copying the entries and the arena as they are
+   * yields an identical table.
+   */
+  tokens = g_new0 (BayesTokens, 1);
+  tokens->entries = g_memdup (old_tokens->entries,
+                              (old_tokens->mask + 1) * sizeof (BayesTokenEntry));
+  if (old_tokens->values != NULL)
+    tokens->values = g_memdup (old_tokens->values,
+                               (old_tokens->mask + 1) * sizeof (guint32));
+  tokens->mask = old_tokens->mask;
+  tokens->n_entries = old_tokens->n_entries;
+  tokens->count = old_tokens->count;
+  tokens->arena = bayes_arena_copy (old_tokens->arena);
+
+  return tokens;
+}
+
+/*
+ * Grows @tokens so that @n_new more tokens can be added without it
+ * being resized again.
+ */
+void
+bayes_tokens_reserve (BayesTokens *tokens,
+                      guint        n_new)
+{
+  guint size = tokens->mask + 1;
+
+  while (((guint64)tokens->n_entries + n_new) * 8 > (guint64)size * 7 &&
+         size <= G_MAXUINT / 2)
+    size *= 2;
+
+  if (size != tokens->mask + 1)
+    bayes_tokens_resize (tokens, size);
+}
+
+/*
+ * Adds @count occurrences of @token. Returns %TRUE if @token was not yet
+ * in @tokens, in which case @key is set to the offset of its copy in the
+ * arena of @tokens. Counts saturate rather than wrap around to 0, which
+ * would turn the entry into an empty slot.
+ */
+gboolean
+bayes_tokens_inc (BayesTokens *tokens,
+                  const gchar *token,
+                  gsize        len,
+                  guint32      hash,
+                  guint        count,
+                  guint32     *key)
+{
+  BayesTokenEntry *entry;
+  BayesTokenEntry new_entry;
+
+  g_assert (tokens);
+  g_assert (token);
+
+  if (count == 0)
+    return FALSE;
+
+  tokens->count = (count > G_MAXUINT - tokens->count) ? G_MAXUINT : tokens->count + count;
+
+  if ((entry = bayes_tokens_lookup_entry (tokens, token, len, hash)))
+    {
+      entry->count = (count > G_MAXUINT32 - entry->count) ? G_MAXUINT32 : entry->count + count;
+      return FALSE;
+    }
+
+  if ((tokens->n_entries + 1) * 8 > (tokens->mask + 1) * 7)
+    bayes_tokens_resize (tokens, (tokens->mask + 1) * 2);
+
+  new_entry.hash = hash;
+  new_entry.count = count;
+  new_entry.key = bayes_arena_add (tokens->arena, token, len);
+  bayes_tokens_insert_entry (tokens, new_entry, 0);
+  tokens->n_entries++;
+
+  if (key != NULL)
+    *key = new_entry.key;
+
+  return TRUE;
+}
+
+/*
+ * Removes @token from @tokens, returning the count it had.
+ */
+guint
+bayes_tokens_remove (BayesTokens *tokens,
+                     const gchar *token,
+                     gsize        len,
+                     guint32      hash)
+{
+  BayesTokenEntry *entry;
+  guint mask = tokens->mask;
+  guint count;
+  guint next;
+  guint pos;
+
+  if (!(entry = bayes_tokens_lookup_entry (tokens, token, len, hash)))
+    return 0;
+
+  count = entry->count;
+  bayes_arena_release (tokens->arena, entry->key);
+  tokens->count -= MIN (tokens->count, count);
+  tokens->n_entries--;
+
+  /*
+   * Shift the following entries back until one is found that is empty or
+   * already in its home slot, which keeps the Robin Hood invariant
+   * without tombstones.
+   */
+  pos = entry - tokens->entries;
+  for (next = (pos + 1) & mask;
+       tokens->entries [next].count != 0 && bayes_tokens_distance (tokens, next) != 0;
+       pos = next, next = (next + 1) & mask)
+    {
+      tokens->entries [pos] = tokens->entries [next];
+      if (tokens->values != NULL)
+        tokens->values [pos] = tokens->values [next];
+    }
+  tokens->entries [pos].count = 0;
+  if (tokens->values != NULL)
+    tokens->values [pos] = 0;
+
+  return count;
+}
+
+/*
+ * Lowers the count of @token, removing it when it drops to 0.
+ */
+void
+bayes_tokens_dec (BayesTokens *tokens,
+                  const gchar *token,
+                  gsize        len,
+                  guint32      hash,
+                  guint        count)
+{
+  BayesTokenEntry *entry;
+
+  if (!(entry = bayes_tokens_lookup_entry (tokens, token, len, hash)))
+    return;
+
+  if (entry->count <= count)
+    {
+      bayes_tokens_remove (tokens, token, len, hash);
+      return;
+    }
+
+  entry->count -= count;
+  tokens->count -= MIN (tokens->count, count);
+}
+
+/*
+ * Copies the live tokens into a new arena and updates the keys in place.
+ * Returns the old arena so that the caller may still resolve previous
+ * keys, the caller must free it.
+ */
+BayesArena *
+bayes_tokens_compact (BayesTokens *tokens)
+{
+  BayesArena *old_arena = tokens->arena;
+  BayesTokenEntry *entry;
+  const gchar *key;
+  guint i;
+
+  tokens->arena = bayes_arena_new ();
+
+  for (i = 0; i <= tokens->mask; i++)
+    {
+      entry = &tokens->entries [i];
+
+      if (entry->count != 0)
+        {
+          key = bayes_arena_get (old_arena, entry->key);
+          entry->key = bayes_arena_add (tokens->arena, key, strlen (key));
+        }
+    }
+
+  return old_arena;
+}
+
+/*
+ * Iterates over the tokens of @tokens. @pos must be initialized to 0,
+ * returns %FALSE once all tokens have been visited.
+ */
+gboolean
+bayes_tokens_iter_next (const BayesTokens  *tokens,
+                        guint              *pos,
+                        const gchar       **token,
+                        guint              *count)
+{
+  const BayesTokenEntry *entry;
+
+  for (; *pos <= tokens->mask; (*pos)++)
+    {
+      entry = &tokens->entries [*pos];
+
+      if (entry->count != 0)
+        {
+          if (token != NULL)
+            *token = bayes_arena_get (tokens->arena, entry->key);
+          if (count != NULL)
+            *count = entry->count;
+          (*pos)++;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/*
+ * Returns the value of @token, or %NULL if @token is not in @tokens or
+ * @tokens has no values. The pointer is valid until @tokens is modified.
+ */
+guint32 *
+bayes_tokens_lookup_value (BayesTokens *tokens,
+                           const gchar *token,
+                           gsize        len,
+                           guint32      hash)
+{
+  BayesTokenEntry *entry;
+
+  if (tokens->values == NULL)
+    return NULL;
+
+  if (!(entry = bayes_tokens_lookup_entry (tokens, token, len, hash)))
+    return NULL;
+
+  return &tokens->values [entry - tokens->entries];
+}
+
+/*
+ * Allocates or drops the values of @tokens. Newly allocated values are 0.
+ */
+void
+bayes_tokens_set_values (BayesTokens *tokens,
+                         gboolean     enabled)
+{
+  if (!enabled)
+    g_clear_pointer (&tokens->values, g_free);
+  else if (tokens->values == NULL)
+    tokens->values = g_new0 (guint32, tokens->mask + 1);
+}
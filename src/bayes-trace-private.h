@@ -0,0 +1,49 @@
+/* bayes-trace-private.h
+ *
+ * Copyright (C) 2016 Christian Hergert <christian@hergert.me>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BAYES_TRACE_PRIVATE_H
+#define BAYES_TRACE_PRIVATE_H
+
+#include "config.h"
+
+#include <glib.h>
+
+/*
+ * USDT probes for perf, bpftrace and SystemTap, under the "bayes_glib"
+ * provider. BAYES_TRACE1 (guess__entry, ...) is listed by the tools as
+ * "bayes_glib:guess__entry".
+ *
+ * Without --enable-tracing the macros expand to nothing and their
+ * arguments are never evaluated.
+ */
+#ifdef ENABLE_TRACING
+# include <sys/sdt.h>
+# define BAYES_TRACE(name)              DTRACE_PROBE (bayes_glib, name)
+# define BAYES_TRACE1(name, a)          DTRACE_PROBE1 (bayes_glib, name, a)
+# define BAYES_TRACE2(name, a, b)       DTRACE_PROBE2 (bayes_glib, name, a, b)
+# define BAYES_TRACE3(name, a, b, c)    DTRACE_PROBE3 (bayes_glib, name, a, b, c)
+# define BAYES_TRACE4(name, a, b, c, d) DTRACE_PROBE4 (bayes_glib, name, a, b, c, d)
+#else
+# define BAYES_TRACE(name)              G_STMT_START { } G_STMT_END
+# define BAYES_TRACE1(name, a)          G_STMT_START { } G_STMT_END
+# define BAYES_TRACE2(name, a, b)       G_STMT_START { } G_STMT_END
+# define BAYES_TRACE3(name, a, b, c)    G_STMT_START { } G_STMT_END
+# define BAYES_TRACE4(name, a, b, c, d) G_STMT_START { } G_STMT_END
+#endif
+
+#endif /* BAYES_TRACE_PRIVATE_H */
@@ -0,0 +1,625 @@
+#include <bayes-glib.h>
+#include <glib/gstdio.h>
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+static guint64
+lookup_uint64 (GVariant    *dict,
+               const gchar *key)
+{
+   guint64 value = 0;
+
+   g_assert (g_variant_lookup (dict, key, "t", &value));
+   return value;
+}
+
+static void
+test_stats (void)
+{
+   g_autoptr(BayesClassifier) classifier = NULL;
+   g_autoptr(BayesStorage) storage = NULL;
+   g_autoptr(GVariant) stats = NULL;
+   g_autoptr(GVariant) guess = NULL;
+   g_autoptr(GVariant) train = NULL;
+   g_autoptr(GVariant) total = NULL;
+   GList *guesses;
+   gdouble rate = 0.0;
+
+   storage = BAYES_STORAGE (bayes_storage_memory_new ());
+   classifier = bayes_classifier_new ();
+   bayes_classifier_set_storage (classifier, storage);
+
+   /* Nothing is recorded until collection is enabled. */
+   bayes_classifier_train (classifier, "english", "the quick brown fox");
+   g_assert_false (bayes_classifier_get_collect_stats (classifier));
+
+   bayes_classifier_set_collect_stats (classifier, TRUE);
+   g_assert_true (bayes_classifier_get_collect_stats (classifier));
+
+   bayes_classifier_train (classifier, "spanish", "el rapido zorro marron");
+
+   guesses = bayes_classifier_guess (classifier, "the lazy zorro");
+   g_list_free_full (guesses, (GDestroyNotify)bayes_guess_unref);
+   guesses = bayes_classifier_guess (classifier, "the brown dog");
+   g_list_free_full (guesses, (GDestroyNotify)bayes_guess_unref);
+
+   stats = bayes_classifier_get_stats (classifier);
+   g_assert (g_variant_is_of_type (stats, G_VARIANT_TYPE_VARDICT));
+
+   train = g_variant_lookup_value (stats, "train", G_VARIANT_TYPE_VARDICT);
+   g_assert_cmpint (1, ==, lookup_uint64 (train, "calls"));
+   g_assert_cmpint (4, ==, lookup_uint64 (train, "tokens"));
+
+   guess = g_variant_lookup_value (stats, "guess", G_VARIANT_TYPE_VARDICT);
+   g_assert_cmpint (2, ==, lookup_uint64 (guess, "calls"));
+   g_assert_cmpint (6, ==, lookup_uint64 (guess, "tokens"));
+   g_assert_cmpint (2, ==, lookup_uint64 (guess, "unknown-tokens"));
+   g_assert (g_variant_lookup (guess, "unknown-rate", "d", &rate));
+   g_assert_cmpfloat (fabs (rate - 2.0 / 6.0), <, 0.0001);
+
+   total = g_variant_lookup_value (guess, "total", G_VARIANT_TYPE_VARDICT);
+   g_assert_cmpint (2, ==, lookup_uint64 (total, "count"));
+   g_assert_cmpint (lookup_uint64 (total, "p50"), <=, lookup_uint64 (total, "max"));
+   g_assert_cmpint (lookup_uint64 (total, "min"), <=, lookup_uint64 (total, "p50"));
+
+   g_clear_pointer (&guess, g_variant_unref);
+   g_clear_pointer (&stats, g_variant_unref);
+
+   bayes_classifier_reset_stats (classifier);
+   stats = bayes_classifier_get_stats (classifier);
+   guess = g_variant_lookup_value (stats, "guess", G_VARIANT_TYPE_VARDICT);
+   g_assert_cmpint (0, ==, lookup_uint64 (guess, "calls"));
+
+   g_clear_pointer (&guess, g_variant_unref);
+   g_clear_pointer (&stats, g_variant_unref);
+
+   bayes_classifier_set_collect_stats (classifier, FALSE);
+   stats = bayes_classifier_get_stats (classifier);
+   guess = g_variant_lookup_value (stats, "guess", G_VARIANT_TYPE_VARDICT);
+   g_assert_cmpint (0, ==, g_variant_n_children (guess));
+}
+
+static void
+assert_same_guesses (GList *a,
+                     GList *b)
+{
+   g_assert_cmpint (g_list_length (a), ==, g_list_length (b));
+
+   for (; a && b; a = a->next, b = b->next)
+     {
+        g_assert_cmpstr (bayes_guess_get_name (a->data), ==, bayes_guess_get_name (b->data));
+        g_assert_cmpfloat (bayes_guess_get_probability (a->data), ==,
+                           bayes_guess_get_probability (b->data));
+     }
+}
+
+static void
+test_sparse (void)
+{
+   static const gchar *texts[] = {
+      "the quick brown fox",
+      "brown fox brown dog",
+      "zorro lazy the the",
+      "nothing known here",
+      "",
+   };
+   g_autoptr(BayesClassifier) classifier = NULL;
+   g_autoptr(BayesStorage) storage = NULL;
+   GList *dense;
+   GList *sparse;
+   gchar name[32];
+   gchar text[64];
+   guint i;
+
+   storage = BAYES_STORAGE (bayes_storage_memory_new ());
+   classifier = bayes_classifier_new ();
+   bayes_classifier_set_storage (classifier, storage);
+   g_assert_false (bayes_classifier_get_sparse (classifier));
+
+   bayes_classifier_train (classifier, "english", "the quick brown fox jumps");
+   bayes_classifier_train (classifier, "spanish", "el rapido zorro marron");
+
+   /* Many classes that none of the tokens above are found in. */
+   for (i = 0; i < 50; i++)
+     {
+        g_snprintf (name, sizeof name, "class%u", i);
+        g_snprintf (text, sizeof text, "word%u other%u", i, i % 5);
+        bayes_classifier_train (classifier, name, text);
+     }
+   bayes_classifier_train (classifier, "class7", "lazy dog");
+
+   for (i = 0; i < G_N_ELEMENTS (texts); i++)
+     {
+        bayes_classifier_set_sparse (classifier, FALSE);
+        dense = bayes_classifier_guess (classifier, texts [i]);
+        bayes_classifier_set_sparse (classifier, TRUE);
+        sparse = bayes_classifier_guess (classifier, texts [i]);
+
+        assert_same_guesses (dense, sparse);
+
+        g_list_free_full (dense, (GDestroyNotify)bayes_guess_unref);
+        g_list_free_full (sparse, (GDestroyNotify)bayes_guess_unref);
+     }
+}
+
+static void
+test_memory (void)
+{
+   static const gchar *tokens[] = { "the", "fox", "el", "zorro", "dog", NULL };
+   g_autoptr(BayesClassifier) classifier = NULL;
+   g_autoptr(BayesStorage) storage = NULL;
+   g_autoptr(BayesStorage) expected = NULL;
+   guint i;
+
+   /* Training a memory storage directly must match the interface. */
+   storage = BAYES_STORAGE (bayes_storage_memory_new ());
+   classifier = bayes_classifier_new ();
+   bayes_classifier_set_storage (classifier, storage);
+   bayes_classifier_train (classifier, "english", "the fox the dog");
+   bayes_classifier_train (classifier, "spanish", "el zorro");
+
+   expected = BAYES_STORAGE (bayes_storage_memory_new ());
+   bayes_storage_add_token_count (expected, "english", "the", 2);
+   bayes_storage_add_token (expected, "english", "fox");
+   bayes_storage_add_token (expected, "english", "dog");
+   bayes_storage_add_token (expected, "spanish", "el");
+   bayes_storage_add_token (expected, "spanish", "zorro");
+
+   g_assert_cmpint (bayes_storage_get_token_count (expected, NULL, NULL), ==,
+                    bayes_storage_get_token_count (storage, NULL, NULL));
+
+   for (i = 0; tokens [i]; i++)
+     {
+        g_assert_cmpint (bayes_storage_get_token_count (expected, "english", tokens [i]), ==,
+                         bayes_storage_get_token_count (storage, "english", tokens [i]));
+        g_assert_cmpint (bayes_storage_get_token_count (expected, "spanish", tokens [i]), ==,
+                         bayes_storage_get_token_count (storage, "spanish", tokens [i]));
+        g_assert_cmpint (bayes_storage_get_token_count (expected, NULL, tokens [i]), ==,
+                         bayes_storage_get_token_count (storage, NULL, tokens [i]));
+     }
+}
+
+static void
+assert_same_names (const gchar * const *expected,
+                   const gchar * const *names)
+{
+   guint i;
+
+   for (i = 0; expected [i]; i++)
+     g_assert_cmpstr (expected [i], ==, names [i]);
+   g_assert_null (names [i]);
+}
+
+static void
+assert_same_results (GList                  *guesses,
+                     const BayesGuessResult *results,
+                     guint                   n_results,
+                     const gchar * const    *names)
+{
+   GList *iter;
+   guint i;
+
+   g_assert_cmpint (n_results, <=, g_list_length (guesses));
+
+   for (i = 0; i < n_results; i++)
+     {
+        if (i > 0)
+          g_assert_cmpfloat (results [i - 1].probability, >=, results [i].probability);
+
+        for (iter = guesses; iter; iter = iter->next)
+          {
+             if (g_strcmp0 (bayes_guess_get_name (iter->data), names [results [i].class_id]) == 0)
+               break;
+          }
+
+        g_assert_nonnull (iter);
+        g_assert_cmpfloat (bayes_guess_get_probability (iter->data), ==, results [i].probability);
+     }
+}
+
+static void
+test_context (void)
+{
+   static const gchar *texts[] = {
+      "the quick brown fox",
+      "brown fox brown dog the lazy dog",
+      "zorro lazy the the",
+      "nothing known here",
+   };
+   g_autoptr(BayesClassifier) classifier = NULL;
+   g_autoptr(BayesStorage) storage = NULL;
+   g_autoptr(BayesGuessContext) context = NULL;
+   BayesGuessResult results[4];
+   g_auto(GStrv) names = NULL;
+   GList *guesses;
+   guint n;
+   guint i;
+
+   storage = BAYES_STORAGE (bayes_storage_memory_new ());
+   classifier = bayes_classifier_new ();
+   bayes_classifier_set_storage (classifier, storage);
+   context = bayes_guess_context_new ();
+
+   bayes_classifier_train (classifier, "english", "the quick brown fox jumps");
+   bayes_classifier_train (classifier, "spanish", "el rapido zorro marron");
+   bayes_classifier_train (classifier, "dogs", "the lazy dog the brown dog");
+
+   g_assert_cmpint (0, ==, bayes_classifier_guess_with_context (classifier, context, "",
+                                                                results, G_N_ELEMENTS (results)));
+   g_assert_null (bayes_guess_context_get_names (context) [0]);
+
+   names = bayes_storage_get_names (storage);
+
+   for (i = 0; i < G_N_ELEMENTS (texts); i++)
+     {
+        guesses = bayes_classifier_guess (classifier, texts [i]);
+
+        n = bayes_classifier_guess_with_context (classifier, context, texts [i],
+                                                 results, G_N_ELEMENTS (results));
+        g_assert_cmpint (n, ==, 3);
+        assert_same_results (guesses, results, n, bayes_guess_context_get_names (context));
+        assert_same_names ((const gchar * const *)names, bayes_guess_context_get_names (context));
+
+        /* Only the most likely classification. */
+        n = bayes_classifier_guess_with_context (classifier, context, texts [i], results, 1);
+        g_assert_cmpint (n, ==, 1);
+        assert_same_results (guesses, results, n, bayes_guess_context_get_names (context));
+
+        g_list_free_full (guesses, (GDestroyNotify)bayes_guess_unref);
+     }
+
+   bayes_classifier_freeze (classifier);
+
+   for (i = 0; i < G_N_ELEMENTS (texts); i++)
+     {
+        guesses = bayes_classifier_guess (classifier, texts [i]);
+
+        n = bayes_classifier_guess_with_context (classifier, context, texts [i],
+                                                 results, 2);
+        g_assert_cmpint (n, ==, 2);
+        assert_same_results (guesses, results, n, bayes_guess_context_get_names (context));
+        assert_same_names (bayes_model_get_names (bayes_classifier_get_model (classifier)),
+                           bayes_guess_context_get_names (context));
+
+        g_list_free_full (guesses, (GDestroyNotify)bayes_guess_unref);
+     }
+}
+
+typedef struct
+{
+   BayesClassifier *classifier;
+   gint             stop;
+} SwapData;
+
+static gpointer
+guess_thread (gpointer data)
+{
+   SwapData *swap = data;
+   BayesStorage *storage;
+   BayesModel *model;
+   GList *guesses;
+
+   while (!g_atomic_int_get (&swap->stop))
+     {
+        guesses = bayes_classifier_guess (swap->classifier, "the quick brown zorro");
+        g_assert_nonnull (guesses);
+        g_list_free_full (guesses, (GDestroyNotify)bayes_guess_unref);
+
+        /* So do the references handed out to other threads. */
+        storage = bayes_classifier_dup_storage (swap->classifier);
+        g_assert_cmpint (1, ==, bayes_storage_get_token_count (storage, "english", "quick"));
+        g_object_unref (storage);
+
+        if ((model = bayes_classifier_dup_model (swap->classifier)))
+          {
+             g_assert_nonnull (bayes_model_get_names (model) [0]);
+             bayes_model_unref (model);
+          }
+     }
+
+   return NULL;
+}
+
+static void
+test_swap (void)
+{
+   g_autoptr(BayesClassifier) classifier = NULL;
+   BayesStorage *storage;
+   SwapData swap = { 0 };
+   GThread *threads[4];
+   guint i;
+   guint j;
+
+   classifier = bayes_classifier_new ();
+   swap.classifier = classifier;
+
+   /* Guesses keep the storage they started with alive. */
+   for (i = 0; i < 200; i++)
+     {
+        storage = BAYES_STORAGE (bayes_storage_memory_new ());
+        bayes_storage_add_token (storage, "english", "quick");
+        bayes_storage_add_token (storage, i % 2 ? "spanish" : "german", "zorro");
+        bayes_classifier_set_storage (classifier, storage);
+        g_object_unref (storage);
+
+        if (i % 3 == 0)
+          bayes_classifier_freeze (classifier);
+        else if (i % 3 == 1)
+          bayes_classifier_thaw (classifier);
+
+        if (i == 0)
+          {
+             for (j = 0; j < G_N_ELEMENTS (threads); j++)
+               threads [j] = g_thread_new ("guess", guess_thread, &swap);
+          }
+     }
+
+   g_atomic_int_set (&swap.stop, TRUE);
+   for (i = 0; i < G_N_ELEMENTS (threads); i++)
+     g_thread_join (threads [i]);
+}
+
+static void
+test_swap_frozen (void)
+{
+   g_autoptr(BayesClassifier) classifier = NULL;
+   g_autoptr(BayesStorage) first = NULL;
+   g_autoptr(BayesStorage) second = NULL;
+   const gchar * const *names;
+
+   first = BAYES_STORAGE (bayes_storage_memory_new ());
+   bayes_storage_add_token (first, "english", "quick");
+   second = BAYES_STORAGE (bayes_storage_memory_new ());
+   bayes_storage_add_token (second, "spanish", "zorro");
+
+   classifier = bayes_classifier_new ();
+   bayes_classifier_set_storage (classifier, first);
+   bayes_classifier_freeze_full (classifier, BAYES_MODEL_PRECISION_8_BIT);
+
+   /* The model follows the storage, at the same precision. */
+   bayes_classifier_set_storage (classifier, second);
+   g_assert_nonnull (bayes_classifier_get_model (classifier));
+   g_assert_cmpint (BAYES_MODEL_PRECISION_8_BIT, ==,
+                    bayes_model_get_precision (bayes_classifier_get_model (classifier)));
+   names = bayes_model_get_names (bayes_classifier_get_model (classifier));
+   g_assert_cmpstr ("spanish", ==, names [0]);
+   g_assert_null (names [1]);
+
+   bayes_classifier_thaw (classifier);
+   bayes_classifier_set_storage (classifier, first);
+   g_assert_null (bayes_classifier_get_model (classifier));
+
+   bayes_classifier_freeze (classifier);
+   bayes_classifier_set_storage (classifier, NULL);
+   g_assert_null (bayes_classifier_get_model (classifier));
+}
+
+static void
+test_freeze_sketch (void)
+{
+   g_autoptr(BayesClassifier) classifier = NULL;
+   g_autoptr(BayesStorage) memory = NULL;
+   g_autoptr(BayesStorage) sketch = NULL;
+
+   sketch = BAYES_STORAGE (bayes_storage_sketch_new (64, 2));
+   bayes_storage_add_token (sketch, "english", "quick");
+   memory = BAYES_STORAGE (bayes_storage_memory_new ());
+   bayes_storage_add_token (memory, "english", "quick");
+
+   /* The tokens of a sketch cannot be enumerated to build a model. */
+   classifier = bayes_classifier_new ();
+   bayes_classifier_set_storage (classifier, sketch);
+   g_test_expect_message (NULL, G_LOG_LEVEL_WARNING, "Cannot freeze*");
+   bayes_classifier_freeze (classifier);
+   g_test_assert_expected_messages ();
+   g_assert_null (bayes_classifier_get_model (classifier));
+
+   bayes_classifier_set_storage (classifier, memory);
+   bayes_classifier_freeze (classifier);
+   g_assert_nonnull (bayes_classifier_get_model (classifier));
+
+   g_test_expect_message (NULL, G_LOG_LEVEL_WARNING, "Thawing*");
+   bayes_classifier_set_storage (classifier, sketch);
+   g_test_assert_expected_messages ();
+   g_assert_null (bayes_classifier_get_model (classifier));
+}
+
+static void
+storage_changed_cb (GObject    *object,
+                    GParamSpec *pspec,
+                    gpointer    user_data)
+{
+   gboolean *changed = user_data;
+
+   *changed = TRUE;
+}
+
+static void
+test_watch (void)
+{
+   g_autoptr(BayesClassifier) classifier = NULL;
+   g_autoptr(BayesStorageMemory) first = NULL;
+   g_autoptr(BayesStorageMemory) second = NULL;
+   g_autoptr(GFile) file = NULL;
+   g_autoptr(GError) error = NULL;
+   g_autofree gchar *filename = NULL;
+   const gchar * const *names;
+   BayesStorage *storage;
+   gboolean changed = FALSE;
+   gint64 deadline;
+   gint fd;
+
+   fd = g_file_open_tmp ("test-bayes-classifier-XXXXXX.json", &filename, &error);
+   g_assert_no_error (error);
+   close (fd);
+
+   first = bayes_storage_memory_new ();
+   classifier = bayes_classifier_new ();
+   bayes_classifier_set_storage (classifier, BAYES_STORAGE (first));
+   bayes_classifier_train (classifier, "english", "the quick brown fox");
+   bayes_classifier_freeze (classifier);
+
+   file = g_file_new_for_path (filename);
+   g_assert (bayes_classifier_watch_file (classifier, file, &error));
+   g_assert_no_error (error);
+   g_signal_connect (classifier, "notify::storage", G_CALLBACK (storage_changed_cb), &changed);
+
+   /* Retrained elsewhere and saved over the watched file. */
+   second = bayes_storage_memory_new ();
+   bayes_storage_add_token (BAYES_STORAGE (second), "spanish", "zorro");
+   g_assert (bayes_storage_memory_save_to_file (second, filename, &error));
+   g_assert_no_error (error);
+
+   deadline = g_get_monotonic_time () + 10 * G_USEC_PER_SEC;
+   while (!changed && g_get_monotonic_time () < deadline)
+     {
+        if (!g_main_context_iteration (NULL, FALSE))
+          g_usleep (1000);
+     }
+   g_assert_true (changed);
+
+   storage = bayes_classifier_get_storage (classifier);
+   g_assert (storage != BAYES_STORAGE (first));
+   g_assert (BAYES_IS_STORAGE_MEMORY (storage));
+   g_assert_cmpint (1, ==, bayes_storage_get_token_count (storage, "spanish", "zorro"));
+   g_assert_cmpint (0, ==, bayes_storage_get_token_count (storage, "english", NULL));
+
+   /* The classifier was frozen, so the new storage is frozen too. */
+   g_assert_nonnull (bayes_classifier_get_model (classifier));
+   names = bayes_model_get_names (bayes_classifier_get_model (classifier));
+   g_assert_cmpstr ("spanish", ==, names [0]);
+   g_assert_null (names [1]);
+
+   g_assert (bayes_classifier_watch_file (classifier, NULL, &error));
+   g_assert_no_error (error);
+   g_unlink (filename);
+}
+
+static gboolean
+reload_failed_cb (const gchar    *log_domain,
+                  GLogLevelFlags  log_level,
+                  const gchar    *message,
+                  gpointer        user_data)
+{
+   gboolean *failed = user_data;
+
+   if (strstr (message, "Failed to reload") == NULL)
+     return TRUE;
+
+   *failed = TRUE;
+   return FALSE;
+}
+
+static void
+test_watch_invalid (void)
+{
+   static const gchar *contents[] = { "", "[1, 2]" };
+   g_autoptr(BayesClassifier) classifier = NULL;
+   g_autoptr(BayesStorageMemory) first = NULL;
+   g_autoptr(GFile) file = NULL;
+   g_autoptr(GError) error = NULL;
+   g_autofree gchar *filename = NULL;
+   gboolean failed;
+   gint64 deadline;
+   guint i;
+   gint fd;
+
+   fd = g_file_open_tmp ("test-bayes-classifier-XXXXXX.json", &filename, &error);
+   g_assert_no_error (error);
+   close (fd);
+
+   first = bayes_storage_memory_new ();
+   classifier = bayes_classifier_new ();
+   bayes_classifier_set_storage (classifier, BAYES_STORAGE (first));
+   bayes_classifier_train (classifier, "english", "the quick brown fox");
+   bayes_classifier_freeze (classifier);
+
+   file = g_file_new_for_path (filename);
+   g_assert (bayes_classifier_watch_file (classifier, file, &error));
+   g_assert_no_error (error);
+   g_test_log_set_fatal_handler (reload_failed_cb, &failed);
+
+   /* Files that are not training data are reported and not swapped in. */
+   for (i = 0; i < G_N_ELEMENTS (contents); i++)
+     {
+        failed = FALSE;
+        g_assert (g_file_set_contents (filename, contents [i], -1, &error));
+        g_assert_no_error (error);
+
+        deadline = g_get_monotonic_time () + 10 * G_USEC_PER_SEC;
+        while (!failed && g_get_monotonic_time () < deadline)
+          {
+             if (!g_main_context_iteration (NULL, FALSE))
+               g_usleep (1000);
+          }
+        g_assert_true (failed);
+
+        g_assert (bayes_classifier_get_storage (classifier) == BAYES_STORAGE (first));
+        g_assert_nonnull (bayes_classifier_get_model (classifier));
+     }
+
+   g_test_log_set_fatal_handler (NULL, NULL);
+   g_assert (bayes_classifier_watch_file (classifier, NULL, &error));
+   g_assert_no_error (error);
+   g_unlink (filename);
+}
+
+static gchar **
+null_tokenizer (const gchar *text,
+                gpointer     user_data)
+{
+   return NULL;
+}
+
+static void
+test_null_tokenizer (void)
+{
+   g_autoptr(BayesClassifier) classifier = NULL;
+   g_autoptr(BayesStorage) storage = NULL;
+   g_autoptr(BayesGuessContext) context = NULL;
+   BayesGuessResult results[4];
+   GList *guesses;
+   guint n;
+
+   storage = BAYES_STORAGE (bayes_storage_memory_new ());
+   classifier = bayes_classifier_new ();
+   bayes_classifier_set_storage (classifier, storage);
+   bayes_classifier_set_collect_stats (classifier, TRUE);
+   context = bayes_guess_context_new ();
+
+   bayes_classifier_train (classifier, "english", "the quick brown fox");
+   bayes_classifier_train (classifier, "spanish", "el rapido zorro marron");
+
+   /* A tokenizer returning NULL is the same as one finding no tokens. */
+   guesses = bayes_classifier_guess (classifier, "");
+   n = g_list_length (guesses);
+   g_list_free_full (guesses, (GDestroyNotify)bayes_guess_unref);
+
+   bayes_classifier_set_tokenizer (classifier, null_tokenizer, NULL, NULL);
+   bayes_classifier_train (classifier, "english", "the lazy dog");
+
+   guesses = bayes_classifier_guess (classifier, "the lazy dog");
+   g_assert_cmpint (n, ==, g_list_length (guesses));
+   g_list_free_full (guesses, (GDestroyNotify)bayes_guess_unref);
+   g_assert_cmpint (0, ==, bayes_classifier_guess_with_context (classifier, context, "the lazy dog",
+                                                                results, G_N_ELEMENTS (results)));
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_test_init (&argc, &argv, NULL);
+   g_test_add_func ("/Classifier/stats", test_stats);
+   g_test_add_func ("/Classifier/sparse", test_sparse);
+   g_test_add_func ("/Classifier/memory", test_memory);
+   g_test_add_func ("/Classifier/context", test_context);
+   g_test_add_func ("/Classifier/null_tokenizer", test_null_tokenizer);
+   g_test_add_func ("/Classifier/swap", test_swap);
+   g_test_add_func ("/Classifier/swap_frozen", test_swap_frozen);
+   g_test_add_func ("/Classifier/freeze_sketch", test_freeze_sketch);
+   g_test_add_func ("/Classifier/watch", test_watch);
+   g_test_add_func ("/Classifier/watch_invalid", test_watch_invalid);
+   return g_test_run ();
+}
@@ -0,0 +1,296 @@
+#include <bayes-glib.h>
+#include <math.h>
+
+/*
+ * The multinomial naive Bayes score of @tokens for @name, computed
+ * directly from the counts of @storage.
+ */
+static gdouble
+naive_score (BayesStorage  *storage,
+             const gchar   *name,
+             const gchar  **tokens,
+             guint          n_classes,
+             guint          n_vocabulary,
+             gdouble        alpha)
+{
+   gdouble pool = bayes_storage_get_token_count (storage, name, NULL);
+   gdouble corpus = bayes_storage_get_token_count (storage, NULL, NULL);
+   gdouble score;
+   guint i;
+
+   score = log ((pool + alpha) / (corpus + alpha * n_classes));
+
+   for (i = 0; tokens [i]; i++)
+     {
+        if (bayes_storage_get_token_count (storage, NULL, tokens [i]) == 0)
+          continue;
+        score += log ((bayes_storage_get_token_count (storage, name, tokens [i]) + alpha) /
+                      (pool + alpha * n_vocabulary));
+     }
+
+   return score;
+}
+
+static void
+test_score (void)
+{
+   const gchar *tokens[] = { "the", "fox", "el", "the", "unknown", NULL };
+   g_autoptr(BayesStorage) storage = NULL;
+   g_autoptr(BayesModel) model = NULL;
+   const gchar * const *names;
+   gdouble scores[3];
+   guint i;
+
+   storage = BAYES_STORAGE (bayes_storage_memory_new ());
+   bayes_storage_add_token_count (storage, "english", "the", 5);
+   bayes_storage_add_token_count (storage, "english", "fox", 2);
+   bayes_storage_add_token (storage, "english", "dog");
+   bayes_storage_add_token_count (storage, "spanish", "el", 4);
+   bayes_storage_add_token (storage, "spanish", "fox");
+   bayes_storage_add_token (storage, "german", "der");
+
+   model = bayes_model_new (storage, 0.5);
+   g_assert_cmpint (3, ==, bayes_model_get_n_classes (model));
+   g_assert_cmpint (5, ==, bayes_model_get_n_tokens (model));
+
+   g_assert_cmpint (4, ==, bayes_model_score (model, tokens, scores));
+
+   names = bayes_model_get_names (model);
+   for (i = 0; i < 3; i++)
+     g_assert_cmpfloat (fabs (scores [i] - naive_score (storage, names [i], tokens, 3, 5, 0.5)), <, 1e-9);
+
+   /* The model is a snapshot. */
+   bayes_storage_add_token (storage, "french", "le");
+   g_assert_cmpint (3, ==, bayes_model_get_n_classes (model));
+}
+
+static void
+test_guess (void)
+{
+   const gchar *tokens[] = { "el", "zorro", "the", NULL };
+   g_autoptr(BayesClassifier) classifier = NULL;
+   g_autoptr(BayesStorage) storage = NULL;
+   GList *guesses;
+   GList *iter;
+   gdouble sum = 0.0;
+
+   storage = BAYES_STORAGE (bayes_storage_memory_new ());
+   classifier = bayes_classifier_new ();
+   bayes_classifier_set_storage (classifier, storage);
+
+   bayes_classifier_train (classifier, "english", "the quick brown fox jumps over the lazy dog");
+   bayes_classifier_train (classifier, "spanish", "el rapido zorro marron salta sobre el perro");
+   g_assert_null (bayes_classifier_get_model (classifier));
+
+   bayes_classifier_freeze (classifier);
+   g_assert_nonnull (bayes_classifier_get_model (classifier));
+
+   guesses = bayes_model_guess (bayes_classifier_get_model (classifier), tokens);
+   g_assert_cmpint (2, ==, g_list_length (guesses));
+   g_assert_cmpstr ("spanish", ==, bayes_guess_get_name (guesses->data));
+   for (iter = guesses; iter; iter = iter->next)
+     sum += bayes_guess_get_probability (iter->data);
+   g_assert_cmpfloat (fabs (sum - 1.0), <, 1e-9);
+   g_list_free_full (guesses, (GDestroyNotify)bayes_guess_unref);
+
+   guesses = bayes_classifier_guess (classifier, "the lazy fox");
+   g_assert_cmpstr ("english", ==, bayes_guess_get_name (guesses->data));
+   g_assert_cmpfloat (bayes_guess_get_probability (guesses->data), >, 0.5);
+   g_list_free_full (guesses, (GDestroyNotify)bayes_guess_unref);
+
+   bayes_classifier_thaw (classifier);
+   g_assert_null (bayes_classifier_get_model (classifier));
+}
+
+static void
+test_index (void)
+{
+   g_autoptr(BayesStorage) storage = NULL;
+   g_autoptr(BayesModel) model = NULL;
+   const gchar *tokens[2] = { NULL, NULL };
+   gdouble scores[2];
+   gchar token[32];
+   guint n_known = 0;
+   guint odd;
+   guint i;
+
+   storage = BAYES_STORAGE (bayes_storage_memory_new ());
+   for (i = 0; i < 5000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        bayes_storage_add_token_count (storage, i % 2 ? "odd" : "even", token, 1 + i % 3);
+     }
+
+   model = bayes_model_new (storage, 1.0);
+   g_assert_cmpint (5000, ==, bayes_model_get_n_tokens (model));
+
+   /* Every token is found, with the weight of its own classification. */
+   odd = g_strcmp0 (bayes_model_get_names (model) [0], "odd") == 0 ? 0 : 1;
+   tokens [0] = token;
+   for (i = 0; i < 5000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        g_assert_cmpint (1, ==, bayes_model_score (model, tokens, scores));
+        if (i % 2)
+          g_assert_cmpfloat (scores [odd], >, scores [1 - odd]);
+        else
+          g_assert_cmpfloat (scores [odd], <, scores [1 - odd]);
+     }
+
+   /* Tokens that were not trained on are rejected by their fingerprint. */
+   for (i = 0; i < 10000; i++)
+     {
+        g_snprintf (token, sizeof token, "other%u", i);
+        n_known += bayes_model_score (model, tokens, scores);
+     }
+   g_assert_cmpint (n_known, <, 10);
+
+   /* The tokens themselves are not kept. */
+   g_assert_cmpint (bayes_model_get_memory_size (model), <, 5000 * 24);
+}
+
+static void
+test_excluding (void)
+{
+   g_autoptr(BayesStorage) storage = NULL;
+   g_autoptr(BayesStorage) fold = NULL;
+   g_autoptr(BayesStorage) rest = NULL;
+   g_autoptr(BayesModel) model = NULL;
+   g_autoptr(BayesModel) expected = NULL;
+   const gchar *tokens[2] = { NULL, NULL };
+   gdouble scores[2];
+   gdouble expected_scores[2];
+   gchar token[32];
+   const gchar *name;
+   guint i;
+
+   storage = BAYES_STORAGE (bayes_storage_memory_new ());
+   fold = BAYES_STORAGE (bayes_storage_memory_new ());
+   rest = BAYES_STORAGE (bayes_storage_memory_new ());
+
+   /* The fold shares some tokens with the rest and has tokens of its own. */
+   for (i = 0; i < 4000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        name = i % 2 ? "odd" : "even";
+        bayes_storage_add_token_count (storage, name, token, 1 + i % 3);
+        if (i < 3000)
+          bayes_storage_add_token_count (rest, name, token, 1 + i % 3);
+        else
+          bayes_storage_add_token_count (fold, name, token, 1 + i % 3);
+     }
+   for (i = 1000; i < 3000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        bayes_storage_add_token_count (storage, "odd", token, 2);
+        bayes_storage_add_token_count (fold, "odd", token, 2);
+     }
+
+   model = bayes_model_new_excluding (storage, fold, 1.0);
+   expected = bayes_model_new (rest, 1.0);
+
+   g_assert_cmpint (bayes_model_get_n_tokens (expected), ==, bayes_model_get_n_tokens (model));
+   g_assert_cmpstr (bayes_model_get_names (expected) [0], ==, bayes_model_get_names (model) [0]);
+
+   tokens [0] = token;
+   for (i = 0; i < 5000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        g_assert_cmpint (bayes_model_score (expected, tokens, expected_scores), ==,
+                         bayes_model_score (model, tokens, scores));
+        g_assert_cmpfloat (fabs (scores [0] - expected_scores [0]), <, 1e-9);
+        g_assert_cmpfloat (fabs (scores [1] - expected_scores [1]), <, 1e-9);
+     }
+}
+
+static void
+test_quantize (void)
+{
+   g_autoptr(BayesStorage) storage = NULL;
+   g_autoptr(BayesModel) model = NULL;
+   g_autoptr(BayesModel) model16 = NULL;
+   g_autoptr(BayesModel) model8 = NULL;
+   g_autoptr(GPtrArray) documents = NULL;
+   g_autoptr(GVariant) report = NULL;
+   g_autoptr(GRand) rand = NULL;
+   const gchar *names[] = { "a", "b", "c" };
+   const gchar *labels[201];
+   gdouble scores[3];
+   gdouble scores16[3];
+   gdouble value = 0.0;
+   guint64 size = 0;
+   guint32 n = 0;
+   gchar **tokens;
+   gchar token[32];
+   guint label;
+   guint i;
+   guint j;
+
+   storage = BAYES_STORAGE (bayes_storage_memory_new ());
+   rand = g_rand_new_with_seed (42);
+
+   /* Each classification favours a third of the tokens. */
+   for (i = 0; i < 3000; i++)
+     {
+        label = g_rand_int_range (rand, 0, 3);
+        g_snprintf (token, sizeof token, "t%u", g_rand_int_range (rand, 0, 100) * 3 + label);
+        bayes_storage_add_token_count (storage, names [label], token, g_rand_int_range (rand, 1, 20));
+     }
+
+   model = bayes_model_new (storage, 1.0);
+   model16 = bayes_model_quantize (model, BAYES_MODEL_PRECISION_16_BIT);
+   model8 = bayes_model_quantize (model, BAYES_MODEL_PRECISION_8_BIT);
+   g_assert_cmpint (BAYES_MODEL_PRECISION_EXACT, ==, bayes_model_get_precision (model));
+   g_assert_cmpint (BAYES_MODEL_PRECISION_16_BIT, ==, bayes_model_get_precision (model16));
+   g_assert_cmpint (BAYES_MODEL_PRECISION_8_BIT, ==, bayes_model_get_precision (model8));
+   g_assert_cmpint (bayes_model_get_n_tokens (model), ==, bayes_model_get_n_tokens (model8));
+   g_assert_cmpint (bayes_model_get_memory_size (model16), <, bayes_model_get_memory_size (model));
+   g_assert_cmpint (bayes_model_get_memory_size (model8), <, bayes_model_get_memory_size (model16));
+
+   documents = g_ptr_array_new_with_free_func ((GDestroyNotify)g_strfreev);
+   for (i = 0; i < 200; i++)
+     {
+        label = g_rand_int_range (rand, 0, 3);
+        labels [i] = names [label];
+        tokens = g_new0 (gchar *, 11);
+        for (j = 0; j < 10; j++)
+          tokens [j] = g_strdup_printf ("t%u", g_rand_int_range (rand, 0, 100) * 3 +
+                                       (j < 6 ? label : g_rand_int_range (rand, 0, 3)));
+        g_ptr_array_add (documents, tokens);
+     }
+   labels [i] = NULL;
+
+   /* 16 bits are as good as exact for ranking. */
+   tokens = g_ptr_array_index (documents, 0);
+   bayes_model_score (model, (const gchar * const *)tokens, scores);
+   bayes_model_score (model16, (const gchar * const *)tokens, scores16);
+   for (i = 0; i < 3; i++)
+     g_assert_cmpfloat (fabs (scores [i] - scores16 [i]), <, 1e-3);
+
+   report = bayes_model_calibrate (model8, model, documents, labels);
+   g_assert (g_variant_lookup (report, "documents", "u", &n));
+   g_assert_cmpint (n, ==, 200);
+   g_assert (g_variant_lookup (report, "agreement", "d", &value));
+   g_assert_cmpfloat (value, >, 0.95);
+   g_assert (g_variant_lookup (report, "max-probability-error", "d", &value));
+   g_assert_cmpfloat (value, <, 0.5);
+   g_assert (g_variant_lookup (report, "reference-accuracy", "d", &value));
+   g_assert_cmpfloat (value, >, 0.8);
+   g_assert (g_variant_lookup (report, "accuracy-delta", "d", &value));
+   g_assert_cmpfloat (fabs (value), <, 0.05);
+   g_assert (g_variant_lookup (report, "memory-size", "t", &size));
+   g_assert_cmpint (size, ==, bayes_model_get_memory_size (model8));
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_test_init (&argc, &argv, NULL);
+   g_test_add_func ("/Model/score", test_score);
+   g_test_add_func ("/Model/guess", test_guess);
+   g_test_add_func ("/Model/index", test_index);
+   g_test_add_func ("/Model/excluding", test_excluding);
+   g_test_add_func ("/Model/quantize", test_quantize);
+   return g_test_run ();
+}
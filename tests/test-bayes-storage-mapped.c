@@ -0,0 +1,331 @@
+#include <bayes-glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+static gchar *
+make_tmpdir (void)
+{
+   g_autoptr(GError) error = NULL;
+   gchar *tmpdir;
+
+   tmpdir = g_dir_make_tmp ("test-bayes-storage-mapped-XXXXXX", &error);
+   g_assert_no_error (error);
+
+   return tmpdir;
+}
+
+static void
+test1 (void)
+{
+   g_autoptr(BayesStorageMapped) storage_mapped = NULL;
+   g_autoptr(GError) error = NULL;
+   g_autofree gchar *tmpdir = make_tmpdir ();
+   g_autofree gchar *filename = g_build_filename (tmpdir, "index", NULL);
+   BayesStorage *storage;
+
+   storage_mapped = bayes_storage_mapped_new (filename, &error);
+   g_assert_no_error (error);
+   storage = BAYES_STORAGE (storage_mapped);
+
+   bayes_storage_add_token (storage, "english", "turbo");
+   bayes_storage_add_token (storage, "english", "brakes");
+   bayes_storage_add_token_count (storage, "english", "suspension", 3);
+   bayes_storage_add_token (storage, "german", "turbo");
+   g_assert_cmpint (5, ==, bayes_storage_get_token_count (storage, "english", NULL));
+
+   bayes_storage_mapped_flush (storage_mapped, &error);
+   g_assert_no_error (error);
+   g_assert_cmpint (0, ==, bayes_storage_mapped_get_overlay_size (storage_mapped));
+
+   /*
+    * Counts are the sum of the index and the overlay.
+    */
+   bayes_storage_add_token (storage, "english", "turbo");
+   bayes_storage_add_token (storage, "french", "turbo");
+   g_assert_cmpint (2, ==, bayes_storage_get_token_count (storage, "english", "turbo"));
+   g_assert_cmpint (1, ==, bayes_storage_get_token_count (storage, "english", "brakes"));
+   g_assert_cmpint (3, ==, bayes_storage_get_token_count (storage, "english", "suspension"));
+   g_assert_cmpint (0, ==, bayes_storage_get_token_count (storage, "english", "cops"));
+   g_assert_cmpint (4, ==, bayes_storage_get_token_count (storage, NULL, "turbo"));
+   g_assert_cmpint (7, ==, bayes_storage_get_token_count (storage, NULL, NULL));
+
+   bayes_storage_mapped_flush (storage_mapped, &error);
+   g_assert_no_error (error);
+   g_clear_object (&storage_mapped);
+
+   storage_mapped = bayes_storage_mapped_new (filename, &error);
+   g_assert_no_error (error);
+   storage = BAYES_STORAGE (storage_mapped);
+
+   g_assert_cmpint (2, ==, bayes_storage_get_token_count (storage, "english", "turbo"));
+   g_assert_cmpint (1, ==, bayes_storage_get_token_count (storage, "german", "turbo"));
+   g_assert_cmpint (1, ==, bayes_storage_get_token_count (storage, "french", "turbo"));
+   g_assert_cmpint (0, ==, bayes_storage_get_token_count (storage, "french", "brakes"));
+   g_assert_cmpint (6, ==, bayes_storage_get_token_count (storage, "english", NULL));
+
+   g_unlink (filename);
+   g_rmdir (tmpdir);
+}
+
+static void
+test_add_memory (void)
+{
+   g_autoptr(BayesStorageMapped) storage_mapped = NULL;
+   g_autoptr(BayesStorageMemory) storage_memory = NULL;
+   g_autoptr(GError) error = NULL;
+   g_autofree gchar *tmpdir = make_tmpdir ();
+   g_autofree gchar *filename = g_build_filename (tmpdir, "index", NULL);
+   BayesStorage *storage;
+   gchar token[32];
+   guint i;
+
+   storage_memory = bayes_storage_memory_new ();
+   for (i = 0; i < 1000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        bayes_storage_add_token_count (BAYES_STORAGE (storage_memory), "english", token, i % 3 + 1);
+     }
+
+   /*
+    * A small overlay limit flushes many times while importing.
+    */
+   storage_mapped = bayes_storage_mapped_new (filename, &error);
+   g_assert_no_error (error);
+   g_object_set (storage_mapped, "overlay-limit", (guint64)4096, NULL);
+   storage = BAYES_STORAGE (storage_mapped);
+
+   bayes_storage_mapped_add_memory (storage_mapped, storage_memory);
+   bayes_storage_mapped_flush (storage_mapped, &error);
+   g_assert_no_error (error);
+
+   for (i = 0; i < 1000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        g_assert_cmpint (i % 3 + 1, ==, bayes_storage_get_token_count (storage, "english", token));
+        g_assert_cmpfloat (bayes_storage_get_token_probability (BAYES_STORAGE (storage_memory), "english", token),
+                           ==,
+                           bayes_storage_get_token_probability (storage, "english", token));
+     }
+
+   g_unlink (filename);
+   g_rmdir (tmpdir);
+}
+
+static void
+test_invalid (void)
+{
+   g_autoptr(BayesStorageMapped) storage_mapped = NULL;
+   g_autoptr(GError) error = NULL;
+   g_autofree gchar *tmpdir = make_tmpdir ();
+   g_autofree gchar *filename = g_build_filename (tmpdir, "index", NULL);
+
+   g_file_set_contents (filename, "not an index, not an index, not an index", -1, &error);
+   g_assert_no_error (error);
+
+   storage_mapped = bayes_storage_mapped_new (filename, &error);
+   g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+   g_assert_null (storage_mapped);
+
+   g_unlink (filename);
+   g_rmdir (tmpdir);
+}
+
+/*
+ * Checks the postings of @token against the counts of every
+ * classification.
+ */
+static void
+check_postings (BayesStorage *storage,
+                const gchar  *token)
+{
+   g_autoptr(GArray) postings = NULL;
+   g_auto(GStrv) names = NULL;
+   BayesPosting *posting;
+   guint n_classes = 0;
+   guint n;
+   guint i;
+
+   names = bayes_storage_get_names (storage);
+   postings = g_array_new (FALSE, FALSE, sizeof (BayesPosting));
+   n = bayes_storage_get_postings (storage, token, postings);
+   g_assert_cmpint (n, ==, postings->len);
+
+   for (i = 0; names [i]; i++)
+     if (bayes_storage_get_token_count (storage, names [i], token) != 0)
+       n_classes++;
+   g_assert_cmpint (n_classes, ==, n);
+
+   for (i = 0; i < postings->len; i++)
+     {
+        posting = &g_array_index (postings, BayesPosting, i);
+        g_assert_cmpint (posting->class_id, <, g_strv_length (names));
+        g_assert_cmpint (posting->count, ==,
+                         bayes_storage_get_token_count (storage, names [posting->class_id], token));
+     }
+}
+
+static void
+collect_cb (const gchar *name,
+            const gchar *token,
+            guint        count,
+            gpointer     user_data)
+{
+   GHashTable *seen = user_data;
+   gchar *key;
+
+   key = g_strdup_printf ("%s/%s", name, token);
+   g_assert_false (g_hash_table_contains (seen, key));
+   g_hash_table_insert (seen, key, GUINT_TO_POINTER (count));
+}
+
+/*
+ * Checks that foreach visits every token of every classification once,
+ * with its count.
+ */
+static void
+check_foreach (BayesStorage *storage,
+               guint         n_expected)
+{
+   g_autoptr(GHashTable) seen = NULL;
+   GHashTableIter iter;
+   gpointer key;
+   gpointer value;
+   gchar **parts;
+
+   seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+   bayes_storage_foreach (storage, collect_cb, seen);
+   g_assert_cmpint (n_expected, ==, g_hash_table_size (seen));
+
+   g_hash_table_iter_init (&iter, seen);
+   while (g_hash_table_iter_next (&iter, &key, &value))
+     {
+        parts = g_strsplit (key, "/", 2);
+        g_assert_cmpint (GPOINTER_TO_UINT (value), ==,
+                         bayes_storage_get_token_count (storage, parts [0], parts [1]));
+        g_strfreev (parts);
+     }
+}
+
+static void
+test_postings_foreach (void)
+{
+   g_autoptr(BayesStorageMapped) storage_mapped = NULL;
+   g_autoptr(GError) error = NULL;
+   g_autofree gchar *tmpdir = make_tmpdir ();
+   g_autofree gchar *filename = g_build_filename (tmpdir, "index", NULL);
+   BayesStorage *storage;
+   gchar token[32];
+   guint i;
+
+   storage_mapped = bayes_storage_mapped_new (filename, &error);
+   g_assert_no_error (error);
+   storage = BAYES_STORAGE (storage_mapped);
+
+   bayes_storage_add_token_count (storage, "english", "the", 3);
+   bayes_storage_add_token (storage, "english", "fox");
+   bayes_storage_add_token (storage, "spanish", "el");
+   bayes_storage_add_token_count (storage, "spanish", "fox", 2);
+   check_postings (storage, "fox");
+   check_foreach (storage, 4);
+
+   bayes_storage_mapped_flush (storage_mapped, &error);
+   g_assert_no_error (error);
+   check_postings (storage, "the");
+   check_postings (storage, "fox");
+   check_postings (storage, "cat");
+   check_foreach (storage, 4);
+
+   /*
+    * Tokens in the index and the overlay, only in the overlay, and in a
+    * classification that is not in the index yet.
+    */
+   bayes_storage_add_token (storage, "english", "fox");
+   bayes_storage_add_token (storage, "german", "fox");
+   bayes_storage_add_token (storage, "english", "dog");
+   bayes_storage_add_token (storage, "german", "der");
+   check_postings (storage, "fox");
+   check_postings (storage, "dog");
+   check_postings (storage, "der");
+   check_postings (storage, "el");
+   check_foreach (storage, 7);
+
+   for (i = 0; i < 500; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        bayes_storage_add_token_count (storage, i % 2 ? "english" : "french", token, i % 4 + 1);
+        if (i % 3 == 0)
+          bayes_storage_add_token (storage, "spanish", token);
+     }
+   bayes_storage_mapped_flush (storage_mapped, &error);
+   g_assert_no_error (error);
+
+   for (i = 0; i < 500; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        check_postings (storage, token);
+     }
+   check_foreach (storage, 7 + 500 + 167);
+
+   g_unlink (filename);
+   g_rmdir (tmpdir);
+}
+
+static void
+test_unterminated_token (void)
+{
+   g_autoptr(BayesStorageMapped) storage_mapped = NULL;
+   g_autoptr(GError) error = NULL;
+   g_autofree gchar *tmpdir = make_tmpdir ();
+   g_autofree gchar *filename = g_build_filename (tmpdir, "index", NULL);
+   g_autofree gchar *contents = NULL;
+   BayesStorage *storage;
+   gboolean found = FALSE;
+   gsize len;
+   gsize i;
+
+   storage_mapped = bayes_storage_mapped_new (filename, &error);
+   g_assert_no_error (error);
+   bayes_storage_add_token (BAYES_STORAGE (storage_mapped), "english", "turbo");
+   bayes_storage_mapped_flush (storage_mapped, &error);
+   g_assert_no_error (error);
+   g_clear_object (&storage_mapped);
+
+   /* Overwrite the nul byte that ends the token. */
+   g_file_get_contents (filename, &contents, &len, &error);
+   g_assert_no_error (error);
+   for (i = 0; i + 6 <= len && !found; i++)
+     {
+        if (memcmp (contents + i, "turbo", 6) == 0)
+          {
+             contents [i + 5] = 'X';
+             found = TRUE;
+          }
+     }
+   g_assert_true (found);
+   g_file_set_contents (filename, contents, len, &error);
+   g_assert_no_error (error);
+
+   /* The record is rejected rather than read past its end. */
+   storage_mapped = bayes_storage_mapped_new (filename, &error);
+   g_assert_no_error (error);
+   storage = BAYES_STORAGE (storage_mapped);
+   g_assert_cmpint (0, ==, bayes_storage_get_token_count (storage, "english", "turbo"));
+   check_postings (storage, "turbo");
+   check_foreach (storage, 0);
+
+   g_unlink (filename);
+   g_rmdir (tmpdir);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_test_init (&argc, &argv, NULL);
+   g_test_add_func ("/Storage/Mapped/basic_tests", test1);
+   g_test_add_func ("/Storage/Mapped/add_memory", test_add_memory);
+   g_test_add_func ("/Storage/Mapped/invalid", test_invalid);
+   g_test_add_func ("/Storage/Mapped/postings_foreach", test_postings_foreach);
+   g_test_add_func ("/Storage/Mapped/unterminated_token", test_unterminated_token);
+   return g_test_run ();
+}
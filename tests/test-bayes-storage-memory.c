@@ -1,4 +1,6 @@
 #include <bayes-glib.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
 
 static void
 test1 (void)
@@ -17,11 +19,619 @@ test1 (void)
    g_assert_cmpint (0, ==, bayes_storage_get_token_count (storage, "english", "cops"));
 }
 
+static void
+test_prune (void)
+{
+   g_autoptr(BayesStorageMemory) storage_memory = NULL;
+   BayesStorage *storage;
+   gchar token[32];
+   guint64 used;
+   guint total;
+   guint i;
+
+   storage_memory = bayes_storage_memory_new ();
+   storage = BAYES_STORAGE (storage_memory);
+   g_object_set (storage_memory, "prune-age", 10, NULL);
+
+   for (i = 0; i < 100; i++)
+     bayes_storage_add_token (storage, "english", "common");
+
+   used = bayes_storage_memory_get_memory_used (storage_memory);
+   g_assert_cmpint (used, >, 0);
+   /* The budget also covers the queue of tokens too young to be pruned. */
+   bayes_storage_memory_set_memory_budget (storage_memory, used * 16);
+
+   for (i = 0; i < 1000; i++)
+     {
+        g_snprintf (token, sizeof token, "rare%u", i);
+        bayes_storage_add_token (storage, "english", token);
+        bayes_storage_add_token (storage, "english", "common");
+     }
+
+   g_assert_cmpint (bayes_storage_memory_get_memory_used (storage_memory), <=, used * 16);
+   g_assert_cmpint (1100, ==, bayes_storage_get_token_count (storage, "english", "common"));
+   g_assert_cmpint (0, ==, bayes_storage_get_token_count (storage, "english", "rare0"));
+   g_assert_cmpint (1, ==, bayes_storage_get_token_count (storage, "english", "rare999"));
+
+   for (i = 0, total = 1100; i < 1000; i++)
+     {
+        g_snprintf (token, sizeof token, "rare%u", i);
+        total += bayes_storage_get_token_count (storage, NULL, token);
+     }
+
+   g_assert_cmpint (total, ==, bayes_storage_get_token_count (storage, "english", NULL));
+}
+
+static void
+test_many_tokens (void)
+{
+   g_autoptr(BayesStorage) storage = NULL;
+   gchar token[32];
+   guint i;
+
+   storage = BAYES_STORAGE (bayes_storage_memory_new ());
+
+   /*
+    * Enough distinct tokens to grow the token tables many times over.
+    */
+   for (i = 0; i < 10000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        bayes_storage_add_token_count (storage, "english", token, i % 7 + 1);
+        if (i % 2 == 0)
+          bayes_storage_add_token (storage, "spanish", token);
+     }
+
+   for (i = 0; i < 10000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        g_assert_cmpint (i % 7 + 1, ==, bayes_storage_get_token_count (storage, "english", token));
+        g_assert_cmpint (i % 2 == 0, ==, bayes_storage_get_token_count (storage, "spanish", token));
+        g_assert_cmpint (i % 7 + 1 + (i % 2 == 0), ==, bayes_storage_get_token_count (storage, NULL, token));
+     }
+
+   g_assert_cmpint (0, ==, bayes_storage_get_token_count (storage, "english", "token10000"));
+   g_assert_cmpint (5000, ==, bayes_storage_get_token_count (storage, "spanish", NULL));
+}
+
+static void
+test_memory_stats (void)
+{
+   g_autoptr(BayesStorageMemory) storage_memory = NULL;
+   g_autoptr(GVariant) stats = NULL;
+   g_autoptr(GVariant) by_class = NULL;
+   g_autoptr(GVariant) english = NULL;
+   g_autoptr(GError) error = NULL;
+   g_autofree gchar *filename = NULL;
+   g_autofree gchar *contents = NULL;
+   BayesStorage *storage;
+   gchar token[32];
+   guint64 value = 0;
+   guint32 classes = 0;
+   gdouble load = 0.0;
+   gsize len = 0;
+   gint fd;
+   guint i;
+
+   storage_memory = bayes_storage_memory_new ();
+   storage = BAYES_STORAGE (storage_memory);
+
+   for (i = 0; i < 1000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        bayes_storage_add_token_count (storage, "english", token, 3);
+        if (i < 100)
+          bayes_storage_add_token (storage, "spanish", token);
+     }
+
+   stats = bayes_storage_memory_get_memory_stats (storage_memory);
+
+   g_assert (g_variant_lookup (stats, "classes", "u", &classes));
+   g_assert_cmpint (classes, ==, 2);
+   g_assert (g_variant_lookup (stats, "distinct-tokens", "t", &value));
+   g_assert_cmpint (value, ==, 1000);
+   g_assert (g_variant_lookup (stats, "token-occurrences", "t", &value));
+   g_assert_cmpint (value, ==, 3100);
+   g_assert (g_variant_lookup (stats, "key-bytes", "t", &value));
+   g_assert_cmpint (value, >, 0);
+   g_assert (g_variant_lookup (stats, "bloom-bytes", "t", &value));
+   g_assert_cmpint (value, >=, 1000);
+   g_assert (g_variant_lookup (stats, "load-factor", "d", &load));
+   g_assert_cmpfloat (load, >, 0.0);
+   g_assert_cmpfloat (load, <, 1.0);
+
+   by_class = g_variant_lookup_value (stats, "by-class", G_VARIANT_TYPE_VARDICT);
+   english = g_variant_lookup_value (by_class, "english", G_VARIANT_TYPE_VARDICT);
+   g_assert (g_variant_lookup (english, "tokens", "t", &value));
+   g_assert_cmpint (value, ==, 1000);
+   g_assert (g_variant_lookup (english, "occurrences", "t", &value));
+   g_assert_cmpint (value, ==, 3000);
+
+   /* the estimate should be in the right ballpark */
+   fd = g_file_open_tmp ("test-bayes-storage-memory-XXXXXX.json", &filename, &error);
+   g_assert_no_error (error);
+   close (fd);
+   g_assert (bayes_storage_memory_save_to_file (storage_memory, filename, &error));
+   g_assert_no_error (error);
+   g_assert (g_file_get_contents (filename, &contents, &len, &error));
+   g_assert_no_error (error);
+   g_unlink (filename);
+
+   g_assert (g_variant_lookup (stats, "serialized-size", "t", &value));
+   g_assert_cmpint (value, >, len / 2);
+   g_assert_cmpint (value, <, len * 2);
+}
+
+/*
+ * Checks the postings of @token against the count of every class.
+ */
+static void
+check_postings (BayesStorage *storage,
+                const gchar  *token)
+{
+   g_autoptr(GArray) postings = NULL;
+   g_auto(GStrv) names = NULL;
+   BayesPosting *posting;
+   guint n_classes = 0;
+   guint n;
+   guint i;
+
+   names = bayes_storage_get_names (storage);
+   postings = g_array_new (FALSE, FALSE, sizeof (BayesPosting));
+   n = bayes_storage_get_postings (storage, token, postings);
+   g_assert_cmpint (n, ==, postings->len);
+
+   for (i = 0; names [i]; i++)
+     if (bayes_storage_get_token_count (storage, names [i], token) != 0)
+       n_classes++;
+   g_assert_cmpint (n_classes, ==, n);
+
+   for (i = 0; i < postings->len; i++)
+     {
+        posting = &g_array_index (postings, BayesPosting, i);
+        g_assert_cmpint (posting->class_id, <, g_strv_length (names));
+        g_assert_cmpint (posting->count, ==,
+                         bayes_storage_get_token_count (storage, names [posting->class_id], token));
+     }
+}
+
+static void
+test_postings (void)
+{
+   g_autoptr(BayesStorageMemory) storage_memory = NULL;
+   BayesStorage *storage;
+   gchar token[32];
+   guint i;
+
+   storage_memory = bayes_storage_memory_new ();
+   storage = BAYES_STORAGE (storage_memory);
+
+   bayes_storage_add_token_count (storage, "english", "the", 3);
+   bayes_storage_add_token (storage, "english", "fox");
+   bayes_storage_add_token (storage, "spanish", "el");
+   bayes_storage_add_token_count (storage, "spanish", "fox", 2);
+   bayes_storage_add_token (storage, "german", "der");
+
+   check_postings (storage, "the");
+   check_postings (storage, "fox");
+   check_postings (storage, "cat");
+
+   /* The index is kept up to date once it has been built. */
+   bayes_storage_add_token (storage, "german", "fox");
+   bayes_storage_add_token (storage, "french", "fox");
+   bayes_storage_add_token (storage, "french", "le");
+   check_postings (storage, "fox");
+   check_postings (storage, "le");
+
+   /* Evicted tokens leave the index. */
+   g_object_set (storage_memory, "prune-age", 0, NULL);
+   bayes_storage_memory_set_memory_budget (storage_memory,
+                                           bayes_storage_memory_get_memory_used (storage_memory));
+   for (i = 0; i < 100; i++)
+     {
+        g_snprintf (token, sizeof token, "rare%u", i);
+        bayes_storage_add_token (storage, i % 2 ? "english" : "spanish", token);
+     }
+
+   check_postings (storage, "fox");
+   for (i = 0; i < 100; i++)
+     {
+        g_snprintf (token, sizeof token, "rare%u", i);
+        check_postings (storage, token);
+     }
+}
+
+static gpointer
+check_postings_thread (gpointer data)
+{
+   BayesStorage *storage = data;
+   gchar token[32];
+   guint i;
+
+   for (i = 0; i < 2000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        check_postings (storage, token);
+     }
+
+   return NULL;
+}
+
+static void
+test_postings_threads (void)
+{
+   static const gchar *names[] = { "english", "spanish", "german", "french" };
+   g_autoptr(BayesStorageMemory) storage_memory = NULL;
+   BayesStorage *storage;
+   GThread *threads[8];
+   gchar token[32];
+   guint i;
+
+   storage_memory = bayes_storage_memory_new ();
+   storage = BAYES_STORAGE (storage_memory);
+
+   for (i = 0; i < 2000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        bayes_storage_add_token_count (storage, names [i % 4], token, 1 + i % 5);
+        bayes_storage_add_token (storage, names [i % 3], token);
+     }
+
+   /* The first guesses build the index at the same time. */
+   for (i = 0; i < G_N_ELEMENTS (threads); i++)
+     threads [i] = g_thread_new ("postings", check_postings_thread, storage);
+   for (i = 0; i < G_N_ELEMENTS (threads); i++)
+     g_thread_join (threads [i]);
+}
+
+static void
+test_add_token_counts (void)
+{
+   static const gchar *words[] = { "the", "fox", "the", "dog", "lazy" };
+   static const guint word_counts[] = { 2, 1, 3, 0, 4 };
+   g_autoptr(BayesStorage) storage = NULL;
+   g_autoptr(BayesStorage) expected = NULL;
+   g_autoptr(GPtrArray) tokens = NULL;
+   g_autoptr(GArray) counts = NULL;
+   gchar token[32];
+   guint count;
+   guint i;
+
+   storage = BAYES_STORAGE (bayes_storage_memory_new ());
+   expected = BAYES_STORAGE (bayes_storage_memory_new ());
+
+   /* Repeated tokens and zero counts. */
+   bayes_storage_add_token_counts (storage, "english", words, word_counts, G_N_ELEMENTS (words));
+   bayes_storage_add_token_counts (storage, "spanish", words, NULL, G_N_ELEMENTS (words));
+   for (i = 0; i < G_N_ELEMENTS (words); i++)
+     {
+        if (word_counts [i])
+          bayes_storage_add_token_count (expected, "english", words [i], word_counts [i]);
+        bayes_storage_add_token (expected, "spanish", words [i]);
+     }
+
+   /* A batch large enough to grow the tables several times. */
+   tokens = g_ptr_array_new_with_free_func (g_free);
+   counts = g_array_new (FALSE, FALSE, sizeof (guint));
+   for (i = 0; i < 5000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        g_ptr_array_add (tokens, g_strdup (token));
+        count = i % 3 + 1;
+        g_array_append_val (counts, count);
+        bayes_storage_add_token_count (expected, "german", token, count);
+     }
+   bayes_storage_add_token_counts (storage, "german", (const gchar * const *)tokens->pdata,
+                                   (const guint *)counts->data, tokens->len);
+
+   g_assert_cmpint (bayes_storage_get_token_count (expected, NULL, NULL), ==,
+                    bayes_storage_get_token_count (storage, NULL, NULL));
+   g_assert_cmpint (bayes_storage_get_token_count (expected, "english", NULL), ==,
+                    bayes_storage_get_token_count (storage, "english", NULL));
+   g_assert_cmpint (bayes_storage_get_token_count (expected, "spanish", NULL), ==,
+                    bayes_storage_get_token_count (storage, "spanish", NULL));
+
+   for (i = 0; i < G_N_ELEMENTS (words); i++)
+     {
+        g_assert_cmpint (bayes_storage_get_token_count (expected, "english", words [i]), ==,
+                         bayes_storage_get_token_count (storage, "english", words [i]));
+        g_assert_cmpint (bayes_storage_get_token_count (expected, NULL, words [i]), ==,
+                         bayes_storage_get_token_count (storage, NULL, words [i]));
+     }
+
+   for (i = 0; i < tokens->len; i++)
+     g_assert_cmpint (i % 3 + 1, ==, bayes_storage_get_token_count (storage, "german",
+                                                                    g_ptr_array_index (tokens, i)));
+}
+
+static void
+test_saturate (void)
+{
+   g_autoptr(BayesStorage) storage = NULL;
+
+   storage = BAYES_STORAGE (bayes_storage_memory_new ());
+
+   /* Wrapping around to 0 would lose the token. */
+   bayes_storage_add_token_count (storage, "english", "the", G_MAXUINT);
+   bayes_storage_add_token (storage, "english", "the");
+   bayes_storage_add_token (storage, "english", "fox");
+
+   g_assert_cmpint (bayes_storage_get_token_count (storage, "english", "the"), ==, G_MAXUINT);
+   g_assert_cmpint (bayes_storage_get_token_count (storage, NULL, "the"), ==, G_MAXUINT);
+   g_assert_cmpint (bayes_storage_get_token_count (storage, "english", "fox"), ==, 1);
+   g_assert_cmpint (bayes_storage_get_token_count (storage, "english", NULL), ==, G_MAXUINT);
+   g_assert_cmpint (bayes_storage_get_token_count (storage, NULL, NULL), ==, G_MAXUINT);
+}
+
+static void
+test_decay (void)
+{
+   g_autoptr(BayesStorageMemory) storage_memory = NULL;
+   BayesStorage *storage;
+   gchar token[32];
+   guint total;
+   guint i;
+
+   storage_memory = bayes_storage_memory_new ();
+   storage = BAYES_STORAGE (storage_memory);
+   bayes_storage_memory_set_half_life (storage_memory, 1000);
+   g_assert_cmpint (1000, ==, bayes_storage_memory_get_half_life (storage_memory));
+
+   bayes_storage_add_token_count (storage, "english", "old", 100);
+
+   for (i = 0; i < 50000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i % 300);
+        bayes_storage_add_token (storage, i % 3 ? "english" : "spanish", token);
+
+        /* The counts stay bounded however much is trained. */
+        g_assert_cmpint (bayes_storage_get_token_count (storage, "english", NULL) +
+                         bayes_storage_get_token_count (storage, "spanish", NULL), <, 3000);
+     }
+
+   /* Evidence that is not repeated fades away. */
+   g_assert_cmpint (0, ==, bayes_storage_get_token_count (storage, "english", "old"));
+   g_assert_cmpint (0, ==, bayes_storage_get_token_count (storage, NULL, "old"));
+
+   /* The corpus is decayed along with the classifications. */
+   total = 0;
+   for (i = 0; i < 300; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        g_assert_cmpint (bayes_storage_get_token_count (storage, NULL, token), ==,
+                         bayes_storage_get_token_count (storage, "english", token) +
+                         bayes_storage_get_token_count (storage, "spanish", token));
+        total += bayes_storage_get_token_count (storage, NULL, token);
+     }
+   g_assert_cmpint (total, >, 0);
+   g_assert_cmpint (total, ==, bayes_storage_get_token_count (storage, "english", NULL) +
+                               bayes_storage_get_token_count (storage, "spanish", NULL));
+}
+
+static void
+test_unknown_tokens (void)
+{
+   g_autoptr(BayesStorageMemory) storage_memory = NULL;
+   BayesStorage *storage;
+   gchar token[32];
+   guint i;
+
+   storage_memory = bayes_storage_memory_new ();
+   storage = BAYES_STORAGE (storage_memory);
+
+   /* Enough tokens for the filter of the corpus to be rebuilt. */
+   for (i = 0; i < 5000; i++)
+     {
+        g_snprintf (token, sizeof token, "word%u", i);
+        bayes_storage_add_token (storage, "english", token);
+     }
+   for (i = 0; i < 10; i++)
+     {
+        g_snprintf (token, sizeof token, "palabra%u", i);
+        bayes_storage_add_token (storage, "spanish", token);
+     }
+
+   for (i = 0; i < 5000; i++)
+     {
+        g_snprintf (token, sizeof token, "word%u", i);
+        g_assert_cmpfloat (bayes_storage_get_token_probability (storage, "english", token), >, 0.99);
+        g_assert_cmpfloat (bayes_storage_get_token_probability (storage, "spanish", token), <, 0.01);
+     }
+
+   for (i = 0; i < 5000; i++)
+     {
+        g_snprintf (token, sizeof token, "unknown%u", i);
+        g_assert_cmpfloat (bayes_storage_get_token_probability (storage, "english", token), ==, 0.0);
+     }
+}
+
+static gchar *
+make_tmp (void)
+{
+   g_autoptr(GError) error = NULL;
+   gchar *filename = NULL;
+   gint fd;
+
+   fd = g_file_open_tmp ("test-bayes-storage-memory-XXXXXX.json", &filename, &error);
+   g_assert_no_error (error);
+   close (fd);
+
+   return filename;
+}
+
+static void
+test_delta (void)
+{
+   g_autoptr(BayesStorageMemory) storage_memory = NULL;
+   g_autoptr(BayesStorageMemory) loaded = NULL;
+   g_autoptr(GError) error = NULL;
+   g_autofree gchar *base = make_tmp ();
+   g_autofree gchar *delta1 = make_tmp ();
+   g_autofree gchar *delta2 = make_tmp ();
+   g_autofree gchar *contents = NULL;
+   const gchar *deltas[3] = { delta1, delta2, NULL };
+   BayesStorage *storage;
+   gchar token[32];
+   gsize base_len = 0;
+   gsize len = 0;
+   guint64 used;
+   guint i;
+
+   storage_memory = bayes_storage_memory_new ();
+   storage = BAYES_STORAGE (storage_memory);
+
+   for (i = 0; i < 1000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        bayes_storage_add_token_count (storage, i % 2 ? "english" : "spanish", token, 4);
+     }
+
+   /* Changes are only tracked on request, and that is not free. */
+   g_assert (!bayes_storage_memory_get_track_changes (storage_memory));
+   g_assert (!bayes_storage_memory_save_delta (storage_memory, delta1, &error));
+   g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED);
+   g_clear_error (&error);
+
+   used = bayes_storage_memory_get_memory_used (storage_memory);
+   bayes_storage_memory_set_track_changes (storage_memory, TRUE);
+   g_assert_cmpint (bayes_storage_memory_get_memory_used (storage_memory), >, used);
+   bayes_storage_memory_set_track_changes (storage_memory, FALSE);
+   g_assert_cmpint (bayes_storage_memory_get_memory_used (storage_memory), ==, used);
+   bayes_storage_memory_set_track_changes (storage_memory, TRUE);
+
+   g_assert (bayes_storage_memory_save_to_file (storage_memory, base, &error));
+   g_assert_no_error (error);
+   g_assert (g_file_get_contents (base, &contents, &base_len, &error));
+   g_assert_no_error (error);
+   g_clear_pointer (&contents, g_free);
+
+   bayes_storage_add_token (storage, "english", "token1");
+   bayes_storage_add_token (storage, "german", "neu");
+   g_assert (bayes_storage_memory_save_delta (storage_memory, delta1, &error));
+   g_assert_no_error (error);
+
+   /* The delta holds the changes only. */
+   g_assert (g_file_get_contents (delta1, &contents, &len, &error));
+   g_assert_no_error (error);
+   g_assert_cmpint (len * 10, <, base_len);
+   g_clear_pointer (&contents, g_free);
+
+   /* Halve the counts so that tokens are both lowered and removed. */
+   bayes_storage_memory_set_half_life (storage_memory, 2000);
+   for (i = 0; i < 10000; i++)
+     bayes_storage_add_token (storage, "english", "new");
+   g_assert_cmpint (0, ==, bayes_storage_get_token_count (storage, "spanish", "token0"));
+   g_assert (bayes_storage_memory_save_delta (storage_memory, delta2, &error));
+   g_assert_no_error (error);
+
+   loaded = bayes_storage_memory_new_from_files (base, deltas, &error);
+   g_assert_no_error (error);
+   g_assert (loaded != NULL);
+
+   for (i = 0; i < 1000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        g_assert_cmpint (bayes_storage_get_token_count (storage, "english", token), ==,
+                         bayes_storage_get_token_count (BAYES_STORAGE (loaded), "english", token));
+        g_assert_cmpint (bayes_storage_get_token_count (storage, "spanish", token), ==,
+                         bayes_storage_get_token_count (BAYES_STORAGE (loaded), "spanish", token));
+        g_assert_cmpint (bayes_storage_get_token_count (storage, NULL, token), ==,
+                         bayes_storage_get_token_count (BAYES_STORAGE (loaded), NULL, token));
+     }
+   g_assert_cmpint (bayes_storage_get_token_count (storage, "english", "new"), ==,
+                    bayes_storage_get_token_count (BAYES_STORAGE (loaded), "english", "new"));
+   g_assert_cmpint (bayes_storage_get_token_count (storage, "german", "neu"), ==,
+                    bayes_storage_get_token_count (BAYES_STORAGE (loaded), "german", "neu"));
+   g_assert_cmpint (bayes_storage_get_token_count (storage, "english", NULL), ==,
+                    bayes_storage_get_token_count (BAYES_STORAGE (loaded), "english", NULL));
+   g_assert_cmpint (bayes_storage_get_token_count (storage, "spanish", NULL), ==,
+                    bayes_storage_get_token_count (BAYES_STORAGE (loaded), "spanish", NULL));
+
+   /* A delta that is not one is rejected. */
+   g_assert (!bayes_storage_memory_load_delta (loaded, base, &error));
+   g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+
+   g_unlink (base);
+   g_unlink (delta1);
+   g_unlink (delta2);
+}
+
+static void
+test_prune_delta (void)
+{
+   g_autoptr(BayesStorageMemory) storage_memory = NULL;
+   g_autoptr(BayesStorageMemory) loaded = NULL;
+   g_autoptr(GError) error = NULL;
+   g_autofree gchar *base = make_tmp ();
+   g_autofree gchar *delta = make_tmp ();
+   BayesStorage *storage;
+   gchar token[32];
+   guint64 used;
+   guint i;
+
+   storage_memory = bayes_storage_memory_new ();
+   storage = BAYES_STORAGE (storage_memory);
+
+   for (i = 0; i < 100; i++)
+     bayes_storage_add_token (storage, "english", "common");
+
+   bayes_storage_memory_set_track_changes (storage_memory, TRUE);
+   g_assert (bayes_storage_memory_save_to_file (storage_memory, base, &error));
+   g_assert_no_error (error);
+
+   for (i = 0; i < 1000; i++)
+     {
+        g_snprintf (token, sizeof token, "rare%u", i);
+        bayes_storage_add_token (storage, "english", token);
+     }
+   g_assert (bayes_storage_memory_save_delta (storage_memory, delta, &error));
+   g_assert_no_error (error);
+
+   loaded = bayes_storage_memory_new_from_file (base, &error);
+   g_assert_no_error (error);
+   storage = BAYES_STORAGE (loaded);
+   g_object_set (loaded, "prune-age", 10, NULL);
+   used = bayes_storage_memory_get_memory_used (loaded);
+   bayes_storage_memory_set_memory_budget (loaded, used * 8);
+
+   /* Tokens of a delta loaded under a budget are pruned like added ones. */
+   g_assert (bayes_storage_memory_load_delta (loaded, delta, &error));
+   g_assert_no_error (error);
+   g_assert_cmpint (1, ==, bayes_storage_get_token_count (storage, "english", "rare0"));
+   g_assert_cmpint (bayes_storage_memory_get_memory_used (loaded), >, used * 8);
+
+   for (i = 0; i < 1000; i++)
+     bayes_storage_add_token (storage, "english", "common");
+
+   g_assert_cmpint (bayes_storage_memory_get_memory_used (loaded), <=, used * 8);
+   g_assert_cmpint (1100, ==, bayes_storage_get_token_count (storage, "english", "common"));
+   g_assert_cmpint (0, ==, bayes_storage_get_token_count (storage, "english", "rare0"));
+
+   /* Dropping the budget releases the queue. */
+   used = bayes_storage_memory_get_memory_used (loaded);
+   bayes_storage_memory_set_memory_budget (loaded, 0);
+   g_assert_cmpint (bayes_storage_memory_get_memory_used (loaded), <, used);
+
+   g_unlink (base);
+   g_unlink (delta);
+}
+
 gint
 main (gint   argc,
       gchar *argv[])
 {
    g_test_init (&argc, &argv, NULL);
    g_test_add_func ("/Storage/Memory/basic_tests", test1);
+   g_test_add_func ("/Storage/Memory/prune", test_prune);
+   g_test_add_func ("/Storage/Memory/many_tokens", test_many_tokens);
+   g_test_add_func ("/Storage/Memory/memory_stats", test_memory_stats);
+   g_test_add_func ("/Storage/Memory/postings", test_postings);
+   g_test_add_func ("/Storage/Memory/postings_threads", test_postings_threads);
+   g_test_add_func ("/Storage/Memory/add_token_counts", test_add_token_counts);
+   g_test_add_func ("/Storage/Memory/saturate", test_saturate);
+   g_test_add_func ("/Storage/Memory/decay", test_decay);
+   g_test_add_func ("/Storage/Memory/delta", test_delta);
+   g_test_add_func ("/Storage/Memory/prune_delta", test_prune_delta);
+   g_test_add_func ("/Storage/Memory/unknown_tokens", test_unknown_tokens);
    return g_test_run ();
 }
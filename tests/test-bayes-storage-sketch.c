@@ -0,0 +1,111 @@
+#include <bayes-glib.h>
+
+static void
+test1 (void)
+{
+   g_autoptr(BayesStorageSketch) storage_sketch = NULL;
+   BayesStorage *storage;
+
+   storage_sketch = bayes_storage_sketch_new (1024, 4);
+   storage = BAYES_STORAGE (storage_sketch);
+   bayes_storage_add_token (storage, "english", "turbo");
+   bayes_storage_add_token (storage, "english", "brakes");
+   bayes_storage_add_token_count (storage, "english", "suspension", 3);
+   bayes_storage_add_token (storage, "german", "turbo");
+   g_assert_cmpint (1, ==, bayes_storage_get_token_count (storage, "english", "turbo"));
+   g_assert_cmpint (1, ==, bayes_storage_get_token_count (storage, "english", "brakes"));
+   g_assert_cmpint (3, ==, bayes_storage_get_token_count (storage, "english", "suspension"));
+   g_assert_cmpint (0, ==, bayes_storage_get_token_count (storage, "english", "cops"));
+   g_assert_cmpint (2, ==, bayes_storage_get_token_count (storage, NULL, "turbo"));
+   g_assert_cmpint (5, ==, bayes_storage_get_token_count (storage, "english", NULL));
+   g_assert_cmpint (1024 * 4 * sizeof (guint32), ==, bayes_storage_sketch_get_memory_size (storage_sketch));
+}
+
+static void
+test_heavy_hitters (void)
+{
+   g_autoptr(BayesStorageSketch) storage_sketch = NULL;
+   BayesStorage *storage;
+   gchar token[32];
+   guint i;
+
+   /* A tiny sketch so that nearly every counter collides. */
+   storage_sketch = bayes_storage_sketch_new_full (16, 2, 4);
+   storage = BAYES_STORAGE (storage_sketch);
+
+   for (i = 0; i < 1000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        bayes_storage_add_token (storage, "english", token);
+        bayes_storage_add_token_count (storage, "english", "frequent", 10);
+     }
+
+   g_assert_cmpint (10000, ==, bayes_storage_get_token_count (storage, "english", "frequent"));
+
+   for (i = 0; i < 1000; i++)
+     {
+        g_snprintf (token, sizeof token, "token%u", i);
+        g_assert_cmpint (1, <=, bayes_storage_get_token_count (storage, "english", token));
+     }
+}
+
+static void
+test_top_k (void)
+{
+   static const gchar *top[] = { "top0", "top1", "top2", "top3" };
+   g_autoptr(BayesStorageSketch) storage_sketch = NULL;
+   BayesStorage *storage;
+   gchar token[32];
+   guint i;
+   guint j;
+
+   /* A sketch this narrow overestimates every token by hundreds. */
+   storage_sketch = bayes_storage_sketch_new_full (64, 2, G_N_ELEMENTS (top));
+   storage = BAYES_STORAGE (storage_sketch);
+
+   /* These fill the heavy hitters first and must be displaced. */
+   for (i = 0; i < G_N_ELEMENTS (top); i++)
+     {
+        g_snprintf (token, sizeof token, "early%u", i);
+        bayes_storage_add_token (storage, "english", token);
+     }
+
+   /* top0 is seen 4 times as often as top3, among 1000 rare tokens. */
+   for (i = 0; i < 1000; i++)
+     {
+        for (j = 0; j < G_N_ELEMENTS (top); j++)
+          bayes_storage_add_token_count (storage, "english", top [j], G_N_ELEMENTS (top) - j);
+
+        g_snprintf (token, sizeof token, "rare%u", i);
+        bayes_storage_add_token (storage, "english", token);
+     }
+
+   for (j = 0; j < G_N_ELEMENTS (top); j++)
+     g_assert_cmpint (bayes_storage_get_token_count (storage, "english", top [j]), ==, 1000 * (G_N_ELEMENTS (top) - j));
+
+   /* Neither are the others inflated by the top tokens. */
+   for (i = 0; i < G_N_ELEMENTS (top); i++)
+     {
+        g_snprintf (token, sizeof token, "early%u", i);
+        g_assert_cmpint (bayes_storage_get_token_count (storage, "english", token), <, 20);
+     }
+
+   for (i = 0; i < 1000; i++)
+     {
+        g_snprintf (token, sizeof token, "rare%u", i);
+        g_assert_cmpint (bayes_storage_get_token_count (storage, "english", token), <, 20);
+     }
+
+   g_assert_cmpint (bayes_storage_get_token_count (storage, "english", NULL), ==, 10000 + 1000 + G_N_ELEMENTS (top));
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_test_init (&argc, &argv, NULL);
+   g_test_add_func ("/Storage/Sketch/basic_tests", test1);
+   g_test_add_func ("/Storage/Sketch/heavy_hitters", test_heavy_hitters);
+   g_test_add_func ("/Storage/Sketch/top_k", test_top_k);
+   return g_test_run ();
+}
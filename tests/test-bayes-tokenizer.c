@@ -0,0 +1,130 @@
+#include <bayes-glib.h>
+
+static void
+test_word_normalized (void)
+{
+   g_auto(GStrv) a = NULL;
+   g_auto(GStrv) b = NULL;
+   g_auto(GStrv) c = NULL;
+   g_auto(GStrv) d = NULL;
+
+   a = bayes_tokenizer_word_normalized ("Hello, WORLD_x 42", NULL);
+   g_assert_cmpint (g_strv_length (a), ==, 3);
+   g_assert_cmpstr (a[0], ==, "Hello");
+   g_assert_cmpstr (a[1], ==, "WORLD_x");
+   g_assert_cmpstr (a[2], ==, "42");
+
+   b = bayes_tokenizer_word_normalized ("Hello, WORLD Straße",
+                                        GUINT_TO_POINTER (BAYES_TOKENIZER_ASCII_LOWER));
+   g_assert_cmpint (g_strv_length (b), ==, 3);
+   g_assert_cmpstr (b[0], ==, "hello");
+   g_assert_cmpstr (b[1], ==, "world");
+   g_assert_cmpstr (b[2], ==, "straße");
+
+   c = bayes_tokenizer_word_normalized ("Hello STRASSE Straße",
+                                        GUINT_TO_POINTER (BAYES_TOKENIZER_CASEFOLD));
+   g_assert_cmpint (g_strv_length (c), ==, 3);
+   g_assert_cmpstr (c[0], ==, "hello");
+   g_assert_cmpstr (c[1], ==, "strasse");
+   g_assert_cmpstr (c[2], ==, "strasse");
+
+   /* U+FB01 LATIN SMALL LIGATURE FI */
+   d = bayes_tokenizer_word_normalized ("\xef\xac\x81ne",
+                                        GUINT_TO_POINTER (BAYES_TOKENIZER_NFKC));
+   g_assert_cmpint (g_strv_length (d), ==, 1);
+   g_assert_cmpstr (d[0], ==, "fine");
+}
+
+static void
+test_word_shingles (void)
+{
+   g_auto(GStrv) a = NULL;
+   g_auto(GStrv) b = NULL;
+   g_auto(GStrv) c = NULL;
+   g_auto(GStrv) d = NULL;
+
+   a = bayes_tokenizer_word_shingles ("the quick brown fox", NULL);
+   g_assert_cmpint (g_strv_length (a), ==, 3);
+   g_assert (g_str_has_prefix (a[0], "w2:"));
+
+   /* punctuation and spacing between words does not matter */
+   b = bayes_tokenizer_word_shingles ("  the, quick...brown\nfox!", NULL);
+   g_assert_cmpint (g_strv_length (b), ==, 3);
+   g_assert_cmpstr (a[0], ==, b[0]);
+   g_assert_cmpstr (a[1], ==, b[1]);
+   g_assert_cmpstr (a[2], ==, b[2]);
+   g_assert_cmpstr (a[0], !=, a[1]);
+
+   /* word order matters */
+   c = bayes_tokenizer_word_shingles ("quick the", NULL);
+   g_assert_cmpint (g_strv_length (c), ==, 1);
+   g_assert_cmpstr (c[0], !=, a[0]);
+
+   d = bayes_tokenizer_word_shingles ("the quick brown fox", GUINT_TO_POINTER (3));
+   g_assert_cmpint (g_strv_length (d), ==, 2);
+   g_assert (g_str_has_prefix (d[0], "w3:"));
+}
+
+static void
+test_char_ngrams (void)
+{
+   g_auto(GStrv) a = NULL;
+   g_auto(GStrv) b = NULL;
+   g_auto(GStrv) c = NULL;
+
+   a = bayes_tokenizer_char_ngrams ("abcabc", NULL);
+   g_assert_cmpint (g_strv_length (a), ==, 4);
+   g_assert_cmpstr (a[0], ==, a[3]);
+   g_assert_cmpstr (a[0], !=, a[1]);
+   g_assert_cmpstr (a[1], !=, a[2]);
+
+   /* n-grams are counted in characters, not bytes */
+   b = bayes_tokenizer_char_ngrams ("日本語です", GUINT_TO_POINTER (2));
+   g_assert_cmpint (g_strv_length (b), ==, 4);
+
+   c = bayes_tokenizer_char_ngrams ("ab", NULL);
+   g_assert_cmpint (g_strv_length (c), ==, 0);
+}
+
+static void
+test_invalid_utf8 (void)
+{
+   g_auto(GStrv) a = NULL;
+   g_auto(GStrv) b = NULL;
+   g_auto(GStrv) c = NULL;
+   g_auto(GStrv) d = NULL;
+   g_auto(GStrv) e = NULL;
+
+   /* A sequence truncated by the end of the text is not read past. */
+   a = bayes_tokenizer_word_normalized ("ab\xe3", NULL);
+   g_assert_cmpint (g_strv_length (a), ==, 1);
+   g_assert_cmpstr (a[0], ==, "ab");
+
+   b = bayes_tokenizer_word_normalized ("ab\xe3\x81", GUINT_TO_POINTER (BAYES_TOKENIZER_CASEFOLD));
+   g_assert_cmpint (g_strv_length (b), ==, 1);
+   g_assert_cmpstr (b[0], ==, "ab");
+
+   /* Invalid bytes separate words. */
+   c = bayes_tokenizer_word_normalized ("ab\xff" "cd", NULL);
+   g_assert_cmpint (g_strv_length (c), ==, 2);
+   g_assert_cmpstr (c[1], ==, "cd");
+
+   d = bayes_tokenizer_word_shingles ("ab cd\xe3", NULL);
+   g_assert_cmpint (g_strv_length (d), ==, 1);
+
+   /* Each invalid byte is a character of its own. */
+   e = bayes_tokenizer_char_ngrams ("ab\xe3", NULL);
+   g_assert_cmpint (g_strv_length (e), ==, 1);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_test_init (&argc, &argv, NULL);
+   g_test_add_func ("/Tokenizer/word_normalized", test_word_normalized);
+   g_test_add_func ("/Tokenizer/word_shingles", test_word_shingles);
+   g_test_add_func ("/Tokenizer/char_ngrams", test_char_ngrams);
+   g_test_add_func ("/Tokenizer/invalid_utf8", test_invalid_utf8);
+   return g_test_run ();
+}
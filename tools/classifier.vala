@@ -1,4 +1,4 @@
-// valac {BayesStorageSerializable,classifier}.vala -g --enable-experimental --pkg Bayes-1.0 --pkg gio-2.0 --pkg json-glib-1.0 -o classifier
+// valac {BayesStorageSerializable,classifier}.vala -g --enable-experimental --pkg Bayes-1.0 --pkg gio-2.0 --pkg json-glib-1.0 --pkg posix -o classifier
 
 public class SourceCodeClassifier {
     static Bayes.Classifier classifier;
@@ -22,11 +22,195 @@ public class SourceCodeClassifier {
 		stdout.printf (" %s (%f)\n", guess.get_name (), guess.get_probability ());
     }
 
+    // a file classified by guess_batch ()
+    class Job {
+	    public string filename;
+	    public uint8[] contents;
+	    public GLib.List<Bayes.Guess> guesses;
+	    public string? error_message;
+
+	    public Job (string filename) {
+		    this.filename = filename;
+	    }
+    }
+
+    // classifies files with a pool of readers feeding a pool of guess
+    // workers, and prints the results as they complete. Reading is latency
+    // bound, so there are more readers than guess workers.
+    static void guess_batch (string[] filenames, int n_workers) throws ThreadError {
+	    var results = new AsyncQueue<Job> ();
+
+	    var guessers = new ThreadPool<Job>.with_owned_data ((job) => {
+		    job.guesses = classifier.guess ((string) job.contents);
+		    job.contents = null;
+		    results.push (job);
+	    }, n_workers, false);
+
+	    var readers = new ThreadPool<Job>.with_owned_data ((job) => {
+		    try {
+			    FileUtils.get_data (job.filename, out job.contents);
+			    // guess () expects a nul-terminated string
+			    job.contents += 0;
+			    guessers.add (job);
+			    return;
+		    } catch (Error e) {
+			    job.error_message = e.message;
+		    }
+		    results.push (job);
+	    }, n_workers * 4, false);
+
+	    int n_files = 0;
+	    foreach (var file in filenames)
+		    if (file != null) {
+			    readers.add (new Job (file));
+			    n_files++;
+		    }
+
+	    for (int i = 0; i < n_files; i++) {
+		    var job = results.pop ();
+		    stdout.printf ("%s\n", job.filename);
+		    if (job.error_message != null)
+			    stdout.printf (" error: %s\n", job.error_message);
+		    foreach (Bayes.Guess guess in job.guesses)
+			    stdout.printf (" %s (%f)\n", guess.get_name (), guess.get_probability ());
+	    }
+    }
+
+    // gets a string member of a request, which may be of any type
+    static string get_string_member (Json.Object request, string name) throws IOError {
+	    var node = request.get_member (name);
+	    if (node.get_node_type () != Json.NodeType.VALUE || node.get_value_type () != typeof (string))
+		    throw new IOError.INVALID_DATA ("\"%s\" is not a string", name);
+	    return node.get_string ();
+    }
+
+    // answers one request of the --serve protocol
+    static string handle_request (string line) {
+	    var builder = new Json.Builder ();
+	    builder.begin_object ();
+
+	    try {
+		    var parser = new Json.Parser ();
+		    parser.load_from_data (line);
+
+		    var root = parser.get_root ();
+		    if (root == null || root.get_node_type () != Json.NodeType.OBJECT)
+			    throw new IOError.INVALID_DATA ("request is not a JSON object");
+
+		    var request = root.get_object ();
+		    if (request.has_member ("id")) {
+			    builder.set_member_name ("id");
+			    builder.add_value (request.get_member ("id").copy ());
+		    }
+
+		    string text;
+		    if (request.has_member ("text"))
+			    text = get_string_member (request, "text");
+		    else if (request.has_member ("path"))
+			    FileUtils.get_contents (get_string_member (request, "path"), out text);
+		    else
+			    throw new IOError.INVALID_DATA ("request has neither \"path\" nor \"text\"");
+
+		    var guesses = classifier.guess (text);
+
+		    builder.set_member_name ("guesses");
+		    builder.begin_array ();
+		    foreach (Bayes.Guess guess in guesses) {
+			    builder.begin_object ();
+			    builder.set_member_name ("name");
+			    builder.add_string_value (guess.get_name ());
+			    builder.set_member_name ("probability");
+			    builder.add_double_value (guess.get_probability ());
+			    builder.end_object ();
+		    }
+		    builder.end_array ();
+	    } catch (Error e) {
+		    builder.set_member_name ("error");
+		    builder.add_string_value (e.message);
+	    }
+
+	    builder.end_object ();
+
+	    var generator = new Json.Generator ();
+	    generator.set_root (builder.get_root ());
+	    return generator.to_data (null);
+    }
+
+    // answers requests from a connection in order. Clients may send
+    // requests without waiting for the answers, which are then flushed
+    // together once every request received so far was answered.
+    static bool serve_connection (SocketConnection connection) {
+	    var input = new DataInputStream (connection.input_stream);
+	    var output = new DataOutputStream (new BufferedOutputStream (connection.output_stream));
+	    string? line;
+
+	    try {
+		    while ((line = input.read_line (null)) != null) {
+			    if (line.strip () == "")
+				    continue;
+			    output.put_string (handle_request (line) + "\n");
+			    if (input.get_available () == 0)
+				    output.flush ();
+		    }
+		    output.flush ();
+	    } catch (Error e) {
+		    stderr.printf ("error: %s\n", e.message);
+	    }
+
+	    return false;
+    }
+
+    static void serve_socket (string path) throws Error {
+	    var service = new ThreadedSocketService (-1);
+
+	    // the socket of an earlier run would make binding fail, but
+	    // anything else at path is not ours to remove
+	    Posix.Stat st;
+	    if (Posix.lstat (path, out st) == 0 && Posix.S_ISSOCK (st.st_mode))
+		    FileUtils.unlink (path);
+	    service.add_address (new UnixSocketAddress (path), SocketType.STREAM,
+	                         SocketProtocol.DEFAULT, null, null);
+	    // requests may name files to read, so only we may connect
+	    FileUtils.chmod (path, 0600);
+	    service.run.connect ((connection, source) => serve_connection (connection));
+	    service.start ();
+
+	    // return on SIGINT or SIGTERM so that --stats gets printed
+	    var loop = new MainLoop ();
+	    Unix.signal_add (Posix.Signal.INT, () => { loop.quit (); return false; });
+	    Unix.signal_add (Posix.Signal.TERM, () => { loop.quit (); return false; });
+
+	    stderr.printf ("listening on %s\n", path);
+	    loop.run ();
+
+	    service.stop ();
+	    FileUtils.unlink (path);
+    }
+
+    static void serve_stdin () {
+	    string? line;
+
+	    while ((line = stdin.read_line ()) != null) {
+		    // let a reloaded training file be swapped in
+		    while (MainContext.default ().iteration (false));
+
+		    if (line.strip () == "")
+			    continue;
+		    stdout.puts (handle_request (line));
+		    stdout.putc ('\n');
+		    stdout.flush ();
+	    }
+    }
+
     private static string? training_file = null;
     [CCode (array_length = false, array_null_terminated = true)]
     private static string[]? files = null;
     private static string? serialize_file = null;
     private static string? tokenizer = "word";
+    private static bool stats = false;
+    private static int jobs = 0;
+    private static bool serve = false;
+    private static string? socket_path = null;
 
     private const OptionEntry[] options = {
 	    // --training-file
@@ -36,7 +220,15 @@ public class SourceCodeClassifier {
 	    // --reserialize
 	    { "reserialize", 'o', 0, OptionArg.FILENAME, ref serialize_file, "File to re-serialize training data to", "FILE"},
 	    // --tokenizer
-	    { "tokenizer", 0, 0, OptionArg.STRING, ref tokenizer, "Tokenizer function", "'word' | 'code_tokens'"},
+	    { "tokenizer", 0, 0, OptionArg.STRING, ref tokenizer, "Tokenizer function", "'word' | 'code_tokens' | 'word_shingles' | 'char_ngrams'"},
+	    // --stats
+	    { "stats", 0, 0, OptionArg.NONE, ref stats, "Print runtime statistics after classifying", null },
+	    // --jobs
+	    { "jobs", 'j', 0, OptionArg.INT, ref jobs, "Classify files on this many threads and print them as they complete", "N" },
+	    // --serve
+	    { "serve", 0, 0, OptionArg.NONE, ref serve, "Answer JSON requests on stdin, one per line, until end of input", null },
+	    // --socket
+	    { "socket", 0, 0, OptionArg.FILENAME, ref socket_path, "With --serve, answer requests on a Unix socket instead", "PATH" },
 	    { null }
     };
 
@@ -63,27 +255,69 @@ public class SourceCodeClassifier {
 	    classifier.set_tokenizer (text => {
 	        return Bayes.tokenizer_code_tokens (text, null);
 	    });
+	else if (tokenizer == "word_shingles")
+	    classifier.set_tokenizer (text => {
+	        return Bayes.tokenizer_word_shingles (text, null);
+	    });
+	else if (tokenizer == "char_ngrams")
+	    classifier.set_tokenizer (text => {
+	        return Bayes.tokenizer_char_ngrams (text, null);
+	    });
 
 	// deserializing
 	try {
 		classifier.storage = new Bayes.StorageMemory.from_file (training_file);
-		stdout.printf ("loaded %s\n", training_file);
+		if (serve)
+			stderr.printf ("loaded %s\n", training_file);
+		else
+			stdout.printf ("loaded %s\n", training_file);
 	} catch (Error e) {
 		error (e.message);
 	}
 
+	// serving, the training file is reloaded when it is saved again
+	if (serve) {
+		classifier.collect_stats = stats;
+
+		try {
+			classifier.watch_file (File.new_for_path (training_file));
+			if (socket_path != null)
+				serve_socket (socket_path);
+			else
+				serve_stdin ();
+		} catch (Error e) {
+			error (e.message);
+		}
+
+		if (stats)
+			stderr.printf ("%s\n", classifier.get_stats ().print (true));
+
+		return 0;
+	}
+
 	if (serialize_file != null) {
 		(classifier.storage as Bayes.StorageMemory).save_to_file (serialize_file);
 		stdout.printf ("wrote to %s\n", serialize_file);
 	}
 
+	classifier.collect_stats = stats;
+
 	// guessing
-	foreach (var file in files)
+	if (jobs > 0 && files != null) {
+		try {
+			guess_batch (files, jobs);
+		} catch (ThreadError e) {
+			error (e.message);
+		}
+	} else foreach (var file in files)
 		if (file != null) {
 			stdout.printf ("%s\n", file);
 			guess_test (file);
 		}
 
+	if (stats)
+		stdout.printf ("%s\n", classifier.get_stats ().print (true));
+
 	return 0;
     }
 }
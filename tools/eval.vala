@@ -0,0 +1,253 @@
+// valac eval.vala -g --pkg bayes-glib-1.0 --pkg gio-2.0 --pkg json-glib-1.0 -o eval
+
+public class SourceCodeEval {
+    // a training sample, the directory it was found in is its class
+    class Document {
+	    public string filename;
+	    public int label;
+	    public int fold;
+	    public string[] tokens;
+    }
+
+    // the documents left out of one model and how they were guessed
+    class Fold {
+	    public int index;
+	    public Bayes.StorageMemory storage = new Bayes.StorageMemory ();
+	    public GenericArray<Document> documents = new GenericArray<Document> ();
+	    public int[] confusion;
+	    public int correct;
+    }
+
+    static Bayes.Tokenizer tokenize;
+    static Bayes.StorageMemory storage;
+    static string[] labels;
+    static HashTable<string, int> label_ids;
+
+    // options
+    private static string? samples_dir = null;
+    private static string? tokenizer = "word";
+    private static int n_folds = 10;
+    private static int jobs = 0;
+    private static double alpha = 1.0;
+
+    private const OptionEntry[] options = {
+	    // --samples
+	    { "samples", 'd', 0, OptionArg.FILENAME, ref samples_dir, "Directory with a directory of samples per class", "DIRECTORY" },
+	    // --folds
+	    { "folds", 'k', 0, OptionArg.INT, ref n_folds, "Number of folds", "K" },
+	    // --jobs
+	    { "jobs", 'j', 0, OptionArg.INT, ref jobs, "Number of folds evaluated at once, the number of processors by default", "N" },
+	    // --alpha
+	    { "alpha", 0, 0, OptionArg.DOUBLE, ref alpha, "Additive smoothing of the token counts", "ALPHA" },
+	    // --tokenizer
+	    { "tokenizer", 't', 0, OptionArg.STRING, ref tokenizer, "Tokenizer function", "'word' | 'code_tokens' | 'word_shingles' | 'char_ngrams'" },
+
+	    { null }
+    };
+
+    // lists the samples, spreading the documents of every class evenly
+    // over the folds
+    static GenericArray<Document> list_documents () throws Error {
+	    var documents = new GenericArray<Document> ();
+	    var classes = new GenericArray<string> ();
+
+	    var dir = Dir.open (samples_dir);
+	    string? name;
+	    while ((name = dir.read_name ()) != null)
+		    if (FileUtils.test (Path.build_filename (samples_dir, name), FileTest.IS_DIR))
+			    classes.add (name);
+	    classes.sort (strcmp);
+
+	    labels = classes.data;
+	    label_ids = new HashTable<string, int> (str_hash, str_equal);
+
+	    for (int i = 0; i < labels.length; i++) {
+		    label_ids.insert (labels[i], i);
+
+		    var class_dir = Path.build_filename (samples_dir, labels[i]);
+		    var samples = Dir.open (class_dir);
+		    var filenames = new GenericArray<string> ();
+		    while ((name = samples.read_name ()) != null) {
+			    var filename = Path.build_filename (class_dir, name);
+			    if (FileUtils.test (filename, FileTest.IS_REGULAR))
+				    filenames.add (filename);
+		    }
+		    filenames.sort (strcmp);
+
+		    for (int j = 0; j < filenames.length; j++) {
+			    var document = new Document ();
+			    document.filename = filenames[j];
+			    document.label = i;
+			    document.fold = j % n_folds;
+			    documents.add (document);
+		    }
+	    }
+
+	    return documents;
+    }
+
+    // trains every document into the storage of all documents and into
+    // the storage of its fold, so that a fold can be left out by
+    // subtracting its counts
+    static void train (GenericArray<Document> documents, Fold[] folds) throws Error {
+	    uint8[] buf;
+
+	    foreach (var document in documents.data) {
+		    FileUtils.get_data (document.filename, out buf);
+		    buf += 0;
+		    document.tokens = tokenize ((string) buf);
+
+		    var name = labels[document.label];
+		    var fold = folds[document.fold];
+		    foreach (var token in document.tokens) {
+			    storage.add_token (name, token);
+			    fold.storage.add_token (name, token);
+		    }
+		    fold.documents.add (document);
+	    }
+    }
+
+    static void evaluate (Fold fold) {
+	    var model = new Bayes.Model.excluding (storage, fold.storage, alpha);
+
+	    fold.confusion = new int[labels.length * n_columns ()];
+
+	    foreach (var document in fold.documents.data) {
+		    var guesses = model.guess (document.tokens);
+
+		    // documents without a guess are misses, counted in the last column
+		    int guessed = labels.length;
+		    if (guesses != null)
+			    guessed = label_ids.get (guesses.data.get_name ());
+		    fold.confusion[document.label * n_columns () + guessed]++;
+		    if (guessed == document.label)
+			    fold.correct++;
+	    }
+    }
+
+    // a column per class, and one for documents that got no guess
+    static int n_columns () {
+	    return labels.length + 1;
+    }
+
+    static void print_confusion (int[] confusion) {
+	    int width = "unclassified".length + 1;
+	    foreach (var label in labels)
+		    width = int.max (width, label.length + 1);
+
+	    stdout.printf ("confusion matrix (rows are classes, columns guesses):\n");
+	    stdout.printf ("%*s", width, "");
+	    for (int j = 0; j < labels.length; j++)
+		    stdout.printf ("%*s", width, labels[j]);
+	    stdout.printf ("%*s\n", width, "unclassified");
+
+	    for (int i = 0; i < labels.length; i++) {
+		    stdout.printf ("%*s", width, labels[i]);
+		    for (int j = 0; j < n_columns (); j++)
+			    stdout.printf ("%*d", width, confusion[i * n_columns () + j]);
+		    stdout.printf ("\n");
+	    }
+    }
+
+    // k-fold cross-validation of the training samples
+    static int main (string[] args) {
+	try {
+		var opt_context = new OptionContext ("- Cross-validate Training Data");
+		opt_context.add_main_entries (options, null);
+		opt_context.set_help_enabled (true);
+		opt_context.parse (ref args);
+	} catch (OptionError e) {
+		stdout.printf ("error: %s\n", e.message);
+		stdout.printf ("Run '%s --help' to see available command-line options.\n", args[0]);
+		return 0;
+	}
+
+	if (samples_dir == null || n_folds < 2) {
+		stdout.printf ("error: --samples is required and --folds must be at least 2\n");
+		return 1;
+	}
+
+	if (jobs <= 0)
+		jobs = (int) get_num_processors ();
+
+    // FIXME: bindings
+	if (tokenizer == "word")
+	    tokenize = text => {
+	        return Bayes.tokenizer_word (text, null);
+	    };
+	else if (tokenizer == "code_tokens")
+	    tokenize = text => {
+	        return Bayes.tokenizer_code_tokens (text, null);
+	    };
+	else if (tokenizer == "word_shingles")
+	    tokenize = text => {
+	        return Bayes.tokenizer_word_shingles (text, null);
+	    };
+	else if (tokenizer == "char_ngrams")
+	    tokenize = text => {
+	        return Bayes.tokenizer_char_ngrams (text, null);
+	    };
+	else {
+		stdout.printf ("error: unknown tokenizer '%s'\n", tokenizer);
+		stdout.printf ("Run '%s --help' to see available command-line options.\n", args[0]);
+		return 1;
+	}
+
+	storage = new Bayes.StorageMemory ();
+
+	var folds = new Fold[n_folds];
+	for (int i = 0; i < n_folds; i++) {
+		folds[i] = new Fold ();
+		folds[i].index = i;
+	}
+
+	// training, once for all the folds
+	var timer = new Timer ();
+	GenericArray<Document> documents;
+
+	try {
+		documents = list_documents ();
+		train (documents, folds);
+	} catch (Error e) {
+		error (e.message);
+	}
+
+	var train_time = timer.elapsed ();
+	stdout.printf ("trained %u documents of %d classes in %.2f s\n",
+	               documents.length, labels.length, train_time);
+
+	// evaluating, the folds are independent
+	timer.start ();
+
+	// freeing the pool at the end of the block waits for every fold
+	try {
+		var pool = new ThreadPool<Fold>.with_owned_data ((fold) => evaluate (fold), jobs, true);
+		foreach (var fold in folds)
+			pool.add (fold);
+	} catch (ThreadError e) {
+		error (e.message);
+	}
+
+	var eval_time = timer.elapsed ();
+
+	var confusion = new int[labels.length * n_columns ()];
+	int correct = 0;
+
+	foreach (var fold in folds) {
+		stdout.printf ("fold %d: %d/%u correct\n", fold.index + 1,
+		               fold.correct, fold.documents.length);
+		correct += fold.correct;
+		for (int i = 0; i < confusion.length; i++)
+			confusion[i] += fold.confusion[i];
+	}
+
+	stdout.printf ("accuracy: %.4f\n", documents.length > 0 ? (double) correct / documents.length : 0.0);
+	print_confusion (confusion);
+	stdout.printf ("evaluated %u documents in %.2f s, %.1f docs/s\n",
+	               documents.length, eval_time, documents.length / eval_time);
+	stdout.printf ("total %.1f docs/s including training\n",
+	               documents.length / (train_time + eval_time));
+
+	return 0;
+    }
+}
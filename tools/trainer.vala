@@ -45,7 +45,7 @@ public class SourceCodeTrainer {
 	    // --output
 	    { "output", 'o', 0, OptionArg.FILENAME, ref output_file, "Output results to file", "FILE" },
 	    // --tokenizer
-	    { "tokenizer", 't', 0, OptionArg.STRING, ref tokenizer, "Tokenizer function", "'word' | 'code_tokens'" },
+	    { "tokenizer", 't', 0, OptionArg.STRING, ref tokenizer, "Tokenizer function", "'word' | 'code_tokens' | 'word_shingles' | 'char_ngrams'" },
 
 	    { null }
     };
@@ -74,6 +74,14 @@ public class SourceCodeTrainer {
 	    classifier.set_tokenizer (text => {
 	        return Bayes.tokenizer_code_tokens (text, null);
 	    });
+	else if (tokenizer == "word_shingles")
+	    classifier.set_tokenizer (text => {
+	        return Bayes.tokenizer_word_shingles (text, null);
+	    });
+	else if (tokenizer == "char_ngrams")
+	    classifier.set_tokenizer (text => {
+	        return Bayes.tokenizer_char_ngrams (text, null);
+	    });
 
     Test.init (ref args);
 